@@ -76,7 +76,8 @@ typedef struct pa_daemon_conf {
         log_time,
         flat_volumes,
         lock_memory,
-        deferred_volume;
+        deferred_volume,
+        partial_rewind;
     pa_server_type_t local_server_type;
     int exit_idle_time,
         scache_idle_time,
@@ -127,6 +128,7 @@ typedef struct pa_daemon_conf {
 #endif
 
     unsigned default_n_fragments, default_fragment_size_msec;
+    unsigned default_rewind_limit_msec;
     unsigned deferred_volume_safety_margin_usec;
     int deferred_volume_extra_delay_usec;
     pa_sample_spec default_sample_spec;
@@ -54,10 +54,12 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/trace.h>
 
 #include <modules/reserve-wrap.h>
 
 #include "alsa-util.h"
+#include "alsa-tsched.h"
 #include "alsa-sink.h"
 
 /* #define DEBUG_TIMING */
@@ -79,6 +81,9 @@
 #define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)                /* 10ms  -- Sleep at least 10ms on each iteration */
 #define TSCHED_MIN_WAKEUP_USEC (4*PA_USEC_PER_MSEC)                /* 4ms   -- Wakeup at least this long before the buffer runs empty*/
 
+#define TSCHED_ADAPT_INTERVAL_USEC (1*PA_USEC_PER_SEC)             /* 1s    -- How often to compare the watermark with the predicted process time */
+#define TSCHED_ADAPT_MARGIN_USEC (1*PA_USEC_PER_MSEC)              /* 1ms   -- Add this much to the predicted process time */
+
 #define SMOOTHER_WINDOW_USEC  (10*PA_USEC_PER_SEC)                 /* 10s   -- smoother windows size */
 #define SMOOTHER_ADJUST_USEC  (1*PA_USEC_PER_SEC)                  /* 1s    -- smoother adjust time */
 
@@ -131,6 +136,11 @@ struct userdata {
     pa_usec_t min_latency_ref;
     pa_usec_t tsched_watermark_usec;
 
+    pa_alsa_tsched_stats *tsched_stats;
+    size_t watermark_floor;
+    pa_usec_t watermark_adapt_not_before;
+    pa_usec_t next_watermark_adapt;
+
     pa_memchunk memchunk;
 
     char *device_name;  /* name of the PCM device */
@@ -159,6 +169,10 @@ struct userdata {
     pa_alsa_ucm_mapping_context *ucm_context;
 };
 
+enum {
+    SINK_MESSAGE_GET_TSCHED_INFO = PA_SINK_MESSAGE_MAX
+};
+
 static void userdata_free(struct userdata *u);
 
 /* FIXME: Is there a better way to do this than device names? */
@@ -395,6 +409,69 @@ restart:
     u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
 }
 
+/* Called from IO context */
+static void adapt_watermark(struct userdata *u, pa_usec_t now) {
+    size_t old_watermark, target;
+    pa_usec_t process_usec;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    if (!pa_alsa_tsched_stats_get_process_time(u->tsched_stats, &process_usec))
+        return;
+
+    /* Leave some headroom for the error of the smoother and for
+     * things our statistics haven't seen yet */
+    process_usec += process_usec / 2 + TSCHED_ADAPT_MARGIN_USEC;
+    target = pa_usec_to_bytes_round_up(process_usec, &u->sink->sample_spec);
+
+    old_watermark = u->tsched_watermark;
+
+    if (target > u->tsched_watermark) {
+
+        /* The tail of the process time got too close to the
+         * watermark, raise it before we actually underrun. */
+        u->tsched_watermark = target;
+        fix_tsched_watermark(u);
+
+        if (old_watermark != u->tsched_watermark) {
+            pa_log_info("Raising wakeup watermark to %0.2f ms, predicted process time is %0.2f ms",
+                        (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC,
+                        (double) process_usec / PA_USEC_PER_MSEC);
+            u->watermark_adapt_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+        }
+
+        return;
+    }
+
+    if (u->watermark_adapt_not_before > now)
+        return;
+
+    /* Each time we made it through the verification period without
+     * an underrun we trust the statistics a bit more than the
+     * watermark that caused the last underrun. */
+    if (u->watermark_floor > u->watermark_dec_step)
+        u->watermark_floor -= u->watermark_dec_step;
+    else
+        u->watermark_floor = 0;
+
+    /* Sleep longer when the process time allows it, but never
+     * more than halve the watermark at once */
+    target = PA_MAX(PA_MAX(target, u->watermark_floor), u->tsched_watermark / 2);
+
+    if (target < u->tsched_watermark) {
+        u->tsched_watermark = target;
+        fix_tsched_watermark(u);
+
+        if (old_watermark != u->tsched_watermark)
+            pa_log_info("Lowering wakeup watermark to %0.2f ms, predicted process time is %0.2f ms",
+                        (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC,
+                        (double) process_usec / PA_USEC_PER_MSEC);
+    }
+
+    u->watermark_adapt_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+}
+
 static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
     pa_usec_t usec, wm;
 
@@ -471,9 +548,12 @@ static size_t check_left_to_play(struct userdata *u, size_t n_bytes, bool on_tim
         PA_DEBUG_TRAP;
 #endif
 
-        if (!u->first && !u->after_rewind)
+        if (!u->first && !u->after_rewind) {
+            pa_io_stats_add_xrun(&u->sink->io_stats);
+
             if (pa_log_ratelimit(PA_LOG_INFO))
                 pa_log_info("Underrun!");
+        }
     }
 
 #ifdef DEBUG_TIMING
@@ -487,9 +567,17 @@ static size_t check_left_to_play(struct userdata *u, size_t n_bytes, bool on_tim
         bool reset_not_before = true;
 
         if (!u->first && !u->after_rewind) {
-            if (underrun || left_to_play < u->watermark_inc_threshold)
+            if (underrun || left_to_play < u->watermark_inc_threshold) {
                 increase_watermark(u);
-            else if (left_to_play > u->watermark_dec_threshold) {
+
+                if (underrun)
+                    pa_alsa_tsched_stats_add_underrun(u->tsched_stats);
+
+                /* Whatever the statistics say, the old watermark was
+                 * too low. Don't go below the new one for a while. */
+                u->watermark_floor = u->tsched_watermark;
+                u->watermark_adapt_not_before = pa_rtclock_now() + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+            } else if (left_to_play > u->watermark_dec_threshold) {
                 reset_not_before = false;
 
                 /* We decrease the watermark only if have actually
@@ -1033,6 +1121,12 @@ static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_samp
     fix_min_sleep_wakeup(u);
     fix_tsched_watermark(u);
 
+    /* Start over collecting statistics, the device might behave
+     * differently now */
+    u->watermark_floor = 0;
+    u->watermark_adapt_not_before = 0;
+    pa_alsa_tsched_stats_reset(u->tsched_stats);
+
     if (in_thread)
         pa_sink_set_latency_range_within_thread(u->sink,
                                                 u->min_latency_ref,
@@ -1151,6 +1245,15 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
     switch (code) {
 
+        case SINK_MESSAGE_GET_TSCHED_INFO: {
+            pa_alsa_tsched_info *i = data;
+
+            pa_alsa_tsched_stats_get_info(u->tsched_stats, pa_rtclock_now(), i);
+            i->watermark = u->tsched_watermark_usec;
+
+            return 0;
+        }
+
         case PA_SINK_MESSAGE_GET_LATENCY: {
             pa_usec_t r = 0;
 
@@ -1206,6 +1309,19 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+/* Called from main context */
+static void sink_print_info_cb(pa_sink *s, pa_strbuf *buf) {
+    pa_alsa_tsched_info i;
+
+    pa_sink_assert_ref(s);
+
+    if (!PA_SINK_IS_LINKED(s->state))
+        return;
+
+    pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), SINK_MESSAGE_GET_TSCHED_INFO, &i, 0, NULL) == 0);
+    pa_alsa_tsched_info_to_string(&i, buf);
+}
+
 /* Called from main context */
 static int sink_set_state_cb(pa_sink *s, pa_sink_state_t new_state) {
     pa_sink_state_t old_state;
@@ -1710,17 +1826,36 @@ static void thread_func(void *userdata) {
         /* Render some data and write it to the dsp */
         if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
             int work_done;
-            pa_usec_t sleep_usec = 0;
+            pa_usec_t sleep_usec = 0, render_start = 0, t;
             bool on_timeout = pa_rtpoll_timer_elapsed(u->rtpoll);
 
+            if (u->use_tsched)
+                render_start = pa_rtclock_now();
+
+            t = pa_trace_begin();
+
             if (u->use_mmap)
                 work_done = mmap_write(u, &sleep_usec, revents & POLLOUT, on_timeout);
             else
                 work_done = unix_write(u, &sleep_usec, revents & POLLOUT, on_timeout);
 
+            pa_trace_end("alsa-sink-write", t);
+
             if (work_done < 0)
                 goto fail;
 
+            if (u->use_tsched) {
+                pa_usec_t now = pa_rtclock_now();
+
+                if (work_done)
+                    pa_alsa_tsched_stats_add_render(u->tsched_stats, now - render_start);
+
+                if (!u->first && now >= u->next_watermark_adapt) {
+                    adapt_watermark(u, now);
+                    u->next_watermark_adapt = now + TSCHED_ADAPT_INTERVAL_USEC;
+                }
+            }
+
 /*             pa_log_debug("work_done = %i", work_done); */
 
             if (work_done) {
@@ -1810,6 +1945,10 @@ static void thread_func(void *userdata) {
                 pa_log_info("Scheduling delay of %0.2f ms > %0.2f ms, you might want to investigate this to improve latency...",
                     (double) (real_sleep - rtpoll_sleep) / PA_USEC_PER_MSEC,
                     (double) (u->tsched_watermark_usec) / PA_USEC_PER_MSEC);
+
+            if (u->use_tsched && PA_SINK_IS_OPENED(u->sink->thread_info.state))
+                pa_alsa_tsched_stats_add_wakeup(u->tsched_stats, pa_rtpoll_timer_elapsed(u->rtpoll),
+                                                real_sleep > rtpoll_sleep ? real_sleep - rtpoll_sleep : 0);
         }
 
         if (u->sink->flags & PA_SINK_DEFERRED_VOLUME)
@@ -2313,8 +2452,10 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     }
 
     u->sink->parent.process_msg = sink_process_msg;
-    if (u->use_tsched)
+    if (u->use_tsched) {
         u->sink->update_requested_latency = sink_update_requested_latency_cb;
+        u->sink->print_info = sink_print_info_cb;
+    }
     u->sink->set_state = sink_set_state_cb;
     if (u->ucm_context)
         u->sink->set_port = sink_set_port_ucm_cb;
@@ -2348,6 +2489,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     }
 
     if (u->use_tsched) {
+        u->tsched_stats = pa_alsa_tsched_stats_new();
         u->tsched_watermark_ref = tsched_watermark;
         reset_watermark(u, u->tsched_watermark_ref, &ss, false);
     } else
@@ -2477,6 +2619,9 @@ static void userdata_free(struct userdata *u) {
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
+    if (u->tsched_stats)
+        pa_alsa_tsched_stats_free(u->tsched_stats);
+
     if (u->formats)
         pa_idxset_free(u->formats, (pa_free_cb_t) pa_format_info_free);
 
@@ -49,6 +49,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/trace.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -446,6 +447,8 @@ static size_t check_left_to_record(struct userdata *u, size_t n_bytes, bool on_t
         PA_DEBUG_TRAP;
 #endif
 
+        pa_io_stats_add_xrun(&u->source->io_stats);
+
         if (pa_log_ratelimit(PA_LOG_INFO))
             pa_log_info("Overrun!");
     }
@@ -1452,7 +1455,7 @@ static void thread_func(void *userdata) {
         /* Read some data and pass it to the sources */
         if (PA_SOURCE_IS_OPENED(u->source->thread_info.state)) {
             int work_done;
-            pa_usec_t sleep_usec = 0;
+            pa_usec_t sleep_usec = 0, t;
             bool on_timeout = pa_rtpoll_timer_elapsed(u->rtpoll);
 
             if (u->first) {
@@ -1464,11 +1467,15 @@ static void thread_func(void *userdata) {
                 u->first = false;
             }
 
+            t = pa_trace_begin();
+
             if (u->use_mmap)
                 work_done = mmap_read(u, &sleep_usec, revents & POLLIN, on_timeout);
             else
                 work_done = unix_read(u, &sleep_usec, revents & POLLIN, on_timeout);
 
+            pa_trace_end("alsa-source-read", t);
+
             if (work_done < 0)
                 goto fail;
 
@@ -0,0 +1,236 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "alsa-tsched.h"
+
+/* Each power of two is split into 2^SUB_BUCKET_BITS buckets, which
+ * gives us a resolution of 12.5% of the measured value at worst. Values
+ * below 2^SUB_BUCKET_BITS usec get a bucket of their own. */
+#define SUB_BUCKET_BITS 3
+#define N_SUB_BUCKETS (1U << SUB_BUCKET_BITS)
+
+/* Anything longer than 2^MAX_LOG2 usec (~8s) is accounted as that */
+#define MAX_LOG2 22
+#define N_BUCKETS ((MAX_LOG2 - SUB_BUCKET_BITS + 2) * N_SUB_BUCKETS)
+
+/* When a histogram holds this many samples all buckets are halved, so
+ * that the statistics follow changes in the system load */
+#define DECAY_SAMPLES 1024
+
+/* Don't make predictions before we have seen this many samples */
+#define MIN_SAMPLES 64
+
+typedef struct histogram {
+    uint32_t buckets[N_BUCKETS];
+    uint32_t n;
+    pa_usec_t max;
+} histogram;
+
+struct pa_alsa_tsched_stats {
+    histogram render, jitter;
+
+    uint64_t n_wakeups, n_underruns;
+
+    uint64_t rate_wakeups;
+    pa_usec_t rate_since;
+};
+
+static unsigned bucket_index(pa_usec_t usec) {
+    unsigned l;
+
+    if (usec < N_SUB_BUCKETS)
+        return (unsigned) usec;
+
+    if (usec >= ((pa_usec_t) 1 << (MAX_LOG2 + 1)))
+        return N_BUCKETS - 1;
+
+    l = pa_ulog2((unsigned) usec);
+
+    /* The leading bit selects the group, the next SUB_BUCKET_BITS bits
+     * the bucket within it */
+    return (l - SUB_BUCKET_BITS + 1) * N_SUB_BUCKETS + (((unsigned) usec >> (l - SUB_BUCKET_BITS)) & (N_SUB_BUCKETS - 1));
+}
+
+/* Returns the largest value that is accounted in the bucket */
+static pa_usec_t bucket_max(unsigned idx) {
+    unsigned l, shift;
+
+    if (idx < N_SUB_BUCKETS)
+        return idx;
+
+    l = idx / N_SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    shift = l - SUB_BUCKET_BITS;
+
+    return ((pa_usec_t) (N_SUB_BUCKETS + idx % N_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+static void histogram_reset(histogram *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+static void histogram_add(histogram *h, pa_usec_t usec) {
+    pa_assert(h);
+
+    if (h->n >= DECAY_SAMPLES) {
+        unsigned i;
+
+        h->n = 0;
+        for (i = 0; i < N_BUCKETS; i++) {
+            h->buckets[i] /= 2;
+            h->n += h->buckets[i];
+        }
+
+        h->max /= 2;
+    }
+
+    h->buckets[bucket_index(usec)]++;
+    h->n++;
+
+    if (usec > h->max)
+        h->max = usec;
+}
+
+/* q is given in percent */
+static pa_usec_t histogram_percentile(const histogram *h, unsigned q) {
+    uint32_t limit, sum = 0;
+    unsigned i;
+
+    pa_assert(h);
+    pa_assert(q <= 100);
+
+    if (h->n <= 0)
+        return 0;
+
+    limit = (uint32_t) (((uint64_t) h->n * q + 99) / 100);
+
+    for (i = 0; i < N_BUCKETS; i++) {
+        sum += h->buckets[i];
+
+        if (sum >= limit)
+            return PA_MIN(bucket_max(i), h->max);
+    }
+
+    return h->max;
+}
+
+pa_alsa_tsched_stats* pa_alsa_tsched_stats_new(void) {
+    return pa_xnew0(pa_alsa_tsched_stats, 1);
+}
+
+void pa_alsa_tsched_stats_free(pa_alsa_tsched_stats *s) {
+    pa_assert(s);
+
+    pa_xfree(s);
+}
+
+void pa_alsa_tsched_stats_reset(pa_alsa_tsched_stats *s) {
+    pa_assert(s);
+
+    histogram_reset(&s->render);
+    histogram_reset(&s->jitter);
+}
+
+void pa_alsa_tsched_stats_add_render(pa_alsa_tsched_stats *s, pa_usec_t usec) {
+    pa_assert(s);
+
+    histogram_add(&s->render, usec);
+}
+
+void pa_alsa_tsched_stats_add_wakeup(pa_alsa_tsched_stats *s, bool timer_elapsed, pa_usec_t lateness) {
+    pa_assert(s);
+
+    s->n_wakeups++;
+    s->rate_wakeups++;
+
+    if (timer_elapsed)
+        histogram_add(&s->jitter, lateness);
+}
+
+void pa_alsa_tsched_stats_add_underrun(pa_alsa_tsched_stats *s) {
+    pa_assert(s);
+
+    s->n_underruns++;
+}
+
+bool pa_alsa_tsched_stats_get_process_time(pa_alsa_tsched_stats *s, pa_usec_t *usec) {
+    pa_assert(s);
+    pa_assert(usec);
+
+    if (s->render.n < MIN_SAMPLES || s->jitter.n < MIN_SAMPLES)
+        return false;
+
+    *usec = histogram_percentile(&s->render, 99) + histogram_percentile(&s->jitter, 99);
+    return true;
+}
+
+void pa_alsa_tsched_stats_get_info(pa_alsa_tsched_stats *s, pa_usec_t now, pa_alsa_tsched_info *i) {
+    pa_assert(s);
+    pa_assert(i);
+
+    memset(i, 0, sizeof(*i));
+
+    i->render_p50 = histogram_percentile(&s->render, 50);
+    i->render_p99 = histogram_percentile(&s->render, 99);
+    i->render_max = s->render.max;
+    i->jitter_p50 = histogram_percentile(&s->jitter, 50);
+    i->jitter_p99 = histogram_percentile(&s->jitter, 99);
+    i->jitter_max = s->jitter.max;
+
+    if (!pa_alsa_tsched_stats_get_process_time(s, &i->process_time))
+        i->process_time = 0;
+
+    i->n_wakeups = s->n_wakeups;
+    i->n_underruns = s->n_underruns;
+
+    if (s->rate_since > 0 && now > s->rate_since)
+        i->wakeups_per_sec = (double) s->rate_wakeups * PA_USEC_PER_SEC / (double) (now - s->rate_since);
+
+    s->rate_wakeups = 0;
+    s->rate_since = now;
+}
+
+void pa_alsa_tsched_info_to_string(const pa_alsa_tsched_info *i, pa_strbuf *buf) {
+    pa_assert(i);
+    pa_assert(buf);
+
+    pa_strbuf_printf(buf, "\ttsched watermark: %0.2f ms\n", (double) i->watermark / PA_USEC_PER_MSEC);
+    pa_strbuf_printf(buf, "\ttsched process time: %0.2f ms\n", (double) i->process_time / PA_USEC_PER_MSEC);
+    pa_strbuf_printf(buf, "\ttsched render time: p50 %0.2f ms, p99 %0.2f ms, max %0.2f ms\n",
+                     (double) i->render_p50 / PA_USEC_PER_MSEC,
+                     (double) i->render_p99 / PA_USEC_PER_MSEC,
+                     (double) i->render_max / PA_USEC_PER_MSEC);
+    pa_strbuf_printf(buf, "\ttsched wakeup jitter: p50 %0.2f ms, p99 %0.2f ms, max %0.2f ms\n",
+                     (double) i->jitter_p50 / PA_USEC_PER_MSEC,
+                     (double) i->jitter_p99 / PA_USEC_PER_MSEC,
+                     (double) i->jitter_max / PA_USEC_PER_MSEC);
+    pa_strbuf_printf(buf, "\ttsched wakeups: %llu (%0.1f per second)\n", (unsigned long long) i->n_wakeups, i->wakeups_per_sec);
+    pa_strbuf_printf(buf, "\ttsched underruns: %llu\n", (unsigned long long) i->n_underruns);
+}
@@ -0,0 +1,85 @@
+#ifndef fooalsatschedhfoo
+#define fooalsatschedhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <pulse/sample.h>
+
+#include <pulsecore/strbuf.h>
+
+/* Timing statistics of a timer-scheduled IO thread. The thread
+ * records how long each iteration spent rendering and writing data
+ * and how late it woke up compared to the timer it asked for. Both
+ * are kept in histograms with logarithmic buckets that slowly forget
+ * old samples, so that the tail latency of the recent past can be
+ * used to predict how much time needs to be left in the hardware
+ * buffer when we go to sleep.
+ *
+ * All functions except pa_alsa_tsched_info_to_string() may only be
+ * called from the IO thread that owns the object. */
+
+typedef struct pa_alsa_tsched_stats pa_alsa_tsched_stats;
+
+typedef struct pa_alsa_tsched_info {
+    pa_usec_t render_p50, render_p99, render_max;
+    pa_usec_t jitter_p50, jitter_p99, jitter_max;
+
+    /* The predicted process time, 0 if we don't know enough yet */
+    pa_usec_t process_time;
+
+    /* Filled in by the user */
+    pa_usec_t watermark;
+
+    double wakeups_per_sec;
+    uint64_t n_wakeups, n_underruns;
+} pa_alsa_tsched_info;
+
+pa_alsa_tsched_stats* pa_alsa_tsched_stats_new(void);
+void pa_alsa_tsched_stats_free(pa_alsa_tsched_stats *s);
+
+/* Forget the collected histograms, e.g. after the device has been
+ * reopened. The counters are kept. */
+void pa_alsa_tsched_stats_reset(pa_alsa_tsched_stats *s);
+
+void pa_alsa_tsched_stats_add_render(pa_alsa_tsched_stats *s, pa_usec_t usec);
+
+/* Record a wakeup. lateness is only looked at if the wakeup was
+ * caused by the timer expiring. */
+void pa_alsa_tsched_stats_add_wakeup(pa_alsa_tsched_stats *s, bool timer_elapsed, pa_usec_t lateness);
+
+void pa_alsa_tsched_stats_add_underrun(pa_alsa_tsched_stats *s);
+
+/* Returns the 99th percentile of the render time plus the 99th
+ * percentile of the wakeup lateness, i.e. the time we need to be
+ * woken up before the buffer runs empty to make it in time in 99% of
+ * the cases even when both happen to be bad at once. Returns false if
+ * not enough samples have been collected yet. */
+bool pa_alsa_tsched_stats_get_process_time(pa_alsa_tsched_stats *s, pa_usec_t *usec);
+
+/* The wakeup rate is averaged over the time since the previous call. */
+void pa_alsa_tsched_stats_get_info(pa_alsa_tsched_stats *s, pa_usec_t now, pa_alsa_tsched_info *i);
+
+/* Appends the info as tab indented lines, as in "pacmd list-sinks" */
+void pa_alsa_tsched_info_to_string(const pa_alsa_tsched_info *i, pa_strbuf *buf);
+
+#endif
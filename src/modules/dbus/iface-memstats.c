@@ -29,16 +29,26 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/dbus-util.h>
 #include <pulsecore/protocol-dbus.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
 
 #include "iface-memstats.h"
 
 #define OBJECT_NAME "memstats"
 
+/* One entry per sink, source, sink input and source output: type and
+ * index of the object, xruns, rewinds, rewound bytes, rendered blocks,
+ * p50, p99 and max render time, total resample time (all in usec),
+ * current and highest buffer fill level in bytes */
+#define IO_STATS_ENTRY_SIGNATURE "(suuututtttuu)"
+#define IO_STATS_SIGNATURE "a" IO_STATS_ENTRY_SIGNATURE
+
 static void handle_get_current_memblocks(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_current_memblocks_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_accumulated_memblocks(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_accumulated_memblocks_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_io_stats(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
@@ -54,6 +64,7 @@ enum property_handler_index {
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS,
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE,
     PROPERTY_HANDLER_SAMPLE_CACHE_SIZE,
+    PROPERTY_HANDLER_IO_STATS,
     PROPERTY_HANDLER_MAX
 };
 
@@ -62,7 +73,8 @@ static pa_dbus_property_handler property_handlers[PROPERTY_HANDLER_MAX] = {
     [PROPERTY_HANDLER_CURRENT_MEMBLOCKS_SIZE]     = { .property_name = "CurrentMemblocksSize",     .type = "u", .get_cb = handle_get_current_memblocks_size,     .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS]      = { .property_name = "AccumulatedMemblocks",     .type = "u", .get_cb = handle_get_accumulated_memblocks,      .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE] = { .property_name = "AccumulatedMemblocksSize", .type = "u", .get_cb = handle_get_accumulated_memblocks_size, .set_cb = NULL },
-    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL }
+    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL },
+    [PROPERTY_HANDLER_IO_STATS]                   = { .property_name = "IoStats",                  .type = IO_STATS_SIGNATURE, .get_cb = handle_get_io_stats,   .set_cb = NULL }
 };
 
 static pa_dbus_interface_info memstats_interface_info = {
@@ -153,6 +165,82 @@ static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg,
     pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &sample_cache_size);
 }
 
+static void append_io_stats_entry(DBusMessageIter *iter, const char *type, uint32_t idx, const pa_io_stats *s) {
+    pa_io_stats_snapshot i;
+    DBusMessageIter struct_iter;
+    dbus_uint64_t rewind_bytes, render_time_p50, render_time_p99, render_time_max, resample_time;
+
+    pa_io_stats_get_snapshot(s, &i);
+
+    rewind_bytes = i.rewind_bytes;
+    render_time_p50 = i.render_time_p50;
+    render_time_p99 = i.render_time_p99;
+    render_time_max = i.render_time_max;
+    resample_time = i.resample_time;
+
+    pa_assert_se(dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL, &struct_iter));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &type));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &idx));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &i.xruns));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &i.rewinds));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &rewind_bytes));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &i.render_count));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &render_time_p50));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &render_time_p99));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &render_time_max));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &resample_time));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &i.queue_length));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &i.queue_length_max));
+    pa_assert_se(dbus_message_iter_close_container(iter, &struct_iter));
+}
+
+static void append_io_stats_variant(DBusMessageIter *iter, pa_dbusiface_memstats *m) {
+    DBusMessageIter variant_iter;
+    DBusMessageIter array_iter;
+    pa_sink *sink;
+    pa_source *source;
+    pa_sink_input *si;
+    pa_source_output *so;
+    uint32_t idx;
+
+    pa_assert(iter);
+    pa_assert(m);
+
+    pa_assert_se(dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, IO_STATS_SIGNATURE, &variant_iter));
+    pa_assert_se(dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, IO_STATS_ENTRY_SIGNATURE, &array_iter));
+
+    PA_IDXSET_FOREACH(sink, m->core->sinks, idx)
+        append_io_stats_entry(&array_iter, "sink", idx, &sink->io_stats);
+
+    PA_IDXSET_FOREACH(source, m->core->sources, idx)
+        append_io_stats_entry(&array_iter, "source", idx, &source->io_stats);
+
+    PA_IDXSET_FOREACH(si, m->core->sink_inputs, idx)
+        append_io_stats_entry(&array_iter, "sink-input", idx, &si->io_stats);
+
+    PA_IDXSET_FOREACH(so, m->core->source_outputs, idx)
+        append_io_stats_entry(&array_iter, "source-output", idx, &so->io_stats);
+
+    pa_assert_se(dbus_message_iter_close_container(&variant_iter, &array_iter));
+    pa_assert_se(dbus_message_iter_close_container(iter, &variant_iter));
+}
+
+static void handle_get_io_stats(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    DBusMessage *reply = NULL;
+    DBusMessageIter msg_iter;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    pa_assert_se(reply = dbus_message_new_method_return(msg));
+    dbus_message_iter_init_append(reply, &msg_iter);
+    append_io_stats_variant(&msg_iter, m);
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+    dbus_message_unref(reply);
+}
+
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
     pa_dbusiface_memstats *m = userdata;
     const pa_mempool_stat *stat;
@@ -164,6 +252,7 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     DBusMessage *reply = NULL;
     DBusMessageIter msg_iter;
     DBusMessageIter dict_iter;
+    DBusMessageIter dict_entry_iter;
 
     pa_assert(conn);
     pa_assert(msg);
@@ -188,6 +277,11 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE].property_name, DBUS_TYPE_UINT32, &accumulated_memblocks_size);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_CACHE_SIZE].property_name, DBUS_TYPE_UINT32, &sample_cache_size);
 
+    pa_assert_se(dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, NULL, &dict_entry_iter));
+    pa_assert_se(dbus_message_iter_append_basic(&dict_entry_iter, DBUS_TYPE_STRING, &property_handlers[PROPERTY_HANDLER_IO_STATS].property_name));
+    append_io_stats_variant(&dict_entry_iter, m);
+    pa_assert_se(dbus_message_iter_close_container(&dict_iter, &dict_entry_iter));
+
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
 
     pa_assert_se(dbus_connection_send(conn, reply, NULL));
@@ -0,0 +1,61 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "adrian.h"
+
+/* NEON versions of the NLMS filter loops in adrian-aec.c. This file is built
+ * with NEON enabled, which the rest of the module isn't on 32-bit ARM, and
+ * the functions are only used if the CPU has it. */
+
+#ifdef AEC_HAVE_NEON
+
+#include <arm_neon.h>
+
+/* len is a multiple of 16 */
+float AEC_dotp_neon(const float a[], const float b[], int len) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    float32x2_t acc;
+    int j;
+
+    for (j = 0; j < len; j += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + j), vld1q_f32(b + j));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + j + 4), vld1q_f32(b + j + 4));
+    }
+
+    acc0 = vaddq_f32(acc0, acc1);
+    acc = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    acc = vpadd_f32(acc, acc);
+
+    return vget_lane_f32(acc, 0);
+}
+
+void AEC_update_neon(float w[], const float xf[], float mikro_ef, int len) {
+    int i;
+
+    for (i = 0; i < len; i += 8) {
+        vst1q_f32(w + i, vmlaq_n_f32(vld1q_f32(w + i), vld1q_f32(xf + i), mikro_ef));
+        vst1q_f32(w + i + 4, vmlaq_n_f32(vld1q_f32(w + i + 4), vld1q_f32(xf + i + 4), mikro_ef));
+    }
+}
+
+#endif /* AEC_HAVE_NEON */
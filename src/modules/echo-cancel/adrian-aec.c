@@ -30,13 +30,21 @@
 #include <xmmintrin.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__amd64__))
+#define AEC_HAVE_AVX 1
+#include <immintrin.h>
+#endif
+
+/* The vector versions rely on len being a multiple of 16 and on a (the tap
+ * weights) being 32-byte aligned, b can have any alignment. */
+
 /* Vector Dot Product */
-static REAL dotp(REAL a[], REAL b[])
+static REAL dotp(const REAL a[], const REAL b[], int len)
 {
   REAL sum0 = 0.0f, sum1 = 0.0f;
   int j;
 
-  for (j = 0; j < NLMS_LEN; j += 2) {
+  for (j = 0; j < len; j += 2) {
     // optimize: partial loop unrolling
     sum0 += a[j] * b[j];
     sum1 += a[j + 1] * b[j + 1];
@@ -44,15 +52,31 @@ static REAL dotp(REAL a[], REAL b[])
   return sum0 + sum1;
 }
 
-static REAL dotp_sse(REAL a[], REAL b[])
+/* Tap weight update, w += mikro_ef * xf */
+static void update(REAL w[], const REAL xf[], REAL mikro_ef, int len)
 {
+#ifdef DISABLE_ORC
+  int i;
+
+  for (i = 0; i < len; i += 2) {
+    // optimize: partial loop unrolling
+    w[i] += mikro_ef * xf[i];
+    w[i + 1] += mikro_ef * xf[i + 1];
+  }
+#else
+  update_tap_weights(w, xf, mikro_ef, len);
+#endif
+}
+
 #ifdef __SSE__
+static REAL dotp_sse(const REAL a[], const REAL b[], int len)
+{
   /* This is taken from speex's inner product implementation */
   int j;
   REAL sum;
   __m128 acc = _mm_setzero_ps();
 
-  for (j=0;j<NLMS_LEN;j+=8)
+  for (j=0;j<len;j+=8)
   {
     acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(a+j), _mm_loadu_ps(b+j)));
     acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(a+j+4), _mm_loadu_ps(b+j+4)));
@@ -62,15 +86,95 @@ static REAL dotp_sse(REAL a[], REAL b[])
   _mm_store_ss(&sum, acc);
 
   return sum;
-#else
-  return dotp(a, b);
+}
+
+static void update_sse(REAL w[], const REAL xf[], REAL mikro_ef, int len)
+{
+  int i;
+  __m128 m = _mm_set1_ps(mikro_ef);
+
+  for (i = 0; i < len; i += 8) {
+    _mm_store_ps(w+i, _mm_add_ps(_mm_load_ps(w+i), _mm_mul_ps(m, _mm_loadu_ps(xf+i))));
+    _mm_store_ps(w+i+4, _mm_add_ps(_mm_load_ps(w+i+4), _mm_mul_ps(m, _mm_loadu_ps(xf+i+4))));
+  }
+}
 #endif
+
+#ifdef AEC_HAVE_AVX
+/* Built for AVX whatever the compiler flags are, only used if the CPU has
+ * it */
+__attribute__((target("avx")))
+static REAL dotp_avx(const REAL a[], const REAL b[], int len)
+{
+  int j;
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  __m128 acc;
+  REAL sum;
+
+  for (j = 0; j < len; j += 16) {
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_load_ps(a+j), _mm256_loadu_ps(b+j)));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_load_ps(a+j+8), _mm256_loadu_ps(b+j+8)));
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+  _mm_store_ss(&sum, acc);
+
+  return sum;
+}
+
+__attribute__((target("avx")))
+static void update_avx(REAL w[], const REAL xf[], REAL mikro_ef, int len)
+{
+  int i;
+  __m256 m = _mm256_set1_ps(mikro_ef);
+
+  for (i = 0; i < len; i += 16) {
+    _mm256_store_ps(w+i, _mm256_add_ps(_mm256_load_ps(w+i), _mm256_mul_ps(m, _mm256_loadu_ps(xf+i))));
+    _mm256_store_ps(w+i+8, _mm256_add_ps(_mm256_load_ps(w+i+8), _mm256_mul_ps(m, _mm256_loadu_ps(xf+i+8))));
+  }
 }
+#endif
 
+int AEC_have_vector(AEC_vector vector)
+{
+  switch (vector) {
+    case AEC_VECTOR_NONE:
+      return 1;
+#ifdef __SSE__
+    case AEC_VECTOR_SSE:
+      return 1;
+#endif
+#ifdef AEC_HAVE_AVX
+    case AEC_VECTOR_AVX:
+      return 1;
+#endif
+#ifdef AEC_HAVE_NEON
+    case AEC_VECTOR_NEON:
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
 
-AEC* AEC_init(int RATE, int have_vector)
+AEC* AEC_init(int RATE, AEC_vector vector)
 {
   AEC *a = pa_xnew0(AEC, 1);
+
+  // 1600 taps and 960 taps of hangover at 16 kHz
+  a->len = ((RATE * NLMS_LEN_MS / 1000 + 15) / 16) * 16;
+  a->hold = RATE * Thold_MS / 1000;
+  a->alphafast = ALPHAFAST * 16000.0f / RATE;
+  a->alphaslow = ALPHASLOW * 16000.0f / RATE;
+
+  a->x = pa_xnew0(REAL, a->len + NLMS_EXT);
+  a->xf = pa_xnew0(REAL, a->len + NLMS_EXT);
+  a->w_arr = pa_xnew0(REAL, a->len + (32 / sizeof(REAL)));
+  /* Get a 32-byte aligned location */
+  a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 32) + 32);
+
   a->j = NLMS_EXT;
   AEC_setambient(a, NoiseFloor);
   a->dfast = a->dslow = M75dB_PCM;
@@ -78,22 +182,40 @@ AEC* AEC_init(int RATE, int have_vector)
   a->gain = 1.0f;
   a->Fx = IIR1_init(2000.0f/RATE);
   a->Fe = IIR1_init(2000.0f/RATE);
-  a->cutoff = FIR_HP_300Hz_init();
-  a->acMic = IIR_HP_init();
-  a->acSpk = IIR_HP_init();
+  a->cutoff = FIR_HP_300Hz_init(RATE);
+  a->acMic = IIR_HP_init(RATE);
+  a->acSpk = IIR_HP_init(RATE);
 
   a->aes_y2 = M0dB;
 
   a->fdwdisplay = -1;
 
-  if (have_vector) {
-      /* Get a 16-byte aligned location */
-      a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 16) + 16);
+  if (!AEC_have_vector(vector))
+    vector = AEC_VECTOR_NONE;
+
+  switch (vector) {
+#ifdef __SSE__
+    case AEC_VECTOR_SSE:
       a->dotp = dotp_sse;
-  } else {
-      /* We don't care about alignment, just use the array as-is */
-      a->w = a->w_arr;
+      a->update = update_sse;
+      break;
+#endif
+#ifdef AEC_HAVE_AVX
+    case AEC_VECTOR_AVX:
+      a->dotp = dotp_avx;
+      a->update = update_avx;
+      break;
+#endif
+#ifdef AEC_HAVE_NEON
+    case AEC_VECTOR_NEON:
+      a->dotp = AEC_dotp_neon;
+      a->update = AEC_update_neon;
+      break;
+#endif
+    default:
       a->dotp = dotp;
+      a->update = update;
+      break;
   }
 
   return a;
@@ -107,6 +229,9 @@ void AEC_done(AEC *a) {
     pa_xfree(a->acMic);
     pa_xfree(a->acSpk);
     pa_xfree(a->cutoff);
+    pa_xfree(a->x);
+    pa_xfree(a->xf);
+    pa_xfree(a->w_arr);
     pa_xfree(a);
 }
 
@@ -123,12 +248,12 @@ static float AEC_dtd(AEC *a, REAL d, REAL x)
   float ratio, stepsize;
 
   // fast near-end and far-end average
-  a->dfast += ALPHAFAST * (fabsf(d) - a->dfast);
-  a->xfast += ALPHAFAST * (fabsf(x) - a->xfast);
+  a->dfast += a->alphafast * (fabsf(d) - a->dfast);
+  a->xfast += a->alphafast * (fabsf(x) - a->xfast);
 
   // slow near-end and far-end average
-  a->dslow += ALPHASLOW * (fabsf(d) - a->dslow);
-  a->xslow += ALPHASLOW * (fabsf(x) - a->xslow);
+  a->dslow += a->alphaslow * (fabsf(d) - a->dslow);
+  a->xslow += a->alphaslow * (fabsf(x) - a->xslow);
 
   if (a->xfast < M70dB_PCM) {
     return 0.0f;   // no Spk signal
@@ -160,14 +285,14 @@ static void AEC_leaky(AEC *a)
 {
   if (a->xfast >= M70dB_PCM) {
     // vector w is valid for hangover Thold time
-    a->hangover = Thold;
+    a->hangover = a->hold;
   } else {
     if (a->hangover > 1) {
       --(a->hangover);
     } else if (1 == a->hangover) {
       --(a->hangover);
       // My Leaky NLMS is to erase vector w when hangover expires
-      memset(a->w_arr, 0, sizeof(a->w_arr));
+      memset(a->w, 0, a->len * sizeof(REAL));
     }
   }
 }
@@ -192,35 +317,26 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
   // (mic signal - estimated mic signal from spk signal)
   e = d;
   if (a->hangover > 0) {
-    e -= a->dotp(a->w, a->x + a->j);
+    e -= a->dotp(a->w, a->x + a->j, a->len);
   }
   ef = IIR1_highpass(a->Fe, e);     // pre-whitening of e
 
   // optimize: iterative dotp(xf, xf)
-  a->dotp_xf_xf += (a->xf[a->j] * a->xf[a->j] - a->xf[a->j + NLMS_LEN - 1] * a->xf[a->j + NLMS_LEN - 1]);
+  a->dotp_xf_xf += (a->xf[a->j] * a->xf[a->j] - a->xf[a->j + a->len - 1] * a->xf[a->j + a->len - 1]);
 
   if (stepsize > 0.0f) {
     // calculate variable step size
     REAL mikro_ef = stepsize * ef / a->dotp_xf_xf;
 
-#ifdef DISABLE_ORC
     // update tap weights (filter learning)
-    int i;
-    for (i = 0; i < NLMS_LEN; i += 2) {
-      // optimize: partial loop unrolling
-      a->w[i] += mikro_ef * a->xf[i + a->j];
-      a->w[i + 1] += mikro_ef * a->xf[i + a->j + 1];
-    }
-#else
-    update_tap_weights(a->w, &a->xf[a->j], mikro_ef, NLMS_LEN);
-#endif
+    a->update(a->w, &a->xf[a->j], mikro_ef, a->len);
   }
 
   if (--(a->j) < 0) {
     // optimize: decrease number of memory copies
     a->j = NLMS_EXT;
-    memmove(a->x + a->j + 1, a->x, (NLMS_LEN - 1) * sizeof(REAL));
-    memmove(a->xf + a->j + 1, a->xf, (NLMS_LEN - 1) * sizeof(REAL));
+    memmove(a->x + a->j + 1, a->x, (a->len - 1) * sizeof(REAL));
+    memmove(a->xf + a->j + 1, a->xf, (a->len - 1) * sizeof(REAL));
   }
 
   // Saturation
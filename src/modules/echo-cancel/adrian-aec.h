@@ -22,6 +22,8 @@
 
 #include <pulsecore/macro.h>
 
+#include "adrian.h"
+
 #define WIDEB 2
 
 // use double if your CPU does software-emulation of float
@@ -62,10 +64,11 @@
 /* The following values are for hardware AEC and studio quality
  * microphone */
 
-/* NLMS filter length in taps (samples). A longer filter length gives
- * better Echo Cancellation, but maybe slower convergence speed and
- * needs more CPU power (Order of NLMS is linear) */
-#define NLMS_LEN  (100*WIDEB*8)
+/* NLMS filter length in ms, the number of taps scales with the sample
+ * rate. A longer filter length gives better Echo Cancellation, but maybe
+ * slower convergence speed and needs more CPU power (Order of NLMS is
+ * linear) */
+#define NLMS_LEN_MS 100
 
 /* Vector w visualization length in taps (samples).
  * Must match argv value for wdisplay.tcl */
@@ -75,9 +78,9 @@
  * to microphone ambient Noise level */
 #define NoiseFloor M55dB_PCM
 
-/* Leaky hangover in taps.
+/* Leaky hangover in ms.
  */
-#define Thold (60 * WIDEB * 8)
+#define Thold_MS 60
 
 // Adrian soft decision DTD
 // left point. X is ratio, Y is stepsize
@@ -86,6 +89,7 @@
 // right point. STEPX2=2.0 is good double talk, 3.0 is good single talk.
 #define STEPX2 2.5
 #define STEPY2 0
+// smoothing factors at 16 kHz, scaled for other sample rates
 #define ALPHAFAST (1.0f / 100.0f)
 #define ALPHASLOW (1.0f / 20000.0f)
 
@@ -110,18 +114,20 @@ typedef struct IIR_HP IIR_HP;
 /* Exponential Smoothing or IIR Infinite Impulse Response Filter */
 struct IIR_HP {
   REAL x;
+  REAL a0;                      /* controls Transfer Frequency */
 };
 
-static  IIR_HP* IIR_HP_init(void) {
+static  IIR_HP* IIR_HP_init(int RATE) {
     IIR_HP *i = pa_xnew(IIR_HP, 1);
     i->x = 0.0f;
+    /* 0.01 at 16 kHz */
+    i->a0 = 160.0f / RATE;
     return i;
   }
 
 static  REAL IIR_HP_highpass(IIR_HP *i, REAL in) {
-    const REAL a0 = 0.01f;      /* controls Transfer Frequency */
     /* Highpass = Signal - Lowpass. Lowpass = Exponential Smoothing */
-    i->x += a0 * (in - i->x);
+    i->x += i->a0 * (in - i->x);
     return in - i->x;
   }
 
@@ -172,21 +178,20 @@ public:
  * sample rate.
  * Coefficients calculated with
  * www.dsptutor.freeuk.com/KaiserFilterDesign/KaiserFilterDesign.html
+ *
+ * Above 16kHz, a windowed sinc filter with the same 300Hz cut-off and a
+ * proportionally longer response is designed instead.
  */
+#define FIR_HP_MAX_TAPS 128
+
 struct FIR_HP_300Hz {
-  REAL z[36];
+  int n;
+  REAL a[FIR_HP_MAX_TAPS];
+  REAL z[FIR_HP_MAX_TAPS];
 };
 
-static  FIR_HP_300Hz* FIR_HP_300Hz_init(void) {
-    FIR_HP_300Hz *ret = pa_xnew(FIR_HP_300Hz, 1);
-    memset(ret, 0, sizeof(FIR_HP_300Hz));
-    return ret;
-  }
-
-static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
-    REAL sum0 = 0.0, sum1 = 0.0;
-    int j;
-    const REAL a[36] = {
+static  FIR_HP_300Hz* FIR_HP_300Hz_init(int RATE) {
+    static const REAL a[36] = {
       // Kaiser Window FIR Filter, Filter type: High pass
       // Passband: 150.0 - 4000.0 Hz, Order: 34
       // Transition band: 34.0 Hz, Stopband attenuation: 10.0 dB
@@ -200,14 +205,45 @@ static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
       -0.02328091, -0.022222936, -0.021104068, -0.019931411,
       -0.01871232, -0.017454365, -0.016165324, 0.0
     };
-    memmove(f->z + 1, f->z, 35 * sizeof(REAL));
+    FIR_HP_300Hz *ret = pa_xnew0(FIR_HP_300Hz, 1);
+    int j, m;
+
+    if (RATE <= 16000) {
+      ret->n = 36;
+      memcpy(ret->a, a, sizeof(a));
+      return ret;
+    }
+
+    // odd length, so that the filter has a centre tap
+    ret->n = PA_MIN(35 * RATE / 16000, FIR_HP_MAX_TAPS - 1) | 1;
+    m = ret->n / 2;
+
+    for (j = 0; j < ret->n; j++) {
+      double t = j - m;
+      double lp = (j == m) ? 2.0 * 300.0 / RATE : sin(2.0 * M_PI * 300.0 / RATE * t) / (M_PI * t);
+      double win = 0.5 + 0.5 * cos(M_PI * t / (m + 1));
+
+      ret->a[j] = (REAL) (((j == m) ? 1.0 : 0.0) - lp * win);
+    }
+
+    return ret;
+  }
+
+static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
+    REAL sum0 = 0.0, sum1 = 0.0;
+    int j;
+
+    memmove(f->z + 1, f->z, (f->n - 1) * sizeof(REAL));
     f->z[0] = in;
 
-    for (j = 0; j < 36; j += 2) {
+    for (j = 0; j + 1 < f->n; j += 2) {
       // optimize: partial loop unrolling
-      sum0 += a[j] * f->z[j];
-      sum1 += a[j + 1] * f->z[j + 1];
+      sum0 += f->a[j] * f->z[j];
+      sum1 += f->a[j + 1] * f->z[j + 1];
     }
+    if (j < f->n)
+      sum0 += f->a[j] * f->z[j];
+
     return sum0 + sum1;
   }
 #endif
@@ -292,8 +328,6 @@ public:
 // block size in taps to optimize DTD calculation
 #define DTD_LEN   16
 
-typedef struct AEC AEC;
-
 struct AEC {
   // Time domain Filters
   IIR_HP *acMic, *acSpk;        // DC-level remove Highpass)
@@ -304,12 +338,15 @@ struct AEC {
   // Adrian soft decision DTD (Double Talk Detector)
   REAL dfast, xfast;
   REAL dslow, xslow;
+  REAL alphafast, alphaslow;    // ALPHAFAST and ALPHASLOW for this rate
 
   // NLMS-pw
-  REAL x[NLMS_LEN + NLMS_EXT];  // tap delayed loudspeaker signal
-  REAL xf[NLMS_LEN + NLMS_EXT]; // pre-whitening tap delayed signal
-  REAL w_arr[NLMS_LEN + (16 / sizeof(REAL))]; // tap weights
-  REAL *w;                      // this will be a 16-byte aligned pointer into w_arr
+  int len;                      // filter length in taps, a multiple of 16
+  int hold;                     // leaky hangover in taps
+  REAL *x;                      // tap delayed loudspeaker signal, len + NLMS_EXT
+  REAL *xf;                     // pre-whitening tap delayed signal, len + NLMS_EXT
+  REAL *w_arr;                  // tap weights
+  REAL *w;                      // this will be a 32-byte aligned pointer into w_arr
   int j;                        // optimize: less memory copies
   double dotp_xf_xf;            // double to avoid loss of precision
   float delta;                  // noise floor to stabilize NLMS
@@ -327,7 +364,8 @@ struct AEC {
   float stepsize;
 
   // vfuncs that are picked based on processor features available
-  REAL (*dotp) (REAL[], REAL[]);
+  REAL (*dotp) (const REAL[], const REAL[], int);
+  void (*update) (REAL[], const REAL[], REAL, int);
 };
 
 /* Double-Talk Detector
@@ -351,8 +389,6 @@ static  void AEC_leaky(AEC *a);
  */
 static  REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize);
 
-AEC* AEC_init(int RATE, int have_vector);
-void AEC_done(AEC *a);
 
 /* Acoustic Echo Cancellation and Suppression of one sample
  * in   d:  microphone signal with echo
@@ -366,7 +402,7 @@ PA_GCC_UNUSED static  float AEC_getambient(AEC *a) {
   }
 static  void AEC_setambient(AEC *a, float Min_xf) {
     a->dotp_xf_xf -= a->delta;  // subtract old delta
-    a->delta = (NLMS_LEN-1) * Min_xf * Min_xf;
+    a->delta = (a->len-1) * Min_xf * Min_xf;
     a->dotp_xf_xf += a->delta;  // add new delta
   }
 PA_GCC_UNUSED static  void AEC_setgain(AEC *a, float gain_) {
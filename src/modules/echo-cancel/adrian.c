@@ -61,7 +61,8 @@ bool pa_adrian_ec_init(pa_core *c, pa_echo_canceller *ec,
                        pa_sample_spec *play_ss, pa_channel_map *play_map,
                        pa_sample_spec *out_ss, pa_channel_map *out_map,
                        uint32_t *nframes, const char *args) {
-    int rate, have_vector = 0;
+    int rate;
+    AEC_vector vector = AEC_VECTOR_NONE;
     uint32_t frame_size_ms;
     pa_modargs *ma;
 
@@ -84,11 +85,22 @@ bool pa_adrian_ec_init(pa_core *c, pa_echo_canceller *ec,
 
     pa_log_debug ("Using nframes %d, blocksize %u, channels %d, rate %d", *nframes, ec->params.priv.adrian.blocksize, out_ss->channels, out_ss->rate);
 
-    /* For now we only support SSE */
-    if (c->cpu_info.cpu_type == PA_CPU_X86 && (c->cpu_info.flags.x86 & PA_CPU_X86_SSE))
-        have_vector = 1;
+    /* Pick the widest vector unit the CPU has and the filter was built for */
+    if (c->cpu_info.cpu_type == PA_CPU_X86) {
+        if ((c->cpu_info.flags.x86 & PA_CPU_X86_AVX) && AEC_have_vector(AEC_VECTOR_AVX))
+            vector = AEC_VECTOR_AVX;
+        else if ((c->cpu_info.flags.x86 & PA_CPU_X86_SSE) && AEC_have_vector(AEC_VECTOR_SSE))
+            vector = AEC_VECTOR_SSE;
+    } else if (c->cpu_info.cpu_type == PA_CPU_ARM) {
+        if ((c->cpu_info.flags.arm & PA_CPU_ARM_NEON) && AEC_have_vector(AEC_VECTOR_NEON))
+            vector = AEC_VECTOR_NEON;
+    }
+#ifdef __aarch64__
+    /* NEON is always there on 64-bit ARM */
+    vector = AEC_VECTOR_NEON;
+#endif
 
-    ec->params.priv.adrian.aec = AEC_init(rate, have_vector);
+    ec->params.priv.adrian.aec = AEC_init(rate, vector);
     if (!ec->params.priv.adrian.aec)
         goto fail;
 
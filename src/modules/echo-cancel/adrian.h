@@ -27,6 +27,26 @@
 
 typedef struct AEC AEC;
 
-AEC* AEC_init(int RATE, int have_vector);
+/* Vector instruction sets the NLMS filter can use */
+typedef enum AEC_vector {
+    AEC_VECTOR_NONE,
+    AEC_VECTOR_SSE,
+    AEC_VECTOR_AVX,
+    AEC_VECTOR_NEON
+} AEC_vector;
+
+/* Whether the filter was built with support for a vector instruction set.
+ * The caller still has to check that the CPU supports it. */
+int AEC_have_vector(AEC_vector vector);
+
+AEC* AEC_init(int RATE, AEC_vector vector);
 void AEC_done(AEC *a);
 int AEC_doAEC(AEC *a, int d_, int x_);
+
+#if defined(HAVE_NEON) || defined(__aarch64__)
+#define AEC_HAVE_NEON 1
+
+/* In adrian-aec-neon.c, which is built with NEON enabled */
+float AEC_dotp_neon(const float a[], const float b[], int len);
+void AEC_update_neon(float w[], const float xf[], float mikro_ef, int len);
+#endif
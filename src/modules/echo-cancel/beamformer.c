@@ -0,0 +1,198 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "echo-cancel.h"
+
+/* Speed of sound in m/s */
+#define SPEED_OF_SOUND 343.0
+
+struct pa_ec_beamformer {
+    unsigned channels;
+    unsigned nframes;
+
+    /* Per channel delay, split into whole samples and a fraction that is
+     * interpolated linearly */
+    unsigned delay[PA_CHANNELS_MAX];
+    float fraction[PA_CHANNELS_MAX];
+
+    /* Per channel: the last history_length input samples, followed by the
+     * current block */
+    unsigned history_length;
+    float *buffer;
+};
+
+/* Parses "x1,y1,z1,x2,y2,z2,..." */
+static int parse_geometry(const char *s, double positions[][3], unsigned *n) {
+    const char *state = NULL;
+    char *v;
+    unsigned i = 0;
+
+    while ((v = pa_split(s, ",", &state))) {
+        double d;
+
+        if (i >= PA_CHANNELS_MAX * 3 || pa_atod(v, &d) < 0) {
+            pa_xfree(v);
+            return -1;
+        }
+
+        positions[i / 3][i % 3] = d;
+        pa_xfree(v);
+        i++;
+    }
+
+    if (i == 0 || i % 3 != 0)
+        return -1;
+
+    *n = i / 3;
+    return 0;
+}
+
+/* Parses "azimuth,elevation" in degrees into a unit vector */
+static int parse_direction(const char *s, double direction[3]) {
+    const char *state = NULL;
+    char *a, *e, *extra;
+    double azimuth, elevation;
+    int r = -1;
+
+    a = pa_split(s, ",", &state);
+    e = pa_split(s, ",", &state);
+    extra = pa_split(s, ",", &state);
+
+    if (!a || !e || extra || pa_atod(a, &azimuth) < 0 || pa_atod(e, &elevation) < 0)
+        goto finish;
+
+    azimuth *= M_PI / 180;
+    elevation *= M_PI / 180;
+
+    direction[0] = cos(elevation) * cos(azimuth);
+    direction[1] = cos(elevation) * sin(azimuth);
+    direction[2] = sin(elevation);
+    r = 0;
+
+finish:
+    pa_xfree(a);
+    pa_xfree(e);
+    pa_xfree(extra);
+    return r;
+}
+
+pa_ec_beamformer *pa_ec_beamformer_new(uint32_t rate, unsigned nframes, const char *mic_geometry, const char *target_direction) {
+    pa_ec_beamformer *b;
+    double positions[PA_CHANNELS_MAX][3], direction[3], projection[PA_CHANNELS_MAX], min_projection;
+    unsigned i, n, max_delay = 0;
+
+    pa_assert(rate > 0);
+    pa_assert(nframes > 0);
+    pa_assert(mic_geometry);
+
+    if (parse_geometry(mic_geometry, positions, &n) < 0) {
+        pa_log("Invalid mic_geometry, expected x,y,z coordinates in metres for each microphone");
+        return NULL;
+    }
+
+    if (parse_direction(target_direction ? target_direction : "90,0", direction) < 0) {
+        pa_log("Invalid target_direction, expected azimuth,elevation in degrees");
+        return NULL;
+    }
+
+    /* A plane wave from the target direction reaches the microphones that
+     * are furthest out along it first. These have to be delayed the most to
+     * line up with the others. */
+    for (i = 0; i < n; i++)
+        projection[i] = positions[i][0] * direction[0] + positions[i][1] * direction[1] + positions[i][2] * direction[2];
+
+    min_projection = projection[0];
+    for (i = 1; i < n; i++)
+        min_projection = PA_MIN(min_projection, projection[i]);
+
+    b = pa_xnew0(pa_ec_beamformer, 1);
+    b->channels = n;
+    b->nframes = nframes;
+
+    for (i = 0; i < n; i++) {
+        double d = (projection[i] - min_projection) / SPEED_OF_SOUND * rate;
+
+        b->delay[i] = (unsigned) floor(d);
+        b->fraction[i] = (float) (d - floor(d));
+        max_delay = PA_MAX(max_delay, b->delay[i]);
+
+        pa_log_debug("Microphone %u is delayed by %0.2f samples", i, d);
+    }
+
+    b->history_length = max_delay + 1;
+    b->buffer = pa_xnew0(float, (size_t) n * (b->history_length + nframes));
+
+    return b;
+}
+
+void pa_ec_beamformer_free(pa_ec_beamformer *b) {
+    pa_assert(b);
+
+    pa_xfree(b->buffer);
+    pa_xfree(b);
+}
+
+unsigned pa_ec_beamformer_get_channels(pa_ec_beamformer *b) {
+    pa_assert(b);
+
+    return b->channels;
+}
+
+void pa_ec_beamformer_run(pa_ec_beamformer *b, const int16_t *in, int16_t *out) {
+    const unsigned stride = b->history_length + b->nframes;
+    const float scale = 1.0f / b->channels;
+    unsigned c, j;
+
+    for (c = 0; c < b->channels; c++) {
+        float *x = b->buffer + c * stride + b->history_length;
+
+        for (j = 0; j < b->nframes; j++)
+            x[j] = in[j * b->channels + c];
+    }
+
+    for (j = 0; j < b->nframes; j++) {
+        float sum = 0;
+
+        for (c = 0; c < b->channels; c++) {
+            const float *x = b->buffer + c * stride + b->history_length + j - b->delay[c];
+
+            sum += (1.0f - b->fraction[c]) * x[0] + b->fraction[c] * x[-1];
+        }
+
+        out[j] = (int16_t) PA_CLAMP_UNLIKELY(lrintf(sum * scale), -0x8000, 0x7FFF);
+    }
+
+    for (c = 0; c < b->channels; c++) {
+        float *x = b->buffer + c * stride;
+
+        memmove(x, x + b->nframes, b->history_length * sizeof(float));
+    }
+}
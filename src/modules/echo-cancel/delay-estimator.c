@@ -0,0 +1,284 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "delay-estimator.h"
+
+/* Windows with less signal than this (mean square, -40 dBFS) are skipped */
+#define MIN_LEVEL 1e-4f
+/* How much the correlation peak has to stand out from the average */
+#define MIN_PEAK_RATIO 8.0f
+/* How close two consecutive estimates have to be, in ms */
+#define AGREEMENT_MS 1
+
+struct pa_ec_delay_estimator {
+    unsigned window;     /* samples per window */
+    unsigned size;       /* FFT size, twice the window so lags don't wrap */
+    unsigned max_delay;
+    unsigned agreement;
+
+    /* Filled by the I/O thread while ready is 0, read by the main thread
+     * while it is 1 */
+    float *rec, *play;
+    unsigned fill;
+    pa_atomic_t ready;
+    pa_atomic_t stale;
+
+    /* main thread */
+    float *re, *im, *g_re, *g_im;
+    float *cos_table, *sin_table;
+    unsigned *bit_reverse;
+    bool have_previous;
+    int previous;
+};
+
+pa_ec_delay_estimator *pa_ec_delay_estimator_new(uint32_t rate, unsigned max_delay_ms) {
+    pa_ec_delay_estimator *e;
+    unsigned i, bits = 0;
+
+    pa_assert(rate > 0);
+
+    e = pa_xnew0(pa_ec_delay_estimator, 1);
+    e->max_delay = (unsigned) ((uint64_t) rate * max_delay_ms / 1000);
+    e->agreement = PA_MAX(1u, rate * AGREEMENT_MS / 1000);
+
+    /* At least half a second, and room for the largest lag on either side */
+    e->window = 1;
+    while (e->window < rate / 2 || e->window < 2 * e->max_delay)
+        e->window *= 2;
+    e->size = 2 * e->window;
+
+    e->rec = pa_xnew(float, e->window);
+    e->play = pa_xnew(float, e->window);
+
+    e->re = pa_xnew(float, e->size);
+    e->im = pa_xnew(float, e->size);
+    e->g_re = pa_xnew(float, e->size);
+    e->g_im = pa_xnew(float, e->size);
+
+    e->cos_table = pa_xnew(float, e->size / 2);
+    e->sin_table = pa_xnew(float, e->size / 2);
+    for (i = 0; i < e->size / 2; i++) {
+        e->cos_table[i] = (float) cos(2 * M_PI * i / e->size);
+        e->sin_table[i] = (float) -sin(2 * M_PI * i / e->size);
+    }
+
+    while ((1u << bits) < e->size)
+        bits++;
+
+    e->bit_reverse = pa_xnew(unsigned, e->size);
+    for (i = 0; i < e->size; i++) {
+        unsigned r = 0, b;
+
+        for (b = 0; b < bits; b++)
+            if (i & (1u << b))
+                r |= 1u << (bits - 1 - b);
+
+        e->bit_reverse[i] = r;
+    }
+
+    pa_log_debug("Delay estimation over %u samples, up to %u samples of delay", e->window, e->max_delay);
+
+    return e;
+}
+
+void pa_ec_delay_estimator_free(pa_ec_delay_estimator *e) {
+    pa_assert(e);
+
+    pa_xfree(e->rec);
+    pa_xfree(e->play);
+    pa_xfree(e->re);
+    pa_xfree(e->im);
+    pa_xfree(e->g_re);
+    pa_xfree(e->g_im);
+    pa_xfree(e->cos_table);
+    pa_xfree(e->sin_table);
+    pa_xfree(e->bit_reverse);
+    pa_xfree(e);
+}
+
+void pa_ec_delay_estimator_feed(pa_ec_delay_estimator *e, const float *rec, const float *play, unsigned n) {
+    pa_assert(e);
+
+    /* The main thread has not picked up the last window yet */
+    if (pa_atomic_load(&e->ready))
+        return;
+
+    if (e->fill == e->window)
+        e->fill = 0;
+
+    n = PA_MIN(n, e->window - e->fill);
+    memcpy(e->rec + e->fill, rec, n * sizeof(float));
+    memcpy(e->play + e->fill, play, n * sizeof(float));
+    e->fill += n;
+
+    if (e->fill == e->window)
+        pa_atomic_store(&e->ready, 1);
+}
+
+void pa_ec_delay_estimator_reset(pa_ec_delay_estimator *e) {
+    pa_assert(e);
+
+    /* A window that is waiting for the main thread can't be touched here,
+     * so it is marked to be thrown away */
+    if (pa_atomic_load(&e->ready))
+        pa_atomic_store(&e->stale, 1);
+
+    e->fill = 0;
+}
+
+/* In-place radix-2 complex FFT on re/im, without any normalization */
+static void fft(pa_ec_delay_estimator *e, float *re, float *im, bool inverse) {
+    unsigned n = e->size, size, i, j;
+
+    for (i = 0; i < n; i++) {
+        unsigned r = e->bit_reverse[i];
+
+        if (r > i) {
+            float t;
+
+            t = re[i]; re[i] = re[r]; re[r] = t;
+            t = im[i]; im[i] = im[r]; im[r] = t;
+        }
+    }
+
+    for (size = 2; size <= n; size *= 2) {
+        unsigned half = size / 2, step = n / size;
+
+        for (j = 0; j < half; j++) {
+            float wr = e->cos_table[j * step];
+            float wi = inverse ? -e->sin_table[j * step] : e->sin_table[j * step];
+
+            for (i = j; i < n; i += size) {
+                unsigned k = i + half;
+                float tr = wr * re[k] - wi * im[k];
+                float ti = wr * im[k] + wi * re[k];
+
+                re[k] = re[i] - tr;
+                im[k] = im[i] - ti;
+                re[i] += tr;
+                im[i] += ti;
+            }
+        }
+    }
+}
+
+/* Returns the lag of the GCC-PHAT peak, or INT32_MIN if there is no clear
+ * one */
+static int correlate(pa_ec_delay_estimator *e) {
+    unsigned n = e->size, k;
+    float peak = 0, sum = 0;
+    int lag, best = 0;
+
+    /* Both real signals go into one complex transform, playback as the real
+     * part and capture as the imaginary part */
+    memcpy(e->re, e->play, e->window * sizeof(float));
+    memcpy(e->im, e->rec, e->window * sizeof(float));
+    memset(e->re + e->window, 0, (n - e->window) * sizeof(float));
+    memset(e->im + e->window, 0, (n - e->window) * sizeof(float));
+
+    fft(e, e->re, e->im, false);
+
+    for (k = 0; k < n; k++) {
+        unsigned m = (n - k) & (n - 1);
+        /* Split the spectra with the symmetry of real signals */
+        float p_re = (e->re[k] + e->re[m]) / 2, p_im = (e->im[k] - e->im[m]) / 2;
+        float r_re = (e->im[k] + e->im[m]) / 2, r_im = (e->re[m] - e->re[k]) / 2;
+        /* Cross spectrum, whitened so that only the phase is left */
+        float c_re = r_re * p_re + r_im * p_im;
+        float c_im = r_im * p_re - r_re * p_im;
+        float mag = sqrtf(c_re * c_re + c_im * c_im) + 1e-20f;
+
+        e->g_re[k] = c_re / mag;
+        e->g_im[k] = c_im / mag;
+    }
+
+    fft(e, e->g_re, e->g_im, true);
+
+    for (lag = -(int) e->max_delay; lag <= (int) e->max_delay; lag++) {
+        float v = fabsf(e->g_re[lag < 0 ? n + lag : (unsigned) lag]);
+
+        sum += v;
+        if (v > peak) {
+            peak = v;
+            best = lag;
+        }
+    }
+
+    if (peak < MIN_PEAK_RATIO * sum / (2 * e->max_delay + 1))
+        return INT32_MIN;
+
+    return best;
+}
+
+bool pa_ec_delay_estimator_estimate(pa_ec_delay_estimator *e, int *delay) {
+    float rec_level = 0, play_level = 0;
+    bool ret = false;
+    unsigned i;
+    int lag;
+
+    pa_assert(e);
+    pa_assert(delay);
+
+    if (!pa_atomic_load(&e->ready))
+        return false;
+
+    if (pa_atomic_cmpxchg(&e->stale, 1, 0))
+        goto finish;
+
+    for (i = 0; i < e->window; i++) {
+        rec_level += e->rec[i] * e->rec[i];
+        play_level += e->play[i] * e->play[i];
+    }
+
+    if (rec_level < MIN_LEVEL * e->window || play_level < MIN_LEVEL * e->window)
+        goto finish;
+
+    if ((lag = correlate(e)) == INT32_MIN) {
+        pa_log_debug("No clear echo delay");
+        goto finish;
+    }
+
+    pa_log_debug("Echo delay estimate: %d samples", lag);
+
+    if (e->have_previous && (unsigned) abs(lag - e->previous) <= e->agreement) {
+        *delay = lag;
+        ret = true;
+    }
+
+    e->previous = lag;
+    e->have_previous = true;
+
+finish:
+    pa_atomic_store(&e->ready, 0);
+    return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef foodelayestimatorhfoo
+#define foodelayestimatorhfoo
+
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/* Measures the delay of the echo in the capture signal relative to the
+ * playback signal from the signals themselves, with a cross-correlation
+ * (GCC-PHAT) of windows of at least half a second. A window also has to
+ * hold twice the largest delay, and is rounded up to a power of two: with
+ * 500 ms either way at 48 kHz that is 65536 samples (1.37 s), transformed
+ * with FFTs of twice that size.
+ *
+ * The I/O thread that sees both signals feeds them in, and the main thread
+ * picks up the estimate whenever a window is complete, so the FFTs don't run
+ * in the I/O thread. */
+typedef struct pa_ec_delay_estimator pa_ec_delay_estimator;
+
+/* Delays of up to max_delay_ms in either direction are detected */
+pa_ec_delay_estimator *pa_ec_delay_estimator_new(uint32_t rate, unsigned max_delay_ms);
+void pa_ec_delay_estimator_free(pa_ec_delay_estimator *e);
+
+/* Feeds n frames of mono capture and playback samples that the canceller
+ * gets at the same time. Called from the I/O thread. */
+void pa_ec_delay_estimator_feed(pa_ec_delay_estimator *e, const float *rec, const float *play, unsigned n);
+
+/* Discards the samples fed so far, for when the alignment of the streams is
+ * changed. Called from the I/O thread. */
+void pa_ec_delay_estimator_reset(pa_ec_delay_estimator *e);
+
+/* Returns true and the delay in frames (positive if the echo comes after the
+ * playback signal) if a window is complete and its estimate is reliable,
+ * i.e. there was enough signal and it agrees with the previous window's.
+ * Called from the main thread. */
+bool pa_ec_delay_estimator_estimate(pa_ec_delay_estimator *e, int *delay);
+
+#endif
@@ -44,6 +44,11 @@ typedef struct pa_echo_canceller_msg pa_echo_canceller_msg;
 
 typedef struct pa_echo_canceller_params pa_echo_canceller_params;
 
+/* Delay-and-sum beamformer that turns the S16NE capture of a microphone array
+ * into one channel steered at the talker. Cancellers can use it to offer a
+ * single clean channel for a mic array. */
+typedef struct pa_ec_beamformer pa_ec_beamformer;
+
 struct pa_echo_canceller_params {
     union {
         struct {
@@ -53,6 +58,8 @@ struct pa_echo_canceller_params {
         struct {
             SpeexEchoState *state;
             SpeexPreprocessState *pp_state;
+            pa_ec_beamformer *beamformer;
+            int16_t *aec_out;
         } speex;
 #endif
 #ifdef HAVE_ADRIAN_EC
@@ -69,6 +76,7 @@ struct pa_echo_canceller_params {
             uint32_t blocksize;
             pa_sample_spec sample_spec;
             bool agc;
+            pa_ec_beamformer *beamformer;
         } webrtc;
 #endif
         /* each canceller-specific structure goes here */
@@ -82,7 +90,10 @@ struct pa_echo_canceller_params {
 typedef struct pa_echo_canceller pa_echo_canceller;
 
 struct pa_echo_canceller {
-    /* Initialise canceller engine. */
+    /* Initialise canceller engine. The canceller adjusts the sample specs
+     * and channel maps to what it can handle. The record stream may have
+     * more channels than the output, e.g. when a microphone array is
+     * cancelled and beamformed into a single channel. */
     bool   (*init)                      (pa_core *c,
                                          pa_echo_canceller *ec,
                                          pa_sample_spec *rec_ss,
@@ -137,6 +148,16 @@ void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_cvolume *v);
  * on sample rate and milliseconds. */
 uint32_t pa_echo_canceller_blocksize_power2(unsigned rate, unsigned ms);
 
+/* mic_geometry lists the x,y,z position of each microphone in metres, in
+ * channel order, target_direction is "azimuth,elevation" in degrees (NULL
+ * for broadside, "90,0"). The beamformer processes nframes at a time. */
+pa_ec_beamformer *pa_ec_beamformer_new(uint32_t rate, unsigned nframes, const char *mic_geometry, const char *target_direction);
+void pa_ec_beamformer_free(pa_ec_beamformer *b);
+/* The number of microphones, i.e. input channels */
+unsigned pa_ec_beamformer_get_channels(pa_ec_beamformer *b);
+/* in has pa_ec_beamformer_get_channels() interleaved channels, out one */
+void pa_ec_beamformer_run(pa_ec_beamformer *b, const int16_t *in, int16_t *out);
+
 /* Null canceller functions */
 bool pa_null_ec_init(pa_core *c, pa_echo_canceller *ec,
                      pa_sample_spec *rec_ss, pa_channel_map *rec_map,
@@ -34,6 +34,7 @@
 #include <math.h>
 
 #include "echo-cancel.h"
+#include "delay-estimator.h"
 
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
@@ -41,6 +42,8 @@
 
 #include <pulsecore/i18n.h>
 #include <pulsecore/atomic.h>
+#include <pulsecore/asyncq.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sink.h>
@@ -51,6 +54,7 @@
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/ltdl-helper.h>
 
 #include "module-echo-cancel-symdef.h"
@@ -77,6 +81,8 @@ PA_MODULE_USAGE(
           "save_aec=<save AEC data in /tmp> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "worker_thread=<run the canceller in its own thread? yes or no> "
+          "delay_estimation=<measure the echo delay from the signals? yes or no> "
         ));
 
 /* NOTE: Make sure the enum and ec_table are maintained in the correct order */
@@ -142,6 +148,13 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_ADJUST_TOLERANCE (5*PA_USEC_PER_MSEC)
 #define DEFAULT_SAVE_AEC false
 #define DEFAULT_AUTOLOADED false
+#define DEFAULT_WORKER_THREAD false
+#define DEFAULT_DELAY_ESTIMATION false
+#define DELAY_ESTIMATION_MAX_MS 500
+#define DELAY_ESTIMATION_MARGIN (1 * PA_USEC_PER_MSEC)
+
+/* How many blocks may be queued up for the worker thread */
+#define MAX_WORKER_JOBS 32
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
@@ -176,6 +189,22 @@ static const pa_echo_canceller ec_table[] = {
  *    be before capture and the difference should not be bigger than one frame
  *    size. We would ideally like to resample the sink_input but most driver
  *    don't give enough accuracy to be able to do that right now.
+ *
+ * With worker_thread=yes, the (possibly expensive) canceller itself runs in a
+ * separate thread, so that it can't make the source I/O thread miss its
+ * deadlines. The source I/O thread still does all the alignment, and then
+ * queues the aligned blocks as jobs to the worker through a lock-free queue.
+ * The worker sends the jobs back through another one, and the canceled data is
+ * posted on the next occasion, in order. The blocks that are in flight are
+ * accounted for in the latency of the source.
+ *
+ * The difference computed in 2) only covers what the devices report, and not
+ * the latency of the converters, the acoustic path or a device that
+ * misreports. With delay_estimation=yes, the capture and playback blocks that
+ * are handed to the canceller are also cross-correlated, which measures where
+ * the echo really is. Each reliable measurement updates an offset that is
+ * added to the difference from 2), so the alignment keeps following the
+ * latency reports between measurements.
  */
 
 struct userdata;
@@ -202,6 +231,26 @@ struct snapshot {
     size_t plen;
 };
 
+enum ec_job_type {
+    JOB_RUN,
+    JOB_PLAY,
+    JOB_RECORD,
+    JOB_SET_DRIFT,
+    JOB_QUIT
+};
+
+/* One call into the canceller, to be done in the worker thread */
+struct ec_job {
+    enum ec_job_type type;
+    pa_memchunk rchunk, pchunk, cchunk;
+    float drift;
+
+    /* The capture volume when the job was queued, and the one the canceller
+     * asked for while processing it */
+    pa_cvolume volume;
+    bool set_volume;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -255,6 +304,21 @@ struct userdata {
     struct {
         pa_cvolume current_volume;
     } thread_info;
+
+    /* worker thread mode */
+    pa_thread *worker;
+    pa_asyncq *worker_inq, *worker_outq;
+    struct ec_job jobs[MAX_WORKER_JOBS];
+    struct ec_job *free_jobs[MAX_WORKER_JOBS]; /* only used in the source I/O thread */
+    unsigned n_free_jobs, n_pending_jobs;
+    size_t worker_bytes;                       /* output bytes in flight */
+    struct ec_job *worker_job;                 /* only used in the worker thread */
+
+    /* delay estimation mode */
+    pa_ec_delay_estimator *delay_estimator;
+    pa_convert_func_t rec_to_float, play_to_float;
+    float *rec_float, *play_float;             /* only used in the source I/O thread */
+    int64_t diff_offset;                       /* only used in the main thread */
 };
 
 static void source_output_snapshot_within_thread(struct userdata *u, struct snapshot *snapshot);
@@ -277,6 +341,8 @@ static const char* const valid_modargs[] = {
     "save_aec",
     "autoloaded",
     "use_volume_sharing",
+    "worker_thread",
+    "delay_estimation",
     NULL
 };
 
@@ -333,6 +399,22 @@ static int64_t calc_diff(struct userdata *u, struct snapshot *snapshot) {
     return diff_time;
 }
 
+/* Called from main context */
+static int64_t correct_diff(struct userdata *u, int64_t diff_time) {
+    int delay;
+
+    if (pa_ec_delay_estimator_estimate(u->delay_estimator, &delay)) {
+        /* Line the echo up with the playback, but keep it a bit late since
+         * the canceller can't handle an echo that comes before the signal */
+        int64_t measured = (int64_t) delay * PA_USEC_PER_SEC / u->source_output->sample_spec.rate - DELAY_ESTIMATION_MARGIN;
+
+        u->diff_offset = measured - diff_time;
+        pa_log_debug("Measured diff %lld, offset %lld", (long long) measured, (long long) u->diff_offset);
+    }
+
+    return diff_time + u->diff_offset;
+}
+
 /* Called from main context */
 static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
     struct userdata *u = userdata;
@@ -356,6 +438,9 @@ static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct tim
     /* calculate drift between capture and playback */
     diff_time = calc_diff(u, &latency_snapshot);
 
+    if (u->delay_estimator)
+        diff_time = correct_diff(u, diff_time);
+
     /*fs = pa_frame_size(&u->source_output->sample_spec);*/
     old_rate = u->sink_input->sample_spec.rate;
     base_rate = u->source_output->sample_spec.rate;
@@ -419,7 +504,9 @@ static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t
                 /* Add the latency internal to our source output on top */
                 pa_bytes_to_usec(pa_memblockq_get_length(u->source_output->thread_info.delay_memblockq), &u->source_output->source->sample_spec) +
                 /* and the buffering we do on the source */
-                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec);
+                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec) +
+                /* and the blocks the worker thread is still busy with */
+                pa_bytes_to_usec(u->worker_bytes, &u->source->sample_spec);
 
             return 0;
 
@@ -646,6 +733,200 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Called from source I/O thread context. */
+static void finish_job(struct userdata *u, struct ec_job *job, bool post) {
+    int unused PA_GCC_UNUSED;
+
+    if (job->set_volume)
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME,
+                pa_xnewdup(pa_cvolume, &job->volume, 1), 0, NULL, pa_xfree);
+
+    if (u->save_aec && post) {
+        if (u->drift_file) {
+            if (job->type == JOB_SET_DRIFT)
+                fprintf(u->drift_file, "d %a\n", job->drift);
+            else if (job->type == JOB_PLAY)
+                fprintf(u->drift_file, "p %d\n", u->sink_blocksize);
+            else if (job->type == JOB_RECORD)
+                fprintf(u->drift_file, "c %d\n", u->source_output_blocksize);
+        }
+
+        if (u->captured_file && job->rchunk.memblock) {
+            unused = fwrite((uint8_t *) pa_memblock_acquire(job->rchunk.memblock) + job->rchunk.index, 1, job->rchunk.length, u->captured_file);
+            pa_memblock_release(job->rchunk.memblock);
+        }
+        if (u->played_file && job->pchunk.memblock) {
+            unused = fwrite((uint8_t *) pa_memblock_acquire(job->pchunk.memblock) + job->pchunk.index, 1, job->pchunk.length, u->played_file);
+            pa_memblock_release(job->pchunk.memblock);
+        }
+        if (u->canceled_file && job->cchunk.memblock) {
+            unused = fwrite(pa_memblock_acquire(job->cchunk.memblock), 1, job->cchunk.length, u->canceled_file);
+            pa_memblock_release(job->cchunk.memblock);
+        }
+    }
+
+    if (job->rchunk.memblock)
+        pa_memblock_unref(job->rchunk.memblock);
+    if (job->pchunk.memblock)
+        pa_memblock_unref(job->pchunk.memblock);
+
+    if (job->cchunk.memblock) {
+        if (post)
+            pa_source_post(u->source, &job->cchunk);
+
+        u->worker_bytes -= job->cchunk.length;
+        pa_memblock_unref(job->cchunk.memblock);
+    }
+
+    u->free_jobs[u->n_free_jobs++] = job;
+    u->n_pending_jobs--;
+}
+
+/* Posts the output of the jobs the worker thread has finished, in order. If
+ * wait is true, blocks until at least one job is done.
+ *
+ * Called from source I/O thread context. */
+static void collect_jobs(struct userdata *u, bool wait) {
+    struct ec_job *job;
+
+    if (u->n_pending_jobs == 0)
+        return;
+
+    while ((job = pa_asyncq_pop(u->worker_outq, wait))) {
+        finish_job(u, job, true);
+        wait = false;
+    }
+}
+
+/* Waits for all jobs, so that data can be posted in order without going
+ * through the worker thread again. The output is dropped if post is false.
+ *
+ * Called from source I/O thread context. */
+static void flush_jobs(struct userdata *u, bool post) {
+    while (u->n_pending_jobs > 0)
+        finish_job(u, pa_asyncq_pop(u->worker_outq, true), post);
+}
+
+/* Called from source I/O thread context. */
+static struct ec_job *new_job(struct userdata *u, enum ec_job_type type) {
+    struct ec_job *job;
+
+    /* If the canceller can't keep up, wait for it rather than piling up
+     * even more latency */
+    while (u->n_free_jobs == 0)
+        collect_jobs(u, true);
+
+    job = u->free_jobs[--u->n_free_jobs];
+    pa_memzero(job, sizeof(*job));
+    job->type = type;
+    job->volume = u->thread_info.current_volume;
+
+    return job;
+}
+
+/* Hands over a job to the worker thread, together with the references to
+ * its chunks. If the job produces output, a block of length out_length is
+ * allocated for it.
+ *
+ * Called from source I/O thread context. */
+static void submit_job(struct userdata *u, struct ec_job *job, size_t out_length) {
+    if (out_length > 0) {
+        job->cchunk.index = 0;
+        job->cchunk.length = out_length;
+        job->cchunk.memblock = pa_memblock_new(u->source->core->mempool, out_length);
+        u->worker_bytes += out_length;
+    }
+
+    u->n_pending_jobs++;
+    pa_assert_se(pa_asyncq_push(u->worker_inq, job, true) == 0);
+}
+
+/* Called from the worker thread. */
+static void run_job(struct userdata *u, struct ec_job *job) {
+    uint8_t *rdata = NULL, *pdata = NULL, *cdata = NULL;
+
+    if (job->rchunk.memblock)
+        rdata = (uint8_t *) pa_memblock_acquire(job->rchunk.memblock) + job->rchunk.index;
+    if (job->pchunk.memblock)
+        pdata = (uint8_t *) pa_memblock_acquire(job->pchunk.memblock) + job->pchunk.index;
+    if (job->cchunk.memblock)
+        cdata = pa_memblock_acquire(job->cchunk.memblock);
+
+    /* The canceller's volume calls go through the job while it runs */
+    u->worker_job = job;
+
+    switch (job->type) {
+        case JOB_RUN:
+            u->ec->run(u->ec, rdata, pdata, cdata);
+            break;
+
+        case JOB_PLAY:
+            u->ec->play(u->ec, pdata);
+            break;
+
+        case JOB_RECORD:
+            u->ec->record(u->ec, rdata, cdata);
+            break;
+
+        case JOB_SET_DRIFT:
+            u->ec->set_drift(u->ec, job->drift);
+            break;
+
+        case JOB_QUIT:
+            pa_assert_not_reached();
+    }
+
+    u->worker_job = NULL;
+
+    if (job->cchunk.memblock)
+        pa_memblock_release(job->cchunk.memblock);
+    if (job->pchunk.memblock)
+        pa_memblock_release(job->pchunk.memblock);
+    if (job->rchunk.memblock)
+        pa_memblock_release(job->rchunk.memblock);
+}
+
+static void worker_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+    struct ec_job *job;
+
+    pa_log_debug("Echo canceller worker thread starting up");
+
+    if (u->core->realtime_scheduling)
+        pa_make_realtime(u->core->realtime_priority);
+
+    while ((job = pa_asyncq_pop(u->worker_inq, true))->type != JOB_QUIT) {
+        run_job(u, job);
+        pa_assert_se(pa_asyncq_push(u->worker_outq, job, true) == 0);
+    }
+
+    pa_log_debug("Echo canceller worker thread shutting down");
+}
+
+/* Called from main context. */
+static void stop_worker(struct userdata *u) {
+    struct ec_job quit, *job;
+
+    if (!u->worker)
+        return;
+
+    /* All jobs are processed before the quit job, so afterwards they can
+     * only be in the outgoing queue */
+    quit.type = JOB_QUIT;
+    pa_assert_se(pa_asyncq_push(u->worker_inq, &quit, true) == 0);
+    pa_thread_free(u->worker);
+    u->worker = NULL;
+
+    while ((job = pa_asyncq_pop(u->worker_outq, false))) {
+        if (job->rchunk.memblock)
+            pa_memblock_unref(job->rchunk.memblock);
+        if (job->pchunk.memblock)
+            pa_memblock_unref(job->pchunk.memblock);
+        if (job->cchunk.memblock)
+            pa_memblock_unref(job->cchunk.memblock);
+    }
+}
+
 /* Called from source I/O thread context. */
 static void apply_diff_time(struct userdata *u, int64_t diff_time) {
     int64_t diff;
@@ -675,6 +956,39 @@ static void apply_diff_time(struct userdata *u, int64_t diff_time) {
     }
 }
 
+/* Converts a block to mono float into buf, and returns the number of frames. */
+static unsigned block_to_mono(pa_convert_func_t convert, const pa_sample_spec *ss, const pa_memchunk *chunk, float *buf) {
+    unsigned n = chunk->length / pa_frame_size(ss), c, j;
+    const uint8_t *data;
+
+    data = pa_memblock_acquire_chunk(chunk);
+    convert(n * ss->channels, data, buf);
+    pa_memblock_release(chunk->memblock);
+
+    if (ss->channels > 1) {
+        for (j = 0; j < n; j++) {
+            float sum = 0;
+
+            for (c = 0; c < ss->channels; c++)
+                sum += buf[j * ss->channels + c];
+
+            buf[j] = sum / ss->channels;
+        }
+    }
+
+    return n;
+}
+
+/* Called from source I/O thread context. */
+static void feed_delay_estimator(struct userdata *u, const pa_memchunk *rchunk, const pa_memchunk *pchunk) {
+    unsigned n;
+
+    n = block_to_mono(u->rec_to_float, &u->source_output->sample_spec, rchunk, u->rec_float);
+    pa_assert_se(block_to_mono(u->play_to_float, &u->sink_input->sample_spec, pchunk, u->play_float) == n);
+
+    pa_ec_delay_estimator_feed(u->delay_estimator, u->rec_float, u->play_float, n);
+}
+
 /* Called from source I/O thread context. */
 static void do_resync(struct userdata *u) {
     int64_t diff_time;
@@ -706,6 +1020,7 @@ static void do_push_drift_comp(struct userdata *u) {
     pa_memchunk rchunk, pchunk, cchunk;
     uint8_t *rdata, *pdata, *cdata;
     float drift;
+    struct ec_job *job;
     int unused PA_GCC_UNUSED;
 
     rlen = pa_memblockq_get_length(u->source_memblockq);
@@ -726,16 +1041,32 @@ static void do_push_drift_comp(struct userdata *u) {
     u->source_rem = rlen % u->source_output_blocksize;
 
     /* Now let the canceller work its drift compensation magic */
-    u->ec->set_drift(u->ec, drift);
+    if (u->worker) {
+        job = new_job(u, JOB_SET_DRIFT);
+        job->drift = drift;
+        submit_job(u, job, 0);
+    } else {
+        u->ec->set_drift(u->ec, drift);
 
-    if (u->save_aec) {
-        if (u->drift_file)
-            fprintf(u->drift_file, "d %a\n", drift);
+        if (u->save_aec) {
+            if (u->drift_file)
+                fprintf(u->drift_file, "d %a\n", drift);
+        }
     }
 
     /* Send in the playback samples first */
     while (plen >= u->sink_blocksize) {
         pa_memblockq_peek_fixed_size(u->sink_memblockq, u->sink_blocksize, &pchunk);
+
+        if (u->worker) {
+            job = new_job(u, JOB_PLAY);
+            job->pchunk = pchunk;
+            submit_job(u, job, 0);
+
+            pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
+            plen -= u->sink_blocksize;
+            continue;
+        }
         pdata = pa_memblock_acquire(pchunk.memblock);
         pdata += pchunk.index;
 
@@ -759,11 +1090,21 @@ static void do_push_drift_comp(struct userdata *u) {
     while (rlen >= u->source_output_blocksize) {
         pa_memblockq_peek_fixed_size(u->source_memblockq, u->source_output_blocksize, &rchunk);
 
+        if (u->worker) {
+            job = new_job(u, JOB_RECORD);
+            job->rchunk = rchunk;
+            submit_job(u, job, u->source_blocksize);
+
+            pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
+            rlen -= u->source_output_blocksize;
+            continue;
+        }
+
         rdata = pa_memblock_acquire(rchunk.memblock);
         rdata += rchunk.index;
 
         cchunk.index = 0;
-        cchunk.length = u->source_output_blocksize;
+        cchunk.length = u->source_blocksize;
         cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
         cdata = pa_memblock_acquire(cchunk.memblock);
 
@@ -775,7 +1116,7 @@ static void do_push_drift_comp(struct userdata *u) {
             if (u->captured_file)
                 unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
             if (u->canceled_file)
-                unused = fwrite(cdata, 1, u->source_output_blocksize, u->canceled_file);
+                unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
         }
 
         pa_memblock_release(cchunk.memblock);
@@ -815,6 +1156,28 @@ static void do_push(struct userdata *u) {
         if (plen < u->sink_blocksize)
             pa_memblockq_seek(u->sink_memblockq, u->sink_blocksize - plen, PA_SEEK_RELATIVE, true);
 
+        if (u->delay_estimator)
+            feed_delay_estimator(u, &rchunk, &pchunk);
+
+        if (u->worker) {
+            struct ec_job *job = new_job(u, JOB_RUN);
+
+            job->rchunk = rchunk;
+            job->pchunk = pchunk;
+            submit_job(u, job, u->source_blocksize);
+
+            pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
+            rlen -= u->source_output_blocksize;
+
+            pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
+            if (plen >= u->sink_blocksize)
+                plen -= u->sink_blocksize;
+            else
+                plen = 0;
+
+            continue;
+        }
+
         rdata = pa_memblock_acquire(rchunk.memblock);
         rdata += rchunk.index;
         pdata = pa_memblock_acquire(pchunk.memblock);
@@ -881,6 +1244,8 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
     if (PA_UNLIKELY(u->source->thread_info.state != PA_SOURCE_RUNNING ||
                     u->sink->thread_info.state != PA_SINK_RUNNING)) {
+        if (u->worker)
+            flush_jobs(u, true);
         pa_source_post(u->source, chunk);
         return;
     }
@@ -914,6 +1279,9 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         to_skip -= to_skip % u->source_output_blocksize;
 
         if (to_skip) {
+            if (u->worker)
+                flush_jobs(u, true);
+
             pa_memblockq_peek_fixed_size(u->source_memblockq, to_skip, &rchunk);
             pa_source_post(u->source, &rchunk);
 
@@ -922,6 +1290,9 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
             rlen -= to_skip;
             u->source_skip -= to_skip;
+
+            if (u->delay_estimator)
+                pa_ec_delay_estimator_reset(u->delay_estimator);
         }
 
         if (rlen && u->source_skip % u->source_output_blocksize) {
@@ -939,6 +1310,9 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
         plen -= to_skip;
         u->sink_skip -= to_skip;
+
+        if (u->delay_estimator)
+            pa_ec_delay_estimator_reset(u->delay_estimator);
     }
 
     /* process and push out samples */
@@ -946,6 +1320,10 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         do_push_drift_comp(u);
     else
         do_push(u);
+
+    /* and whatever the worker thread has done by now */
+    if (u->worker)
+        collect_jobs(u, false);
 }
 
 /* Called from sink I/O thread context. */
@@ -1063,6 +1441,9 @@ static int source_output_process_msg_cb(pa_msgobject *obj, int code, void *data,
 
             u->recv_counter -= offset;
 
+            if (u->delay_estimator)
+                pa_ec_delay_estimator_reset(u->delay_estimator);
+
             return 0;
 
         case SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT: {
@@ -1294,6 +1675,10 @@ static void source_output_detach_cb(pa_source_output *o) {
     pa_source_output_assert_io_context(o);
     pa_assert_se(u = o->userdata);
 
+    /* The jobs would end up on the wrong source */
+    if (u->worker)
+        flush_jobs(u, false);
+
     pa_source_detach_within_thread(u->source);
     pa_source_set_rtpoll(u->source, NULL);
 
@@ -1540,13 +1925,32 @@ static int canceller_process_msg_cb(pa_msgobject *o, int code, void *userdata, i
     return 0;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread or worker thread context. */
 void pa_echo_canceller_get_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
+    struct ec_job *job = ec->msg->userdata->worker_job;
+
+    if (job) {
+        *v = job->volume;
+        return;
+    }
+
     *v = ec->msg->userdata->thread_info.current_volume;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread or worker thread context. In
+ * the latter case, the source I/O thread sends the message when it collects
+ * the job. */
 void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
+    struct ec_job *job = ec->msg->userdata->worker_job;
+
+    if (job) {
+        if (!pa_cvolume_equal(&job->volume, v)) {
+            job->volume = *v;
+            job->set_volume = true;
+        }
+        return;
+    }
+
     if (!pa_cvolume_equal(&ec->msg->userdata->thread_info.current_volume, v)) {
         pa_cvolume *vol = pa_xnewdup(pa_cvolume, v, 1);
 
@@ -1643,6 +2047,8 @@ int pa__init(pa_module*m) {
     pa_memchunk silence;
     uint32_t temp;
     uint32_t nframes = 0;
+    bool worker_thread = DEFAULT_WORKER_THREAD;
+    bool delay_estimation = DEFAULT_DELAY_ESTIMATION;
 
     pa_assert(m);
 
@@ -1726,6 +2132,16 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "worker_thread", &worker_thread) < 0) {
+        pa_log("worker_thread= expects a boolean argument");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "delay_estimation", &delay_estimation) < 0) {
+        pa_log("delay_estimation= expects a boolean argument");
+        goto fail;
+    }
+
     if (init_common(ma, u, &source_ss, &source_map) < 0)
         goto fail;
 
@@ -1868,6 +2284,11 @@ int pa__init(pa_module*m) {
     pa_source_output_new_data_set_sample_spec(&source_output_data, &source_output_ss);
     pa_source_output_new_data_set_channel_map(&source_output_data, &source_output_map);
 
+    /* When the canceller takes more channels than it puts out, it processes
+     * a mic array, whose channels are taken from the master in order */
+    if (source_output_ss.channels != source_ss.channels)
+        source_output_data.flags |= PA_SOURCE_OUTPUT_NO_REMIX;
+
     pa_source_output_new(&u->source_output, m->core, &source_output_data);
     pa_source_output_new_data_done(&source_output_data);
 
@@ -1953,6 +2374,18 @@ int pa__init(pa_module*m) {
         pa_atomic_store(&u->request_resync, 1);
     }
 
+    if (delay_estimation) {
+        if (!u->time_event)
+            pa_log_warn("Delay estimation needs the built-in alignment (adjust_time > 0, no drift compensation), disabling it");
+        else {
+            u->delay_estimator = pa_ec_delay_estimator_new(source_output_ss.rate, DELAY_ESTIMATION_MAX_MS);
+            u->rec_to_float = pa_get_convert_to_float32ne_function(source_output_ss.format);
+            u->play_to_float = pa_get_convert_to_float32ne_function(sink_ss.format);
+            u->rec_float = pa_xnew(float, nframes * source_output_ss.channels);
+            u->play_float = pa_xnew(float, nframes * sink_ss.channels);
+        }
+    }
+
     if (u->save_aec) {
         pa_log("Creating AEC files in /tmp");
         u->captured_file = fopen("/tmp/aec_rec.sw", "wb");
@@ -1977,6 +2410,22 @@ int pa__init(pa_module*m) {
 
     u->thread_info.current_volume = u->source->reference_volume;
 
+    if (worker_thread) {
+        unsigned i;
+
+        for (i = 0; i < MAX_WORKER_JOBS; i++)
+            u->free_jobs[i] = &u->jobs[i];
+        u->n_free_jobs = MAX_WORKER_JOBS;
+
+        u->worker_inq = pa_asyncq_new(0);
+        u->worker_outq = pa_asyncq_new(0);
+
+        if (!(u->worker = pa_thread_new("echo-cancel", worker_thread_func, u))) {
+            pa_log("Failed to create worker thread.");
+            goto fail;
+        }
+    }
+
     pa_sink_put(u->sink);
     pa_source_put(u->source);
 
@@ -2020,7 +2469,7 @@ void pa__done(pa_module*m) {
      * destruction order! */
 
     if (u->time_event)
-        u->core->mainloop->time_free(u->time_event);
+        pa_core_rttime_free(u->core, u->time_event);
 
     if (u->source_output)
         pa_source_output_unlink(u->source_output);
@@ -2047,6 +2496,12 @@ void pa__done(pa_module*m) {
     if (u->sink_memblockq)
         pa_memblockq_free(u->sink_memblockq);
 
+    stop_worker(u);
+    if (u->worker_inq)
+        pa_asyncq_free(u->worker_inq, NULL);
+    if (u->worker_outq)
+        pa_asyncq_free(u->worker_outq, NULL);
+
     if (u->ec) {
         if (u->ec->done)
             u->ec->done(u->ec);
@@ -2054,6 +2509,11 @@ void pa__done(pa_module*m) {
         pa_xfree(u->ec);
     }
 
+    if (u->delay_estimator)
+        pa_ec_delay_estimator_free(u->delay_estimator);
+    pa_xfree(u->rec_float);
+    pa_xfree(u->play_float);
+
     if (u->asyncmsgq)
         pa_asyncmsgq_unref(u->asyncmsgq);
 
@@ -25,6 +25,8 @@
 #include <config.h>
 #endif
 
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
 #include "echo-cancel.h"
@@ -37,6 +39,7 @@
 #define DEFAULT_DENOISE_ENABLED true
 #define DEFAULT_ECHO_SUPPRESS_ENABLED true
 #define DEFAULT_ECHO_SUPPRESS_ATTENUATION 0
+#define DEFAULT_BEAMFORMING false
 
 static const char* const valid_modargs[] = {
     "frame_size_ms",
@@ -46,18 +49,33 @@ static const char* const valid_modargs[] = {
     "echo_suppress",
     "echo_suppress_attenuation",
     "echo_suppress_attenuation_active",
+    "beamforming",
+    "mic_geometry",
+    "target_direction",
     NULL
 };
 
 static void pa_speex_ec_fixate_spec(pa_sample_spec *rec_ss, pa_channel_map *rec_map,
                                     pa_sample_spec *play_ss, pa_channel_map *play_map,
-                                    pa_sample_spec *out_ss, pa_channel_map *out_map) {
+                                    pa_sample_spec *out_ss, pa_channel_map *out_map,
+                                    unsigned mics) {
     out_ss->format = PA_SAMPLE_S16NE;
 
+    /* The beamformer turns the mic array into one channel */
+    if (mics > 0) {
+        out_ss->channels = 1;
+        pa_channel_map_init_mono(out_map);
+    }
+
     *play_ss = *out_ss;
     *play_map = *out_map;
     *rec_ss = *out_ss;
     *rec_map = *out_map;
+
+    if (mics > 0) {
+        rec_ss->channels = mics;
+        pa_channel_map_init_auto(rec_map, mics, PA_CHANNEL_MAP_AUX);
+    }
 }
 
 static bool pa_speex_ec_preprocessor_init(pa_echo_canceller *ec, pa_sample_spec *out_ss, uint32_t nframes, pa_modargs *ma) {
@@ -153,6 +171,8 @@ bool pa_speex_ec_init(pa_core *c, pa_echo_canceller *ec,
                       uint32_t *nframes, const char *args) {
     int rate;
     uint32_t frame_size_ms, filter_size_ms;
+    bool beamforming;
+    const char *mic_geometry, *target_direction;
     pa_modargs *ma;
 
     if (!(ma = pa_modargs_new(args, valid_modargs))) {
@@ -172,13 +192,45 @@ bool pa_speex_ec_init(pa_core *c, pa_echo_canceller *ec,
         goto fail;
     }
 
-    pa_speex_ec_fixate_spec(rec_ss, rec_map, play_ss, play_map, out_ss, out_map);
+    beamforming = DEFAULT_BEAMFORMING;
+    if (pa_modargs_get_value_boolean(ma, "beamforming", &beamforming) < 0) {
+        pa_log("Failed to parse beamforming value");
+        goto fail;
+    }
+
+    mic_geometry = pa_modargs_get_value(ma, "mic_geometry", NULL);
+    target_direction = pa_modargs_get_value(ma, "target_direction", NULL);
+
+    if (beamforming && !mic_geometry) {
+        pa_log("beamforming needs the mic_geometry of the array");
+        goto fail;
+    }
+
+    if (!beamforming && (mic_geometry || target_direction)) {
+        pa_log("The mic_geometry and target_direction options are only valid with beamforming=true");
+        goto fail;
+    }
 
     rate = out_ss->rate;
     *nframes = pa_echo_canceller_blocksize_power2(rate, frame_size_ms);
 
-    pa_log_debug ("Using nframes %d, channels %d, rate %d", *nframes, out_ss->channels, out_ss->rate);
-    ec->params.priv.speex.state = speex_echo_state_init_mc(*nframes, (rate * filter_size_ms) / 1000, out_ss->channels, out_ss->channels);
+    if (beamforming) {
+        if (!(ec->params.priv.speex.beamformer = pa_ec_beamformer_new(rate, *nframes, mic_geometry, target_direction)))
+            goto fail;
+    }
+
+    pa_speex_ec_fixate_spec(rec_ss, rec_map, play_ss, play_map, out_ss, out_map,
+                            beamforming ? pa_ec_beamformer_get_channels(ec->params.priv.speex.beamformer) : 0);
+
+    /* With a mic array, every microphone gets its own adaptive filter, but
+     * they all share the transformed playback signal. The filtered
+     * channels are then beamformed. */
+    if (beamforming)
+        ec->params.priv.speex.aec_out = pa_xnew(int16_t, *nframes * rec_ss->channels);
+
+    pa_log_debug ("Using nframes %d, channels %d, capture channels %d, rate %d", *nframes, out_ss->channels,
+                  rec_ss->channels, out_ss->rate);
+    ec->params.priv.speex.state = speex_echo_state_init_mc(*nframes, (rate * filter_size_ms) / 1000, rec_ss->channels, play_ss->channels);
 
     if (!ec->params.priv.speex.state)
         goto fail;
@@ -194,6 +246,12 @@ bool pa_speex_ec_init(pa_core *c, pa_echo_canceller *ec,
 fail:
     if (ma)
         pa_modargs_free(ma);
+    if (ec->params.priv.speex.beamformer) {
+        pa_ec_beamformer_free(ec->params.priv.speex.beamformer);
+        ec->params.priv.speex.beamformer = NULL;
+    }
+    pa_xfree(ec->params.priv.speex.aec_out);
+    ec->params.priv.speex.aec_out = NULL;
     if (ec->params.priv.speex.pp_state) {
         speex_preprocess_state_destroy(ec->params.priv.speex.pp_state);
         ec->params.priv.speex.pp_state = NULL;
@@ -206,8 +264,13 @@ fail:
 }
 
 void pa_speex_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
-    speex_echo_cancellation(ec->params.priv.speex.state, (const spx_int16_t *) rec, (const spx_int16_t *) play,
-                            (spx_int16_t *) out);
+    if (ec->params.priv.speex.beamformer) {
+        speex_echo_cancellation(ec->params.priv.speex.state, (const spx_int16_t *) rec, (const spx_int16_t *) play,
+                                ec->params.priv.speex.aec_out);
+        pa_ec_beamformer_run(ec->params.priv.speex.beamformer, ec->params.priv.speex.aec_out, (int16_t *) out);
+    } else
+        speex_echo_cancellation(ec->params.priv.speex.state, (const spx_int16_t *) rec, (const spx_int16_t *) play,
+                                (spx_int16_t *) out);
 
     /* preprecessor is run after AEC. This is not a mistake! */
     if (ec->params.priv.speex.pp_state)
@@ -215,6 +278,14 @@ void pa_speex_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *p
 }
 
 void pa_speex_ec_done(pa_echo_canceller *ec) {
+    if (ec->params.priv.speex.beamformer) {
+        pa_ec_beamformer_free(ec->params.priv.speex.beamformer);
+        ec->params.priv.speex.beamformer = NULL;
+    }
+
+    pa_xfree(ec->params.priv.speex.aec_out);
+    ec->params.priv.speex.aec_out = NULL;
+
     if (ec->params.priv.speex.pp_state) {
         speex_preprocess_state_destroy(ec->params.priv.speex.pp_state);
         ec->params.priv.speex.pp_state = NULL;
@@ -48,6 +48,7 @@ PA_C_DECL_END
 #define DEFAULT_ROUTING_MODE "speakerphone"
 #define DEFAULT_COMFORT_NOISE true
 #define DEFAULT_DRIFT_COMPENSATION false
+#define DEFAULT_BEAMFORMING false
 
 static const char* const valid_modargs[] = {
     "high_pass_filter",
@@ -58,6 +59,9 @@ static const char* const valid_modargs[] = {
     "routing_mode",
     "comfort_noise",
     "drift_compensation",
+    "beamforming",
+    "mic_geometry",
+    "target_direction",
     NULL
 };
 
@@ -82,7 +86,8 @@ bool pa_webrtc_ec_init(pa_core *c, pa_echo_canceller *ec,
                        pa_sample_spec *out_ss, pa_channel_map *out_map,
                        uint32_t *nframes, const char *args) {
     webrtc::AudioProcessing *apm = NULL;
-    bool hpf, ns, agc, dgc, mobile, cn;
+    bool hpf, ns, agc, dgc, mobile, cn, beamforming;
+    const char *mic_geometry, *target_direction;
     int rm = -1;
     pa_modargs *ma;
 
@@ -155,6 +160,25 @@ bool pa_webrtc_ec_init(pa_core *c, pa_echo_canceller *ec,
         }
     }
 
+    beamforming = DEFAULT_BEAMFORMING;
+    if (pa_modargs_get_value_boolean(ma, "beamforming", &beamforming) < 0) {
+        pa_log("Failed to parse beamforming value");
+        goto fail;
+    }
+
+    mic_geometry = pa_modargs_get_value(ma, "mic_geometry", NULL);
+    target_direction = pa_modargs_get_value(ma, "target_direction", NULL);
+
+    if (beamforming && !mic_geometry) {
+        pa_log("beamforming needs the mic_geometry of the array");
+        goto fail;
+    }
+
+    if (!beamforming && (mic_geometry || target_direction)) {
+        pa_log("The mic_geometry and target_direction options are only valid with beamforming=true");
+        goto fail;
+    }
+
     apm = webrtc::AudioProcessing::Create(0);
 
     out_ss->format = PA_SAMPLE_S16NE;
@@ -165,6 +189,24 @@ bool pa_webrtc_ec_init(pa_core *c, pa_echo_canceller *ec,
     *rec_ss = *out_ss;
     *rec_map = *out_map;
 
+    /* The audio processing only handles up to two capture channels, so the
+     * mic array is beamformed into one channel first, and the echo of the
+     * steered signal is cancelled. */
+    if (beamforming) {
+        ec->params.priv.webrtc.beamformer = pa_ec_beamformer_new(out_ss->rate, out_ss->rate * BLOCK_SIZE_US / PA_USEC_PER_SEC,
+                                                                 mic_geometry, target_direction);
+        if (!ec->params.priv.webrtc.beamformer)
+            goto fail;
+
+        out_ss->channels = 1;
+        pa_channel_map_init_mono(out_map);
+        *play_ss = *out_ss;
+        *play_map = *out_map;
+
+        rec_ss->channels = pa_ec_beamformer_get_channels(ec->params.priv.webrtc.beamformer);
+        pa_channel_map_init_auto(rec_map, rec_ss->channels, PA_CHANNEL_MAP_AUX);
+    }
+
     apm->set_sample_rate_hz(out_ss->rate);
 
     apm->set_num_channels(out_ss->channels, out_ss->channels);
@@ -228,6 +270,10 @@ fail:
         pa_modargs_free(ma);
     if (apm)
         webrtc::AudioProcessing::Destroy(apm);
+    if (ec->params.priv.webrtc.beamformer) {
+        pa_ec_beamformer_free(ec->params.priv.webrtc.beamformer);
+        ec->params.priv.webrtc.beamformer = NULL;
+    }
 
     return false;
 }
@@ -254,7 +300,11 @@ void pa_webrtc_ec_record(pa_echo_canceller *ec, const uint8_t *rec, uint8_t *out
     out_frame._audioChannel = ss->channels;
     out_frame._frequencyInHz = ss->rate;
     out_frame._payloadDataLengthInSamples = ec->params.priv.webrtc.blocksize / pa_frame_size(ss);
-    memcpy(out_frame._payloadData, rec, ec->params.priv.webrtc.blocksize);
+
+    if (ec->params.priv.webrtc.beamformer)
+        pa_ec_beamformer_run(ec->params.priv.webrtc.beamformer, (const int16_t *) rec, out_frame._payloadData);
+    else
+        memcpy(out_frame._payloadData, rec, ec->params.priv.webrtc.blocksize);
 
     if (ec->params.priv.webrtc.agc) {
         pa_cvolume_init(&v);
@@ -286,6 +336,11 @@ void pa_webrtc_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *
 }
 
 void pa_webrtc_ec_done(pa_echo_canceller *ec) {
+    if (ec->params.priv.webrtc.beamformer) {
+        pa_ec_beamformer_free(ec->params.priv.webrtc.beamformer);
+        ec->params.priv.webrtc.beamformer = NULL;
+    }
+
     if (ec->params.priv.webrtc.apm) {
         webrtc::AudioProcessing::Destroy((webrtc::AudioProcessing*)ec->params.priv.webrtc.apm);
         ec->params.priv.webrtc.apm = NULL;
@@ -0,0 +1,883 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <lilv/lilv.h>
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/atom/atom.h>
+#include <lv2/lv2plug.in/ns/ext/buf-size/buf-size.h>
+#include <lv2/lv2plug.in/ns/ext/options/options.h>
+#include <lv2/lv2plug.in/ns/ext/resize-port/resize-port.h>
+#include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+#include <lv2/lv2plug.in/ns/ext/worker/worker.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/dynarray.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/strbuf.h>
+#include <pulsecore/thread.h>
+
+#include "lv2-host.h"
+
+/* Used for atom ports that don't tell how much space they need */
+#define DEFAULT_ATOM_BUFFER_SIZE 8192
+
+/* The worker queues. They must be a power of two in size. */
+#define WORKER_RING_SIZE 8192
+
+/* A single reader, single writer ring buffer carrying the worker requests
+ * from the IO thread to the worker thread, and the responses back */
+struct ring {
+    uint8_t *data;
+    pa_atomic_t read_index, write_index;
+};
+
+struct worker_message {
+    struct instance *instance;
+    uint32_t size;
+};
+
+struct atom_port {
+    uint32_t index;
+    bool output;
+    size_t size;
+};
+
+struct instance {
+    pa_lv2_chain *chain;
+    struct plugin *plugin;
+
+    LilvInstance *instance;
+    const LV2_Worker_Interface *worker;
+
+    LV2_Worker_Schedule schedule;
+    LV2_Feature schedule_feature;
+    const LV2_Feature *features[7];
+
+    LV2_Atom_Sequence **atom_buffers;
+
+    /* Only used for plugins that can't run in place */
+    float **inputs;
+};
+
+struct plugin {
+    const LilvPlugin *plugin;
+    char *name;
+
+    /* Audio ports per instance, inputs and outputs alike */
+    unsigned n_audio;
+    uint32_t *audio_inputs, *audio_outputs;
+
+    unsigned n_atom_ports;
+    struct atom_port *atom_ports;
+
+    /* Storage for all control ports, indexed by port */
+    float *port_values;
+    int latency_port;
+
+    bool in_place_broken;
+
+    unsigned n_instances;
+    struct instance *instances;
+};
+
+struct pa_lv2_chain {
+    LilvWorld *world;
+
+    unsigned channels, max_frames;
+    float **buffers;
+
+    struct plugin *plugins;
+    unsigned n_plugins;
+    char *name;
+    bool active;
+
+    /* The nodes we look up ports and features by */
+    LilvNode *audio_port_class, *control_port_class, *atom_port_class;
+    LilvNode *input_port_class, *output_port_class;
+    LilvNode *connection_optional, *reports_latency, *minimum_size;
+    LilvNode *in_place_broken, *worker_interface;
+
+    pa_mutex *urid_mutex;
+    pa_hashmap *urids;
+    pa_dynarray *uris;
+    LV2_URID_Map urid_map;
+    LV2_URID_Unmap urid_unmap;
+
+    LV2_URID atom_sequence, atom_chunk;
+
+    int32_t min_block_length, max_block_length;
+    LV2_Options_Option options[3];
+
+    LV2_Feature map_feature, unmap_feature, options_feature, bounded_block_length_feature;
+
+    struct ring requests, responses;
+    uint8_t *request_data, *response_data;
+    pa_semaphore *worker_semaphore;
+    pa_thread *worker_thread;
+    pa_atomic_t worker_quit;
+};
+
+static const char * const supported_features[] = {
+    LV2_URID__map,
+    LV2_URID__unmap,
+    LV2_WORKER__schedule,
+    LV2_OPTIONS__options,
+    LV2_BUF_SIZE__boundedBlockLength,
+    LV2_CORE__inPlaceBroken,
+    LV2_CORE__hardRTCapable,
+    LV2_CORE__isLive,
+    NULL
+};
+
+static void ring_init(struct ring *r) {
+    r->data = pa_xnew(uint8_t, WORKER_RING_SIZE);
+    pa_atomic_store(&r->read_index, 0);
+    pa_atomic_store(&r->write_index, 0);
+}
+
+static void ring_copy_in(struct ring *r, unsigned index, const void *data, size_t n) {
+    unsigned offset = index & (WORKER_RING_SIZE - 1);
+    size_t first = PA_MIN(n, WORKER_RING_SIZE - offset);
+
+    memcpy(r->data + offset, data, first);
+    memcpy(r->data, (const uint8_t *) data + first, n - first);
+}
+
+static void ring_copy_out(struct ring *r, unsigned index, void *data, size_t n) {
+    unsigned offset = index & (WORKER_RING_SIZE - 1);
+    size_t first = PA_MIN(n, WORKER_RING_SIZE - offset);
+
+    memcpy(data, r->data + offset, first);
+    memcpy((uint8_t *) data + first, r->data, n - first);
+}
+
+static bool ring_write(struct ring *r, struct instance *i, const void *data, uint32_t size) {
+    struct worker_message m;
+    unsigned w, used;
+
+    w = (unsigned) pa_atomic_load(&r->write_index);
+    used = w - (unsigned) pa_atomic_load(&r->read_index);
+
+    if (sizeof(m) + size > WORKER_RING_SIZE - used)
+        return false;
+
+    m.instance = i;
+    m.size = size;
+
+    ring_copy_in(r, w, &m, sizeof(m));
+    ring_copy_in(r, w + sizeof(m), data, size);
+
+    pa_atomic_store(&r->write_index, (int) (w + sizeof(m) + size));
+
+    return true;
+}
+
+/* data must have room for WORKER_RING_SIZE bytes */
+static bool ring_read(struct ring *r, struct worker_message *m, void *data) {
+    unsigned rd;
+
+    rd = (unsigned) pa_atomic_load(&r->read_index);
+
+    if (rd == (unsigned) pa_atomic_load(&r->write_index))
+        return false;
+
+    ring_copy_out(r, rd, m, sizeof(*m));
+    ring_copy_out(r, rd + sizeof(*m), data, m->size);
+
+    pa_atomic_store(&r->read_index, (int) (rd + sizeof(*m) + m->size));
+
+    return true;
+}
+
+/* May be called from any thread */
+static LV2_URID urid_map(LV2_URID_Map_Handle handle, const char *uri) {
+    pa_lv2_chain *c = handle;
+    void *id;
+
+    pa_mutex_lock(c->urid_mutex);
+
+    if (!(id = pa_hashmap_get(c->urids, uri))) {
+        char *u = pa_xstrdup(uri);
+
+        pa_dynarray_append(c->uris, u);
+        id = PA_UINT32_TO_PTR(pa_dynarray_size(c->uris));
+        pa_hashmap_put(c->urids, u, id);
+    }
+
+    pa_mutex_unlock(c->urid_mutex);
+
+    return PA_PTR_TO_UINT32(id);
+}
+
+/* May be called from any thread */
+static const char *urid_unmap(LV2_URID_Unmap_Handle handle, LV2_URID urid) {
+    pa_lv2_chain *c = handle;
+    const char *uri = NULL;
+
+    pa_mutex_lock(c->urid_mutex);
+
+    if (urid > 0 && urid <= pa_dynarray_size(c->uris))
+        uri = pa_dynarray_get(c->uris, urid - 1);
+
+    pa_mutex_unlock(c->urid_mutex);
+
+    return uri;
+}
+
+/* Called from the IO thread, from within run() */
+static LV2_Worker_Status worker_schedule(LV2_Worker_Schedule_Handle handle, uint32_t size, const void *data) {
+    struct instance *i = handle;
+
+    if (!i->worker)
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    if (!ring_write(&i->chain->requests, i, data, size))
+        return LV2_WORKER_ERR_NO_SPACE;
+
+    pa_semaphore_post(i->chain->worker_semaphore);
+
+    return LV2_WORKER_SUCCESS;
+}
+
+/* Called from the worker thread, from within work() */
+static LV2_Worker_Status worker_respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void *data) {
+    struct instance *i = handle;
+
+    if (!ring_write(&i->chain->responses, i, data, size))
+        return LV2_WORKER_ERR_NO_SPACE;
+
+    return LV2_WORKER_SUCCESS;
+}
+
+static void worker_thread_func(void *userdata) {
+    pa_lv2_chain *c = userdata;
+    struct worker_message m;
+
+    pa_log_debug("LV2 worker thread starting up");
+
+    for (;;) {
+        pa_semaphore_wait(c->worker_semaphore);
+
+        if (pa_atomic_load(&c->worker_quit))
+            break;
+
+        while (ring_read(&c->requests, &m, c->request_data))
+            m.instance->worker->work(lilv_instance_get_handle(m.instance->instance),
+                                     worker_respond, m.instance, m.size, c->request_data);
+    }
+
+    pa_log_debug("LV2 worker thread shutting down");
+}
+
+static bool feature_is_supported(const char *uri) {
+    unsigned i;
+
+    for (i = 0; supported_features[i]; i++)
+        if (pa_streq(supported_features[i], uri))
+            return true;
+
+    return false;
+}
+
+static int parse_controls(pa_lv2_chain *c, struct plugin *p, const char *controls) {
+    const LilvPlugin *lp = p->plugin;
+    const char *state = NULL;
+    uint32_t i, n_ports;
+    char *k;
+
+    if (!controls)
+        return 0;
+
+    n_ports = lilv_plugin_get_num_ports(lp);
+    i = 0;
+
+    while ((k = pa_split(controls, ",", &state))) {
+        const LilvPort *port;
+        double d;
+
+        /* Skip to the next control input */
+        for (; i < n_ports; i++) {
+            port = lilv_plugin_get_port_by_index(lp, i);
+
+            if (lilv_port_is_a(lp, port, c->control_port_class) &&
+                lilv_port_is_a(lp, port, c->input_port_class))
+                break;
+        }
+
+        if (i >= n_ports) {
+            pa_log("Too many control values for %s", p->name);
+            pa_xfree(k);
+            return -1;
+        }
+
+        if (*k) {
+            if (pa_atod(k, &d) < 0) {
+                pa_log("Failed to parse control value '%s' for %s", k, p->name);
+                pa_xfree(k);
+                return -1;
+            }
+
+            p->port_values[i] = (float) d;
+        }
+
+        pa_xfree(k);
+        i++;
+    }
+
+    return 0;
+}
+
+static int instance_init(pa_lv2_chain *c, struct plugin *p, struct instance *i, unsigned first_channel, uint32_t rate) {
+    const LilvPlugin *lp = p->plugin;
+    uint32_t j, n_ports;
+    unsigned f = 0;
+
+    i->chain = c;
+    i->plugin = p;
+
+    i->schedule.handle = i;
+    i->schedule.schedule_work = worker_schedule;
+    i->schedule_feature.URI = LV2_WORKER__schedule;
+    i->schedule_feature.data = &i->schedule;
+
+    i->features[f++] = &c->map_feature;
+    i->features[f++] = &c->unmap_feature;
+    i->features[f++] = &c->options_feature;
+    i->features[f++] = &c->bounded_block_length_feature;
+    i->features[f++] = &i->schedule_feature;
+    i->features[f] = NULL;
+
+    if (!(i->instance = lilv_plugin_instantiate(lp, rate, i->features))) {
+        pa_log("Failed to instantiate %s", p->name);
+        return -1;
+    }
+
+    if (lilv_plugin_has_extension_data(lp, c->worker_interface))
+        i->worker = lilv_instance_get_extension_data(i->instance, LV2_WORKER__interface);
+
+    /* Unknown optional ports stay unconnected */
+    n_ports = lilv_plugin_get_num_ports(lp);
+    for (j = 0; j < n_ports; j++)
+        lilv_instance_connect_port(i->instance, j, NULL);
+
+    for (j = 0; j < n_ports; j++) {
+        const LilvPort *port = lilv_plugin_get_port_by_index(lp, j);
+
+        if (lilv_port_is_a(lp, port, c->control_port_class))
+            lilv_instance_connect_port(i->instance, j, &p->port_values[j]);
+    }
+
+    /* The outputs write right back into the channel buffers, which the next
+     * plugin reads from */
+    if (p->in_place_broken)
+        i->inputs = pa_xnew0(float *, p->n_audio);
+
+    for (j = 0; j < p->n_audio; j++) {
+        float *buffer = c->buffers[first_channel + j];
+
+        if (p->in_place_broken) {
+            i->inputs[j] = pa_xnew0(float, c->max_frames);
+            lilv_instance_connect_port(i->instance, p->audio_inputs[j], i->inputs[j]);
+        } else
+            lilv_instance_connect_port(i->instance, p->audio_inputs[j], buffer);
+
+        lilv_instance_connect_port(i->instance, p->audio_outputs[j], buffer);
+    }
+
+    i->atom_buffers = pa_xnew0(LV2_Atom_Sequence *, p->n_atom_ports);
+
+    for (j = 0; j < p->n_atom_ports; j++) {
+        i->atom_buffers[j] = pa_xmalloc0(p->atom_ports[j].size);
+        lilv_instance_connect_port(i->instance, p->atom_ports[j].index, i->atom_buffers[j]);
+    }
+
+    return 0;
+}
+
+static void instance_done(struct instance *i) {
+    unsigned j;
+
+    if (i->instance)
+        lilv_instance_free(i->instance);
+
+    if (i->inputs) {
+        for (j = 0; j < i->plugin->n_audio; j++)
+            pa_xfree(i->inputs[j]);
+        pa_xfree(i->inputs);
+    }
+
+    if (i->atom_buffers) {
+        for (j = 0; j < i->plugin->n_atom_ports; j++)
+            pa_xfree(i->atom_buffers[j]);
+        pa_xfree(i->atom_buffers);
+    }
+}
+
+static int plugin_init(pa_lv2_chain *c, struct plugin *p, const char *uri, const char *controls, uint32_t rate) {
+    const LilvPlugins *plugins;
+    const LilvPlugin *lp;
+    LilvNodes *features;
+    LilvNode *node;
+    float *minimum, *maximum, *defaults;
+    uint32_t j, n_ports;
+    unsigned n_inputs = 0, n_outputs = 0, h;
+    int r = -1;
+
+    plugins = lilv_world_get_all_plugins(c->world);
+
+    node = lilv_new_uri(c->world, uri);
+    lp = node ? lilv_plugins_get_by_uri(plugins, node) : NULL;
+    lilv_node_free(node);
+
+    if (!lp) {
+        pa_log("LV2 plugin %s not found", uri);
+        return -1;
+    }
+
+    p->plugin = lp;
+    p->latency_port = -1;
+
+    node = lilv_plugin_get_name(lp);
+    p->name = pa_xstrdup(node ? lilv_node_as_string(node) : uri);
+    lilv_node_free(node);
+
+    pa_log_debug("Plugin: %s (%s)", p->name, uri);
+
+    features = lilv_plugin_get_required_features(lp);
+    LILV_FOREACH(nodes, it, features) {
+        const char *f = lilv_node_as_uri(lilv_nodes_get(features, it));
+
+        if (!feature_is_supported(f)) {
+            pa_log("%s requires the unsupported feature %s", p->name, f);
+            lilv_nodes_free(features);
+            return -1;
+        }
+    }
+    lilv_nodes_free(features);
+
+    p->in_place_broken = lilv_plugin_has_feature(lp, c->in_place_broken);
+
+    n_ports = lilv_plugin_get_num_ports(lp);
+    p->port_values = pa_xnew0(float, n_ports);
+    p->audio_inputs = pa_xnew(uint32_t, n_ports);
+    p->audio_outputs = pa_xnew(uint32_t, n_ports);
+    p->atom_ports = pa_xnew0(struct atom_port, n_ports);
+
+    minimum = pa_xnew(float, n_ports);
+    maximum = pa_xnew(float, n_ports);
+    defaults = pa_xnew(float, n_ports);
+    lilv_plugin_get_port_ranges_float(lp, minimum, maximum, defaults);
+
+    for (j = 0; j < n_ports; j++) {
+        const LilvPort *port = lilv_plugin_get_port_by_index(lp, j);
+        const char *symbol = lilv_node_as_string(lilv_port_get_symbol(lp, port));
+        bool input = lilv_port_is_a(lp, port, c->input_port_class);
+
+        if (lilv_port_is_a(lp, port, c->audio_port_class)) {
+            pa_log_debug("Port %u is audio %s: %s", j, input ? "input" : "output", symbol);
+
+            if (input)
+                p->audio_inputs[n_inputs++] = j;
+            else
+                p->audio_outputs[n_outputs++] = j;
+
+        } else if (lilv_port_is_a(lp, port, c->control_port_class)) {
+
+            if (!isnan(defaults[j]))
+                p->port_values[j] = defaults[j];
+            else if (!isnan(minimum[j]))
+                p->port_values[j] = minimum[j];
+
+            if (!input && lilv_port_has_property(lp, port, c->reports_latency))
+                p->latency_port = (int) j;
+
+            pa_log_debug("Port %u is control %s: %s = %f", j, input ? "input" : "output", symbol, p->port_values[j]);
+
+        } else if (lilv_port_is_a(lp, port, c->atom_port_class)) {
+            struct atom_port *a = &p->atom_ports[p->n_atom_ports++];
+            LilvNode *size;
+
+            a->index = j;
+            a->output = !input;
+            a->size = DEFAULT_ATOM_BUFFER_SIZE;
+
+            if ((size = lilv_port_get(lp, port, c->minimum_size))) {
+                a->size = PA_MAX(a->size, (size_t) lilv_node_as_int(size));
+                lilv_node_free(size);
+            }
+
+            pa_log_debug("Port %u is atom %s: %s", j, input ? "input" : "output", symbol);
+
+        } else if (lilv_port_has_property(lp, port, c->connection_optional))
+            pa_log_debug("Ignored port %u: %s", j, symbol);
+        else {
+            pa_log("Port %s of %s has an unsupported type", symbol, p->name);
+            goto finish;
+        }
+    }
+
+    if (n_inputs == 0 || n_inputs != n_outputs) {
+        pa_log("%s has %u audio inputs and %u outputs, only plugins with as many outputs as inputs can run in place",
+               p->name, n_inputs, n_outputs);
+        goto finish;
+    }
+
+    if (c->channels % n_inputs) {
+        pa_log("Cannot handle non-integral number of %s instances required for %u channels", p->name, c->channels);
+        goto finish;
+    }
+
+    p->n_audio = n_inputs;
+    p->n_instances = c->channels / n_inputs;
+
+    if (parse_controls(c, p, controls) < 0)
+        goto finish;
+
+    pa_log_debug("Will run %u instances of %s", p->n_instances, p->name);
+
+    p->instances = pa_xnew0(struct instance, p->n_instances);
+
+    for (h = 0; h < p->n_instances; h++)
+        if (instance_init(c, p, &p->instances[h], h * p->n_audio, rate) < 0)
+            goto finish;
+
+    r = 0;
+
+finish:
+    pa_xfree(minimum);
+    pa_xfree(maximum);
+    pa_xfree(defaults);
+
+    return r;
+}
+
+static void plugin_done(struct plugin *p) {
+    unsigned h;
+
+    if (p->instances) {
+        for (h = 0; h < p->n_instances; h++)
+            instance_done(&p->instances[h]);
+        pa_xfree(p->instances);
+    }
+
+    pa_xfree(p->name);
+    pa_xfree(p->audio_inputs);
+    pa_xfree(p->audio_outputs);
+    pa_xfree(p->atom_ports);
+    pa_xfree(p->port_values);
+}
+
+pa_lv2_chain *pa_lv2_chain_new(const char *plugins, const char *controls, unsigned channels, uint32_t rate, unsigned max_frames) {
+    pa_lv2_chain *c;
+    const char *state = NULL, *control_state = NULL;
+    pa_strbuf *name;
+    bool need_worker = false;
+    char *uri;
+    unsigned i, h;
+
+    pa_assert(plugins);
+    pa_assert(channels > 0);
+    pa_assert(max_frames > 0);
+
+    c = pa_xnew0(pa_lv2_chain, 1);
+    c->channels = channels;
+    c->max_frames = max_frames;
+
+    c->buffers = pa_xnew(float *, channels);
+    for (i = 0; i < channels; i++)
+        c->buffers[i] = pa_xnew0(float, max_frames);
+
+    c->urid_mutex = pa_mutex_new(false, false);
+    c->urids = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    c->uris = pa_dynarray_new(pa_xfree);
+
+    c->urid_map.handle = c;
+    c->urid_map.map = urid_map;
+    c->urid_unmap.handle = c;
+    c->urid_unmap.unmap = urid_unmap;
+
+    c->atom_sequence = urid_map(c, LV2_ATOM__Sequence);
+    c->atom_chunk = urid_map(c, LV2_ATOM__Chunk);
+
+    /* We never run more than max_frames, but may run less */
+    c->min_block_length = 0;
+    c->max_block_length = (int32_t) max_frames;
+
+    c->options[0].context = LV2_OPTIONS_INSTANCE;
+    c->options[0].key = urid_map(c, LV2_BUF_SIZE__minBlockLength);
+    c->options[0].size = sizeof(int32_t);
+    c->options[0].type = urid_map(c, LV2_ATOM__Int);
+    c->options[0].value = &c->min_block_length;
+    c->options[1] = c->options[0];
+    c->options[1].key = urid_map(c, LV2_BUF_SIZE__maxBlockLength);
+    c->options[1].value = &c->max_block_length;
+
+    c->map_feature.URI = LV2_URID__map;
+    c->map_feature.data = &c->urid_map;
+    c->unmap_feature.URI = LV2_URID__unmap;
+    c->unmap_feature.data = &c->urid_unmap;
+    c->options_feature.URI = LV2_OPTIONS__options;
+    c->options_feature.data = c->options;
+    c->bounded_block_length_feature.URI = LV2_BUF_SIZE__boundedBlockLength;
+
+    ring_init(&c->requests);
+    ring_init(&c->responses);
+    c->request_data = pa_xnew(uint8_t, WORKER_RING_SIZE);
+    c->response_data = pa_xnew(uint8_t, WORKER_RING_SIZE);
+    c->worker_semaphore = pa_semaphore_new(0);
+
+    c->world = lilv_world_new();
+    lilv_world_load_all(c->world);
+
+    c->audio_port_class = lilv_new_uri(c->world, LV2_CORE__AudioPort);
+    c->control_port_class = lilv_new_uri(c->world, LV2_CORE__ControlPort);
+    c->atom_port_class = lilv_new_uri(c->world, LV2_ATOM__AtomPort);
+    c->input_port_class = lilv_new_uri(c->world, LV2_CORE__InputPort);
+    c->output_port_class = lilv_new_uri(c->world, LV2_CORE__OutputPort);
+    c->connection_optional = lilv_new_uri(c->world, LV2_CORE__connectionOptional);
+    c->reports_latency = lilv_new_uri(c->world, LV2_CORE__reportsLatency);
+    c->minimum_size = lilv_new_uri(c->world, LV2_RESIZE_PORT__minimumSize);
+    c->in_place_broken = lilv_new_uri(c->world, LV2_CORE__inPlaceBroken);
+    c->worker_interface = lilv_new_uri(c->world, LV2_WORKER__interface);
+
+    while ((uri = pa_split(plugins, "|", &state))) {
+        char *k;
+
+        c->plugins = pa_xrenew(struct plugin, c->plugins, c->n_plugins + 1);
+        memset(&c->plugins[c->n_plugins], 0, sizeof(struct plugin));
+        c->n_plugins++;
+
+        k = controls ? pa_split(controls, "|", &control_state) : NULL;
+
+        if (plugin_init(c, &c->plugins[c->n_plugins - 1], uri, k, rate) < 0) {
+            pa_xfree(k);
+            pa_xfree(uri);
+            goto fail;
+        }
+
+        pa_xfree(k);
+        pa_xfree(uri);
+    }
+
+    if (c->n_plugins == 0) {
+        pa_log("No LV2 plugins given");
+        goto fail;
+    }
+
+    name = pa_strbuf_new();
+
+    for (i = 0; i < c->n_plugins; i++) {
+        struct plugin *p = &c->plugins[i];
+
+        pa_strbuf_printf(name, "%s%s", i > 0 ? " + " : "", p->name);
+
+        for (h = 0; h < p->n_instances; h++) {
+            if (p->instances[h].worker)
+                need_worker = true;
+
+            lilv_instance_activate(p->instances[h].instance);
+        }
+    }
+
+    c->name = pa_strbuf_tostring_free(name);
+    c->active = true;
+
+    if (need_worker && !(c->worker_thread = pa_thread_new("lv2-worker", worker_thread_func, c))) {
+        pa_log("Failed to create LV2 worker thread");
+        goto fail;
+    }
+
+    return c;
+
+fail:
+    pa_lv2_chain_free(c);
+
+    return NULL;
+}
+
+void pa_lv2_chain_free(pa_lv2_chain *c) {
+    unsigned i, h;
+
+    pa_assert(c);
+
+    if (c->worker_thread) {
+        pa_atomic_store(&c->worker_quit, 1);
+        pa_semaphore_post(c->worker_semaphore);
+        pa_thread_free(c->worker_thread);
+    }
+
+    for (i = 0; i < c->n_plugins; i++) {
+        struct plugin *p = &c->plugins[i];
+
+        if (c->active)
+            for (h = 0; h < p->n_instances; h++)
+                lilv_instance_deactivate(p->instances[h].instance);
+
+        plugin_done(p);
+    }
+
+    pa_xfree(c->plugins);
+    pa_xfree(c->name);
+
+    lilv_node_free(c->audio_port_class);
+    lilv_node_free(c->control_port_class);
+    lilv_node_free(c->atom_port_class);
+    lilv_node_free(c->input_port_class);
+    lilv_node_free(c->output_port_class);
+    lilv_node_free(c->connection_optional);
+    lilv_node_free(c->reports_latency);
+    lilv_node_free(c->minimum_size);
+    lilv_node_free(c->in_place_broken);
+    lilv_node_free(c->worker_interface);
+    lilv_world_free(c->world);
+
+    pa_semaphore_free(c->worker_semaphore);
+    pa_xfree(c->request_data);
+    pa_xfree(c->response_data);
+    pa_xfree(c->requests.data);
+    pa_xfree(c->responses.data);
+
+    /* The dynarray owns the URI strings */
+    pa_hashmap_free(c->urids);
+    pa_dynarray_free(c->uris);
+    pa_mutex_free(c->urid_mutex);
+
+    for (i = 0; i < c->channels; i++)
+        pa_xfree(c->buffers[i]);
+    pa_xfree(c->buffers);
+
+    pa_xfree(c);
+}
+
+float * const *pa_lv2_chain_get_buffers(pa_lv2_chain *c) {
+    pa_assert(c);
+
+    return c->buffers;
+}
+
+static void prepare_atom_ports(pa_lv2_chain *c, struct plugin *p, struct instance *i) {
+    unsigned j;
+
+    for (j = 0; j < p->n_atom_ports; j++) {
+        LV2_Atom_Sequence *s = i->atom_buffers[j];
+
+        if (p->atom_ports[j].output) {
+            /* Tell the plugin how much room there is */
+            s->atom.size = (uint32_t) (p->atom_ports[j].size - sizeof(LV2_Atom));
+            s->atom.type = c->atom_chunk;
+        } else {
+            /* We have no events to send */
+            s->atom.size = sizeof(LV2_Atom_Sequence_Body);
+            s->atom.type = c->atom_sequence;
+            s->body.unit = 0;
+            s->body.pad = 0;
+        }
+    }
+}
+
+void pa_lv2_chain_run(pa_lv2_chain *c, unsigned n) {
+    struct worker_message m;
+    unsigned i, h, j;
+
+    pa_assert(c);
+    pa_assert(n <= c->max_frames);
+
+    for (i = 0; i < c->n_plugins; i++) {
+        struct plugin *p = &c->plugins[i];
+
+        for (h = 0; h < p->n_instances; h++) {
+            struct instance *in = &p->instances[h];
+
+            if (p->in_place_broken)
+                for (j = 0; j < p->n_audio; j++)
+                    memcpy(in->inputs[j], c->buffers[h * p->n_audio + j], n * sizeof(float));
+
+            prepare_atom_ports(c, p, in);
+
+            lilv_instance_run(in->instance, n);
+        }
+    }
+
+    if (!c->worker_thread)
+        return;
+
+    /* Hand the results of the worker back to the plugins */
+    while (ring_read(&c->responses, &m, c->response_data))
+        if (m.instance->worker->work_response)
+            m.instance->worker->work_response(lilv_instance_get_handle(m.instance->instance), m.size, c->response_data);
+
+    for (i = 0; i < c->n_plugins; i++)
+        for (h = 0; h < c->plugins[i].n_instances; h++) {
+            struct instance *in = &c->plugins[i].instances[h];
+
+            if (in->worker && in->worker->end_run)
+                in->worker->end_run(lilv_instance_get_handle(in->instance));
+        }
+}
+
+unsigned pa_lv2_chain_get_latency(pa_lv2_chain *c) {
+    unsigned i, latency = 0;
+
+    pa_assert(c);
+
+    for (i = 0; i < c->n_plugins; i++)
+        if (c->plugins[i].latency_port >= 0 && c->plugins[i].port_values[c->plugins[i].latency_port] > 0)
+            latency += (unsigned) c->plugins[i].port_values[c->plugins[i].latency_port];
+
+    return latency;
+}
+
+const char *pa_lv2_chain_get_name(pa_lv2_chain *c) {
+    pa_assert(c);
+
+    return c->name;
+}
+
+void pa_lv2_chain_update_proplist(pa_lv2_chain *c, pa_proplist *p) {
+    pa_strbuf *uris;
+    char *s;
+    unsigned i;
+
+    pa_assert(c);
+    pa_assert(p);
+
+    uris = pa_strbuf_new();
+
+    for (i = 0; i < c->n_plugins; i++)
+        pa_strbuf_printf(uris, "%s%s", i > 0 ? "|" : "",
+                         lilv_node_as_uri(lilv_plugin_get_uri(c->plugins[i].plugin)));
+
+    pa_proplist_sets(p, "device.lv2.name", c->name);
+    pa_proplist_sets(p, "device.lv2.uri", s = pa_strbuf_tostring_free(uris));
+    pa_xfree(s);
+}
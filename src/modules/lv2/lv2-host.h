@@ -0,0 +1,57 @@
+#ifndef foolv2hostfoo
+#define foolv2hostfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/proplist.h>
+
+/* A chain of LV2 plugins that runs in place on one planar float buffer per
+ * channel. Plugins with fewer audio ports than there are channels are
+ * instantiated once per group of channels, like module-ladspa-sink does. The
+ * buffers are connected to the plugin ports once, so running the chain does
+ * not copy any audio between the plugins. */
+typedef struct pa_lv2_chain pa_lv2_chain;
+
+/* plugins is a list of plugin URIs separated by '|', controls is an optional
+ * list of comma separated control input values for each plugin, separated by
+ * '|' as well. Empty control values select the plugin's default. At most
+ * max_frames are processed in one go. */
+pa_lv2_chain *pa_lv2_chain_new(const char *plugins, const char *controls, unsigned channels, uint32_t rate, unsigned max_frames);
+void pa_lv2_chain_free(pa_lv2_chain *c);
+
+/* The per channel buffers to fill before pa_lv2_chain_run() and to read the
+ * result from afterwards */
+float * const *pa_lv2_chain_get_buffers(pa_lv2_chain *c);
+
+/* Called from the IO thread */
+void pa_lv2_chain_run(pa_lv2_chain *c, unsigned n);
+
+/* The latency reported by the plugins, in frames */
+unsigned pa_lv2_chain_get_latency(pa_lv2_chain *c);
+
+/* Human readable plugin names, e.g. "Reverb + Limiter" */
+const char *pa_lv2_chain_get_name(pa_lv2_chain *c);
+
+/* Sets device.lv2.* properties describing the chain */
+void pa_lv2_chain_update_proplist(pa_lv2_chain *c, pa_proplist *p);
+
+#endif
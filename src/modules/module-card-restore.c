@@ -93,7 +93,7 @@ static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct
     pa_assert(u);
 
     pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
+    pa_core_rttime_free(u->core, u->save_time_event);
     u->save_time_event = NULL;
 
     pa_database_sync(u->database);
@@ -555,7 +555,7 @@ void pa__done(pa_module*m) {
     }
 
     if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+        pa_core_rttime_free(u->core, u->save_time_event);
 
     if (u->database)
         pa_database_close(u->database);
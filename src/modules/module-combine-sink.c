@@ -45,6 +45,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/rate-controller.h>
 #include <pulsecore/strlist.h>
 
 #include "module-combine-sink-symdef.h"
@@ -57,7 +58,8 @@ PA_MODULE_USAGE(
         "sink_name=<name for the sink> "
         "sink_properties=<properties for the sink> "
         "slaves=<slave sinks> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<how quickly to adjust rates, in s> "
+        "sync_tolerance=<maximum skew between outputs in usec> "
         "resample_method=<method> "
         "format=<sample format> "
         "rate=<sample rate> "
@@ -70,6 +72,11 @@ PA_MODULE_USAGE(
 
 #define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
 
+#define DEFAULT_SYNC_TOLERANCE_USEC 100
+
+/* Do the adjustment in small steps; 2‰ can be considered inaudible */
+#define MAX_RATE_DEVIATION 0.002
+
 #define BLOCK_USEC (PA_USEC_PER_MSEC * 200)
 
 static const char* const valid_modargs[] = {
@@ -77,6 +84,7 @@ static const char* const valid_modargs[] = {
     "sink_properties",
     "slaves",
     "adjust_time",
+    "sync_tolerance",
     "resample_method",
     "format",
     "rate",
@@ -102,6 +110,32 @@ struct output {
     /* For communication of the stream latencies to the main thread */
     pa_usec_t total_latency;
 
+    /* Managed in the IO thread of the output */
+    struct {
+        pa_rate_controller *rate_controller;
+
+        /* The position in the combined stream, in bytes, that the
+         * write index of memblockq corresponds to */
+        uint64_t write_counter;
+        bool write_counter_valid;
+    } thread_info;
+
+    /* For communication of the playback position to the sink thread:
+     * the difference between the time and the position in the
+     * combined stream that is audible at that time, both in usec. This
+     * stays constant while the output plays in sync with the clock.
+     * It's stored modulo 2^32, so compare two offsets by casting their
+     * difference to int32_t. */
+    pa_atomic_t offset;
+    pa_atomic_t offset_valid;
+
+    /* Skew statistics, updated from the IO thread of the output and
+     * read from the main thread */
+    pa_atomic_t skew;
+    pa_atomic_t skew_max;
+    pa_atomic_t n_measurements;
+    pa_atomic_t n_out_of_sync;
+
     /* For communication of the stream parameters to the sink thread */
     pa_atomic_t max_request;
     pa_atomic_t max_latency;
@@ -121,6 +155,7 @@ struct userdata {
 
     pa_time_event *time_event;
     pa_usec_t adjust_time;
+    pa_usec_t sync_tolerance;
 
     bool automatic;
     bool auto_desc;
@@ -144,6 +179,11 @@ struct userdata {
         bool in_null_mode;
         pa_smoother *smoother;
         uint64_t counter;
+
+        /* The output the others are synchronized to, and its offset.
+         * Written by the sink thread, read by the output threads. */
+        pa_atomic_ptr_t reference;
+        pa_atomic_t reference_offset;
     } thread_info;
 };
 
@@ -166,10 +206,41 @@ static void output_enable(struct output *o);
 static void output_free(struct output *o);
 static int output_create_sink_input(struct output *o);
 
-static void adjust_rates(struct userdata *u) {
+/* Called from main context */
+static void update_sync_statistics(struct output *o) {
+    pa_proplist *pl;
+    unsigned n, n_out_of_sync;
+    int skew, skew_max;
+    bool reference;
+
+    pa_assert(o);
+    pa_assert(o->sink_input);
+
+    n = (unsigned) pa_atomic_load(&o->n_measurements);
+    n_out_of_sync = (unsigned) pa_atomic_load(&o->n_out_of_sync);
+    skew = pa_atomic_load(&o->skew);
+    skew_max = pa_atomic_load(&o->skew_max);
+    reference = pa_atomic_ptr_load(&o->userdata->thread_info.reference) == o;
+
+    if (n <= 0)
+        return;
+
+    pa_log_info("[%s] skew is %i usec%s, max %i usec, out of sync %0.1f%% of the time.",
+                o->sink->name, skew, reference ? " (reference)" : "", skew_max, (double) n_out_of_sync * 100 / n);
+
+    pl = pa_proplist_new();
+    pa_proplist_setf(pl, "combine.skew", "%i", skew);
+    pa_proplist_setf(pl, "combine.skew_max", "%i", skew_max);
+    pa_proplist_setf(pl, "combine.out_of_sync", "%0.1f", (double) n_out_of_sync * 100 / n);
+    pa_proplist_sets(pl, "combine.reference", pa_yes_no(reference));
+    pa_sink_input_update_proplist(o->sink_input, PA_UPDATE_REPLACE, pl);
+    pa_proplist_free(pl);
+}
+
+/* Called from main context */
+static void update_latency(struct userdata *u) {
     struct output *o;
-    pa_usec_t max_sink_latency = 0, min_total_latency = (pa_usec_t) -1, target_latency, avg_total_latency = 0;
-    uint32_t base_rate;
+    pa_usec_t avg_total_latency = 0;
     uint32_t idx;
     unsigned n = 0;
 
@@ -191,12 +262,6 @@ static void adjust_rates(struct userdata *u) {
         o->total_latency = pa_sink_input_get_latency(o->sink_input, &sink_latency);
         o->total_latency += sink_latency;
 
-        if (sink_latency > max_sink_latency)
-            max_sink_latency = sink_latency;
-
-        if (min_total_latency == (pa_usec_t) -1 || o->total_latency < min_total_latency)
-            min_total_latency = o->total_latency;
-
         avg_total_latency += o->total_latency;
         n++;
 
@@ -204,47 +269,16 @@ static void adjust_rates(struct userdata *u) {
 
         if (o->total_latency > 10*PA_USEC_PER_SEC)
             pa_log_warn("[%s] Total latency of output is very high (%0.2fms), most likely the audio timing in one of your drivers is broken.", o->sink->name, (double) o->total_latency / PA_USEC_PER_MSEC);
+
+        update_sync_statistics(o);
     }
 
-    if (min_total_latency == (pa_usec_t) -1)
+    if (n <= 0)
         return;
 
     avg_total_latency /= n;
 
-    target_latency = max_sink_latency > min_total_latency ? max_sink_latency : min_total_latency;
-
     pa_log_info("[%s] avg total latency is %0.2f msec.", u->sink->name, (double) avg_total_latency / PA_USEC_PER_MSEC);
-    pa_log_info("[%s] target latency is %0.2f msec.", u->sink->name, (double) target_latency / PA_USEC_PER_MSEC);
-
-    base_rate = u->sink->sample_spec.rate;
-
-    PA_IDXSET_FOREACH(o, u->outputs, idx) {
-        uint32_t new_rate = base_rate;
-        uint32_t current_rate;
-
-        if (!o->sink_input || !PA_SINK_IS_OPENED(pa_sink_get_state(o->sink)))
-            continue;
-
-        current_rate = o->sink_input->sample_spec.rate;
-
-        if (o->total_latency != target_latency)
-            new_rate += (uint32_t) (((double) o->total_latency - (double) target_latency) / (double) u->adjust_time * (double) new_rate);
-
-        if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
-            pa_log_warn("[%s] sample rates too different, not adjusting (%u vs. %u).", o->sink_input->sink->name, base_rate, new_rate);
-            new_rate = base_rate;
-        } else {
-            if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
-              new_rate = base_rate;
-            /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-            if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002)) {
-                pa_log_info("[%s] new rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", o->sink_input->sink->name, new_rate, current_rate);
-                new_rate = PA_CLAMP(new_rate, (uint32_t) (current_rate*0.998), (uint32_t) (current_rate*1.002));
-            }
-            pa_log_info("[%s] new rate is %u Hz; ratio is %0.3f; latency is %0.2f msec.", o->sink_input->sink->name, new_rate, (double) new_rate / base_rate, (double) o->total_latency / PA_USEC_PER_MSEC);
-        }
-        pa_sink_input_set_rate(o->sink_input, new_rate);
-    }
 
     pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY, NULL, (int64_t) avg_total_latency, NULL);
 }
@@ -256,10 +290,10 @@ static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct tim
     pa_assert(a);
     pa_assert(u->time_event == e);
 
-    adjust_rates(u);
+    update_latency(u);
 
     if (pa_sink_get_state(u->sink) == PA_SINK_SUSPENDED) {
-        u->core->mainloop->time_free(e);
+        pa_core_rttime_free(u->core, e);
         u->time_event = NULL;
     } else
         pa_core_rttime_restart(u->core, e, pa_rtclock_now() + u->adjust_time);
@@ -354,6 +388,55 @@ finish:
     pa_log_debug("Thread shutting down");
 }
 
+/* Called from I/O thread context */
+static void update_reference(struct userdata *u) {
+    struct output *o, *reference, *latest = NULL;
+    uint32_t reference_offset = 0, latest_offset = 0;
+    bool reference_valid = false;
+
+    pa_assert(u);
+
+    reference = pa_atomic_ptr_load(&u->thread_info.reference);
+
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        uint32_t offset;
+
+        if (!pa_atomic_load(&o->offset_valid))
+            continue;
+
+        offset = (uint32_t) pa_atomic_load(&o->offset);
+
+        if (o == reference) {
+            reference_offset = offset;
+            reference_valid = true;
+        }
+
+        if (!latest || (int32_t) (offset - latest_offset) > 0) {
+            latest = o;
+            latest_offset = offset;
+        }
+    }
+
+    if (!latest)
+        return;
+
+    /* The output that plays latest is the reference, the others are
+     * delayed to match it: an output can always be delayed, but it can
+     * only catch up as far as it has data queued. The reference only
+     * changes once another output lags behind by more than the
+     * tolerance, so that it doesn't jump back and forth on noise. */
+    if (!reference_valid || (int32_t) (latest_offset - reference_offset) > (int32_t) u->sync_tolerance) {
+        if (latest != reference)
+            pa_log_debug("Synchronizing outputs to %s.", latest->sink->name);
+
+        reference = latest;
+        reference_offset = latest_offset;
+    }
+
+    pa_atomic_store(&u->thread_info.reference_offset, (int) reference_offset);
+    pa_atomic_ptr_store(&u->thread_info.reference, reference);
+}
+
 /* Called from I/O thread context */
 static void render_memblock(struct userdata *u, struct output *o, size_t length) {
     pa_assert(u);
@@ -372,6 +455,8 @@ static void render_memblock(struct userdata *u, struct output *o, size_t length)
     while (pa_asyncmsgq_process_one(o->inq) > 0)
         ;
 
+    update_reference(u);
+
     /* Ok, now let's prepare some data if we really have to */
     while (!pa_memblockq_is_readable(o->memblockq)) {
         struct output *j;
@@ -387,12 +472,15 @@ static void render_memblock(struct userdata *u, struct output *o, size_t length)
             if (j == o)
                 continue;
 
-            pa_asyncmsgq_post(j->inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, &chunk, NULL);
+            pa_asyncmsgq_post(j->inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, (int64_t) u->thread_info.counter, &chunk, NULL);
         }
 
         /* And place it directly into the requesting output's queue */
         pa_memblockq_push_align(o->memblockq, &chunk);
         pa_memblock_unref(chunk.memblock);
+
+        o->thread_info.write_counter = u->thread_info.counter;
+        o->thread_info.write_counter_valid = true;
     }
 }
 
@@ -417,6 +505,68 @@ static void request_memblock(struct output *o, size_t length) {
         pa_asyncmsgq_send(o->outq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_NEED, o, (int64_t) length, NULL);
 }
 
+/* Called from I/O thread context */
+static void synchronize_output(struct output *o) {
+    struct userdata *u;
+    pa_sink_input *i;
+    struct output *reference;
+    size_t length;
+    pa_usec_t now, sink_latency, position;
+    uint32_t offset;
+    int64_t skew;
+
+    pa_assert(o);
+    pa_assert_se(u = o->userdata);
+    pa_assert_se(i = o->sink_input);
+
+    if (!o->thread_info.write_counter_valid)
+        return;
+
+    /* The sample at the write index of our queue is write_counter
+     * bytes into the combined stream. Everything in front of it is
+     * still waiting in our queue, in the render queue of the sink
+     * input or in the sink, so we know which sample is audible now. */
+    now = pa_rtclock_now();
+    sink_latency = pa_sink_get_latency_within_thread(i->sink);
+
+    length = pa_memblockq_get_length(i->thread_info.render_memblockq);
+    length = pa_resampler_request(i->thread_info.resampler, length);
+    length += pa_memblockq_get_length(o->memblockq);
+
+    position = pa_bytes_to_usec(o->thread_info.write_counter - PA_MIN((uint64_t) length, o->thread_info.write_counter), &u->sink->sample_spec);
+    offset = (uint32_t) (now + sink_latency - position);
+
+    pa_atomic_store(&o->offset, (int) offset);
+    pa_atomic_store(&o->offset_valid, 1);
+
+    if (!(reference = pa_atomic_ptr_load(&u->thread_info.reference)))
+        return;
+
+    /* Positive if we play later than the reference */
+    if (reference == o)
+        skew = 0;
+    else
+        skew = (int32_t) (offset - (uint32_t) pa_atomic_load(&u->thread_info.reference_offset));
+
+    if (o->thread_info.rate_controller) {
+        pa_sink_input_set_rate_within_thread(i, pa_rate_controller_update(o->thread_info.rate_controller, now, skew));
+        skew = pa_rate_controller_get_error(o->thread_info.rate_controller);
+    }
+
+    pa_atomic_store(&o->skew, (int) skew);
+
+    if (skew < 0)
+        skew = -skew;
+
+    if (skew > pa_atomic_load(&o->skew_max))
+        pa_atomic_store(&o->skew_max, (int) skew);
+
+    pa_atomic_inc(&o->n_measurements);
+
+    if ((pa_usec_t) skew > u->sync_tolerance)
+        pa_atomic_inc(&o->n_out_of_sync);
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct output *o;
@@ -427,6 +577,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     /* If necessary, get some new data */
     request_memblock(o, nbytes);
 
+    synchronize_output(o);
+
     /* pa_log("%s q size is %u + %u (%u/%u)", */
     /*        i->sink->name, */
     /*        pa_memblockq_get_nblocks(o->memblockq), */
@@ -545,6 +697,18 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_atomic_store(&o->max_latency, (int) max);
     pa_log_debug("attach latency range %lu %lu", (unsigned long) min, (unsigned long) max);
 
+    /* Start synchronizing from scratch, the sink input was created
+     * with the nominal rate */
+    if (o->thread_info.rate_controller)
+        pa_rate_controller_reset(o->thread_info.rate_controller);
+
+    o->thread_info.write_counter_valid = false;
+    pa_atomic_store(&o->offset_valid, 0);
+    pa_atomic_store(&o->skew, 0);
+    pa_atomic_store(&o->skew_max, 0);
+    pa_atomic_store(&o->n_measurements, 0);
+    pa_atomic_store(&o->n_out_of_sync, 0);
+
     /* We register the output. That means that the sink will start to pass data to
      * this output. */
     pa_asyncmsgq_send(o->userdata->sink->asyncmsgq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_ADD_OUTPUT, o, 0, NULL);
@@ -561,6 +725,8 @@ static void sink_input_detach_cb(pa_sink_input *i) {
      * pass any further data to this output */
     pa_asyncmsgq_send(o->userdata->sink->asyncmsgq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_REMOVE_OUTPUT, o, 0, NULL);
 
+    pa_atomic_store(&o->offset_valid, 0);
+
     if (o->inq_rtpoll_item_read) {
         pa_rtpoll_item_free(o->inq_rtpoll_item_read);
         o->inq_rtpoll_item_read = NULL;
@@ -608,6 +774,11 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
             else
                 pa_memblockq_flush_write(o->memblockq, true);
 
+            /* offset is the position in the combined stream at the
+             * end of the chunk */
+            o->thread_info.write_counter = (uint64_t) offset;
+            o->thread_info.write_counter_valid = true;
+
             return 0;
 
         case SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY: {
@@ -777,6 +948,9 @@ static void output_remove_within_thread(struct output *o) {
 
     PA_LLIST_REMOVE(struct output, o->userdata->thread_info.active_outputs, o);
 
+    if (pa_atomic_ptr_load(&o->userdata->thread_info.reference) == o)
+        pa_atomic_ptr_store(&o->userdata->thread_info.reference, NULL);
+
     if (o->outq_rtpoll_item_read) {
         pa_rtpoll_item_free(o->outq_rtpoll_item_read);
         o->outq_rtpoll_item_read = NULL;
@@ -993,6 +1167,9 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
             0,
             &u->sink->silence);
 
+    if (u->adjust_time > 0)
+        o->thread_info.rate_controller = pa_rate_controller_new(u->sink->sample_spec.rate, u->adjust_time, MAX_RATE_DEVIATION);
+
     pa_assert_se(pa_idxset_put(u->outputs, o, NULL) == 0);
     update_description(u);
 
@@ -1025,6 +1202,9 @@ static void output_free(struct output *o) {
     if (o->memblockq)
         pa_memblockq_free(o->memblockq);
 
+    if (o->thread_info.rate_controller)
+        pa_rate_controller_free(o->thread_info.rate_controller);
+
     pa_xfree(o);
 }
 
@@ -1209,7 +1389,7 @@ int pa__init(pa_module*m) {
     struct output *o;
     uint32_t idx;
     pa_sink_new_data data;
-    uint32_t adjust_time_sec;
+    uint32_t adjust_time_sec, sync_tolerance;
     size_t nbytes;
 
     pa_assert(m);
@@ -1253,6 +1433,14 @@ int pa__init(pa_module*m) {
     else
         u->adjust_time = DEFAULT_ADJUST_TIME_USEC;
 
+    sync_tolerance = DEFAULT_SYNC_TOLERANCE_USEC;
+    if (pa_modargs_get_value_u32(ma, "sync_tolerance", &sync_tolerance) < 0 || sync_tolerance > INT32_MAX) {
+        pa_log("Failed to parse sync_tolerance value");
+        goto fail;
+    }
+
+    u->sync_tolerance = sync_tolerance;
+
     slaves = pa_modargs_get_value(ma, "slaves", NULL);
     u->automatic = !slaves;
 
@@ -1482,7 +1670,7 @@ void pa__done(pa_module*m) {
         pa_rtpoll_free(u->rtpoll);
 
     if (u->time_event)
-        u->core->mainloop->time_free(u->time_event);
+        pa_core_rttime_free(u->core, u->time_event);
 
     if (u->thread_info.smoother)
         pa_smoother_free(u->thread_info.smoother);
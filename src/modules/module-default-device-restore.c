@@ -135,7 +135,7 @@ static void time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *
     save(u);
 
     if (u->time_event) {
-        u->core->mainloop->time_free(u->time_event);
+        pa_core_rttime_free(u->core, u->time_event);
         u->time_event = NULL;
     }
 }
@@ -191,7 +191,7 @@ void pa__done(pa_module*m) {
         pa_subscription_free(u->subscription);
 
     if (u->time_event)
-        m->core->mainloop->time_free(u->time_event);
+        pa_core_rttime_free(m->core, u->time_event);
 
     pa_xfree(u->sink_filename);
     pa_xfree(u->source_filename);
@@ -51,6 +51,8 @@
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/i18n.h>
 #include <pulsecore/aupdate.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/convolver.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/module.h>
@@ -82,10 +84,23 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "low_latency=<filter with a partitioned convolution instead of the STFT? yes or no> "
+          "minimum_phase=<use a minimum phase filter in low latency mode? yes or no> "
          ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED false
+#define DEFAULT_LOW_LATENCY false
+#define DEFAULT_MINIMUM_PHASE true
+
+/* The low latency mode splits the impulse response into a short head,
+ * convolved in small blocks, and a long tail, convolved in large blocks
+ * that are cheap per sample. The tail starts where its larger block
+ * latency is hidden behind the head, so the output is only delayed by
+ * the head block size. */
+#define HEAD_BLOCK_SIZE 64
+#define TAIL_BLOCK_SIZE 1024
+#define HEAD_LENGTH (TAIL_BLOCK_SIZE - HEAD_BLOCK_SIZE)
 
 struct userdata {
     pa_module *module;
@@ -129,6 +144,18 @@ struct userdata {
 
     pa_database *database;
     char **base_profiles;
+
+    /* low latency mode */
+    bool low_latency;
+    bool minimum_phase;
+    size_t response_length;
+    pa_convolver **head, **tail;//one of each per channel
+    float *designed_X, **designed_H;//the settings the responses were designed for (main thread)
+    float *response;
+    float ***responses;//designed responses, handed to the I/O thread
+    pa_aupdate **a_response;
+    pa_atomic_t *response_version;//bumped by the main thread after every new response
+    int *applied_version;//the responses the convolvers are using (I/O thread)
 };
 
 static const char* const valid_modargs[] = {
@@ -141,6 +168,8 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "autoloaded",
     "use_volume_sharing",
+    "low_latency",
+    "minimum_phase",
     NULL
 };
 
@@ -239,6 +268,17 @@ static void alloc_input_buffers(struct userdata *u, size_t min_buffer_length) {
     u->input_buffer_max = min_buffer_length;
 }
 
+/* The delay of the low latency mode in frames. A linear phase response
+ * is centered in the middle. */
+static size_t low_latency_delay(struct userdata *u) {
+    size_t delay = pa_convolver_get_latency(u->head[0]);
+
+    if (!u->minimum_phase)
+        delay += u->response_length / 2;
+
+    return delay;
+}
+
 /* Called from I/O thread context */
 static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
@@ -265,6 +305,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 pa_bytes_to_usec(pa_memblockq_get_length(u->output_q) +
                                  pa_memblockq_get_length(u->input_q), &u->sink_input->sink->sample_spec) +
                 pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+
+            /* And the delay of the low latency filter */
+            if (u->low_latency)
+                *((pa_usec_t*) data) += pa_bytes_to_usec(low_latency_delay(u) * pa_frame_size(&u->sink->sample_spec), &u->sink->sample_spec);
             //    pa_bytes_to_usec(u->samples_gathered * fs, &u->sink->sample_spec);
             //+ pa_bytes_to_usec(u->latency * fs, ss)
             return 0;
@@ -575,19 +619,231 @@ static void input_buffer(struct userdata *u, pa_memchunk *in) {
     size_t fs = pa_frame_size(&(u->sink->sample_spec));
     size_t samples = in->length/fs;
     float *src = pa_memblock_acquire_chunk(in);
+    float *dst[PA_CHANNELS_MAX];
     pa_assert(u->samples_gathered + samples <= u->input_buffer_max);
     for(size_t c = 0; c < u->channels; c++) {
         //buffer with an offset after the overlap from previous
         //iterations
-        pa_assert_se(
-            u->input[c] + u->samples_gathered + samples <= u->input[c] + u->input_buffer_max
-        );
-        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c] + u->samples_gathered, sizeof(float), src + c, fs, samples);
+        dst[c] = u->input[c] + u->samples_gathered;
     }
+    pa_deinterleave_float_clamp(src, u->channels, dst, u->channels, samples);
     u->samples_gathered += samples;
     pa_memblock_release(in->memblock);
 }
 
+/* Turns the magnitude response X * H into a causal FIR of
+ * u->response_length taps in u->response. The result is either linear
+ * phase, which delays the signal by half the response length, or
+ * minimum phase, designed from the real cepstrum, which puts most of the
+ * energy at the start of the response and adds no delay of its own.
+ * This borrows the STFT buffers and plans, which the I/O thread doesn't
+ * use in low latency mode. */
+static void design_response(struct userdata *u, float X, const float *H) {
+    const size_t N = u->fft_size, L = u->response_length;
+    float *t = u->work_buffer;
+    fftwf_complex *S = u->output_window;
+
+    if (!u->minimum_phase) {
+        /* zero phase spectrum, the fftw gain is already divided out of H */
+        for (size_t k = 0; k < FILTER_SIZE(u); ++k) {
+            S[k][0] = X * H[k];
+            S[k][1] = 0;
+        }
+        fftwf_execute_dft_c2r(u->inverse_plan, S, t);
+
+        /* center the (circular) impulse response and window it */
+        for (size_t j = 0; j < L; ++j)
+            u->response[j] = t[(j + N - L / 2) % N] * (float) .5 * (1 - cos(2*M_PI*j / L));
+
+        return;
+    }
+
+    /* real cepstrum of the magnitude response */
+    for (size_t k = 0; k < FILTER_SIZE(u); ++k) {
+        S[k][0] = logf(PA_MAX(X * H[k] * N, 1e-7f)) / N;
+        S[k][1] = 0;
+    }
+    fftwf_execute_dft_c2r(u->inverse_plan, S, t);
+
+    /* fold the anti-causal part of the cepstrum onto the causal part */
+    for (size_t j = 1; j < N / 2; ++j) {
+        t[j] *= 2;
+        t[N - j] = 0;
+    }
+    fftwf_execute_dft_r2c(u->forward_plan, t, S);
+
+    /* back from the log domain, and into the time domain */
+    for (size_t k = 0; k < FILTER_SIZE(u); ++k) {
+        float m = expf(S[k][0]) / N;
+        float phi = S[k][1];
+
+        S[k][0] = m * cosf(phi);
+        S[k][1] = m * sinf(phi);
+    }
+    fftwf_execute_dft_c2r(u->inverse_plan, S, t);
+
+    /* truncate, with a short fade out against the step */
+    for (size_t j = 0; j < L; ++j) {
+        float w = 1;
+
+        if (j >= L - L / 8)
+            w = (float) .5 * (1 + cos(M_PI * (j - (L - L / 8)) / (L / 8)));
+
+        u->response[j] = t[j] * w;
+    }
+}
+
+/* Called from main context */
+static void publish_response(struct userdata *u, unsigned c) {
+    unsigned a_i;
+
+    a_i = pa_aupdate_write_begin(u->a_response[c]);
+    memcpy(u->responses[c][a_i], u->response, u->response_length * sizeof(float));
+    pa_aupdate_write_end(u->a_response[c]);
+
+    pa_atomic_inc(&u->response_version[c]);
+}
+
+static bool same_settings(struct userdata *u, unsigned a, unsigned b) {
+    return u->designed_X[a] == u->designed_X[b] &&
+        memcmp(u->designed_H[a], u->designed_H[b], FILTER_SIZE(u) * sizeof(float)) == 0;
+}
+
+/* Designs the responses of the channels whose settings changed, and
+ * hands them to the I/O thread. Call this from the main context after
+ * every filter change. */
+static void update_responses(struct userdata *u) {
+    bool changed[PA_CHANNELS_MAX];
+    unsigned n_designed = 0, n_changed = 0;
+
+    if (!u->low_latency)
+        return;
+
+    for (unsigned c = 0; c < u->channels; ++c) {
+        unsigned a_i = pa_aupdate_read_begin(u->a_H[c]);
+
+        changed[c] = u->designed_X[c] != u->Xs[c][a_i] ||
+            memcmp(u->designed_H[c], u->Hs[c][a_i], FILTER_SIZE(u) * sizeof(float)) != 0;
+
+        if (changed[c]) {
+            u->designed_X[c] = u->Xs[c][a_i];
+            memcpy(u->designed_H[c], u->Hs[c][a_i], FILTER_SIZE(u) * sizeof(float));
+            n_changed++;
+        }
+
+        pa_aupdate_read_end(u->a_H[c]);
+    }
+
+    /* Channels with identical settings share one design */
+    for (unsigned c = 0; c < u->channels; ++c) {
+        if (!changed[c])
+            continue;
+
+        design_response(u, u->designed_X[c], u->designed_H[c]);
+        n_designed++;
+
+        for (unsigned d = c; d < u->channels; ++d) {
+            if (!changed[d] || (d != c && !same_settings(u, c, d)))
+                continue;
+
+            publish_response(u, d);
+            changed[d] = false;
+        }
+    }
+
+    if (n_changed > 0)
+        pa_log_debug("Designed %u filter(s) for %u changed channel(s).", n_designed, n_changed);
+}
+
+/* Loads the responses the main thread published since the last call
+ * into the convolvers. Called from I/O thread context. */
+static void apply_responses(struct userdata *u) {
+    for (unsigned c = 0; c < u->channels; ++c) {
+        int version = pa_atomic_load(&u->response_version[c]);
+        const float *response;
+        unsigned a_i;
+
+        if (version == u->applied_version[c])
+            continue;
+
+        u->applied_version[c] = version;
+
+        a_i = pa_aupdate_read_begin(u->a_response[c]);
+        response = u->responses[c][a_i];
+
+        pa_convolver_set_filter(u->head[c], 0, 0, response, 1, PA_MIN(u->response_length, HEAD_LENGTH));
+        if (u->tail[c])
+            pa_convolver_set_filter(u->tail[c], 0, 0, response + HEAD_LENGTH, 1, u->response_length - HEAD_LENGTH);
+
+        pa_aupdate_read_end(u->a_response[c]);
+    }
+}
+
+/* Called from I/O thread context */
+static void low_latency_pop(struct userdata *u, size_t nbytes, pa_memchunk *chunk) {
+    size_t fs = pa_frame_size(&u->sink->sample_spec);
+    pa_memchunk tchunk;
+    float *src, *dst, *t;
+    float *in[PA_CHANNELS_MAX], *out[PA_CHANNELS_MAX];
+    unsigned n;
+
+    /* Hmm, process any rewind request that might be queued up */
+    pa_sink_process_rewind(u->sink, 0);
+
+    while (pa_memblockq_peek(u->input_q, &tchunk) < 0) {
+        pa_sink_render(u->sink, nbytes, &tchunk);
+        pa_memblockq_push(u->input_q, &tchunk);
+        pa_memblock_unref(tchunk.memblock);
+    }
+
+    tchunk.length = PA_MIN(nbytes, tchunk.length);
+    pa_assert(tchunk.length > 0);
+    n = (unsigned) (tchunk.length / fs);
+
+    apply_responses(u);
+
+    chunk->index = 0;
+    chunk->length = n * fs;
+    chunk->memblock = pa_memblock_new(u->sink->core->mempool, chunk->length);
+
+    pa_memblockq_drop(u->input_q, chunk->length);
+
+    /* room for the input and the output of every channel, and the tail
+     * output of one */
+    if ((2 * u->channels + 1) * n * sizeof(float) > u->output_buffer_max_length) {
+        u->output_buffer_max_length = (2 * u->channels + 1) * n * sizeof(float);
+        pa_xfree(u->output_buffer);
+        u->output_buffer = pa_xmalloc(u->output_buffer_max_length);
+    }
+
+    t = (float *) u->output_buffer;
+    for (unsigned c = 0; c < u->channels; ++c) {
+        in[c] = t + c * n;
+        out[c] = t + (u->channels + c) * n;
+    }
+    t += 2 * u->channels * n;
+
+    src = pa_memblock_acquire_chunk(&tchunk);
+    pa_deinterleave_float_clamp(src, u->channels, in, u->channels, n);
+    pa_memblock_release(tchunk.memblock);
+    pa_memblock_unref(tchunk.memblock);
+
+    for (unsigned c = 0; c < u->channels; ++c) {
+        pa_convolver_process(u->head[c], in[c], out[c], n);
+
+        if (u->tail[c]) {
+            pa_convolver_process(u->tail[c], in[c], t, n);
+
+            for (unsigned j = 0; j < n; ++j)
+                out[c][j] += t[j];
+        }
+    }
+
+    dst = pa_memblock_acquire(chunk->memblock);
+    pa_interleave_float_clamp(out, u->channels, dst, u->channels, n);
+    pa_memblock_release(chunk->memblock);
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -601,6 +857,11 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_assert(chunk);
     pa_assert(u->sink);
 
+    if (u->low_latency) {
+        low_latency_pop(u, nbytes, chunk);
+        return 0;
+    }
+
     /* FIXME: Please clean this up. I see more commented code lines
      * than uncommented code lines. I am sorry, but I am too dumb to
      * understand this. */
@@ -747,6 +1008,32 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     pa_sink_process_rewind(u->sink, amount);
     pa_memblockq_rewind(u->input_q, nbytes);
+
+    /* The convolvers take back what they were fed, and continue seamlessly
+     * with the data that is now read again */
+    if (u->low_latency) {
+        size_t fs = pa_frame_size(&u->sink->sample_spec);
+
+        for (unsigned c = 0; c < u->channels; ++c) {
+            pa_convolver_rewind(u->head[c], (unsigned) (nbytes / fs));
+            if (u->tail[c])
+                pa_convolver_rewind(u->tail[c], (unsigned) (nbytes / fs));
+        }
+    }
+}
+
+/* Called from I/O thread context */
+static void set_convolver_max_rewind(struct userdata *u, size_t nbytes) {
+    size_t fs = pa_frame_size(&u->sink->sample_spec);
+
+    if (!u->low_latency)
+        return;
+
+    for (unsigned c = 0; c < u->channels; ++c) {
+        pa_convolver_set_max_rewind(u->head[c], (unsigned) (nbytes / fs));
+        if (u->tail[c])
+            pa_convolver_set_max_rewind(u->tail[c], (unsigned) (nbytes / fs));
+    }
 }
 
 /* Called from I/O thread context */
@@ -760,6 +1047,7 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
     pa_memblockq_set_maxrewind(u->input_q, nbytes);
     pa_sink_set_max_rewind_within_thread(u->sink, nbytes);
+    set_convolver_max_rewind(u, nbytes);
 }
 
 /* Called from I/O thread context */
@@ -770,6 +1058,11 @@ static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
 
+    if (u->low_latency) {
+        pa_sink_set_max_request_within_thread(u->sink, nbytes);
+        return;
+    }
+
     fs = pa_frame_size(&u->sink_input->sample_spec);
     pa_sink_set_max_request_within_thread(u->sink, PA_ROUND_UP(nbytes / fs, u->R) * fs);
 }
@@ -819,15 +1112,20 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
 
     fs = pa_frame_size(&u->sink_input->sample_spec);
-    /* set buffer size to max request, no overlap copy */
-    max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
-    max_request = PA_MAX(max_request, u->window_size);
+    if (u->low_latency)
+        max_request = pa_sink_input_get_max_request(u->sink_input) / fs;
+    else {
+        /* set buffer size to max request, no overlap copy */
+        max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
+        max_request = PA_MAX(max_request, u->window_size);
+    }
 
     pa_sink_set_max_request_within_thread(u->sink, max_request * fs);
 
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
     pa_sink_set_max_rewind_within_thread(u->sink, pa_sink_input_get_max_rewind(i));
+    set_convolver_max_rewind(u, pa_sink_input_get_max_rewind(i));
 
     pa_sink_attach_within_thread(u->sink);
 }
@@ -1093,6 +1391,7 @@ int pa__init(pa_module*m) {
     float *H;
     unsigned a_i;
     bool use_volume_sharing = true;
+    bool low_latency = DEFAULT_LOW_LATENCY, minimum_phase = DEFAULT_MINIMUM_PHASE;
 
     pa_assert(m);
 
@@ -1121,9 +1420,21 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "low_latency", &low_latency) < 0) {
+        pa_log("low_latency= expects a boolean argument");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "minimum_phase", &minimum_phase) < 0) {
+        pa_log("minimum_phase= expects a boolean argument");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
+    u->low_latency = low_latency;
+    u->minimum_phase = minimum_phase;
 
     u->channels = ss.channels;
     u->fft_size = pow(2, ceil(log(ss.rate) / log(2)));//probably unstable near corner cases of powers of 2
@@ -1163,6 +1474,38 @@ int pa__init(pa_module*m) {
     hanning_window(u->W, u->window_size);
     u->first_iteration = true;
 
+    if (u->low_latency) {
+        /* a few Hz of resolution is plenty for an equalizer */
+        u->response_length = u->fft_size / 8;
+        u->response = alloc(u->response_length, sizeof(float));
+
+        u->head = pa_xnew0(pa_convolver *, u->channels);
+        u->tail = pa_xnew0(pa_convolver *, u->channels);
+        u->designed_X = pa_xnew0(float, u->channels);
+        u->designed_H = pa_xnew0(float *, u->channels);
+        u->responses = pa_xnew0(float **, u->channels);
+        u->a_response = pa_xnew0(pa_aupdate *, u->channels);
+        u->response_version = pa_xnew0(pa_atomic_t, u->channels);
+        u->applied_version = pa_xnew0(int, u->channels);
+        for (c = 0; c < u->channels; ++c) {
+            /* the channels are filtered independently */
+            u->head[c] = pa_convolver_new(HEAD_BLOCK_SIZE, 1, 1, HEAD_LENGTH);
+            if (u->response_length > HEAD_LENGTH)
+                u->tail[c] = pa_convolver_new(TAIL_BLOCK_SIZE, 1, 1, u->response_length - HEAD_LENGTH);
+
+            /* NaN never compares equal, so every channel is designed once */
+            u->designed_X[c] = NAN;
+            u->designed_H[c] = alloc(FILTER_SIZE(u), sizeof(float));
+
+            u->responses[c] = pa_xnew0(float *, 2);
+            for (i = 0; i < 2; ++i)
+                u->responses[c][i] = alloc(u->response_length, sizeof(float));
+            u->a_response[c] = pa_aupdate_new();
+        }
+
+        pa_log_debug("low latency mode, %zu taps, %s phase", u->response_length, u->minimum_phase ? "minimum" : "linear");
+    }
+
     u->base_profiles = pa_xnew0(char *, u->channels);
     for (c = 0; c < u->channels; ++c)
         u->base_profiles[c] = pa_xstrdup("default");
@@ -1277,6 +1620,8 @@ int pa__init(pa_module*m) {
     /* load old parameters */
     load_state(u);
 
+    update_responses(u);
+
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
 
@@ -1360,6 +1705,28 @@ void pa__done(pa_module*m) {
     pa_xfree(u->Xs);
     pa_xfree(u->Hs);
 
+    if (u->head) {
+        for (c = 0; c < u->channels; ++c) {
+            if (u->tail[c])
+                pa_convolver_free(u->tail[c]);
+            pa_convolver_free(u->head[c]);
+            pa_xfree(u->designed_H[c]);
+            for (size_t i = 0; i < 2; ++i)
+                pa_xfree(u->responses[c][i]);
+            pa_xfree(u->responses[c]);
+            pa_aupdate_free(u->a_response[c]);
+        }
+        pa_xfree(u->tail);
+        pa_xfree(u->head);
+        pa_xfree(u->designed_H);
+        pa_xfree(u->responses);
+        pa_xfree(u->a_response);
+        pa_xfree(u->response_version);
+        pa_xfree(u->applied_version);
+    }
+    pa_xfree(u->designed_X);
+    pa_xfree(u->response);
+
     pa_xfree(u);
 }
 
@@ -1853,6 +2220,7 @@ void equalizer_handle_seed_filter(DBusConnection *conn, DBusMessage *msg, void *
         }
     }
     pa_aupdate_write_end(u->a_H[r_channel]);
+    update_responses(u);
     pa_xfree(ys);
 
     pa_dbus_send_empty_reply(conn, msg);
@@ -2003,6 +2371,7 @@ static void set_filter(struct userdata *u, size_t channel, double *H_, double pr
         }
     }
     pa_aupdate_write_end(u->a_H[r_channel]);
+    update_responses(u);
 }
 
 void equalizer_handle_set_filter(DBusConnection *conn, DBusMessage *msg, void *_u) {
@@ -2116,6 +2485,7 @@ void equalizer_handle_load_profile(DBusConnection *conn, DBusMessage *msg, void
             load_profile(u, c, name);
         }
     }
+    update_responses(u);
     pa_dbus_send_empty_reply(conn, msg);
 
     pa_assert_se((message = dbus_message_new_signal(u->dbus_path, EQUALIZER_IFACE, equalizer_signals[EQUALIZER_SIGNAL_FILTER_CHANGED].name)));
@@ -253,7 +253,7 @@ static void housekeeping_time_callback(pa_mainloop_api*a, pa_time_event* e, cons
     pa_assert(u);
 
     pa_assert(e == u->housekeeping_time_event);
-    u->core->mainloop->time_free(u->housekeeping_time_event);
+    pa_core_rttime_free(u->core, u->housekeeping_time_event);
     u->housekeeping_time_event = NULL;
 
     PA_HASHMAP_FOREACH(filter, u->filters, state) {
@@ -737,7 +737,7 @@ void pa__done(pa_module *m) {
         pa_hook_slot_free(u->source_unlink_slot);
 
     if (u->housekeeping_time_event)
-        u->core->mainloop->time_free(u->housekeeping_time_event);
+        pa_core_rttime_free(u->core, u->housekeeping_time_event);
 
     if (u->filters) {
         struct filter *f;
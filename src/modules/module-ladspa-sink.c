@@ -19,9 +19,6 @@
   USA.
 ***/
 
-/* TODO: Some plugins cause latency, and some even report it by using a control
-   out port. We don't currently use the latency information. */
-
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -40,6 +37,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/strbuf.h>
 
 #ifdef HAVE_DBUS
 #include <pulsecore/protocol-dbus.h>
@@ -65,31 +63,56 @@ PA_MODULE_USAGE(
       "label=<ladspa plugin label> "
       "control=<comma separated list of input control values> "
       "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "));
+      "output_ladspaport_map=<comma separated list of output LADSPA port names> "
+      "(separate the values for several plugins, run in the given order, by '|')"));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
 
+struct plugin {
+    lt_dlhandle dl;
+
+    const LADSPA_Descriptor *descriptor;
+    LADSPA_Handle handle[PA_CHANNELS_MAX];
+    unsigned long max_ladspaport_count, input_count, output_count;
+
+    /* Only allocated for plugins that can't run in place. The audio ports of
+    all other plugins are connected to the shared channel buffers directly. */
+    LADSPA_Data **input;
+
+    /* The control values of this plugin within those of the userdata */
+    LADSPA_Data *control;
+    bool *use_default;
+    long unsigned n_control;
+
+    /* This is a dummy buffer. Every port must be connected, but we don't care
+    about control out ports, except for the latency. */
+    LADSPA_Data control_out;
+    LADSPA_Data latency;
+};
+
 struct userdata {
     pa_module *module;
 
     pa_sink *sink;
     pa_sink_input *sink_input;
 
-    const LADSPA_Descriptor *descriptor;
-    LADSPA_Handle handle[PA_CHANNELS_MAX];
-    unsigned long max_ladspaport_count, input_count, output_count, channels;
-    LADSPA_Data **input, **output;
+    /* The plugins, in the order they are run in */
+    struct plugin *plugins;
+    unsigned n_plugins;
+
+    unsigned long channels;
     size_t block_size;
+
+    /* One buffer per channel, which all plugins process in turn */
+    LADSPA_Data **buffer;
+
+    /* The control values of all plugins, one after another */
     LADSPA_Data *control;
     long unsigned n_control;
 
-    /* This is a dummy buffer. Every port must be connected, but we don't care
-    about control out ports. We connect them all to this single buffer. */
-    LADSPA_Data control_out;
-
     pa_memblockq *memblockq;
 
     bool *use_default;
@@ -126,6 +149,7 @@ enum {
 
 static int write_control_parameters(struct userdata *u, double *control_values, bool *use_default);
 static void connect_control_ports(struct userdata *u);
+static unsigned long get_latency(struct userdata *u);
 
 #ifdef HAVE_DBUS
 
@@ -354,7 +378,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
             pa_sink_get_latency_within_thread(u->sink_input->sink) +
 
             /* Add the latency internal to our sink input on top */
-            pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+            pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec) +
+
+            /* Add the latency that the plugins report */
+            pa_bytes_to_usec(get_latency(u) * pa_frame_size(&u->sink->sample_spec), &u->sink->sample_spec);
 
         return 0;
 
@@ -442,7 +469,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, h, c;
+    unsigned n, h, j, c;
     pa_memchunk tchunk;
 
     pa_sink_input_assert_ref(i);
@@ -477,14 +504,23 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
+    pa_deinterleave_float_clamp(src, u->channels, u->buffer, u->channels, n);
+
+    /* The plugins run one after another on the same channel buffers */
+    for (j = 0; j < u->n_plugins; j++) {
+        struct plugin *pl = &u->plugins[j];
+
+        for (h = 0; h < (u->channels / pl->max_ladspaport_count); h++) {
+            if (pl->input)
+                for (c = 0; c < pl->input_count; c++)
+                    memcpy(pl->input[c], u->buffer[h*pl->max_ladspaport_count + c], n * sizeof(float));
+
+            pl->descriptor->run(pl->handle[h], n);
+        }
     }
 
+    pa_interleave_float_clamp(u->buffer, u->channels, dst, u->channels, n);
+
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
 
@@ -509,19 +545,23 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
+            unsigned c, i;
 
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
 
-            pa_log_debug("Resetting plugin");
+            pa_log_debug("Resetting plugins");
 
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
+            /* Reset the plugins */
+            for (i = 0; i < u->n_plugins; i++) {
+                struct plugin *pl = &u->plugins[i];
+
+                if (pl->descriptor->deactivate)
+                    for (c = 0; c < (u->channels / pl->max_ladspaport_count); c++)
+                        pl->descriptor->deactivate(pl->handle[c]);
+                if (pl->descriptor->activate)
+                    for (c = 0; c < (u->channels / pl->max_ladspaport_count); c++)
+                        pl->descriptor->activate(pl->handle[c]);
+            }
         }
     }
 
@@ -678,23 +718,23 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
-static int parse_control_parameters(struct userdata *u, const char *cdata, double *read_values, bool *use_default) {
+static int parse_plugin_control_parameters(struct plugin *pl, const char *cdata, double *read_values, bool *use_default) {
     unsigned long p = 0;
     const char *state = NULL;
     char *k;
 
     pa_assert(read_values);
     pa_assert(use_default);
-    pa_assert(u);
+    pa_assert(pl);
 
-    pa_log_debug("Trying to read %lu control values", u->n_control);
+    pa_log_debug("Trying to read %lu control values", pl->n_control);
 
-    if (!cdata && u->n_control > 0)
+    if (!cdata && pl->n_control > 0)
         return -1;
 
     pa_log_debug("cdata: '%s'", cdata);
 
-    while ((k = pa_split(cdata, ",", &state)) && p < u->n_control) {
+    while ((k = pa_split(cdata, ",", &state)) && p < pl->n_control) {
         double f;
 
         if (*k == 0) {
@@ -721,19 +761,19 @@ static int parse_control_parameters(struct userdata *u, const char *cdata, doubl
     /* The previous loop doesn't take the last control value into account
        if it is left empty, so we do it here. */
     if (*cdata == 0 || cdata[strlen(cdata) - 1] == ',') {
-        if (p < u->n_control)
+        if (p < pl->n_control)
             use_default[p] = true;
         p++;
     }
 
-    if (p > u->n_control || k) {
-        pa_log("Too many control values passed, %lu expected.", u->n_control);
+    if (p > pl->n_control || k) {
+        pa_log("Too many control values passed, %lu expected.", pl->n_control);
         pa_xfree(k);
         goto fail;
     }
 
-    if (p < u->n_control) {
-        pa_log("Not enough control values passed, %lu expected, %lu passed.", u->n_control, p);
+    if (p < pl->n_control) {
+        pa_log("Not enough control values passed, %lu expected, %lu passed.", pl->n_control, p);
         goto fail;
     }
 
@@ -743,35 +783,90 @@ fail:
     return -1;
 }
 
-static void connect_control_ports(struct userdata *u) {
+static int parse_control_parameters(struct userdata *u, const char *cdata, double *read_values, bool *use_default) {
+    const char *state = NULL;
+    unsigned long offset = 0;
+    unsigned i;
+
+    pa_assert(u);
+
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+        char *k;
+        int r = 0;
+
+        /* The values of the plugins in a chain are separated by '|' */
+        if (u->n_plugins == 1)
+            k = pa_xstrdup(cdata);
+        else
+            k = cdata ? pa_split(cdata, "|", &state) : NULL;
+
+        if (pl->n_control > 0)
+            r = parse_plugin_control_parameters(pl, k, read_values + offset, use_default + offset);
+
+        pa_xfree(k);
+
+        if (r < 0)
+            return -1;
+
+        offset += pl->n_control;
+    }
+
+    return 0;
+}
+
+/* Plugins report their latency through a control out port of that name */
+static bool is_latency_port(const LADSPA_Descriptor *d, unsigned long p) {
+    return LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) &&
+        LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]) &&
+        pa_streq(d->PortNames[p], "latency");
+}
+
+static void connect_control_out_port(struct userdata *u, struct plugin *pl, unsigned long p) {
+    unsigned long c;
+
+    for (c = 0; c < (u->channels / pl->max_ladspaport_count); c++)
+        pl->descriptor->connect_port(pl->handle[c], p, is_latency_port(pl->descriptor, p) ? &pl->latency : &pl->control_out);
+}
+
+static void connect_plugin_control_ports(struct userdata *u, struct plugin *pl) {
     unsigned long p = 0, h = 0, c;
     const LADSPA_Descriptor *d;
 
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     for (p = 0; p < d->PortCount; p++) {
         if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
             continue;
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+            connect_control_out_port(u, pl, p);
             continue;
         }
 
         /* input control port */
 
-        pa_log_debug("Binding %f to port %s", u->control[h], d->PortNames[p]);
+        pa_log_debug("Binding %f to port %s", pl->control[h], d->PortNames[p]);
 
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->connect_port(u->handle[c], p, &u->control[h]);
+        for (c = 0; c < (u->channels / pl->max_ladspaport_count); c++)
+            d->connect_port(pl->handle[c], p, &pl->control[h]);
 
         h++;
     }
 }
 
-static int validate_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
+static void connect_control_ports(struct userdata *u) {
+    unsigned i;
+
+    pa_assert(u);
+
+    for (i = 0; i < u->n_plugins; i++)
+        connect_plugin_control_ports(u, &u->plugins[i]);
+}
+
+static int validate_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, bool *use_default) {
     unsigned long p = 0, h = 0;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
@@ -779,7 +874,8 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
@@ -834,21 +930,19 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     return 0;
 }
 
-static int write_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
-    unsigned long p = 0, h = 0, c;
+static void write_plugin_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, bool *use_default) {
+    unsigned long p = 0, h = 0;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
 
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
-    if (validate_control_parameters(u, control_values, use_default) < 0)
-        return -1;
-
     /* p iterates over all ports, h is the control port iterator */
 
     for (p = 0; p < d->PortCount; p++) {
@@ -858,8 +952,7 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             continue;
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+            connect_control_out_port(u, pl, p);
             continue;
         }
 
@@ -878,48 +971,48 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             switch (hint & LADSPA_HINT_DEFAULT_MASK) {
 
             case LADSPA_HINT_DEFAULT_MINIMUM:
-                u->control[h] = lower;
+                pl->control[h] = lower;
                 break;
 
             case LADSPA_HINT_DEFAULT_MAXIMUM:
-                u->control[h] = upper;
+                pl->control[h] = upper;
                 break;
 
             case LADSPA_HINT_DEFAULT_LOW:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
                 break;
 
             case LADSPA_HINT_DEFAULT_MIDDLE:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
                 break;
 
             case LADSPA_HINT_DEFAULT_HIGH:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
                 break;
 
             case LADSPA_HINT_DEFAULT_0:
-                u->control[h] = 0;
+                pl->control[h] = 0;
                 break;
 
             case LADSPA_HINT_DEFAULT_1:
-                u->control[h] = 1;
+                pl->control[h] = 1;
                 break;
 
             case LADSPA_HINT_DEFAULT_100:
-                u->control[h] = 100;
+                pl->control[h] = 100;
                 break;
 
             case LADSPA_HINT_DEFAULT_440:
-                u->control[h] = 440;
+                pl->control[h] = 440;
                 break;
 
             default:
@@ -928,10 +1021,10 @@ static int write_control_parameters(struct userdata *u, double *control_values,
         }
         else {
             if (LADSPA_IS_HINT_INTEGER(hint)) {
-                u->control[h] = roundf(control_values[h]);
+                pl->control[h] = roundf(control_values[h]);
             }
             else {
-                u->control[h] = control_values[h];
+                pl->control[h] = control_values[h];
             }
         }
 
@@ -939,76 +1032,49 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     }
 
     /* set the use_default array to the user data */
-    memcpy(u->use_default, use_default, u->n_control * sizeof(u->use_default[0]));
-
-    return 0;
+    memcpy(pl->use_default, use_default, pl->n_control * sizeof(pl->use_default[0]));
 }
 
-int pa__init(pa_module*m) {
-    struct userdata *u;
-    pa_sample_spec ss;
-    pa_channel_map map;
-    pa_modargs *ma;
-    char *t;
-    pa_sink *master;
-    pa_sink_input_new_data sink_input_data;
-    pa_sink_new_data sink_data;
-    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
-    LADSPA_Descriptor_Function descriptor_func;
-    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
-    const char *e, *cdata;
-    const LADSPA_Descriptor *d;
-    unsigned long p, h, j, n_control, c;
-    pa_memchunk silence;
-
-    pa_assert(m);
-
-    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
-
-    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
-        pa_log("Failed to parse module arguments.");
-        goto fail;
-    }
+/* control_values and use_default hold the values of all plugins, one after
+ * another */
+static int write_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
+    unsigned long offset;
+    unsigned i;
 
-    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
-        pa_log("Master sink not found");
-        goto fail;
-    }
+    pa_assert(u);
 
-    ss = master->sample_spec;
-    ss.format = PA_SAMPLE_FLOAT32;
-    map = master->channel_map;
-    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
-        pa_log("Invalid sample format specification or channel map");
-        goto fail;
-    }
+    /* Check everything first, so that we don't change some plugins only */
+    for (i = 0, offset = 0; i < u->n_plugins; offset += u->plugins[i].n_control, i++)
+        if (validate_control_parameters(u, &u->plugins[i], control_values + offset, use_default + offset) < 0)
+            return -1;
 
-    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
-        pa_log("Missing LADSPA plugin name");
-        goto fail;
-    }
+    for (i = 0, offset = 0; i < u->n_plugins; offset += u->plugins[i].n_control, i++)
+        write_plugin_control_parameters(u, &u->plugins[i], control_values + offset, use_default + offset);
 
-    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
-        pa_log("Missing LADSPA plugin label");
-        goto fail;
-    }
+    return 0;
+}
 
-    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
-        pa_log_debug("Using default input ladspa port mapping");
+/* Called from I/O thread context. Returns the latency of the whole chain in
+ * frames. */
+static unsigned long get_latency(struct userdata *u) {
+    unsigned long latency = 0;
+    unsigned i;
 
-    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
-        pa_log_debug("Using default output ladspa port mapping");
+    for (i = 0; i < u->n_plugins; i++)
+        if (u->plugins[i].latency > 0)
+            latency += (unsigned long) u->plugins[i].latency;
 
-    cdata = pa_modargs_get_value(ma, "control", NULL);
+    return latency;
+}
 
-    u = pa_xnew0(struct userdata, 1);
-    u->module = m;
-    m->userdata = u;
-    u->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
-    u->channels = 0;
-    u->input = NULL;
-    u->output = NULL;
-    u->ss = ss;
+static int plugin_init(struct userdata *u, struct plugin *pl, const char *plugin, const char *label,
+                       const char *input_ladspaport_map, const char *output_ladspaport_map) {
+    LADSPA_Descriptor_Function descriptor_func;
+    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
+    const char *e;
+    char *t;
+    const LADSPA_Descriptor *d;
+    unsigned long p, h, j, c;
 
     if (!(e = getenv("LADSPA_PATH")))
         e = LADSPA_PATH;
@@ -1016,32 +1082,32 @@ int pa__init(pa_module*m) {
     /* FIXME: This is not exactly thread safe */
     t = pa_xstrdup(lt_dlgetsearchpath());
     lt_dlsetsearchpath(e);
-    m->dl = lt_dlopenext(plugin);
+    pl->dl = lt_dlopenext(plugin);
     lt_dlsetsearchpath(t);
     pa_xfree(t);
 
-    if (!m->dl) {
+    if (!pl->dl) {
         pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
-        goto fail;
+        return -1;
     }
 
-    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(m->dl, NULL, "ladspa_descriptor"))) {
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(pl->dl, NULL, "ladspa_descriptor"))) {
         pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
-        goto fail;
+        return -1;
     }
 
     for (j = 0;; j++) {
 
         if (!(d = descriptor_func(j))) {
             pa_log("Failed to find plugin label '%s' in plugin '%s'.", label, plugin);
-            goto fail;
+            return -1;
         }
 
         if (pa_streq(d->Label, label))
             break;
     }
 
-    u->descriptor = d;
+    pl->descriptor = d;
 
     pa_log_debug("Module: %s", plugin);
     pa_log_debug("Label: %s", d->Label);
@@ -1050,9 +1116,6 @@ int pa__init(pa_module*m) {
     pa_log_debug("Maker: %s", d->Maker);
     pa_log_debug("Copyright: %s", d->Copyright);
 
-    n_control = 0;
-    u->channels = ss.channels;
-
     /*
     * Enumerate ladspa ports
     * Default mapping is in order given by the plugin
@@ -1061,44 +1124,44 @@ int pa__init(pa_module*m) {
         if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
             if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is input: %s", p, d->PortNames[p]);
-                input_ladspaport[u->input_count] = p;
-                u->input_count++;
+                input_ladspaport[pl->input_count] = p;
+                pl->input_count++;
             } else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is output: %s", p, d->PortNames[p]);
-                output_ladspaport[u->output_count] = p;
-                u->output_count++;
+                output_ladspaport[pl->output_count] = p;
+                pl->output_count++;
             }
         } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
             pa_log_debug("Port %lu is control: %s", p, d->PortNames[p]);
-            n_control++;
-        } else
-            pa_log_debug("Ignored port %s", d->PortNames[p]);
-        /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
-        /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
-        /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
-        if (u->input_count > u->max_ladspaport_count)
-            u->max_ladspaport_count = u->input_count;
+            pl->n_control++;
+        } else if (is_latency_port(d, p))
+            pa_log_debug("Port %lu reports the latency: %s", p, d->PortNames[p]);
         else
-            u->max_ladspaport_count = u->output_count;
+            pa_log_debug("Ignored port %s", d->PortNames[p]);
     }
 
-    if (u->channels % u->max_ladspaport_count) {
+    /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
+    /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
+    /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
+    pl->max_ladspaport_count = PA_MAX(1UL, PA_MAX(pl->input_count, pl->output_count));
+
+    if (u->channels % pl->max_ladspaport_count) {
         pa_log("Cannot handle non-integral number of plugins required for given number of channels");
-        goto fail;
+        return -1;
     }
 
-    pa_log_debug("Will run %lu plugin instances", u->channels / u->max_ladspaport_count);
+    pa_log_debug("Will run %lu plugin instances", u->channels / pl->max_ladspaport_count);
 
     /* Parse data for input ladspa port map */
-    if (input_ladspaport_map) {
+    if (input_ladspaport_map && *input_ladspaport_map) {
         const char *state = NULL;
         char *pname;
         c = 0;
         while ((pname = pa_split(input_ladspaport_map, ",", &state))) {
-            if (c == u->input_count) {
+            if (c == pl->input_count) {
                 pa_log("Too many ports in input ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
 
             for (p = 0; p < d->PortCount; p++) {
@@ -1108,7 +1171,7 @@ int pa__init(pa_module*m) {
                     } else {
                         pa_log("Port %s is not an audio input ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1118,15 +1181,15 @@ int pa__init(pa_module*m) {
     }
 
     /* Parse data for output port map */
-    if (output_ladspaport_map) {
+    if (output_ladspaport_map && *output_ladspaport_map) {
         const char *state = NULL;
         char *pname;
         c = 0;
         while ((pname = pa_split(output_ladspaport_map, ",", &state))) {
-            if (c == u->output_count) {
+            if (c == pl->output_count) {
                 pa_log("Too many ports in output ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
             for (p = 0; p < d->PortCount; p++) {
                 if (pa_streq(d->PortNames[p], pname)) {
@@ -1135,7 +1198,7 @@ int pa__init(pa_module*m) {
                     } else {
                         pa_log("Port %s is not an output ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1144,35 +1207,201 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
-
-    /* Create buffers */
+    /* Plugins that can't run in place read from their own copy of the
+     * input */
     if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = u->input;
+        pl->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) pl->input_count);
+        for (c = 0; c < pl->input_count; c++)
+            pl->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
     }
+
     /* Initialize plugin instances */
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
+    for (h = 0; h < (u->channels / pl->max_ladspaport_count); h++) {
+        LADSPA_Data **buffer = u->buffer + h * pl->max_ladspaport_count;
+
+        if (!(pl->handle[h] = d->instantiate(d, u->ss.rate))) {
             pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
+            return -1;
+        }
+
+        for (c = 0; c < pl->input_count; c++)
+            d->connect_port(pl->handle[h], input_ladspaport[c], pl->input ? pl->input[c] : buffer[c]);
+        for (c = 0; c < pl->output_count; c++)
+            d->connect_port(pl->handle[h], output_ladspaport[c], buffer[c]);
+    }
+
+    return 0;
+}
+
+static void plugin_done(struct userdata *u, struct plugin *pl) {
+    unsigned long c;
+
+    for (c = 0; c < (u->channels / pl->max_ladspaport_count); c++) {
+        if (pl->handle[c]) {
+            if (pl->descriptor->deactivate)
+                pl->descriptor->deactivate(pl->handle[c]);
+            pl->descriptor->cleanup(pl->handle[c]);
+        }
+    }
+
+    if (pl->input) {
+        for (c = 0; c < pl->input_count; c++)
+            pa_xfree(pl->input[c]);
+        pa_xfree(pl->input);
+    }
+
+    if (pl->dl)
+        lt_dlclose(pl->dl);
+}
+
+static void set_plugin_properties(struct userdata *u, pa_proplist *p) {
+    pa_strbuf *label, *name, *maker, *copyright, *unique_id;
+    unsigned i;
+    char *s;
+
+    label = pa_strbuf_new();
+    name = pa_strbuf_new();
+    maker = pa_strbuf_new();
+    copyright = pa_strbuf_new();
+    unique_id = pa_strbuf_new();
+
+    /* Chains list the values of all plugins, in the same way as the module
+     * arguments */
+    for (i = 0; i < u->n_plugins; i++) {
+        const LADSPA_Descriptor *d = u->plugins[i].descriptor;
+        const char *separator = i > 0 ? "|" : "";
+
+        pa_strbuf_printf(label, "%s%s", separator, d->Label);
+        pa_strbuf_printf(name, "%s%s", i > 0 ? " + " : "", d->Name);
+        pa_strbuf_printf(maker, "%s%s", separator, d->Maker);
+        pa_strbuf_printf(copyright, "%s%s", separator, d->Copyright);
+        pa_strbuf_printf(unique_id, "%s%lu", separator, (unsigned long) d->UniqueID);
+    }
+
+    pa_proplist_sets(p, "device.ladspa.label", s = pa_strbuf_tostring_free(label));
+    pa_xfree(s);
+    pa_proplist_sets(p, "device.ladspa.name", s = pa_strbuf_tostring_free(name));
+    pa_xfree(s);
+    pa_proplist_sets(p, "device.ladspa.maker", s = pa_strbuf_tostring_free(maker));
+    pa_xfree(s);
+    pa_proplist_sets(p, "device.ladspa.copyright", s = pa_strbuf_tostring_free(copyright));
+    pa_xfree(s);
+    pa_proplist_sets(p, "device.ladspa.unique_id", s = pa_strbuf_tostring_free(unique_id));
+    pa_xfree(s);
+}
+
+int pa__init(pa_module*m) {
+    struct userdata *u;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_modargs *ma;
+    pa_sink *master;
+    pa_sink_input_new_data sink_input_data;
+    pa_sink_new_data sink_data;
+    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
+    const char *plugin_state = NULL, *label_state = NULL, *input_state = NULL, *output_state = NULL;
+    const char *cdata;
+    char *pname;
+    unsigned long c, n_control;
+    unsigned i;
+    pa_memchunk silence;
+
+    pa_assert(m);
+
+    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments.");
+        goto fail;
+    }
+
+    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
+        pa_log("Master sink not found");
+        goto fail;
+    }
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        goto fail;
+    }
+
+    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
+    }
+
+    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
+        pa_log("Missing LADSPA plugin label");
+        goto fail;
+    }
+
+    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
+        pa_log_debug("Using default input ladspa port mapping");
+
+    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
+        pa_log_debug("Using default output ladspa port mapping");
+
+    cdata = pa_modargs_get_value(ma, "control", NULL);
+
+    u = pa_xnew0(struct userdata, 1);
+    u->module = m;
+    m->userdata = u;
+    u->channels = ss.channels;
+    u->ss = ss;
+
+    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+
+    /* The buffers all plugins run on */
+    u->buffer = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->channels);
+    for (c = 0; c < u->channels; c++)
+        u->buffer[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+
+    /* Load the plugins of the chain, in order */
+    while ((pname = pa_split(plugin, "|", &plugin_state))) {
+        struct plugin *pl;
+        char *plabel, *imap, *omap;
+        int r;
+
+        if (!(plabel = pa_split(label, "|", &label_state))) {
+            pa_log("Missing LADSPA plugin label for plugin %s", pname);
+            pa_xfree(pname);
             goto fail;
         }
 
-        for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
-        for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
+        imap = input_ladspaport_map ? pa_split(input_ladspaport_map, "|", &input_state) : NULL;
+        omap = output_ladspaport_map ? pa_split(output_ladspaport_map, "|", &output_state) : NULL;
+
+        u->plugins = pa_xrenew(struct plugin, u->plugins, u->n_plugins + 1);
+        pl = &u->plugins[u->n_plugins++];
+        memset(pl, 0, sizeof(*pl));
+        pl->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
+
+        r = plugin_init(u, pl, pname, plabel, imap, omap);
+
+        pa_xfree(pname);
+        pa_xfree(plabel);
+        pa_xfree(imap);
+        pa_xfree(omap);
+
+        if (r < 0)
+            goto fail;
+    }
+
+    if (u->n_plugins == 0) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
     }
 
+    if (u->n_plugins > 1)
+        pa_log_debug("Running a chain of %u plugins", u->n_plugins);
+
+    n_control = 0;
+    for (i = 0; i < u->n_plugins; i++)
+        n_control += u->plugins[i].n_control;
+
     u->n_control = n_control;
 
     if (u->n_control > 0) {
@@ -1187,6 +1416,11 @@ int pa__init(pa_module*m) {
         u->control = pa_xnew(LADSPA_Data, (unsigned) u->n_control);
         u->use_default = pa_xnew(bool, (unsigned) u->n_control);
 
+        for (i = 0, n_control = 0; i < u->n_plugins; n_control += u->plugins[i].n_control, i++) {
+            u->plugins[i].control = u->control + n_control;
+            u->plugins[i].use_default = u->use_default + n_control;
+        }
+
         if ((parse_control_parameters(u, cdata, control_values, use_default) < 0) ||
             (write_control_parameters(u, control_values, use_default) < 0)) {
             pa_xfree(control_values);
@@ -1196,14 +1430,20 @@ int pa__init(pa_module*m) {
 
             goto fail;
         }
-        connect_control_ports(u);
         pa_xfree(control_values);
         pa_xfree(use_default);
     }
 
-    if (d->activate)
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->activate(u->handle[c]);
+    /* Also connects the control out ports of plugins without inputs */
+    connect_control_ports(u);
+
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        if (pl->descriptor->activate)
+            for (c = 0; c < (u->channels / pl->max_ladspaport_count); c++)
+                pl->descriptor->activate(pl->handle[c]);
+    }
 
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
@@ -1216,11 +1456,7 @@ int pa__init(pa_module*m) {
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
     pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugin);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", d->Label);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", d->Name);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", d->Maker);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", d->Copyright);
-    pa_proplist_setf(sink_data.proplist, "device.ladspa.unique_id", "%lu", (unsigned long) d->UniqueID);
+    set_plugin_properties(u, sink_data.proplist);
 
     if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
@@ -1232,7 +1468,8 @@ int pa__init(pa_module*m) {
         const char *z;
 
         z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s", d->Name, z ? z : master->name);
+        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s",
+                         pa_proplist_gets(sink_data.proplist, "device.ladspa.name"), z ? z : master->name);
     }
 
     u->sink = pa_sink_new(m->core, &sink_data,
@@ -1347,31 +1584,15 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
-        if (u->handle[c]) {
-            if (u->descriptor->deactivate)
-                u->descriptor->deactivate(u->handle[c]);
-            u->descriptor->cleanup(u->handle[c]);
-        }
-    }
+    for (c = 0; c < u->n_plugins; c++)
+        plugin_done(u, &u->plugins[c]);
 
-    if (u->output == u->input) {
-        if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-    } else {
-        if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-        if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
-                pa_xfree(u->output[c]);
-            pa_xfree(u->output);
-        }
+    pa_xfree(u->plugins);
+
+    if (u->buffer) {
+        for (c = 0; c < u->channels; c++)
+            pa_xfree(u->buffer[c]);
+        pa_xfree(u->buffer);
     }
 
     if (u->memblockq)
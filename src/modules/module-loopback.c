@@ -34,6 +34,7 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/rate-controller.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
@@ -47,7 +48,7 @@ PA_MODULE_LOAD_ONCE(false);
 PA_MODULE_USAGE(
         "source=<source to connect to> "
         "sink=<sink to connect to> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<how quickly to adjust rates in s> "
         "latency_msec=<latency in ms> "
         "format=<sample format> "
         "rate=<sample rate> "
@@ -65,6 +66,10 @@ PA_MODULE_USAGE(
 
 #define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
 
+/* How far we may go off the nominal rate to keep the latency at the
+ * target, relative. 5‰ can be considered barely audible. */
+#define MAX_RATE_DEVIATION 0.005
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -77,30 +82,20 @@ struct userdata {
 
     pa_rtpoll_item *rtpoll_item_read, *rtpoll_item_write;
 
-    pa_time_event *time_event;
     pa_usec_t adjust_time;
 
-    int64_t recv_counter;
-    int64_t send_counter;
-
     size_t skip;
     pa_usec_t latency;
 
     bool in_pop;
-    size_t min_memblockq_length;
-
-    struct {
-        int64_t send_counter;
-        size_t source_output_buffer;
-        pa_usec_t source_latency;
 
-        int64_t recv_counter;
-        size_t sink_input_buffer;
-        pa_usec_t sink_latency;
-
-        size_t min_memblockq_length;
-        size_t max_request;
-    } latency_snapshot;
+    /* Only accessed from the output thread */
+    pa_rate_controller *rate_controller;
+    pa_usec_t capture_time;     /* When the newest sample in the queue was captured */
+    pa_usec_t min_latency;      /* The latency we can't get below */
+    pa_usec_t min_latency_next; /* The same, measured since the last log message */
+    bool latency_too_low;
+    pa_usec_t last_log;
 };
 
 static const char* const valid_modargs[] = {
@@ -122,25 +117,14 @@ static const char* const valid_modargs[] = {
 
 enum {
     SINK_INPUT_MESSAGE_POST = PA_SINK_INPUT_MESSAGE_MAX,
-    SINK_INPUT_MESSAGE_REWIND,
-    SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT,
-    SINK_INPUT_MESSAGE_MAX_REQUEST_CHANGED
-};
-
-enum {
-    SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT
+    SINK_INPUT_MESSAGE_REWIND
 };
 
-static void enable_adjust_timer(struct userdata *u, bool enable);
-
 /* Called from main context */
 static void teardown(struct userdata *u) {
     pa_assert(u);
     pa_assert_ctl_context();
 
-    u->adjust_time = 0;
-    enable_adjust_timer(u, false);
-
     /* Handling the asyncmsgq between the source output and the sink input
      * requires some care. When the source output is unlinked, nothing needs
      * to be done for the asyncmsgq, because the source output is the sending
@@ -169,106 +153,11 @@ static void teardown(struct userdata *u) {
     }
 }
 
-/* Called from main context */
-static void adjust_rates(struct userdata *u) {
-    size_t buffer, fs;
-    uint32_t old_rate, base_rate, new_rate;
-    pa_usec_t buffer_latency;
-
-    pa_assert(u);
-    pa_assert_ctl_context();
-
-    pa_asyncmsgq_send(u->source_output->source->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT, NULL, 0, NULL);
-    pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT, NULL, 0, NULL);
-
-    buffer =
-        u->latency_snapshot.sink_input_buffer +
-        u->latency_snapshot.source_output_buffer;
-
-    if (u->latency_snapshot.recv_counter <= u->latency_snapshot.send_counter)
-        buffer += (size_t) (u->latency_snapshot.send_counter - u->latency_snapshot.recv_counter);
-    else
-        buffer += PA_CLIP_SUB(buffer, (size_t) (u->latency_snapshot.recv_counter - u->latency_snapshot.send_counter));
-
-    buffer_latency = pa_bytes_to_usec(buffer, &u->sink_input->sample_spec);
-
-    pa_log_debug("Loopback overall latency is %0.2f ms + %0.2f ms + %0.2f ms = %0.2f ms",
-                (double) u->latency_snapshot.sink_latency / PA_USEC_PER_MSEC,
-                (double) buffer_latency / PA_USEC_PER_MSEC,
-                (double) u->latency_snapshot.source_latency / PA_USEC_PER_MSEC,
-                ((double) u->latency_snapshot.sink_latency + buffer_latency + u->latency_snapshot.source_latency) / PA_USEC_PER_MSEC);
-
-    pa_log_debug("Should buffer %zu bytes, buffered at minimum %zu bytes",
-                u->latency_snapshot.max_request*2,
-                u->latency_snapshot.min_memblockq_length);
-
-    fs = pa_frame_size(&u->sink_input->sample_spec);
-    old_rate = u->sink_input->sample_spec.rate;
-    base_rate = u->source_output->sample_spec.rate;
-
-    if (u->latency_snapshot.min_memblockq_length < u->latency_snapshot.max_request*2)
-        new_rate = base_rate - (((u->latency_snapshot.max_request*2 - u->latency_snapshot.min_memblockq_length) / fs) *PA_USEC_PER_SEC)/u->adjust_time;
-    else
-        new_rate = base_rate + (((u->latency_snapshot.min_memblockq_length - u->latency_snapshot.max_request*2) / fs) *PA_USEC_PER_SEC)/u->adjust_time;
-
-    if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
-        pa_log_warn("Sample rates too different, not adjusting (%u vs. %u).", base_rate, new_rate);
-        new_rate = base_rate;
-    } else {
-        if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
-          new_rate = base_rate;
-        /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-        if (new_rate < (uint32_t) (old_rate*0.998) || new_rate > (uint32_t) (old_rate*1.002)) {
-            pa_log_info("New rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", new_rate, old_rate);
-            new_rate = PA_CLAMP(new_rate, (uint32_t) (old_rate*0.998), (uint32_t) (old_rate*1.002));
-        }
-    }
-
-    pa_sink_input_set_rate(u->sink_input, new_rate);
-    pa_log_debug("[%s] Updated sampling rate to %lu Hz.", u->sink_input->sink->name, (unsigned long) new_rate);
-
-    pa_core_rttime_restart(u->core, u->time_event, pa_rtclock_now() + u->adjust_time);
-}
-
-/* Called from main context */
-static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(u);
-    pa_assert(a);
-    pa_assert(u->time_event == e);
-
-    adjust_rates(u);
-}
-
-/* Called from main context */
-static void enable_adjust_timer(struct userdata *u, bool enable) {
-    if (enable) {
-        if (u->time_event || u->adjust_time <= 0)
-            return;
-
-        u->time_event = pa_core_rttime_new(u->module->core, pa_rtclock_now() + u->adjust_time, time_callback, u);
-    } else {
-        if (!u->time_event)
-            return;
-
-        u->core->mainloop->time_free(u->time_event);
-        u->time_event = NULL;
-    }
-}
-
-/* Called from main context */
-static void update_adjust_timer(struct userdata *u) {
-    if (u->sink_input->state == PA_SINK_INPUT_CORKED || u->source_output->state == PA_SOURCE_OUTPUT_CORKED)
-        enable_adjust_timer(u, false);
-    else
-        enable_adjust_timer(u, true);
-}
-
 /* Called from input thread context */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
     pa_memchunk copy;
+    pa_usec_t capture_time;
 
     pa_source_output_assert_ref(o);
     pa_source_output_assert_io_context(o);
@@ -288,8 +177,14 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         chunk = &copy;
     }
 
-    pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, chunk, NULL);
-    u->send_counter += (int64_t) chunk->length;
+    /* The last sample of this chunk was captured before whatever is
+     * still buffered in the source and the source output */
+    capture_time = pa_rtclock_now();
+    capture_time -= PA_MIN(capture_time,
+                           pa_source_get_latency_within_thread(o->source) +
+                           pa_bytes_to_usec(pa_memblockq_get_length(o->thread_info.delay_memblockq), &o->source->sample_spec));
+
+    pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_POST, NULL, (int64_t) capture_time, chunk, NULL);
 }
 
 /* Called from input thread context */
@@ -301,29 +196,6 @@ static void source_output_process_rewind_cb(pa_source_output *o, size_t nbytes)
     pa_assert_se(u = o->userdata);
 
     pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_REWIND, NULL, (int64_t) nbytes, NULL, NULL);
-    u->send_counter -= (int64_t) nbytes;
-}
-
-/* Called from output thread context */
-static int source_output_process_msg_cb(pa_msgobject *obj, int code, void *data, int64_t offset, pa_memchunk *chunk) {
-    struct userdata *u = PA_SOURCE_OUTPUT(obj)->userdata;
-
-    switch (code) {
-
-        case SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT: {
-            size_t length;
-
-            length = pa_memblockq_get_length(u->source_output->thread_info.delay_memblockq);
-
-            u->latency_snapshot.send_counter = u->send_counter;
-            u->latency_snapshot.source_output_buffer = u->source_output->thread_info.resampler ? pa_resampler_result(u->source_output->thread_info.resampler, length) : length;
-            u->latency_snapshot.source_latency = pa_source_get_latency_within_thread(u->source_output->source);
-
-            return 0;
-        }
-    }
-
-    return pa_source_output_process_msg(obj, code, data, offset, chunk);
 }
 
 /* Called from output thread context */
@@ -424,8 +296,6 @@ static void source_output_moving_cb(pa_source_output *o, pa_source *dest) {
         pa_sink_input_cork(u->sink_input, true);
     else
         pa_sink_input_cork(u->sink_input, false);
-
-    update_adjust_timer(u);
 }
 
 /* Called from main thread */
@@ -437,22 +307,73 @@ static void source_output_suspend_cb(pa_source_output *o, bool suspended) {
     pa_assert_se(u = o->userdata);
 
     pa_sink_input_cork(u->sink_input, suspended);
-
-    update_adjust_timer(u);
 }
 
 /* Called from output thread context */
-static void update_min_memblockq_length(struct userdata *u) {
+static void adjust_rate(struct userdata *u) {
     size_t length;
+    pa_usec_t now, sink_latency, queue_latency, buffer_latency, latency, fixed_latency, target;
+    uint32_t rate;
 
     pa_assert(u);
     pa_sink_input_assert_io_context(u->sink_input);
 
-    length = pa_memblockq_get_length(u->memblockq);
+    if (!u->rate_controller || u->capture_time <= 0)
+        return;
+
+    /* The newest sample we have was captured at capture_time, and will
+     * be played once everything in front of it has been played. That
+     * is everything queued here, whatever sits in the render queue of
+     * the sink input and the latency of the sink. */
+    now = pa_rtclock_now();
+    sink_latency = pa_sink_get_latency_within_thread(u->sink_input->sink);
+
+    length = pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq);
+    length = pa_resampler_request(u->sink_input->thread_info.resampler, length);
+    queue_latency = pa_bytes_to_usec(pa_memblockq_get_length(u->memblockq), &u->sink_input->thread_info.sample_spec);
+    buffer_latency = queue_latency + pa_bytes_to_usec(length, &u->sink_input->thread_info.sample_spec);
+
+    latency = now - PA_MIN(now, u->capture_time) + buffer_latency + sink_latency;
+
+    /* Only our own queue can be made shorter, the rest of the latency
+     * is up to the devices. If that is more than configured, aim for it
+     * instead, otherwise the rate would stay at its limit forever while
+     * the queue runs empty. It moves with the periods of both devices,
+     * so take its peak over the last adjust_time. */
+    fixed_latency = latency - queue_latency;
+    u->min_latency = PA_MAX(u->min_latency, fixed_latency);
+    u->min_latency_next = PA_MAX(u->min_latency_next, fixed_latency);
+    target = PA_MAX(u->latency, u->min_latency);
+
+    if ((target > u->latency) != u->latency_too_low) {
+        u->latency_too_low = target > u->latency;
+
+        if (u->latency_too_low)
+            pa_log_info("[%s] Configured latency of %0.2f ms is below what the devices allow, aiming for %0.2f ms instead",
+                        u->sink_input->sink->name,
+                        (double) u->latency / PA_USEC_PER_MSEC,
+                        (double) target / PA_USEC_PER_MSEC);
+        else
+            pa_log_info("[%s] Configured latency of %0.2f ms is achievable again",
+                        u->sink_input->sink->name,
+                        (double) u->latency / PA_USEC_PER_MSEC);
+    }
+
+    rate = pa_rate_controller_update(u->rate_controller, now, (int64_t) latency - (int64_t) target);
+    pa_sink_input_set_rate_within_thread(u->sink_input, rate);
+
+    if (now >= u->last_log + u->adjust_time) {
+        pa_log_debug("[%s] Loopback overall latency is %0.2f ms (target %0.2f ms), resampling from %lu Hz, clock drift %0.1f ppm",
+                     u->sink_input->sink->name,
+                     (double) latency / PA_USEC_PER_MSEC,
+                     (double) target / PA_USEC_PER_MSEC,
+                     (unsigned long) rate,
+                     pa_rate_controller_get_drift(u->rate_controller) * 1e6);
 
-    if (u->min_memblockq_length == (size_t) -1 ||
-        length < u->min_memblockq_length)
-        u->min_memblockq_length = length;
+        u->min_latency = u->min_latency_next;
+        u->min_latency_next = 0;
+        u->last_log = now;
+    }
 }
 
 /* Called from output thread context */
@@ -477,7 +398,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     chunk->length = PA_MIN(chunk->length, nbytes);
     pa_memblockq_drop(u->memblockq, chunk->length);
 
-    update_min_memblockq_length(u);
+    adjust_rate(u);
 
     return 0;
 }
@@ -515,13 +436,12 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
 
             pa_sink_input_assert_io_context(u->sink_input);
 
-            if (PA_SINK_IS_OPENED(u->sink_input->sink->thread_info.state))
+            if (PA_SINK_IS_OPENED(u->sink_input->sink->thread_info.state)) {
                 pa_memblockq_push_align(u->memblockq, chunk);
-            else
+                u->capture_time = (pa_usec_t) offset;
+            } else
                 pa_memblockq_flush_write(u->memblockq, true);
 
-            update_min_memblockq_length(u);
-
             /* Is this the end of an underrun? Then let's start things
              * right-away */
             if (!u->in_pop &&
@@ -534,8 +454,6 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
                                              false, true, false);
             }
 
-            u->recv_counter += (int64_t) chunk->length;
-
             return 0;
 
         case SINK_INPUT_MESSAGE_REWIND:
@@ -547,44 +465,7 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
             else
                 pa_memblockq_flush_write(u->memblockq, true);
 
-            u->recv_counter -= offset;
-
-            update_min_memblockq_length(u);
-
-            return 0;
-
-        case SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT: {
-            size_t length;
-
-            update_min_memblockq_length(u);
-
-            length = pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq);
-
-            u->latency_snapshot.recv_counter = u->recv_counter;
-            u->latency_snapshot.sink_input_buffer =
-                pa_memblockq_get_length(u->memblockq) +
-                (u->sink_input->thread_info.resampler ? pa_resampler_request(u->sink_input->thread_info.resampler, length) : length);
-            u->latency_snapshot.sink_latency = pa_sink_get_latency_within_thread(u->sink_input->sink);
-
-            u->latency_snapshot.max_request = pa_sink_input_get_max_request(u->sink_input);
-
-            u->latency_snapshot.min_memblockq_length = u->min_memblockq_length;
-            u->min_memblockq_length = (size_t) -1;
-
             return 0;
-        }
-
-        case SINK_INPUT_MESSAGE_MAX_REQUEST_CHANGED: {
-            /* This message is sent from the IO thread to the main
-             * thread! So don't be confused. All the user cases above
-             * are executed in thread context, but this one is not! */
-
-            pa_assert_ctl_context();
-
-            if (u->time_event)
-                adjust_rates(u);
-            return 0;
-        }
     }
 
     return pa_sink_input_process_msg(obj, code, data, offset, chunk);
@@ -606,7 +487,12 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_memblockq_set_prebuf(u->memblockq, pa_sink_input_get_max_request(i)*2);
     pa_memblockq_set_maxrewind(u->memblockq, pa_sink_input_get_max_rewind(i));
 
-    u->min_memblockq_length = (size_t) -1;
+    /* The new sink runs off a different clock */
+    if (u->rate_controller)
+        pa_rate_controller_reset(u->rate_controller);
+
+    u->capture_time = 0;
+    u->min_latency = u->min_latency_next = 0;
 }
 
 /* Called from output thread context */
@@ -643,8 +529,6 @@ static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
     pa_assert_se(u = i->userdata);
 
     pa_memblockq_set_prebuf(u->memblockq, nbytes*2);
-    pa_log_info("Max request changed");
-    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_MAX_REQUEST_CHANGED, NULL, 0, NULL, NULL);
 }
 
 /* Called from main thread */
@@ -696,8 +580,6 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
         pa_source_output_cork(u->source_output, true);
     else
         pa_source_output_cork(u->source_output, false);
-
-    update_adjust_timer(u);
 }
 
 /* Called from main thread */
@@ -723,8 +605,6 @@ static void sink_input_suspend_cb(pa_sink_input *i, bool suspended) {
     pa_assert_se(u = i->userdata);
 
     pa_source_output_cork(u->source_output, suspended);
-
-    update_adjust_timer(u);
 }
 
 int pa__init(pa_module *m) {
@@ -884,6 +764,9 @@ int pa__init(pa_module *m) {
     ss = u->sink_input->sample_spec;
     map = u->sink_input->channel_map;
 
+    if (u->adjust_time > 0)
+        u->rate_controller = pa_rate_controller_new(ss.rate, u->adjust_time, MAX_RATE_DEVIATION);
+
     u->sink_input->parent.process_msg = sink_input_process_msg_cb;
     u->sink_input->pop = sink_input_pop_cb;
     u->sink_input->process_rewind = sink_input_process_rewind_cb;
@@ -937,7 +820,6 @@ int pa__init(pa_module *m) {
     if (!u->source_output)
         goto fail;
 
-    u->source_output->parent.process_msg = source_output_process_msg_cb;
     u->source_output->push = source_output_push_cb;
     u->source_output->process_rewind = source_output_process_rewind_cb;
     u->source_output->kill = source_output_kill_cb;
@@ -991,8 +873,6 @@ int pa__init(pa_module *m) {
     if (pa_sink_get_state(u->sink_input->sink) != PA_SINK_SUSPENDED)
         pa_source_output_cork(u->source_output, false);
 
-    update_adjust_timer(u);
-
     pa_modargs_free(ma);
     return 0;
 
@@ -1021,5 +901,8 @@ void pa__done(pa_module*m) {
     if (u->asyncmsgq)
         pa_asyncmsgq_unref(u->asyncmsgq);
 
+    if (u->rate_controller)
+        pa_rate_controller_free(u->rate_controller);
+
     pa_xfree(u);
 }
@@ -86,7 +86,7 @@ static void timeout_cb(pa_mainloop_api*a, pa_time_event* e, const struct timeval
 
     pa_assert(d);
 
-    d->userdata->core->mainloop->time_restart(d->time_event, NULL);
+    pa_core_rttime_restart(d->userdata->core, d->time_event, PA_USEC_INVALID);
 
     if (d->sink && pa_sink_check_suspend(d->sink) <= 0 && !(d->sink->suspend_cause & PA_SUSPEND_IDLE)) {
         pa_log_info("Sink %s idle for too long, suspending ...", d->sink->name);
@@ -119,7 +119,7 @@ static void restart(struct device_info *d) {
 static void resume(struct device_info *d) {
     pa_assert(d);
 
-    d->userdata->core->mainloop->time_restart(d->time_event, NULL);
+    pa_core_rttime_restart(d->userdata->core, d->time_event, PA_USEC_INVALID);
 
     if (d->sink) {
         pa_log_debug("Sink %s becomes busy, resuming.", d->sink->name);
@@ -390,7 +390,7 @@ static void device_info_free(struct device_info *d) {
     if (d->sink)
         pa_sink_unref(d->sink);
 
-    d->userdata->core->mainloop->time_free(d->time_event);
+    pa_core_rttime_free(d->userdata->core, d->time_event);
 
     pa_xfree(d);
 }
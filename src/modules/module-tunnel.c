@@ -2313,7 +2313,7 @@ void pa__done(pa_module*m) {
         pa_smoother_free(u->smoother);
 
     if (u->time_event)
-        u->core->mainloop->time_free(u->time_event);
+        pa_core_rttime_free(u->core, u->time_event);
 
 #ifndef TUNNEL_SINK
     if (u->mcalign)
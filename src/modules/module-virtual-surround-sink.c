@@ -28,6 +28,7 @@
 #include <pulse/gccmacro.h>
 #include <pulse/xmalloc.h>
 
+#include <pulsecore/convolver.h>
 #include <pulsecore/i18n.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sink.h>
@@ -64,6 +65,10 @@ PA_MODULE_USAGE(
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* The hrir is applied in blocks of that many frames, which is also the
+ * latency this adds */
+#define CONVOLVER_BLOCK_SIZE 128
+
 struct userdata {
     pa_module *module;
 
@@ -87,8 +92,7 @@ struct userdata {
     unsigned hrir_samples;
     float *hrir_data;
 
-    float *input_buffer;
-    int input_buffer_offset;
+    pa_convolver *convolver;
 };
 
 static const char* const valid_modargs[] = {
@@ -128,7 +132,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 pa_sink_get_latency_within_thread(u->sink_input->sink) +
 
                 /* Add the latency internal to our sink input on top */
-                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec) +
+
+                /* And the block of the convolver that is still in flight */
+                pa_bytes_to_usec(pa_convolver_get_latency(u->convolver) * u->fs, &u->sink_input->sample_spec);
 
             return 0;
     }
@@ -220,9 +227,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     unsigned n;
     pa_memchunk tchunk;
 
-    unsigned j, k, l;
-    float sum_right, sum_left;
-    float current_sample;
+    unsigned l;
 
     pa_sink_input_assert_ref(i);
     pa_assert(chunk);
@@ -255,29 +260,11 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (l = 0; l < n; l++) {
-        memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((char *) src) + l * u->sink_fs, u->sink_fs);
-
-        sum_right = 0;
-        sum_left = 0;
-
-        /* fold the input buffer with the impulse response */
-        for (j = 0; j < u->hrir_samples; j++) {
-            for (k = 0; k < u->channels; k++) {
-                current_sample = u->input_buffer[((u->input_buffer_offset + j) % u->hrir_samples) * u->channels + k];
-
-                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
-                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
-            }
-        }
-
-        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
-        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
+    /* fold the input with the impulse response */
+    pa_convolver_process(u->convolver, src, dst, n);
 
-        u->input_buffer_offset--;
-        if (u->input_buffer_offset < 0)
-            u->input_buffer_offset += u->hrir_samples;
-    }
+    for (l = 0; l < 2 * n; l++)
+        dst[l] = PA_CLAMP_UNLIKELY(dst[l], -1.0f, 1.0f);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -302,17 +289,15 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         amount = PA_MIN(u->sink->thread_info.rewind_nbytes * u->sink_fs / u->fs, max_rewrite);
         u->sink->thread_info.rewind_nbytes = 0;
 
-        if (amount > 0) {
+        if (amount > 0)
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
-
-            /* Reset the input buffer */
-            memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
-            u->input_buffer_offset = 0;
-        }
     }
 
     pa_sink_process_rewind(u->sink, amount);
     pa_memblockq_rewind(u->memblockq, nbytes * u->sink_fs / u->fs);
+
+    /* What we handed out is going to be convolved again */
+    pa_convolver_rewind(u->convolver, nbytes / u->fs);
 }
 
 /* Called from I/O thread context */
@@ -326,6 +311,7 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
     pa_memblockq_set_maxrewind(u->memblockq, nbytes * u->sink_fs / u->fs);
     pa_sink_set_max_rewind_within_thread(u->sink, nbytes * u->sink_fs / u->fs);
+    pa_convolver_set_max_rewind(u->convolver, nbytes / u->fs);
 }
 
 /* Called from I/O thread context */
@@ -387,6 +373,7 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
     pa_sink_set_max_rewind_within_thread(u->sink, pa_sink_input_get_max_rewind(i) * u->sink_fs / u->fs);
+    pa_convolver_set_max_rewind(u->convolver, pa_sink_input_get_max_rewind(i) / u->fs);
 
     pa_sink_attach_within_thread(u->sink);
 }
@@ -749,9 +736,10 @@ int pa__init(pa_module*m) {
                                  PA_RESAMPLER_SRC_SINC_BEST_QUALITY, PA_RESAMPLER_NO_REMAP);
 
     u->hrir_samples = hrir_temp_chunk.length / pa_frame_size(&hrir_temp_ss) * hrir_ss.rate / hrir_temp_ss.rate;
-    if (u->hrir_samples > 64) {
-        u->hrir_samples = 64;
-        pa_log("The (resampled) hrir contains more than 64 samples. Only the first 64 samples will be used to limit processor usage.");
+    if (u->hrir_samples == 0) {
+        pa_log("The (resampled) hrir is empty.");
+        pa_resampler_free(resampler);
+        goto fail;
     }
 
     hrir_total_length = u->hrir_samples * pa_frame_size(&hrir_ss);
@@ -773,10 +761,10 @@ int pa__init(pa_module*m) {
             hrir_data = (float *) pa_memblock_acquire(hrir_temp_chunk_resampled.memblock);
 
             if (hrir_total_length - hrir_copied_length >= hrir_temp_chunk_resampled.length) {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
                 hrir_copied_length += hrir_temp_chunk_resampled.length;
             } else {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
                 hrir_copied_length = hrir_total_length;
             }
 
@@ -827,8 +815,14 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
-    u->input_buffer_offset = 0;
+    u->convolver = pa_convolver_new(CONVOLVER_BLOCK_SIZE, u->channels, 2, u->hrir_samples);
+
+    for (i = 0; i < u->channels; i++) {
+        pa_convolver_set_filter(u->convolver, i, 0, u->hrir_data + u->mapping_left[i], u->hrir_channels, u->hrir_samples);
+        pa_convolver_set_filter(u->convolver, i, 1, u->hrir_data + u->mapping_right[i], u->hrir_channels, u->hrir_samples);
+    }
+
+    pa_log_debug("Using a hrir of %u samples", u->hrir_samples);
 
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
@@ -889,8 +883,8 @@ void pa__done(pa_module*m) {
     if (u->hrir_data)
         pa_xfree(u->hrir_data);
 
-    if (u->input_buffer)
-        pa_xfree(u->input_buffer);
+    if (u->convolver)
+        pa_convolver_free(u->convolver);
 
     if (u->mapping_left)
         pa_xfree(u->mapping_left);
@@ -780,7 +780,7 @@ void pa__done(pa_module*m) {
         m->core->mainloop->io_free(u->sap_event);
 
     if (u->check_death_event)
-        m->core->mainloop->time_free(u->check_death_event);
+        pa_core_rttime_free(m->core, u->check_death_event);
 
     pa_sap_context_destroy(&u->sap_context);
 
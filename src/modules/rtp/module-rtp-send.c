@@ -534,7 +534,7 @@ void pa__done(pa_module*m) {
         return;
 
     if (u->sap_event)
-        m->core->mainloop->time_free(u->sap_event);
+        pa_core_rttime_free(m->core, u->sap_event);
 
     if (u->source_output) {
         pa_source_output_unlink(u->source_output);
@@ -80,6 +80,72 @@ pa_operation* pa_context_stat(pa_context *c, pa_stat_info_cb_t cb, void *userdat
     return pa_context_send_simple_command(c, PA_COMMAND_STAT, context_stat_callback, (pa_operation_cb_t) cb, userdata);
 }
 
+static void context_get_io_stats_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    int eol = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, false) < 0)
+            goto finish;
+
+        eol = -1;
+    } else {
+
+        while (!pa_tagstruct_eof(t)) {
+            pa_io_stats_info i;
+            uint32_t facility;
+
+            pa_zero(i);
+
+            if (pa_tagstruct_getu32(t, &facility) < 0 ||
+                pa_tagstruct_getu32(t, &i.index) < 0 ||
+                pa_tagstruct_getu32(t, &i.xruns) < 0 ||
+                pa_tagstruct_getu32(t, &i.rewinds) < 0 ||
+                pa_tagstruct_getu64(t, &i.rewind_bytes) < 0 ||
+                pa_tagstruct_getu32(t, &i.render_count) < 0 ||
+                pa_tagstruct_get_usec(t, &i.render_time_p50) < 0 ||
+                pa_tagstruct_get_usec(t, &i.render_time_p99) < 0 ||
+                pa_tagstruct_get_usec(t, &i.render_time_max) < 0 ||
+                pa_tagstruct_get_usec(t, &i.resample_time) < 0 ||
+                pa_tagstruct_getu32(t, &i.queue_length) < 0 ||
+                pa_tagstruct_getu32(t, &i.queue_length_max) < 0) {
+
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+
+            i.facility = (pa_subscription_event_type_t) facility;
+
+            if (o->callback) {
+                pa_io_stats_info_cb_t cb = (pa_io_stats_info_cb_t) o->callback;
+                cb(o->context, &i, 0, o->userdata);
+            }
+        }
+    }
+
+    if (o->callback) {
+        pa_io_stats_info_cb_t cb = (pa_io_stats_info_cb_t) o->callback;
+        cb(o->context, NULL, eol, o->userdata);
+    }
+
+finish:
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+pa_operation* pa_context_get_io_stats_info_list(pa_context *c, pa_io_stats_info_cb_t cb, void *userdata) {
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 31, PA_ERR_NOTSUPPORTED);
+
+    return pa_context_send_simple_command(c, PA_COMMAND_GET_IO_STATS_INFO_LIST, context_get_io_stats_info_callback, (pa_operation_cb_t) cb, userdata);
+}
+
 /*** Server Info ***/
 
 static void context_get_server_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -677,6 +677,31 @@ typedef void (*pa_stat_info_cb_t) (pa_context *c, const pa_stat_info *i, void *u
 /** Get daemon memory block statistics */
 pa_operation* pa_context_stat(pa_context *c, pa_stat_info_cb_t cb, void *userdata);
 
+/** Real-time statistics of a sink, source or stream, as collected by
+ * the IO threads of the daemon. The 32 bit counters wrap around. Please note
+ * that this structure can be extended as part of evolutionary API
+ * updates at any time in any new release. \since 6.0 */
+typedef struct pa_io_stats_info {
+    pa_subscription_event_type_t facility; /**< The kind of object, one of PA_SUBSCRIPTION_EVENT_SINK, PA_SUBSCRIPTION_EVENT_SOURCE, PA_SUBSCRIPTION_EVENT_SINK_INPUT and PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT */
+    uint32_t index;                        /**< Index of the object */
+    uint32_t xruns;                        /**< Number of underruns of sinks and playback streams, of overruns of sources and record streams */
+    uint32_t rewinds;                      /**< Number of rewinds */
+    uint64_t rewind_bytes;                 /**< Total number of bytes rewound */
+    uint32_t render_count;                 /**< Number of blocks rendered (or posted for sources) */
+    pa_usec_t render_time_p50;             /**< Median time it took to render one block */
+    pa_usec_t render_time_p99;             /**< 99th percentile of the time it took to render one block */
+    pa_usec_t render_time_max;             /**< Longest time it took to render one block */
+    pa_usec_t resample_time;               /**< Total time spent in the resampler */
+    uint32_t queue_length;                 /**< Current fill level of the buffer of a stream, in bytes */
+    uint32_t queue_length_max;             /**< Highest fill level of the buffer of a stream, in bytes */
+} pa_io_stats_info;
+
+/** Callback prototype for pa_context_get_io_stats_info_list() \since 6.0 */
+typedef void (*pa_io_stats_info_cb_t) (pa_context *c, const pa_io_stats_info *i, int eol, void *userdata);
+
+/** Get the real-time statistics of all sinks, sources and streams \since 6.0 */
+pa_operation* pa_context_get_io_stats_info_list(pa_context *c, pa_io_stats_info_cb_t cb, void *userdata);
+
 /** @} */
 
 /** @{ \name Cached Samples */
@@ -32,8 +32,9 @@
 #include <pulsecore/log.h>
 #include <pulsecore/semaphore.h>
 #include <pulsecore/macro.h>
-#include <pulsecore/mutex.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/mpscq.h>
 
 #include "asyncmsgq.h"
 
@@ -41,6 +42,7 @@ PA_STATIC_FLIST_DECLARE(asyncmsgq, 0, pa_xfree);
 PA_STATIC_FLIST_DECLARE(semaphores, 0, (void(*)(void*)) pa_semaphore_free);
 
 struct asyncmsgq_item {
+    pa_mpscq_item item; /* Needs to be the first member */
     int code;
     pa_msgobject *object;
     void *userdata;
@@ -53,8 +55,12 @@ struct asyncmsgq_item {
 
 struct pa_asyncmsgq {
     PA_REFCNT_DECLARE;
-    pa_asyncq *asyncq;
-    pa_mutex *mutex; /* only for the writer side */
+    pa_mpscq *mpscq;
+
+    /* The queue is unbounded, so writers never need to wait for
+     * room. This is never posted and only exists so that the writing
+     * side has an fd to poll on, like with a bounded queue. */
+    pa_fdsem *write_fdsem;
 
     struct asyncmsgq_item *current;
 };
@@ -62,11 +68,14 @@ struct pa_asyncmsgq {
 pa_asyncmsgq *pa_asyncmsgq_new(unsigned size) {
     pa_asyncmsgq *a;
 
+    /* The queue is unbounded now, so size is only kept for API
+     * compatibility */
+
     a = pa_xnew(pa_asyncmsgq, 1);
 
     PA_REFCNT_INIT(a);
-    pa_assert_se(a->asyncq = pa_asyncq_new(size));
-    pa_assert_se(a->mutex = pa_mutex_new(false, true));
+    pa_assert_se(a->mpscq = pa_mpscq_new());
+    pa_assert_se(a->write_fdsem = pa_fdsem_new());
     a->current = NULL;
 
     return a;
@@ -76,7 +85,7 @@ static void asyncmsgq_free(pa_asyncmsgq *a) {
     struct asyncmsgq_item *i;
     pa_assert(a);
 
-    while ((i = pa_asyncq_pop(a->asyncq, false))) {
+    while ((i = (struct asyncmsgq_item*) pa_mpscq_pop(a->mpscq, false))) {
 
         pa_assert(!i->semaphore);
 
@@ -93,8 +102,8 @@ static void asyncmsgq_free(pa_asyncmsgq *a) {
             pa_xfree(i);
     }
 
-    pa_asyncq_free(a->asyncq, NULL);
-    pa_mutex_free(a->mutex);
+    pa_mpscq_free(a->mpscq);
+    pa_fdsem_free(a->write_fdsem);
     pa_xfree(a);
 }
 
@@ -112,7 +121,7 @@ void pa_asyncmsgq_unref(pa_asyncmsgq* q) {
         asyncmsgq_free(q);
 }
 
-void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk, pa_free_cb_t free_cb) {
+static void post(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk, pa_free_cb_t free_cb, bool wakeup) {
     struct asyncmsgq_item *i;
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
@@ -132,10 +141,21 @@ void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const vo
         pa_memchunk_reset(&i->memchunk);
     i->semaphore = NULL;
 
-    /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
-    pa_mutex_lock(a->mutex);
-    pa_asyncq_post(a->asyncq, i);
-    pa_mutex_unlock(a->mutex);
+    pa_mpscq_push(a->mpscq, &i->item, wakeup);
+}
+
+void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk, pa_free_cb_t free_cb) {
+    post(a, object, code, userdata, offset, chunk, free_cb, true);
+}
+
+void pa_asyncmsgq_post_deferred(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk, pa_free_cb_t free_cb) {
+    post(a, object, code, userdata, offset, chunk, free_cb, false);
+}
+
+void pa_asyncmsgq_wakeup(pa_asyncmsgq *a) {
+    pa_assert(PA_REFCNT_VALUE(a) > 0);
+
+    pa_mpscq_wakeup(a->mpscq);
 }
 
 int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk) {
@@ -157,10 +177,7 @@ int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const voi
     if (!(i.semaphore = pa_flist_pop(PA_STATIC_FLIST_GET(semaphores))))
         i.semaphore = pa_semaphore_new(0);
 
-    /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
-    pa_mutex_lock(a->mutex);
-    pa_assert_se(pa_asyncq_push(a->asyncq, &i, true) == 0);
-    pa_mutex_unlock(a->mutex);
+    pa_mpscq_push(a->mpscq, &i.item, true);
 
     pa_semaphore_wait(i.semaphore);
 
@@ -174,7 +191,7 @@ int pa_asyncmsgq_get(pa_asyncmsgq *a, pa_msgobject **object, int *code, void **u
     pa_assert(PA_REFCNT_VALUE(a) > 0);
     pa_assert(!a->current);
 
-    if (!(a->current = pa_asyncq_pop(a->asyncq, wait_op))) {
+    if (!(a->current = (struct asyncmsgq_item*) pa_mpscq_pop(a->mpscq, wait_op))) {
 /*         pa_log("failure"); */
         return -1;
     }
@@ -281,37 +298,35 @@ int pa_asyncmsgq_process_one(pa_asyncmsgq *a) {
 int pa_asyncmsgq_read_fd(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    return pa_asyncq_read_fd(a->asyncq);
+    return pa_mpscq_read_fd(a->mpscq);
 }
 
 int pa_asyncmsgq_read_before_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    return pa_asyncq_read_before_poll(a->asyncq);
+    return pa_mpscq_read_before_poll(a->mpscq);
 }
 
 void pa_asyncmsgq_read_after_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    pa_asyncq_read_after_poll(a->asyncq);
+    pa_mpscq_read_after_poll(a->mpscq);
 }
 
 int pa_asyncmsgq_write_fd(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    return pa_asyncq_write_fd(a->asyncq);
+    return pa_fdsem_get(a->write_fdsem);
 }
 
 void pa_asyncmsgq_write_before_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    pa_asyncq_write_before_poll(a->asyncq);
+    /* Nothing to do, posting never has to wait for room */
 }
 
 void pa_asyncmsgq_write_after_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
-
-    pa_asyncq_write_after_poll(a->asyncq);
 }
 
 int pa_asyncmsgq_dispatch(pa_msgobject *object, int code, void *userdata, int64_t offset, pa_memchunk *memchunk) {
@@ -24,17 +24,14 @@
 
 #include <sys/types.h>
 
-#include <pulsecore/asyncq.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/msgobject.h>
 
-/* A simple asynchronous message queue, based on pa_asyncq. In
- * contrast to pa_asyncq this one is multiple-writer safe, though
- * still not multiple-reader safe. This queue is intended to be used
- * for controlling real-time threads from normal-priority
- * threads. Multiple-writer-safety is accomplished by using a mutex on
- * the writer side. This queue is thus not useful for communication
- * between several real-time threads.
+/* A simple asynchronous message queue, based on pa_mpscq. It is
+ * multiple-writer safe, though not multiple-reader safe. This queue
+ * is intended to be used for controlling real-time threads from
+ * normal-priority threads and vice versa. Neither side takes a lock,
+ * and since the queue is unbounded posting never blocks.
  *
  * The queue takes messages consisting of:
  *    "Object" for which this messages is intended (may be NULL)
@@ -44,7 +41,11 @@
  *
  * There are two functions for submitting messages: _post and
  * _send. The former just enqueues the message asynchronously, the
- * latter waits for completion, synchronously. */
+ * latter waits for completion, synchronously.
+ *
+ * When posting many messages in a row, _post_deferred can be used to
+ * enqueue them without waking up the reader each time. Call _wakeup
+ * after the last message of such a batch. */
 
 enum {
     PA_MESSAGE_SHUTDOWN = -1/* A generic message to inform the handler of this queue to quit */
@@ -58,6 +59,8 @@ pa_asyncmsgq* pa_asyncmsgq_ref(pa_asyncmsgq *q);
 void pa_asyncmsgq_unref(pa_asyncmsgq* q);
 
 void pa_asyncmsgq_post(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk, pa_free_cb_t userdata_free_cb);
+void pa_asyncmsgq_post_deferred(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk, pa_free_cb_t userdata_free_cb);
+void pa_asyncmsgq_wakeup(pa_asyncmsgq *q);
 int pa_asyncmsgq_send(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk);
 
 int pa_asyncmsgq_get(pa_asyncmsgq *q, pa_msgobject **object, int *code, void **userdata, int64_t *offset, pa_memchunk *memchunk, bool wait);
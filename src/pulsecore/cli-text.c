@@ -270,6 +270,7 @@ char *pa_sink_list_to_string(pa_core *c) {
             "\tcurrent latency: %0.2f ms\n"
             "\tmax request: %lu KiB\n"
             "\tmax rewind: %lu KiB\n"
+            "\trewind limit: %0.2f ms\n"
             "\tmonitor source: %u\n"
             "\tsample spec: %s\n"
             "\tchannel map: %s%s%s\n"
@@ -305,6 +306,7 @@ char *pa_sink_list_to_string(pa_core *c) {
             (double) pa_sink_get_latency(sink) / (double) PA_USEC_PER_MSEC,
             (unsigned long) pa_sink_get_max_request(sink) / 1024,
             (unsigned long) pa_sink_get_max_rewind(sink) / 1024,
+            (double) sink->rewind_limit / (double) PA_USEC_PER_MSEC,
             sink->monitor_source ? sink->monitor_source->index : PA_INVALID_INDEX,
             pa_sample_spec_snprint(ss, sizeof(ss), &sink->sample_spec),
             pa_channel_map_snprint(cm, sizeof(cm), &sink->channel_map),
@@ -329,6 +331,9 @@ char *pa_sink_list_to_string(pa_core *c) {
                     "\tfixed latency: %0.2f ms\n",
                     (double) pa_sink_get_fixed_latency(sink) / PA_USEC_PER_MSEC);
 
+        if (sink->print_info)
+            sink->print_info(sink, s);
+
         if (sink->card)
             pa_strbuf_printf(s, "\tcard: %u <%s>\n", sink->card->index, sink->card->name);
         if (sink->module)
@@ -0,0 +1,531 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "convolver.h"
+
+/* The transforms are real FFTs of 2 * block_size samples, done as a
+ * complex FFT of block_size points on the even and odd samples, plus a
+ * pass that separates the two halves again. A spectrum has
+ * block_size + 1 bins, stored as separate arrays of the real and
+ * imaginary parts. */
+
+struct pa_convolver {
+    unsigned block_size, n_bins;
+    unsigned n_inputs, n_outputs;
+    unsigned n_partitions;
+
+    /* Twiddle factors of the complex FFT, e^(-2 pi i k / block_size)
+     * for k < block_size / 2 */
+    float *fft_cos, *fft_sin;
+
+    /* Twiddle factors of the real FFT, e^(-pi i k / block_size) for
+     * k <= block_size */
+    float *rfft_cos, *rfft_sin;
+
+    unsigned *bit_reverse;
+
+    /* Spectra of the filter partitions, prescaled by the normalization
+     * of the inverse transform, indexed by [input][output][partition].
+     * n_used tells for every filter how many partitions it has, i.e.
+     * its length in blocks as set with pa_convolver_set_filter(). */
+    float *filter_re, *filter_im;
+    unsigned *n_used;
+
+    /* Frequency domain delay line: the spectra of the last n_slots
+     * input blocks of every input, indexed by [input][slot]. The
+     * convolution uses the newest n_partitions of them, the others are
+     * kept for rewinding. fdl_pos is the slot holding the newest block,
+     * and fdl_filled tells how many slots up to it are still valid,
+     * i.e. weren't rewound over. */
+    float *fdl_re, *fdl_im;
+    unsigned n_slots, fdl_pos, fdl_filled;
+
+    /* The last two blocks of every input, the older one first. New
+     * samples are collected in the second half. */
+    float *input;
+
+    /* The output blocks calculated along with the spectra in the delay
+     * line, indexed by [slot][output]. The one at fdl_pos is currently
+     * being played back. */
+    float *output;
+
+    /* Position within the current block */
+    unsigned pos;
+
+    /* Scratch space */
+    float *work_re, *work_im;
+    float *acc_re, *acc_im;
+    float *time;
+
+    /* The interleaved input of the last history_filled frames, for
+     * rewinding, in a ring of history_length frames. history_pos is
+     * where the next frame goes. After a reset the ring is filled with
+     * silence. */
+    float *history;
+    unsigned history_length, history_pos, history_filled;
+};
+
+static inline float *spectrum(float *base, pa_convolver *c, unsigned n) {
+    return base + (size_t) n * c->n_bins;
+}
+
+static inline float *block_output(float *base, pa_convolver *c, unsigned slot) {
+    return base + (size_t) slot * c->n_outputs * c->block_size;
+}
+
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_inputs, unsigned n_outputs, unsigned max_length) {
+    pa_convolver *c;
+    unsigned i, j, bits;
+
+    pa_assert(block_size >= 2);
+    pa_assert(pa_is_power_of_two(block_size));
+    pa_assert(n_inputs > 0);
+    pa_assert(n_outputs > 0);
+    pa_assert(max_length > 0);
+
+    c = pa_xnew0(pa_convolver, 1);
+    c->block_size = block_size;
+    c->n_bins = block_size + 1;
+    c->n_inputs = n_inputs;
+    c->n_outputs = n_outputs;
+    c->n_partitions = (max_length + block_size - 1) / block_size;
+    c->n_slots = c->fdl_filled = c->n_partitions;
+
+    c->fft_cos = pa_xnew(float, block_size / 2);
+    c->fft_sin = pa_xnew(float, block_size / 2);
+    for (i = 0; i < block_size / 2; i++) {
+        c->fft_cos[i] = (float) cos(2 * M_PI * i / block_size);
+        c->fft_sin[i] = (float) -sin(2 * M_PI * i / block_size);
+    }
+
+    c->rfft_cos = pa_xnew(float, c->n_bins);
+    c->rfft_sin = pa_xnew(float, c->n_bins);
+    for (i = 0; i < c->n_bins; i++) {
+        c->rfft_cos[i] = (float) cos(M_PI * i / block_size);
+        c->rfft_sin[i] = (float) -sin(M_PI * i / block_size);
+    }
+
+    bits = pa_ulog2(block_size);
+    c->bit_reverse = pa_xnew(unsigned, block_size);
+    for (i = 0; i < block_size; i++) {
+        unsigned r = 0;
+
+        for (j = 0; j < bits; j++)
+            if (i & (1U << j))
+                r |= 1U << (bits - 1 - j);
+
+        c->bit_reverse[i] = r;
+    }
+
+    c->filter_re = pa_xnew0(float, (size_t) n_inputs * n_outputs * c->n_partitions * c->n_bins);
+    c->filter_im = pa_xnew0(float, (size_t) n_inputs * n_outputs * c->n_partitions * c->n_bins);
+    c->n_used = pa_xnew0(unsigned, n_inputs * n_outputs);
+
+    c->fdl_re = pa_xnew0(float, (size_t) n_inputs * c->n_slots * c->n_bins);
+    c->fdl_im = pa_xnew0(float, (size_t) n_inputs * c->n_slots * c->n_bins);
+
+    c->input = pa_xnew0(float, (size_t) n_inputs * 2 * block_size);
+    c->output = pa_xnew0(float, (size_t) c->n_slots * n_outputs * block_size);
+
+    c->work_re = pa_xnew(float, block_size);
+    c->work_im = pa_xnew(float, block_size);
+    c->acc_re = pa_xnew(float, c->n_bins);
+    c->acc_im = pa_xnew(float, c->n_bins);
+    c->time = pa_xnew(float, 2 * block_size);
+
+    return c;
+}
+
+void pa_convolver_free(pa_convolver *c) {
+    pa_assert(c);
+
+    pa_xfree(c->fft_cos);
+    pa_xfree(c->fft_sin);
+    pa_xfree(c->rfft_cos);
+    pa_xfree(c->rfft_sin);
+    pa_xfree(c->bit_reverse);
+    pa_xfree(c->filter_re);
+    pa_xfree(c->filter_im);
+    pa_xfree(c->n_used);
+    pa_xfree(c->fdl_re);
+    pa_xfree(c->fdl_im);
+    pa_xfree(c->input);
+    pa_xfree(c->output);
+    pa_xfree(c->work_re);
+    pa_xfree(c->work_im);
+    pa_xfree(c->acc_re);
+    pa_xfree(c->acc_im);
+    pa_xfree(c->time);
+    pa_xfree(c->history);
+    pa_xfree(c);
+}
+
+/* In-place radix-2 complex FFT of block_size points on work_re/work_im,
+ * without any normalization */
+static void fft(pa_convolver *c, bool inverse) {
+    float *re = c->work_re, *im = c->work_im;
+    unsigned n = c->block_size, size, i, j;
+
+    for (i = 0; i < n; i++) {
+        unsigned r = c->bit_reverse[i];
+
+        if (r > i) {
+            float t;
+
+            t = re[i]; re[i] = re[r]; re[r] = t;
+            t = im[i]; im[i] = im[r]; im[r] = t;
+        }
+    }
+
+    for (size = 2; size <= n; size *= 2) {
+        unsigned half = size / 2, step = n / size;
+
+        for (j = 0; j < half; j++) {
+            float wr = c->fft_cos[j * step];
+            float wi = inverse ? -c->fft_sin[j * step] : c->fft_sin[j * step];
+
+            for (i = j; i < n; i += size) {
+                unsigned k = i + half;
+                float tr = wr * re[k] - wi * im[k];
+                float ti = wr * im[k] + wi * re[k];
+
+                re[k] = re[i] - tr;
+                im[k] = im[i] - ti;
+                re[i] += tr;
+                im[i] += ti;
+            }
+        }
+    }
+}
+
+/* Transforms 2 * block_size real samples of src into a spectrum */
+static void rfft(pa_convolver *c, const float *src, float *dst_re, float *dst_im) {
+    unsigned n = c->block_size, k;
+
+    for (k = 0; k < n; k++) {
+        c->work_re[k] = src[2 * k];
+        c->work_im[k] = src[2 * k + 1];
+    }
+
+    fft(c, false);
+
+    /* Split the spectrum of the packed signal Z into the spectra of the
+     * even samples E and the odd samples O, and combine them to
+     * X[k] = E[k] + e^(-pi i k / n) * O[k] */
+    for (k = 0; k <= n; k++) {
+        unsigned a = k & (n - 1), b = (n - k) & (n - 1);
+        float e_re = 0.5f * (c->work_re[a] + c->work_re[b]);
+        float e_im = 0.5f * (c->work_im[a] - c->work_im[b]);
+        float o_re = 0.5f * (c->work_im[a] + c->work_im[b]);
+        float o_im = -0.5f * (c->work_re[a] - c->work_re[b]);
+
+        dst_re[k] = e_re + c->rfft_cos[k] * o_re - c->rfft_sin[k] * o_im;
+        dst_im[k] = e_im + c->rfft_cos[k] * o_im + c->rfft_sin[k] * o_re;
+    }
+}
+
+/* The inverse of rfft(), except that the result is scaled by
+ * 2 * block_size */
+static void irfft(pa_convolver *c, const float *src_re, const float *src_im, float *dst) {
+    unsigned n = c->block_size, k;
+
+    for (k = 0; k < n; k++) {
+        float e_re = src_re[k] + src_re[n - k];
+        float e_im = src_im[k] - src_im[n - k];
+        float d_re = src_re[k] - src_re[n - k];
+        float d_im = src_im[k] + src_im[n - k];
+
+        /* O = D * e^(pi i k / n), Z = E + i * O */
+        float o_re = c->rfft_cos[k] * d_re + c->rfft_sin[k] * d_im;
+        float o_im = c->rfft_cos[k] * d_im - c->rfft_sin[k] * d_re;
+
+        c->work_re[k] = e_re - o_im;
+        c->work_im[k] = e_im + o_re;
+    }
+
+    fft(c, true);
+
+    for (k = 0; k < n; k++) {
+        dst[2 * k] = c->work_re[k];
+        dst[2 * k + 1] = c->work_im[k];
+    }
+}
+
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *response, unsigned stride, unsigned length) {
+    unsigned p, j, n_used, n = c->block_size;
+    float scale;
+    size_t base;
+
+    pa_assert(c);
+    pa_assert(input < c->n_inputs);
+    pa_assert(output < c->n_outputs);
+    pa_assert(response || length == 0);
+    pa_assert(stride > 0);
+    pa_assert(length <= c->n_partitions * n);
+
+    n_used = (length + n - 1) / n;
+    scale = 1.0f / (2 * n);
+    base = ((size_t) input * c->n_outputs + output) * c->n_partitions;
+
+    /* Each partition is zero padded to twice its size, so that the
+     * second half of the circular convolution is the linear one */
+    for (p = 0; p < n_used; p++) {
+        for (j = 0; j < n; j++) {
+            unsigned s = p * n + j;
+
+            c->time[j] = s < length ? response[(size_t) s * stride] * scale : 0.0f;
+            c->time[n + j] = 0.0f;
+        }
+
+        rfft(c, c->time, spectrum(c->filter_re, c, base + p), spectrum(c->filter_im, c, base + p));
+    }
+
+    c->n_used[input * c->n_outputs + output] = n_used;
+}
+
+static void process_block(pa_convolver *c) {
+    unsigned i, o, p, k, n = c->block_size;
+    float *out;
+
+    c->fdl_pos = (c->fdl_pos + 1) % c->n_slots;
+    c->fdl_filled = PA_MIN(c->fdl_filled + 1, c->n_slots);
+
+    for (i = 0; i < c->n_inputs; i++) {
+        float *in = c->input + (size_t) i * 2 * n;
+        unsigned slot = i * c->n_slots + c->fdl_pos;
+
+        rfft(c, in, spectrum(c->fdl_re, c, slot), spectrum(c->fdl_im, c, slot));
+        memmove(in, in + n, n * sizeof(float));
+    }
+
+    out = block_output(c->output, c, c->fdl_pos);
+
+    for (o = 0; o < c->n_outputs; o++) {
+        memset(c->acc_re, 0, c->n_bins * sizeof(float));
+        memset(c->acc_im, 0, c->n_bins * sizeof(float));
+
+        for (i = 0; i < c->n_inputs; i++) {
+            size_t base = ((size_t) i * c->n_outputs + o) * c->n_partitions;
+            unsigned n_used = c->n_used[i * c->n_outputs + o];
+
+            for (p = 0; p < n_used; p++) {
+                unsigned slot = i * c->n_slots + (c->fdl_pos + c->n_slots - p) % c->n_slots;
+                const float *xr = spectrum(c->fdl_re, c, slot);
+                const float *xi = spectrum(c->fdl_im, c, slot);
+                const float *hr = spectrum(c->filter_re, c, base + p);
+                const float *hi = spectrum(c->filter_im, c, base + p);
+
+                for (k = 0; k < c->n_bins; k++) {
+                    c->acc_re[k] += xr[k] * hr[k] - xi[k] * hi[k];
+                    c->acc_im[k] += xr[k] * hi[k] + xi[k] * hr[k];
+                }
+            }
+        }
+
+        irfft(c, c->acc_re, c->acc_im, c->time);
+        memcpy(out + (size_t) o * n, c->time + n, n * sizeof(float));
+    }
+}
+
+/* Like pa_convolver_process(), but dst may be NULL to drop the output */
+static void run(pa_convolver *c, const float *src, float *dst, unsigned n) {
+    unsigned f, i, o, bs;
+    float *out;
+
+    bs = c->block_size;
+    out = block_output(c->output, c, c->fdl_pos);
+
+    for (f = 0; f < n; f++) {
+        for (i = 0; i < c->n_inputs; i++)
+            c->input[(size_t) i * 2 * bs + bs + c->pos] = *(src++);
+
+        if (dst)
+            for (o = 0; o < c->n_outputs; o++)
+                *(dst++) = out[(size_t) o * bs + c->pos];
+
+        if (++c->pos >= bs) {
+            process_block(c);
+            out = block_output(c->output, c, c->fdl_pos);
+            c->pos = 0;
+        }
+    }
+}
+
+static void record_history(pa_convolver *c, const float *src, unsigned n) {
+    unsigned k;
+
+    if (c->history_length == 0)
+        return;
+
+    /* Only the newest frames fit */
+    if (n > c->history_length) {
+        src += (size_t) (n - c->history_length) * c->n_inputs;
+        n = c->history_length;
+    }
+
+    while (n > 0) {
+        k = PA_MIN(n, c->history_length - c->history_pos);
+        memcpy(c->history + (size_t) c->history_pos * c->n_inputs, src, (size_t) k * c->n_inputs * sizeof(float));
+
+        c->history_pos = (c->history_pos + k) % c->history_length;
+        c->history_filled = PA_MIN(c->history_filled + k, c->history_length);
+        src += (size_t) k * c->n_inputs;
+        n -= k;
+    }
+}
+
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n) {
+    pa_assert(c);
+    pa_assert(src);
+    pa_assert(dst);
+
+    record_history(c, src, n);
+    run(c, src, dst, n);
+}
+
+static void clear_state(pa_convolver *c) {
+    memset(c->fdl_re, 0, (size_t) c->n_inputs * c->n_slots * c->n_bins * sizeof(float));
+    memset(c->fdl_im, 0, (size_t) c->n_inputs * c->n_slots * c->n_bins * sizeof(float));
+    memset(c->input, 0, (size_t) c->n_inputs * 2 * c->block_size * sizeof(float));
+    memset(c->output, 0, (size_t) c->n_slots * c->n_outputs * c->block_size * sizeof(float));
+    c->fdl_pos = 0;
+    c->fdl_filled = c->n_slots;
+    c->pos = 0;
+}
+
+void pa_convolver_reset(pa_convolver *c) {
+    pa_assert(c);
+
+    clear_state(c);
+
+    if (c->history)
+        memset(c->history, 0, (size_t) c->history_length * c->n_inputs * sizeof(float));
+
+    c->history_pos = 0;
+    c->history_filled = c->history_length;
+}
+
+void pa_convolver_rewind(pa_convolver *c, unsigned n) {
+    unsigned bs, pos, n_blocks, start, f, i;
+
+    pa_assert(c);
+
+    if (n == 0)
+        return;
+
+    bs = c->block_size;
+
+    /* How many blocks were completed in the last n frames, and where in
+     * its block the frame we go back to is */
+    n_blocks = n > c->pos ? (n - c->pos + bs - 1) / bs : 0;
+    pos = c->pos + n_blocks * bs - n;
+
+    /* The block we go back to needs the spectra its output was
+     * calculated from, and its input so far plus that of the block
+     * before it, which are transformed together */
+    if (c->n_partitions + n_blocks > c->fdl_filled || n + bs + pos > c->history_filled) {
+        pa_convolver_reset(c);
+        return;
+    }
+
+    c->fdl_pos = (c->fdl_pos + c->n_slots - n_blocks) % c->n_slots;
+    c->fdl_filled -= n_blocks;
+    c->pos = pos;
+
+    c->history_filled -= n;
+    c->history_pos = (c->history_pos + c->history_length - n) % c->history_length;
+
+    start = (c->history_pos + c->history_length - bs - pos) % c->history_length;
+
+    for (f = 0; f < bs + pos; f++) {
+        const float *h = c->history + (size_t) ((start + f) % c->history_length) * c->n_inputs;
+
+        for (i = 0; i < c->n_inputs; i++)
+            c->input[(size_t) i * 2 * bs + f] = h[i];
+    }
+}
+
+void pa_convolver_set_max_rewind(pa_convolver *c, unsigned n) {
+    unsigned length, n_slots, i, q;
+    float *fdl_re, *fdl_im, *output;
+
+    pa_assert(c);
+
+    /* A rewind may go back n frames and then to the start of the block
+     * before the one it lands in */
+    length = n > 0 ? n + 2 * c->block_size : 0;
+    n_slots = c->n_partitions + (n + c->block_size - 1) / c->block_size;
+
+    if (length == c->history_length)
+        return;
+
+    pa_xfree(c->history);
+    c->history = length > 0 ? pa_xnew(float, (size_t) length * c->n_inputs) : NULL;
+    c->history_length = length;
+    c->history_pos = c->history_filled = 0;
+
+    if (n_slots == c->n_slots)
+        return;
+
+    /* Move over what the convolution needs, without anything to rewind
+     * to yet */
+    fdl_re = pa_xnew0(float, (size_t) c->n_inputs * n_slots * c->n_bins);
+    fdl_im = pa_xnew0(float, (size_t) c->n_inputs * n_slots * c->n_bins);
+    output = pa_xnew0(float, (size_t) n_slots * c->n_outputs * c->block_size);
+
+    for (i = 0; i < c->n_inputs; i++)
+        for (q = 0; q < c->n_partitions; q++) {
+            unsigned from = i * c->n_slots + (c->fdl_pos + c->n_slots - q) % c->n_slots;
+            unsigned to = i * n_slots + c->n_partitions - 1 - q;
+
+            memcpy(spectrum(fdl_re, c, to), spectrum(c->fdl_re, c, from), c->n_bins * sizeof(float));
+            memcpy(spectrum(fdl_im, c, to), spectrum(c->fdl_im, c, from), c->n_bins * sizeof(float));
+        }
+
+    memcpy(block_output(output, c, c->n_partitions - 1), block_output(c->output, c, c->fdl_pos),
+           (size_t) c->n_outputs * c->block_size * sizeof(float));
+
+    pa_xfree(c->fdl_re);
+    pa_xfree(c->fdl_im);
+    pa_xfree(c->output);
+
+    c->fdl_re = fdl_re;
+    c->fdl_im = fdl_im;
+    c->output = output;
+    c->n_slots = n_slots;
+    c->fdl_pos = c->n_partitions - 1;
+    c->fdl_filled = c->n_partitions;
+}
+
+unsigned pa_convolver_get_latency(pa_convolver *c) {
+    pa_assert(c);
+
+    return c->block_size;
+}
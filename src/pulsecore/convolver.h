@@ -0,0 +1,70 @@
+#ifndef foopulsecoreconvolverhfoo
+#define foopulsecoreconvolverhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Convolves a number of input channels with impulse responses and mixes
+ * the results into a number of output channels, i.e. output channel o
+ * is the sum over all input channels i of input i convolved with the
+ * filter (i, o).
+ *
+ * The work is done in the frequency domain, with uniformly partitioned
+ * overlap-save: the impulse responses are cut into partitions of
+ * block_size samples each, and every block of block_size input samples
+ * costs one FFT per input channel, one inverse FFT per output channel
+ * and a multiply-add of the spectra per partition. That is cheap enough
+ * for impulse responses of many thousand samples. The price is a fixed
+ * latency of block_size samples. */
+
+typedef struct pa_convolver pa_convolver;
+
+/* block_size must be a power of two. The filters are initially
+ * silent, and they may be at most max_length samples long. */
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_inputs, unsigned n_outputs, unsigned max_length);
+void pa_convolver_free(pa_convolver *c);
+
+/* Sets the impulse response of the filter from input channel 'input' to
+ * output channel 'output'. Sample j of the response is read from
+ * response[j * stride], so it can be picked directly from interleaved
+ * data. */
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *response, unsigned stride, unsigned length);
+
+/* Processes n frames of interleaved float samples. src has n_inputs
+ * channels, dst n_outputs channels. The output is delayed by
+ * block_size frames. */
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n);
+
+/* Drops all history, as if only silence had been processed so far */
+void pa_convolver_reset(pa_convolver *c);
+
+/* Takes back the last n frames that were processed, so that the ones
+ * which replace them are convolved as if the old ones never happened.
+ * The convolver keeps enough of its input and of the spectra of past
+ * blocks for that, up to the amount set with
+ * pa_convolver_set_max_rewind(), which is 0 initially. This costs no
+ * more than copying two blocks, however long the filters are. Anything
+ * further back is forgotten, and the convolver starts from silence. */
+void pa_convolver_rewind(pa_convolver *c, unsigned n);
+void pa_convolver_set_max_rewind(pa_convolver *c, unsigned n);
+
+/* The delay of the output, in frames */
+unsigned pa_convolver_get_latency(pa_convolver *c);
+
+#endif
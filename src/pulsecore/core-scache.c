@@ -68,7 +68,7 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_core *c = userdata;
 
     pa_assert(c);
-    pa_assert(c->mainloop == m);
+    pa_assert(pa_time_wheel_get_api(c->time_wheel) == m);
     pa_assert(c->scache_auto_unload_event == e);
 
     pa_scache_unload_unused(c);
@@ -287,7 +287,7 @@ void pa_scache_free_all(pa_core *c) {
     pa_idxset_remove_all(c->scache, (pa_free_cb_t) free_entry);
 
     if (c->scache_auto_unload_event) {
-        c->mainloop->time_free(c->scache_auto_unload_event);
+        pa_core_rttime_free(c, c->scache_auto_unload_event);
         c->scache_auto_unload_event = NULL;
     }
 }
@@ -90,6 +90,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
 
     c->state = PA_CORE_STARTUP;
     c->mainloop = m;
+    c->time_wheel = pa_time_wheel_new(m, PA_USEC_PER_MSEC);
 
     c->clients = pa_idxset_new(NULL, NULL);
     c->cards = pa_idxset_new(NULL, NULL);
@@ -112,6 +113,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
     pa_channel_map_init_extend(&c->default_channel_map, c->default_sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
     c->default_n_fragments = 4;
     c->default_fragment_size_msec = 25;
+    c->default_rewind_limit_msec = 0;
 
     c->deferred_volume_safety_margin_usec = 8000;
     c->deferred_volume_extra_delay_usec = 0;
@@ -146,6 +148,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
     c->disable_remixing = false;
     c->disable_lfe_remixing = false;
     c->deferred_volume = true;
+    c->partial_rewind = true;
     c->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
@@ -207,7 +210,7 @@ static void core_free(pa_object *o) {
     pa_subscription_free_all(c);
 
     if (c->exit_event)
-        c->mainloop->time_free(c->exit_event);
+        pa_core_rttime_free(c, c->exit_event);
 
     pa_assert(!c->default_source);
     pa_assert(!c->default_sink);
@@ -220,6 +223,8 @@ static void core_free(pa_object *o) {
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
         pa_hook_done(&c->hooks[j]);
 
+    pa_time_wheel_free(c->time_wheel);
+
     pa_xfree(c);
 }
 
@@ -241,7 +246,7 @@ void pa_core_check_idle(pa_core *c) {
         c->exit_event = pa_core_rttime_new(c, pa_rtclock_now() + c->exit_idle_time * PA_USEC_PER_SEC, exit_callback, c);
 
     } else if (c->exit_event && pa_idxset_size(c->clients) > 0) {
-        c->mainloop->time_free(c->exit_event);
+        pa_core_rttime_free(c, c->exit_event);
         c->exit_event = NULL;
     }
 }
@@ -287,18 +292,27 @@ void pa_core_maybe_vacuum(pa_core *c) {
 
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata) {
     struct timeval tv;
+    pa_mainloop_api *a;
 
     pa_assert(c);
-    pa_assert(c->mainloop);
+    pa_assert(c->time_wheel);
 
-    return c->mainloop->time_new(c->mainloop, pa_timeval_rtstore(&tv, usec, true), cb, userdata);
+    a = pa_time_wheel_get_api(c->time_wheel);
+    return a->time_new(a, pa_timeval_rtstore(&tv, usec, true), cb, userdata);
 }
 
 void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec) {
     struct timeval tv;
 
     pa_assert(c);
-    pa_assert(c->mainloop);
+    pa_assert(c->time_wheel);
+
+    pa_time_wheel_get_api(c->time_wheel)->time_restart(e, pa_timeval_rtstore(&tv, usec, true));
+}
+
+void pa_core_rttime_free(pa_core *c, pa_time_event *e) {
+    pa_assert(c);
+    pa_assert(c->time_wheel);
 
-    c->mainloop->time_restart(e, pa_timeval_rtstore(&tv, usec, true));
+    pa_time_wheel_get_api(c->time_wheel)->time_free(e);
 }
@@ -52,6 +52,7 @@ typedef enum pa_suspend_cause {
 #include <pulsecore/source.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/msgobject.h>
+#include <pulsecore/time-wheel.h>
 
 typedef enum pa_server_type {
     PA_SERVER_TYPE_UNSET,
@@ -146,6 +147,9 @@ struct pa_core {
 
     pa_mainloop_api *mainloop;
 
+    /* All pa_core_rttime_*() events are multiplexed on this wheel */
+    pa_time_wheel *time_wheel;
+
     /* idxset of all kinds of entities */
     pa_idxset *clients, *cards, *sinks, *sources, *sink_inputs, *source_outputs, *modules, *scache;
 
@@ -160,6 +164,7 @@ struct pa_core {
     pa_sample_spec default_sample_spec;
     uint32_t alternate_sample_rate;
     unsigned default_n_fragments, default_fragment_size_msec;
+    unsigned default_rewind_limit_msec;
     unsigned deferred_volume_safety_margin_usec;
     int deferred_volume_extra_delay_usec;
 
@@ -189,6 +194,7 @@ struct pa_core {
     bool disable_remixing:1;
     bool disable_lfe_remixing:1;
     bool deferred_volume:1;
+    bool partial_rewind:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
@@ -217,8 +223,11 @@ int pa_core_exit(pa_core *c, bool force, int retval);
 
 void pa_core_maybe_vacuum(pa_core *c);
 
-/* wrapper for c->mainloop->time_*() RT time events */
+/* RT time events, backed by c->time_wheel. Events created with
+ * pa_core_rttime_new() must only be restarted and freed with the
+ * functions below, not with c->mainloop->time_*(). */
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata);
 void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec);
+void pa_core_rttime_free(pa_core *c, pa_time_event *e);
 
 #endif
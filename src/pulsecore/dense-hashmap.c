@@ -0,0 +1,328 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "dense-hashmap.h"
+
+/* Number of entries we have room for initially, must be a power of
+ * two. The index table is always twice as large as the entry array, so
+ * it is at most half full. */
+#define MIN_ENTRIES 4U
+#define MIN_INDEX_BITS 3U
+
+/* Values of the index table that don't point to an entry */
+#define SLOT_EMPTY 0U
+#define SLOT_DELETED ((uint32_t) -1)
+
+struct dense_entry {
+    void *key;
+    void *value;
+    unsigned hash;
+    bool valid;
+};
+
+struct pa_dense_hashmap {
+    pa_hash_func_t hash_func;
+    pa_compare_func_t compare_func;
+
+    pa_free_cb_t key_free_func;
+    pa_free_cb_t value_free_func;
+
+    /* The entries in insertion order. Removed entries stay in place
+     * with valid unset until the array is compacted, which only happens
+     * when a new entry doesn't fit anymore. */
+    struct dense_entry *entries;
+    unsigned n_allocated, n_used, n_entries;
+
+    /* Maps hashes to positions in the entry array, plus one */
+    uint32_t *index;
+    unsigned index_bits;
+};
+
+/* Spreads the hash over the upper bits, so that keys that only differ
+ * in their higher bits, like pointers, don't end up next to each other */
+static inline unsigned slot_of(pa_dense_hashmap *h, unsigned hash) {
+    return (uint32_t) (hash * 0x9E3779B1U) >> (32 - h->index_bits);
+}
+
+static inline unsigned index_mask(pa_dense_hashmap *h) {
+    return (1U << h->index_bits) - 1;
+}
+
+static void rebuild(pa_dense_hashmap *h, unsigned n_allocated) {
+    struct dense_entry *entries;
+    unsigned i, n = 0;
+
+    pa_assert(h);
+    pa_assert(n_allocated >= h->n_entries);
+
+    entries = pa_xnew(struct dense_entry, n_allocated);
+
+    for (i = 0; i < h->n_used; i++)
+        if (h->entries[i].valid)
+            entries[n++] = h->entries[i];
+
+    pa_assert(n == h->n_entries);
+
+    pa_xfree(h->entries);
+    h->entries = entries;
+    h->n_allocated = n_allocated;
+    h->n_used = n;
+
+    if (h->index_bits == 0 || (1U << h->index_bits) != 2 * n_allocated) {
+        pa_xfree(h->index);
+        h->index_bits = pa_ulog2(n_allocated) + 1;
+        h->index = pa_xnew(uint32_t, 1U << h->index_bits);
+    }
+
+    memset(h->index, 0, sizeof(uint32_t) << h->index_bits);
+
+    for (i = 0; i < n; i++) {
+        unsigned slot = slot_of(h, entries[i].hash);
+
+        while (h->index[slot] != SLOT_EMPTY)
+            slot = (slot + 1) & index_mask(h);
+
+        h->index[slot] = i + 1;
+    }
+}
+
+pa_dense_hashmap *pa_dense_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t compare_func, pa_free_cb_t key_free_func, pa_free_cb_t value_free_func) {
+    pa_dense_hashmap *h;
+
+    h = pa_xnew0(pa_dense_hashmap, 1);
+
+    h->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
+    h->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
+
+    h->key_free_func = key_free_func;
+    h->value_free_func = value_free_func;
+
+    rebuild(h, MIN_ENTRIES);
+    pa_assert(h->index_bits == MIN_INDEX_BITS);
+
+    return h;
+}
+
+pa_dense_hashmap *pa_dense_hashmap_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
+    return pa_dense_hashmap_new_full(hash_func, compare_func, NULL, NULL);
+}
+
+void pa_dense_hashmap_free(pa_dense_hashmap *h) {
+    pa_assert(h);
+
+    pa_dense_hashmap_remove_all(h);
+
+    pa_xfree(h->entries);
+    pa_xfree(h->index);
+    pa_xfree(h);
+}
+
+/* Returns the slot in the index table that points to the entry with
+ * this key, or -1 */
+static int find_slot(pa_dense_hashmap *h, unsigned hash, const void *key) {
+    unsigned slot;
+
+    for (slot = slot_of(h, hash); h->index[slot] != SLOT_EMPTY; slot = (slot + 1) & index_mask(h)) {
+        struct dense_entry *e;
+
+        if (h->index[slot] == SLOT_DELETED)
+            continue;
+
+        e = &h->entries[h->index[slot] - 1];
+
+        if (e->hash == hash && h->compare_func(e->key, key) == 0)
+            return (int) slot;
+    }
+
+    return -1;
+}
+
+int pa_dense_hashmap_put(pa_dense_hashmap *h, void *key, void *value) {
+    struct dense_entry *e;
+    unsigned hash, slot;
+
+    pa_assert(h);
+
+    hash = h->hash_func(key);
+
+    if (find_slot(h, hash, key) >= 0)
+        return -1;
+
+    /* Make room at the end of the entry array, either by getting rid
+     * of removed entries or by growing it */
+    if (h->n_used >= h->n_allocated)
+        rebuild(h, h->n_entries < h->n_allocated / 2 ? h->n_allocated : h->n_allocated * 2);
+
+    slot = slot_of(h, hash);
+    while (h->index[slot] != SLOT_EMPTY && h->index[slot] != SLOT_DELETED)
+        slot = (slot + 1) & index_mask(h);
+
+    e = &h->entries[h->n_used];
+    e->key = key;
+    e->value = value;
+    e->hash = hash;
+    e->valid = true;
+
+    h->index[slot] = ++h->n_used;
+    h->n_entries++;
+
+    return 0;
+}
+
+void* pa_dense_hashmap_get(pa_dense_hashmap *h, const void *key) {
+    int slot;
+
+    pa_assert(h);
+
+    if ((slot = find_slot(h, h->hash_func(key), key)) < 0)
+        return NULL;
+
+    return h->entries[h->index[slot] - 1].value;
+}
+
+void* pa_dense_hashmap_remove(pa_dense_hashmap *h, const void *key) {
+    struct dense_entry *e;
+    int slot;
+
+    pa_assert(h);
+
+    if ((slot = find_slot(h, h->hash_func(key), key)) < 0)
+        return NULL;
+
+    e = &h->entries[h->index[slot] - 1];
+    e->valid = false;
+    h->index[slot] = SLOT_DELETED;
+
+    pa_assert(h->n_entries >= 1);
+    h->n_entries--;
+
+    if (h->key_free_func)
+        h->key_free_func(e->key);
+
+    /* Once the map is empty, start over with a clean index table. This
+     * doesn't move any entries, so it is safe during iteration, too. */
+    if (h->n_entries == 0) {
+        h->n_used = 0;
+        memset(h->index, 0, sizeof(uint32_t) << h->index_bits);
+    }
+
+    return e->value;
+}
+
+int pa_dense_hashmap_remove_and_free(pa_dense_hashmap *h, const void *key) {
+    void *data;
+
+    pa_assert(h);
+
+    data = pa_dense_hashmap_remove(h, key);
+
+    if (data && h->value_free_func)
+        h->value_free_func(data);
+
+    return data ? 0 : -1;
+}
+
+void pa_dense_hashmap_remove_all(pa_dense_hashmap *h) {
+    unsigned i, n_used;
+
+    pa_assert(h);
+
+    /* Empty the map first, so that the free functions see a consistent
+     * state */
+    n_used = h->n_used;
+    h->n_used = 0;
+    h->n_entries = 0;
+    memset(h->index, 0, sizeof(uint32_t) << h->index_bits);
+
+    for (i = 0; i < n_used; i++) {
+        struct dense_entry e = h->entries[i];
+
+        if (!e.valid)
+            continue;
+
+        if (h->key_free_func)
+            h->key_free_func(e.key);
+
+        if (h->value_free_func)
+            h->value_free_func(e.value);
+    }
+}
+
+unsigned pa_dense_hashmap_size(pa_dense_hashmap *h) {
+    pa_assert(h);
+
+    return h->n_entries;
+}
+
+bool pa_dense_hashmap_isempty(pa_dense_hashmap *h) {
+    pa_assert(h);
+
+    return h->n_entries == 0;
+}
+
+void *pa_dense_hashmap_iterate(pa_dense_hashmap *h, void **state, const void **key) {
+    unsigned i;
+
+    pa_assert(h);
+    pa_assert(state);
+
+    if (*state == (void*) -1)
+        goto at_end;
+
+    /* The state is the position of the next entry to look at */
+    for (i = PA_PTR_TO_UINT(*state); i < h->n_used; i++) {
+        struct dense_entry *e = &h->entries[i];
+
+        if (!e->valid)
+            continue;
+
+        *state = PA_UINT_TO_PTR(i + 1);
+
+        if (key)
+            *key = e->key;
+
+        return e->value;
+    }
+
+at_end:
+    *state = (void *) -1;
+
+    if (key)
+        *key = NULL;
+
+    return NULL;
+}
+
+void* pa_dense_hashmap_first(pa_dense_hashmap *h) {
+    void *state = NULL;
+
+    pa_assert(h);
+
+    return pa_dense_hashmap_iterate(h, &state, NULL);
+}
@@ -0,0 +1,86 @@
+#ifndef foopulsecoredensehashmaphfoo
+#define foopulsecoredensehashmaphfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/def.h>
+
+#include <pulsecore/idxset.h>
+
+/* A hash table with the same semantics as pa_hashmap, but laid out for
+ * fast iteration: the entries are stored in insertion order in one
+ * contiguous array, and an open addressing index table maps hashes to
+ * positions in that array. Nothing is allocated per entry.
+ *
+ * It doesn't do any locking, like pa_hashmap. It is meant for the maps
+ * the IO threads walk on every period, such as the streams connected to
+ * a sink or source. Memory management is the user's job. The insertion
+ * order is preserved when iterating. */
+
+typedef struct pa_dense_hashmap pa_dense_hashmap;
+
+/* Create a new hashmap. Use the specified functions for hashing and comparing objects in the map */
+pa_dense_hashmap *pa_dense_hashmap_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func);
+
+/* Create a new hashmap. Use the specified functions for hashing and comparing objects in the map, and functions to free the key
+ * and value (either or both can be NULL). */
+pa_dense_hashmap *pa_dense_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t compare_func, pa_free_cb_t key_free_func, pa_free_cb_t value_free_func);
+
+/* Free the hash table. */
+void pa_dense_hashmap_free(pa_dense_hashmap *h);
+
+/* Add an entry to the hashmap. Returns non-zero when the entry already exists */
+int pa_dense_hashmap_put(pa_dense_hashmap *h, void *key, void *value);
+
+/* Return an entry from the hashmap */
+void* pa_dense_hashmap_get(pa_dense_hashmap *h, const void *key);
+
+/* Returns the data of the entry while removing */
+void* pa_dense_hashmap_remove(pa_dense_hashmap *h, const void *key);
+
+/* Removes the entry and frees the entry data. Returns a negative value if the
+ * entry is not found. */
+int pa_dense_hashmap_remove_and_free(pa_dense_hashmap *h, const void *key);
+
+/* Remove all entries but don't free the hashmap */
+void pa_dense_hashmap_remove_all(pa_dense_hashmap *h);
+
+/* Return the current number of entries of the hashmap */
+unsigned pa_dense_hashmap_size(pa_dense_hashmap *h);
+
+/* Return true if the hashmap is empty */
+bool pa_dense_hashmap_isempty(pa_dense_hashmap *h);
+
+/* May be used to iterate through the hashmap. Initially the opaque
+   pointer *state has to be set to NULL. The hashmap may not be
+   modified during iteration -- except for deleting the current entry
+   via pa_dense_hashmap_remove(). The key of the entry is returned in
+   *key, if key is non-NULL. After the last entry in the hashmap NULL
+   is returned. */
+void *pa_dense_hashmap_iterate(pa_dense_hashmap *h, void **state, const void **key);
+
+/* Return the oldest entry in the hashmap */
+void* pa_dense_hashmap_first(pa_dense_hashmap *h);
+
+/* A macro to ease iteration through all entries */
+#define PA_DENSE_HASHMAP_FOREACH(e, h, state) \
+    for ((state) = NULL, (e) = pa_dense_hashmap_iterate((h), &(state), NULL); (e); (e) = pa_dense_hashmap_iterate((h), &(state), NULL))
+
+#endif
@@ -32,11 +32,15 @@
 
 #include "hashmap.h"
 
-#define NBUCKETS 127
+/* The hash table starts with 2^MIN_BUCKET_BITS buckets. It is grown
+ * when there is more than one entry per bucket on average, and shrunk
+ * when it is less than a quarter full. */
+#define MIN_BUCKET_BITS 4U
 
 struct hashmap_entry {
     void *key;
     void *value;
+    unsigned hash;
 
     struct hashmap_entry *bucket_next, *bucket_previous;
     struct hashmap_entry *iterate_next, *iterate_previous;
@@ -49,18 +53,46 @@ struct pa_hashmap {
     pa_free_cb_t key_free_func;
     pa_free_cb_t value_free_func;
 
+    struct hashmap_entry **by_hash;
+    unsigned bucket_bits;
+
     struct hashmap_entry *iterate_list_head, *iterate_list_tail;
     unsigned n_entries;
 };
 
-#define BY_HASH(h) ((struct hashmap_entry**) ((uint8_t*) (h) + PA_ALIGN(sizeof(pa_hashmap))))
+/* Spreads the hash over the upper bits, so that hash functions that
+ * leave the lower bits unused, like the one for pointers, don't put
+ * everything into the same few buckets */
+#define BUCKET(h, hash) ((uint32_t) ((hash) * 0x9E3779B1U) >> (32 - (h)->bucket_bits))
 
 PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
 
+/* Moves all entries to a new table of 2^bits buckets */
+static void resize(pa_hashmap *h, unsigned bits) {
+    struct hashmap_entry *e;
+
+    pa_assert(h);
+
+    pa_xfree(h->by_hash);
+
+    h->bucket_bits = bits;
+    h->by_hash = pa_xnew0(struct hashmap_entry*, 1U << bits);
+
+    for (e = h->iterate_list_head; e; e = e->iterate_next) {
+        unsigned hash = BUCKET(h, e->hash);
+
+        e->bucket_next = h->by_hash[hash];
+        e->bucket_previous = NULL;
+        if (h->by_hash[hash])
+            h->by_hash[hash]->bucket_previous = e;
+        h->by_hash[hash] = e;
+    }
+}
+
 pa_hashmap *pa_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t compare_func, pa_free_cb_t key_free_func, pa_free_cb_t value_free_func) {
     pa_hashmap *h;
 
-    h = pa_xmalloc0(PA_ALIGN(sizeof(pa_hashmap)) + NBUCKETS*sizeof(struct hashmap_entry*));
+    h = pa_xnew0(pa_hashmap, 1);
 
     h->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     h->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
@@ -71,6 +103,8 @@ pa_hashmap *pa_hashmap_new_full(pa_hash_func_t hash_func, pa_compare_func_t comp
     h->n_entries = 0;
     h->iterate_list_head = h->iterate_list_tail = NULL;
 
+    resize(h, MIN_BUCKET_BITS);
+
     return h;
 }
 
@@ -99,10 +133,8 @@ static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
 
     if (e->bucket_previous)
         e->bucket_previous->bucket_next = e->bucket_next;
-    else {
-        unsigned hash = h->hash_func(e->key) % NBUCKETS;
-        BY_HASH(h)[hash] = e->bucket_next;
-    }
+    else
+        h->by_hash[BUCKET(h, e->hash)] = e->bucket_next;
 
     if (h->key_free_func)
         h->key_free_func(e->key);
@@ -112,22 +144,27 @@ static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
 
     pa_assert(h->n_entries >= 1);
     h->n_entries--;
+
+    /* This doesn't move the entries themselves, so it is fine to do
+     * while somebody iterates */
+    if (h->bucket_bits > MIN_BUCKET_BITS && h->n_entries < (1U << h->bucket_bits) / 4)
+        resize(h, h->bucket_bits - 1);
 }
 
 void pa_hashmap_free(pa_hashmap *h) {
     pa_assert(h);
 
     pa_hashmap_remove_all(h);
+    pa_xfree(h->by_hash);
     pa_xfree(h);
 }
 
 static struct hashmap_entry *hash_scan(pa_hashmap *h, unsigned hash, const void *key) {
     struct hashmap_entry *e;
     pa_assert(h);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_HASH(h)[hash]; e; e = e->bucket_next)
-        if (h->compare_func(e->key, key) == 0)
+    for (e = h->by_hash[BUCKET(h, hash)]; e; e = e->bucket_next)
+        if (e->hash == hash && h->compare_func(e->key, key) == 0)
             return e;
 
     return NULL;
@@ -139,7 +176,7 @@ int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (hash_scan(h, hash, key))
         return -1;
@@ -149,13 +186,15 @@ int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
 
     e->key = key;
     e->value = value;
+    e->hash = hash;
 
     /* Insert into hash table */
-    e->bucket_next = BY_HASH(h)[hash];
+    hash = BUCKET(h, hash);
+    e->bucket_next = h->by_hash[hash];
     e->bucket_previous = NULL;
-    if (BY_HASH(h)[hash])
-        BY_HASH(h)[hash]->bucket_previous = e;
-    BY_HASH(h)[hash] = e;
+    if (h->by_hash[hash])
+        h->by_hash[hash]->bucket_previous = e;
+    h->by_hash[hash] = e;
 
     /* Insert into iteration list */
     e->iterate_previous = h->iterate_list_tail;
@@ -172,6 +211,9 @@ int pa_hashmap_put(pa_hashmap *h, void *key, void *value) {
     h->n_entries++;
     pa_assert(h->n_entries >= 1);
 
+    if (h->n_entries > (1U << h->bucket_bits))
+        resize(h, h->bucket_bits + 1);
+
     return 0;
 }
 
@@ -181,7 +223,7 @@ void* pa_hashmap_get(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
@@ -196,7 +238,7 @@ void* pa_hashmap_remove(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
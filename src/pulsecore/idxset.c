@@ -31,14 +31,20 @@
 #include <pulse/xmalloc.h>
 #include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/once.h>
+#include <pulsecore/random.h>
 
 #include "idxset.h"
 
-#define NBUCKETS 127
+/* The hash tables start with 2^MIN_BUCKET_BITS buckets. They are grown
+ * when there is more than one entry per bucket on average, and shrunk
+ * when they are less than a quarter full. */
+#define MIN_BUCKET_BITS 4U
 
 struct idxset_entry {
     uint32_t idx;
     void *data;
+    unsigned hash;
 
     struct idxset_entry *data_next, *data_previous;
     struct idxset_entry *index_next, *index_previous;
@@ -51,23 +57,82 @@ struct pa_idxset {
 
     uint32_t current_index;
 
+    /* Two tables of 2^bucket_bits buckets each, one by data and one by
+     * index */
+    struct idxset_entry **by_data, **by_index;
+    unsigned bucket_bits;
+
     struct idxset_entry *iterate_list_head, *iterate_list_tail;
     unsigned n_entries;
 };
 
-#define BY_DATA(i) ((struct idxset_entry**) ((uint8_t*) (i) + PA_ALIGN(sizeof(pa_idxset))))
-#define BY_INDEX(i) (BY_DATA(i) + NBUCKETS)
+/* The data hash is spread over the upper bits, so that hash functions
+ * that leave the lower bits unused, like the one for pointers, don't
+ * put everything into the same few buckets. Indexes are handed out
+ * sequentially, they are distributed evenly anyway. */
+#define DATA_BUCKET(s, hash) ((uint32_t) ((hash) * 0x9E3779B1U) >> (32 - (s)->bucket_bits))
+#define INDEX_BUCKET(s, idx) ((idx) & ((1U << (s)->bucket_bits) - 1))
 
 PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
 
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3)                                        \
+    do {                                                                \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);       \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                          \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                          \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);       \
+    } while (0)
+
+/* SipHash-2-4 of a NUL terminated string. The key is chosen randomly
+ * once per process, so that nobody who can pick the names of objects,
+ * e.g. clients, can make them all collide. */
 unsigned pa_idxset_string_hash_func(const void *p) {
-    unsigned hash = 0;
-    const char *c;
+    static uint64_t key[2];
+    const uint8_t *c = p;
+    uint64_t v0, v1, v2, v3, m, b;
+    size_t length, i;
+
+    PA_ONCE_BEGIN {
+        pa_random(key, sizeof(key));
+    } PA_ONCE_END;
+
+    v0 = key[0] ^ 0x736f6d6570736575ULL;
+    v1 = key[1] ^ 0x646f72616e646f6dULL;
+    v2 = key[0] ^ 0x6c7967656e657261ULL;
+    v3 = key[1] ^ 0x7465646279746573ULL;
+
+    length = strlen(p);
+
+    for (; c + 8 <= (const uint8_t*) p + (length & ~(size_t) 7); c += 8) {
+        for (m = 0, i = 0; i < 8; i++)
+            m |= (uint64_t) c[i] << (8 * i);
+
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
 
-    for (c = p; *c; c++)
-        hash = 31 * hash + (unsigned) *c;
+    b = (uint64_t) length << 56;
+    for (i = 0; i < (length & 7); i++)
+        b |= (uint64_t) c[i] << (8 * i);
 
-    return hash;
+    v3 ^= b;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+
+    b = v0 ^ v1 ^ v2 ^ v3;
+
+    return (unsigned) (b ^ (b >> 32));
 }
 
 int pa_idxset_string_compare_func(const void *a, const void *b) {
@@ -82,10 +147,41 @@ int pa_idxset_trivial_compare_func(const void *a, const void *b) {
     return a < b ? -1 : (a > b ? 1 : 0);
 }
 
+/* Moves all entries to new tables of 2^bits buckets each */
+static void resize(pa_idxset *s, unsigned bits) {
+    struct idxset_entry *e;
+
+    pa_assert(s);
+
+    pa_xfree(s->by_data);
+
+    s->bucket_bits = bits;
+    s->by_data = pa_xnew0(struct idxset_entry*, 2U << bits);
+    s->by_index = s->by_data + (1U << bits);
+
+    for (e = s->iterate_list_head; e; e = e->iterate_next) {
+        unsigned hash = DATA_BUCKET(s, e->hash);
+
+        e->data_next = s->by_data[hash];
+        e->data_previous = NULL;
+        if (s->by_data[hash])
+            s->by_data[hash]->data_previous = e;
+        s->by_data[hash] = e;
+
+        hash = INDEX_BUCKET(s, e->idx);
+
+        e->index_next = s->by_index[hash];
+        e->index_previous = NULL;
+        if (s->by_index[hash])
+            s->by_index[hash]->index_previous = e;
+        s->by_index[hash] = e;
+    }
+}
+
 pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_idxset *s;
 
-    s = pa_xmalloc0(PA_ALIGN(sizeof(pa_idxset)) + NBUCKETS*2*sizeof(struct idxset_entry*));
+    s = pa_xnew0(pa_idxset, 1);
 
     s->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     s->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
@@ -94,6 +190,8 @@ pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_fun
     s->n_entries = 0;
     s->iterate_list_head = s->iterate_list_tail = NULL;
 
+    resize(s, MIN_BUCKET_BITS);
+
     return s;
 }
 
@@ -118,10 +216,8 @@ static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
 
     if (e->data_previous)
         e->data_previous->data_next = e->data_next;
-    else {
-        unsigned hash = s->hash_func(e->data) % NBUCKETS;
-        BY_DATA(s)[hash] = e->data_next;
-    }
+    else
+        s->by_data[DATA_BUCKET(s, e->hash)] = e->data_next;
 
     /* Remove from index hash table */
     if (e->index_next)
@@ -130,41 +226,45 @@ static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
     if (e->index_previous)
         e->index_previous->index_next = e->index_next;
     else
-        BY_INDEX(s)[e->idx % NBUCKETS] = e->index_next;
+        s->by_index[INDEX_BUCKET(s, e->idx)] = e->index_next;
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
         pa_xfree(e);
 
     pa_assert(s->n_entries >= 1);
     s->n_entries--;
+
+    /* This doesn't move the entries themselves, so it is fine to do
+     * while somebody iterates */
+    if (s->bucket_bits > MIN_BUCKET_BITS && s->n_entries < (1U << s->bucket_bits) / 4)
+        resize(s, s->bucket_bits - 1);
 }
 
 void pa_idxset_free(pa_idxset *s, pa_free_cb_t free_cb) {
     pa_assert(s);
 
     pa_idxset_remove_all(s, free_cb);
+    pa_xfree(s->by_data);
     pa_xfree(s);
 }
 
 static struct idxset_entry* data_scan(pa_idxset *s, unsigned hash, const void *p) {
     struct idxset_entry *e;
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
     pa_assert(p);
 
-    for (e = BY_DATA(s)[hash]; e; e = e->data_next)
-        if (s->compare_func(e->data, p) == 0)
+    for (e = s->by_data[DATA_BUCKET(s, hash)]; e; e = e->data_next)
+        if (e->hash == hash && s->compare_func(e->data, p) == 0)
             return e;
 
     return NULL;
 }
 
-static struct idxset_entry* index_scan(pa_idxset *s, unsigned hash, uint32_t idx) {
+static struct idxset_entry* index_scan(pa_idxset *s, uint32_t idx) {
     struct idxset_entry *e;
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_INDEX(s)[hash]; e; e = e->index_next)
+    for (e = s->by_index[INDEX_BUCKET(s, idx)]; e; e = e->index_next)
         if (e->idx == idx)
             return e;
 
@@ -177,7 +277,7 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = s->hash_func(p);
 
     if ((e = data_scan(s, hash, p))) {
         if (idx)
@@ -190,23 +290,25 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
         e = pa_xnew(struct idxset_entry, 1);
 
     e->data = p;
+    e->hash = hash;
     e->idx = s->current_index++;
 
     /* Insert into data hash table */
-    e->data_next = BY_DATA(s)[hash];
+    hash = DATA_BUCKET(s, e->hash);
+    e->data_next = s->by_data[hash];
     e->data_previous = NULL;
-    if (BY_DATA(s)[hash])
-        BY_DATA(s)[hash]->data_previous = e;
-    BY_DATA(s)[hash] = e;
+    if (s->by_data[hash])
+        s->by_data[hash]->data_previous = e;
+    s->by_data[hash] = e;
 
-    hash = e->idx % NBUCKETS;
+    hash = INDEX_BUCKET(s, e->idx);
 
     /* Insert into index hash table */
-    e->index_next = BY_INDEX(s)[hash];
+    e->index_next = s->by_index[hash];
     e->index_previous = NULL;
-    if (BY_INDEX(s)[hash])
-        BY_INDEX(s)[hash]->index_previous = e;
-    BY_INDEX(s)[hash] = e;
+    if (s->by_index[hash])
+        s->by_index[hash]->index_previous = e;
+    s->by_index[hash] = e;
 
     /* Insert into iteration list */
     e->iterate_previous = s->iterate_list_tail;
@@ -223,6 +325,9 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
     s->n_entries++;
     pa_assert(s->n_entries >= 1);
 
+    if (s->n_entries > (1U << s->bucket_bits))
+        resize(s, s->bucket_bits + 1);
+
     if (idx)
         *idx = e->idx;
 
@@ -230,14 +335,11 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 }
 
 void* pa_idxset_get_by_index(pa_idxset*s, uint32_t idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     return e->data;
@@ -249,7 +351,7 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = s->hash_func(p);
 
     if (!(e = data_scan(s, hash, p)))
         return NULL;
@@ -262,14 +364,11 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 
 void* pa_idxset_remove_by_index(pa_idxset*s, uint32_t idx) {
     struct idxset_entry *e;
-    unsigned hash;
     void *data;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     data = e->data;
@@ -285,7 +384,7 @@ void* pa_idxset_remove_by_data(pa_idxset*s, const void *data, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(data) % NBUCKETS;
+    hash = s->hash_func(data);
 
     if (!(e = data_scan(s, hash, data)))
         return NULL;
@@ -314,15 +413,12 @@ void pa_idxset_remove_all(pa_idxset *s, pa_free_cb_t free_cb) {
 }
 
 void* pa_idxset_rrobin(pa_idxset *s, uint32_t *idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
     pa_assert(idx);
 
-    hash = *idx % NBUCKETS;
-
-    e = index_scan(s, hash, *idx);
+    e = index_scan(s, *idx);
 
     if (e && e->iterate_next)
         e = e->iterate_next;
@@ -404,7 +500,6 @@ void* pa_idxset_first(pa_idxset *s, uint32_t *idx) {
 
 void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     struct idxset_entry *e;
-    unsigned hash;
 
     pa_assert(s);
     pa_assert(idx);
@@ -412,9 +507,7 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     if (*idx == PA_IDXSET_INVALID)
         return NULL;
 
-    hash = *idx % NBUCKETS;
-
-    if ((e = index_scan(s, hash, *idx))) {
+    if ((e = index_scan(s, *idx))) {
 
         e = e->iterate_next;
 
@@ -433,9 +526,7 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
 
         for ((*idx)++; *idx < s->current_index; (*idx)++) {
 
-            hash = *idx % NBUCKETS;
-
-            if ((e = index_scan(s, hash, *idx))) {
+            if ((e = index_scan(s, *idx))) {
                 *idx = e->idx;
                 return e->data;
             }
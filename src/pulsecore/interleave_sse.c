@@ -0,0 +1,259 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "cpu-x86.h"
+#include "sample-util.h"
+
+/* The intrinsics are only available if the compiler may use SSE, which
+ * is always the case on amd64 */
+#if defined (__SSE__)
+
+#include <xmmintrin.h>
+
+#define CLAMP(v) _mm_min_ps(_mm_max_ps((v), _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f))
+
+/* The kernels work on four frames at a time, the rest is left to the
+ * generic code */
+
+static void deinterleave_float_clamp_2ch_sse(const float *src, float *dst[], unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, src += 8) {
+        __m128 a = _mm_loadu_ps(src), b = _mm_loadu_ps(src + 4);
+
+        _mm_storeu_ps(dst[0] + j, CLAMP(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+        _mm_storeu_ps(dst[1] + j, CLAMP(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+
+    for (c = 0; j < n && c < 2; c++) {
+        float *rest[1] = { dst[c] + j };
+
+        pa_deinterleave_float_clamp(src + c, 2, rest, 1, n - j);
+    }
+}
+
+static void deinterleave_float_clamp_4ch_sse(const float *src, float *dst[], unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, src += 16) {
+        __m128 r0 = _mm_loadu_ps(src), r1 = _mm_loadu_ps(src + 4);
+        __m128 r2 = _mm_loadu_ps(src + 8), r3 = _mm_loadu_ps(src + 12);
+
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        _mm_storeu_ps(dst[0] + j, CLAMP(r0));
+        _mm_storeu_ps(dst[1] + j, CLAMP(r1));
+        _mm_storeu_ps(dst[2] + j, CLAMP(r2));
+        _mm_storeu_ps(dst[3] + j, CLAMP(r3));
+    }
+
+    for (c = 0; j < n && c < 4; c++) {
+        float *rest[1] = { dst[c] + j };
+
+        pa_deinterleave_float_clamp(src + c, 4, rest, 1, n - j);
+    }
+}
+
+static void deinterleave_float_clamp_6ch_sse(const float *src, float *dst[], unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, src += 24) {
+        __m128 v0 = _mm_loadu_ps(src), v1 = _mm_loadu_ps(src + 4), v2 = _mm_loadu_ps(src + 8);
+        __m128 v3 = _mm_loadu_ps(src + 12), v4 = _mm_loadu_ps(src + 16), v5 = _mm_loadu_ps(src + 20);
+        __m128 r0, r1, r2, r3, a, b;
+
+        /* Channels 0 to 3 of every frame */
+        r0 = v0;
+        r1 = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(1, 0, 3, 2));
+        r2 = v3;
+        r3 = _mm_shuffle_ps(v4, v5, _MM_SHUFFLE(1, 0, 3, 2));
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        /* Channels 4 and 5 of frames 0/1 and 2/3 */
+        a = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(3, 2, 1, 0));
+        b = _mm_shuffle_ps(v4, v5, _MM_SHUFFLE(3, 2, 1, 0));
+
+        _mm_storeu_ps(dst[0] + j, CLAMP(r0));
+        _mm_storeu_ps(dst[1] + j, CLAMP(r1));
+        _mm_storeu_ps(dst[2] + j, CLAMP(r2));
+        _mm_storeu_ps(dst[3] + j, CLAMP(r3));
+        _mm_storeu_ps(dst[4] + j, CLAMP(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+        _mm_storeu_ps(dst[5] + j, CLAMP(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+
+    for (c = 0; j < n && c < 6; c++) {
+        float *rest[1] = { dst[c] + j };
+
+        pa_deinterleave_float_clamp(src + c, 6, rest, 1, n - j);
+    }
+}
+
+static void deinterleave_float_clamp_8ch_sse(const float *src, float *dst[], unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, src += 32) {
+        __m128 r0 = _mm_loadu_ps(src), r1 = _mm_loadu_ps(src + 8);
+        __m128 r2 = _mm_loadu_ps(src + 16), r3 = _mm_loadu_ps(src + 24);
+        __m128 r4 = _mm_loadu_ps(src + 4), r5 = _mm_loadu_ps(src + 12);
+        __m128 r6 = _mm_loadu_ps(src + 20), r7 = _mm_loadu_ps(src + 28);
+
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+
+        _mm_storeu_ps(dst[0] + j, CLAMP(r0));
+        _mm_storeu_ps(dst[1] + j, CLAMP(r1));
+        _mm_storeu_ps(dst[2] + j, CLAMP(r2));
+        _mm_storeu_ps(dst[3] + j, CLAMP(r3));
+        _mm_storeu_ps(dst[4] + j, CLAMP(r4));
+        _mm_storeu_ps(dst[5] + j, CLAMP(r5));
+        _mm_storeu_ps(dst[6] + j, CLAMP(r6));
+        _mm_storeu_ps(dst[7] + j, CLAMP(r7));
+    }
+
+    for (c = 0; j < n && c < 8; c++) {
+        float *rest[1] = { dst[c] + j };
+
+        pa_deinterleave_float_clamp(src + c, 8, rest, 1, n - j);
+    }
+}
+
+static void interleave_float_clamp_2ch_sse(float * const src[], float *dst, unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, dst += 8) {
+        __m128 l = CLAMP(_mm_loadu_ps(src[0] + j)), r = CLAMP(_mm_loadu_ps(src[1] + j));
+
+        _mm_storeu_ps(dst, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(l, r));
+    }
+
+    for (c = 0; j < n && c < 2; c++) {
+        float *rest[1] = { src[c] + j };
+
+        pa_interleave_float_clamp(rest, 1, dst + c, 2, n - j);
+    }
+}
+
+static void interleave_float_clamp_4ch_sse(float * const src[], float *dst, unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, dst += 16) {
+        __m128 r0 = CLAMP(_mm_loadu_ps(src[0] + j)), r1 = CLAMP(_mm_loadu_ps(src[1] + j));
+        __m128 r2 = CLAMP(_mm_loadu_ps(src[2] + j)), r3 = CLAMP(_mm_loadu_ps(src[3] + j));
+
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        _mm_storeu_ps(dst, r0);
+        _mm_storeu_ps(dst + 4, r1);
+        _mm_storeu_ps(dst + 8, r2);
+        _mm_storeu_ps(dst + 12, r3);
+    }
+
+    for (c = 0; j < n && c < 4; c++) {
+        float *rest[1] = { src[c] + j };
+
+        pa_interleave_float_clamp(rest, 1, dst + c, 4, n - j);
+    }
+}
+
+static void interleave_float_clamp_6ch_sse(float * const src[], float *dst, unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, dst += 24) {
+        __m128 r0 = CLAMP(_mm_loadu_ps(src[0] + j)), r1 = CLAMP(_mm_loadu_ps(src[1] + j));
+        __m128 r2 = CLAMP(_mm_loadu_ps(src[2] + j)), r3 = CLAMP(_mm_loadu_ps(src[3] + j));
+        __m128 c4 = CLAMP(_mm_loadu_ps(src[4] + j)), c5 = CLAMP(_mm_loadu_ps(src[5] + j));
+        __m128 a, b;
+
+        /* Channels 0 to 3 of every frame, and channels 4 and 5 of
+         * frames 0/1 and 2/3 */
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        a = _mm_unpacklo_ps(c4, c5);
+        b = _mm_unpackhi_ps(c4, c5);
+
+        _mm_storeu_ps(dst, r0);
+        _mm_storeu_ps(dst + 4, _mm_shuffle_ps(a, r1, _MM_SHUFFLE(1, 0, 1, 0)));
+        _mm_storeu_ps(dst + 8, _mm_shuffle_ps(r1, a, _MM_SHUFFLE(3, 2, 3, 2)));
+        _mm_storeu_ps(dst + 12, r2);
+        _mm_storeu_ps(dst + 16, _mm_shuffle_ps(b, r3, _MM_SHUFFLE(1, 0, 1, 0)));
+        _mm_storeu_ps(dst + 20, _mm_shuffle_ps(r3, b, _MM_SHUFFLE(3, 2, 3, 2)));
+    }
+
+    for (c = 0; j < n && c < 6; c++) {
+        float *rest[1] = { src[c] + j };
+
+        pa_interleave_float_clamp(rest, 1, dst + c, 6, n - j);
+    }
+}
+
+static void interleave_float_clamp_8ch_sse(float * const src[], float *dst, unsigned n) {
+    unsigned c, j;
+
+    for (j = 0; j + 4 <= n; j += 4, dst += 32) {
+        __m128 r0 = CLAMP(_mm_loadu_ps(src[0] + j)), r1 = CLAMP(_mm_loadu_ps(src[1] + j));
+        __m128 r2 = CLAMP(_mm_loadu_ps(src[2] + j)), r3 = CLAMP(_mm_loadu_ps(src[3] + j));
+        __m128 r4 = CLAMP(_mm_loadu_ps(src[4] + j)), r5 = CLAMP(_mm_loadu_ps(src[5] + j));
+        __m128 r6 = CLAMP(_mm_loadu_ps(src[6] + j)), r7 = CLAMP(_mm_loadu_ps(src[7] + j));
+
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+
+        _mm_storeu_ps(dst, r0);
+        _mm_storeu_ps(dst + 4, r4);
+        _mm_storeu_ps(dst + 8, r1);
+        _mm_storeu_ps(dst + 12, r5);
+        _mm_storeu_ps(dst + 16, r2);
+        _mm_storeu_ps(dst + 20, r6);
+        _mm_storeu_ps(dst + 24, r3);
+        _mm_storeu_ps(dst + 28, r7);
+    }
+
+    for (c = 0; j < n && c < 8; c++) {
+        float *rest[1] = { src[c] + j };
+
+        pa_interleave_float_clamp(rest, 1, dst + c, 8, n - j);
+    }
+}
+
+#endif /* defined (__SSE__) */
+
+void pa_interleave_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__SSE__)
+    if (flags & PA_CPU_X86_SSE) {
+        pa_log_info("Initialising SSE optimized interleaving functions.");
+
+        pa_set_deinterleave_float_func(2, deinterleave_float_clamp_2ch_sse);
+        pa_set_deinterleave_float_func(4, deinterleave_float_clamp_4ch_sse);
+        pa_set_deinterleave_float_func(6, deinterleave_float_clamp_6ch_sse);
+        pa_set_deinterleave_float_func(8, deinterleave_float_clamp_8ch_sse);
+
+        pa_set_interleave_float_func(2, interleave_float_clamp_2ch_sse);
+        pa_set_interleave_float_func(4, interleave_float_clamp_4ch_sse);
+        pa_set_interleave_float_func(6, interleave_float_clamp_6ch_sse);
+        pa_set_interleave_float_func(8, interleave_float_clamp_8ch_sse);
+    }
+#endif /* defined (__SSE__) */
+}
@@ -0,0 +1,148 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <limits.h>
+#include <string.h>
+
+#include <pulsecore/core-util.h>
+
+#include "io-stats.h"
+
+/* log2 of PA_IO_STATS_SUB_BUCKETS */
+#define SUB_BUCKET_BITS 2
+
+static unsigned bucket_index(pa_usec_t usec) {
+    unsigned l, idx;
+
+    if (usec < PA_IO_STATS_SUB_BUCKETS)
+        return (unsigned) usec;
+
+    if (usec >= UINT32_MAX)
+        return PA_IO_STATS_N_BUCKETS - 1;
+
+    l = pa_ulog2((unsigned) usec);
+
+    /* The leading bit selects the group, the next SUB_BUCKET_BITS bits
+     * the bucket within it */
+    idx = (l - SUB_BUCKET_BITS + 1) * PA_IO_STATS_SUB_BUCKETS + (((unsigned) usec >> (l - SUB_BUCKET_BITS)) & (PA_IO_STATS_SUB_BUCKETS - 1));
+
+    return PA_MIN(idx, PA_IO_STATS_N_BUCKETS - 1);
+}
+
+/* Returns the largest value that is accounted in the bucket */
+static pa_usec_t bucket_max(unsigned idx) {
+    unsigned l, shift;
+
+    if (idx < PA_IO_STATS_SUB_BUCKETS)
+        return idx;
+
+    l = idx / PA_IO_STATS_SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    shift = l - SUB_BUCKET_BITS;
+
+    return ((pa_usec_t) (PA_IO_STATS_SUB_BUCKETS + idx % PA_IO_STATS_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+/* Called from IO context */
+void pa_io_stats_add_render(pa_io_stats *s, pa_usec_t usec) {
+    pa_assert(s);
+
+    pa_atomic_inc(&s->render_time[bucket_index(usec)]);
+    pa_io_stats_total_add(&s->render_time_total, usec);
+
+    /* There is only one writer, so no need for a CAS loop here */
+    if (usec > (pa_usec_t) (unsigned) pa_atomic_load(&s->render_time_max))
+        pa_atomic_store(&s->render_time_max, (int) PA_MIN(usec, (pa_usec_t) INT_MAX));
+}
+
+/* Called from IO context */
+void pa_io_stats_set_queue_length(pa_io_stats *s, size_t length) {
+    pa_assert(s);
+
+    pa_atomic_store(&s->queue_length, (int) length);
+
+    if (length > (size_t) (unsigned) pa_atomic_load(&s->queue_length_max))
+        pa_atomic_store(&s->queue_length_max, (int) length);
+}
+
+static pa_usec_t percentile(const uint32_t *buckets, uint32_t n, pa_usec_t max, unsigned q) {
+    uint32_t limit, sum = 0;
+    unsigned i;
+
+    if (n <= 0)
+        return 0;
+
+    limit = (uint32_t) (((uint64_t) n * q + 99) / 100);
+
+    for (i = 0; i < PA_IO_STATS_N_BUCKETS; i++) {
+        sum += buckets[i];
+
+        if (sum >= limit)
+            return PA_MIN(bucket_max(i), max);
+    }
+
+    return max;
+}
+
+static uint64_t total_load(const pa_io_stats_total *t) {
+    int seq;
+    uint32_t low, high;
+
+    do {
+        seq = pa_atomic_load(&t->seq);
+        low = (uint32_t) pa_atomic_load(&t->low);
+        high = (uint32_t) pa_atomic_load(&t->high);
+    } while ((seq & 1) || pa_atomic_load(&t->seq) != seq);
+
+    return (uint64_t) high << 32 | low;
+}
+
+/* Called from main context */
+void pa_io_stats_get_snapshot(const pa_io_stats *s, pa_io_stats_snapshot *i) {
+    uint32_t buckets[PA_IO_STATS_N_BUCKETS];
+    unsigned j;
+
+    pa_assert(s);
+    pa_assert(i);
+
+    memset(i, 0, sizeof(*i));
+
+    i->xruns = (uint32_t) pa_atomic_load(&s->xruns);
+    i->rewinds = (uint32_t) pa_atomic_load(&s->rewinds);
+    i->rewind_bytes = total_load(&s->rewind_bytes);
+
+    /* The histogram might change while we read it, but since all we do
+     * is increment the buckets this gives us a good enough picture */
+    for (j = 0; j < PA_IO_STATS_N_BUCKETS; j++) {
+        buckets[j] = (uint32_t) pa_atomic_load(&s->render_time[j]);
+        i->render_count += buckets[j];
+    }
+
+    i->render_time_max = (uint32_t) pa_atomic_load(&s->render_time_max);
+    i->render_time_p50 = percentile(buckets, i->render_count, i->render_time_max, 50);
+    i->render_time_p99 = percentile(buckets, i->render_count, i->render_time_max, 99);
+    i->render_time_total = total_load(&s->render_time_total);
+
+    i->resample_time = total_load(&s->resample_time);
+    i->queue_length = (uint32_t) pa_atomic_load(&s->queue_length);
+    i->queue_length_max = (uint32_t) pa_atomic_load(&s->queue_length_max);
+}
@@ -0,0 +1,117 @@
+#ifndef foopulsecoreiostatshfoo
+#define foopulsecoreiostatshfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <pulse/sample.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* Statistics counters of sinks, sources and streams. They are updated
+ * from the IO threads without taking any locks and can be read at any
+ * time from the main thread. Each set of counters is updated by one
+ * thread at a time only, the one the object is attached to.
+ *
+ * The counters of events are 32 bit wide and wrap around. The totals of
+ * bytes and time would wrap within days, so they are kept in 64 bits. */
+
+/* Render times are kept in a histogram with 4 buckets for each power
+ * of two, up to ~2s */
+#define PA_IO_STATS_SUB_BUCKETS 4
+#define PA_IO_STATS_N_BUCKETS (20 * PA_IO_STATS_SUB_BUCKETS)
+
+/* A 64 bit total, made of two halves. The writer makes seq odd while it
+ * updates them, and readers retry until they saw it even and unchanged
+ * around reading both. */
+typedef struct pa_io_stats_total {
+    pa_atomic_t seq;
+    pa_atomic_t low, high;
+} pa_io_stats_total;
+
+typedef struct pa_io_stats {
+    /* Underruns of sinks and playback streams, overruns of sources and
+     * record streams */
+    pa_atomic_t xruns;
+
+    pa_atomic_t rewinds;
+    pa_io_stats_total rewind_bytes;
+
+    /* How long the object took to render or post one block, in usec */
+    pa_atomic_t render_time[PA_IO_STATS_N_BUCKETS];
+    pa_atomic_t render_time_max;
+    pa_io_stats_total render_time_total;
+
+    /* Total time spent in the resampler, in usec */
+    pa_io_stats_total resample_time;
+
+    /* Fill level of the buffer of a stream, in bytes */
+    pa_atomic_t queue_length;
+    pa_atomic_t queue_length_max;
+} pa_io_stats;
+
+/* A snapshot of the counters, as read from the main thread */
+typedef struct pa_io_stats_snapshot {
+    uint32_t xruns;
+    uint32_t rewinds;
+    uint64_t rewind_bytes;
+    uint32_t render_count;
+    pa_usec_t render_time_p50;
+    pa_usec_t render_time_p99;
+    pa_usec_t render_time_max;
+    pa_usec_t render_time_total;
+    pa_usec_t resample_time;
+    uint32_t queue_length;
+    uint32_t queue_length_max;
+} pa_io_stats_snapshot;
+
+/* Called from IO context, by the only writer */
+static inline void pa_io_stats_total_add(pa_io_stats_total *t, uint64_t v) {
+    v += (uint64_t) (uint32_t) pa_atomic_load(&t->high) << 32 | (uint32_t) pa_atomic_load(&t->low);
+
+    pa_atomic_inc(&t->seq);
+    pa_atomic_store(&t->low, (int) (uint32_t) v);
+    pa_atomic_store(&t->high, (int) (uint32_t) (v >> 32));
+    pa_atomic_inc(&t->seq);
+}
+
+static inline void pa_io_stats_add_xrun(pa_io_stats *s) {
+    pa_atomic_inc(&s->xruns);
+}
+
+static inline void pa_io_stats_add_rewind(pa_io_stats *s, size_t nbytes) {
+    pa_atomic_inc(&s->rewinds);
+    pa_io_stats_total_add(&s->rewind_bytes, nbytes);
+}
+
+static inline void pa_io_stats_add_resample(pa_io_stats *s, pa_usec_t usec) {
+    pa_io_stats_total_add(&s->resample_time, usec);
+}
+
+void pa_io_stats_add_render(pa_io_stats *s, pa_usec_t usec);
+void pa_io_stats_set_queue_length(pa_io_stats *s, size_t length);
+
+/* Called from main context */
+void pa_io_stats_get_snapshot(const pa_io_stats *s, pa_io_stats_snapshot *i);
+
+#endif
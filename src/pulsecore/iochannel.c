@@ -43,6 +43,28 @@
 
 #include "iochannel.h"
 
+#ifdef HAVE_IO_URING
+
+#define URING_BUFFER_SIZE (32*1024)
+
+struct uring_buffer {
+    struct msghdr msg;
+    struct iovec iov;
+#ifdef HAVE_CREDS
+    union {
+        struct cmsghdr hdr;
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * MAX_ANCIL_DATA_FDS)];
+    } cmsg;
+
+    /* Ancillary data that came in with the buffered data */
+    pa_cmsg_ancil_data ancil_data;
+#endif
+    size_t index, length;
+    uint8_t data[URING_BUFFER_SIZE];
+};
+
+#endif
+
 struct pa_iochannel {
     int ifd, ofd;
     int ifd_type, ofd_type;
@@ -57,6 +79,18 @@ struct pa_iochannel {
     bool no_close:1;
 
     pa_io_event* input_event, *output_event;
+
+#ifdef HAVE_IO_URING
+    /* When the channel is driven by an io_uring, readable means that
+     * there is data in the read buffer or that the next receive waits
+     * to be queued by a read, and writable that there is room in the
+     * write buffer */
+    pa_iouring *iouring;
+    struct uring_buffer *read_buffer, *write_buffer;
+    pa_iouring_op *read_op, *write_op;
+    int read_error, write_error;
+    pa_defer_event *defer_event;
+#endif
 };
 
 static void callback(pa_mainloop_api* m, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata);
@@ -76,6 +110,11 @@ static void delete_events(pa_iochannel *io) {
 static void enable_events(pa_iochannel *io) {
     pa_assert(io);
 
+#ifdef HAVE_IO_URING
+    if (io->iouring)
+        return;
+#endif
+
     if (io->hungup) {
         delete_events(io);
         return;
@@ -182,9 +221,435 @@ pa_iochannel* pa_iochannel_new(pa_mainloop_api*m, int ifd, int ofd) {
     return io;
 }
 
+#ifdef HAVE_CREDS
+
+static void close_ancil_fds(pa_cmsg_ancil_data *ancil_data) {
+    int i;
+
+    for (i = 0; i < ancil_data->nfd; i++)
+        pa_close(ancil_data->fds[i]);
+
+    ancil_data->nfd = 0;
+}
+
+static void parse_ancil_data(struct msghdr *mh, pa_cmsg_ancil_data *ancil_data) {
+    struct cmsghdr *cmh;
+
+    ancil_data->creds_valid = false;
+    ancil_data->nfd = 0;
+
+    for (cmh = CMSG_FIRSTHDR(mh); cmh; cmh = CMSG_NXTHDR(mh, cmh)) {
+
+        if (cmh->cmsg_level != SOL_SOCKET)
+            continue;
+
+        if (cmh->cmsg_type == SCM_CREDENTIALS) {
+            struct ucred u;
+            pa_assert(cmh->cmsg_len == CMSG_LEN(sizeof(struct ucred)));
+            memcpy(&u, CMSG_DATA(cmh), sizeof(struct ucred));
+
+            ancil_data->creds.gid = u.gid;
+            ancil_data->creds.uid = u.uid;
+            ancil_data->creds_valid = true;
+        }
+        else if (cmh->cmsg_type == SCM_RIGHTS) {
+            int nfd = (cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (nfd > MAX_ANCIL_DATA_FDS) {
+                int i;
+                pa_log("Trying to receive too many file descriptors!");
+                for (i = 0; i < nfd; i++)
+                    pa_close(((int*) CMSG_DATA(cmh))[i]);
+                continue;
+            }
+            memcpy(ancil_data->fds, CMSG_DATA(cmh), nfd * sizeof(int));
+            ancil_data->nfd = nfd;
+        }
+    }
+}
+
+static void init_creds_cmsg(struct cmsghdr *hdr, const pa_creds *ucred) {
+    struct ucred *u;
+
+    hdr->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+    hdr->cmsg_level = SOL_SOCKET;
+    hdr->cmsg_type = SCM_CREDENTIALS;
+
+    u = (struct ucred*) CMSG_DATA(hdr);
+
+    u->pid = getpid();
+    if (ucred) {
+        u->uid = ucred->uid;
+        u->gid = ucred->gid;
+    } else {
+        u->uid = getuid();
+        u->gid = getgid();
+    }
+}
+
+static void init_fds_cmsg(struct cmsghdr *hdr, int nfd, const int *fds) {
+    hdr->cmsg_level = SOL_SOCKET;
+    hdr->cmsg_type = SCM_RIGHTS;
+
+    memcpy(CMSG_DATA(hdr), fds, nfd * sizeof(int));
+    hdr->cmsg_len = CMSG_LEN(sizeof(int) * nfd);
+}
+
+#endif /* HAVE_CREDS */
+
+#ifdef HAVE_IO_URING
+
+static void uring_read_cb(pa_iouring *r, pa_iouring_op *op, int res, void *userdata);
+static void uring_write_cb(pa_iouring *r, pa_iouring_op *op, int res, void *userdata);
+
+/* A stream socket doesn't tell where in the received data ancillary
+ * data belongs, recvmsg() happily returns the tail of one message
+ * together with the start of the next one which carries the file
+ * descriptors. So we never read more than the caller asked for: a
+ * caller like pstream never asks for more than the rest of the current
+ * frame, and ancillary data can then only arrive with the first byte
+ * of the buffer. */
+static void uring_submit_read(pa_iochannel *io, size_t l) {
+    struct uring_buffer *b = io->read_buffer;
+
+    pa_assert(!io->read_op);
+    pa_assert(l > 0);
+
+    b->index = b->length = 0;
+    b->iov.iov_base = b->data;
+    b->iov.iov_len = PA_MIN(l, sizeof(b->data));
+    b->msg.msg_iov = &b->iov;
+    b->msg.msg_iovlen = 1;
+#ifdef HAVE_CREDS
+    b->msg.msg_control = &b->cmsg;
+    b->msg.msg_controllen = sizeof(b->cmsg);
+#endif
+    b->msg.msg_flags = 0;
+
+    io->read_op = pa_iouring_recvmsg(io->iouring, io->ifd, &b->msg, 0, uring_read_cb, io);
+}
+
+static void uring_submit_write(pa_iochannel *io) {
+    struct uring_buffer *b = io->write_buffer;
+
+    pa_assert(!io->write_op);
+    pa_assert(b->length > 0);
+
+    b->iov.iov_base = b->data;
+    b->iov.iov_len = b->length;
+
+    io->write_op = pa_iouring_sendmsg(io->iouring, io->ofd, &b->msg, MSG_NOSIGNAL, uring_write_cb, io);
+}
+
+static void uring_read_cb(pa_iouring *r, pa_iouring_op *op, int res, void *userdata) {
+    pa_iochannel *io = userdata;
+    struct uring_buffer *b;
+
+    pa_assert(io);
+    pa_assert(io->read_op == op);
+
+    io->read_op = NULL;
+    b = io->read_buffer;
+
+    if (res == -EINTR || res == -EAGAIN) {
+        uring_submit_read(io, b->iov.iov_len);
+        return;
+    }
+
+    if (res > 0) {
+        b->length = (size_t) res;
+#ifdef HAVE_CREDS
+        parse_ancil_data(&b->msg, &b->ancil_data);
+#endif
+        io->readable = true;
+    } else {
+        /* End of file or error, which is reported by the next read */
+        io->read_error = -res;
+        io->hungup = true;
+    }
+
+    if (io->callback)
+        io->callback(io, io->userdata);
+}
+
+static void uring_write_cb(pa_iouring *r, pa_iouring_op *op, int res, void *userdata) {
+    pa_iochannel *io = userdata;
+    struct uring_buffer *b;
+    bool changed = false;
+
+    pa_assert(io);
+    pa_assert(io->write_op == op);
+
+    io->write_op = NULL;
+    b = io->write_buffer;
+
+    if (res == -EINTR || res == -EAGAIN) {
+        uring_submit_write(io);
+        return;
+    }
+
+    if (res < 0) {
+        /* Reported by the next write */
+        io->write_error = -res;
+
+        if (!io->hungup) {
+            io->hungup = true;
+            changed = true;
+        }
+
+    } else {
+        pa_assert((size_t) res <= b->length);
+
+        memmove(b->data, b->data + res, b->length - (size_t) res);
+        b->length -= (size_t) res;
+
+        /* Ancillary data is only sent along with the first chunk */
+        b->msg.msg_control = NULL;
+        b->msg.msg_controllen = 0;
+
+        if (b->length > 0)
+            uring_submit_write(io);
+    }
+
+    if (!io->writable) {
+        io->writable = true;
+        changed = true;
+    }
+
+    if (changed && io->callback)
+        io->callback(io, io->userdata);
+}
+
+static void uring_defer_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_iochannel *io = userdata;
+
+    pa_assert(io);
+    pa_assert(io->defer_event == e);
+
+    m->defer_enable(e, 0);
+
+    /* There is still data in the read buffer, just like poll() would
+     * tell us again about a socket that hasn't been drained */
+    if (io->readable && io->callback)
+        io->callback(io, io->userdata);
+}
+
+static ssize_t uring_read(pa_iochannel *io, void *data, size_t l, pa_cmsg_ancil_data *ancil_data) {
+    struct uring_buffer *b = io->read_buffer;
+    size_t n;
+
+    if (b->index >= b->length) {
+
+        if (io->read_error > 0) {
+            errno = io->read_error;
+            return -1;
+        }
+
+        if (io->hungup)
+            /* End of file */
+            return 0;
+
+        /* Now we know how much the caller wants */
+        if (!io->read_op)
+            uring_submit_read(io, l);
+
+        io->readable = false;
+        errno = EAGAIN;
+        return -1;
+    }
+
+#ifdef HAVE_CREDS
+    /* Ancillary data belongs to the first byte of the buffer */
+    if (b->index == 0) {
+        if (ancil_data) {
+            *ancil_data = b->ancil_data;
+            b->ancil_data.creds_valid = false;
+            b->ancil_data.nfd = 0;
+        } else
+            close_ancil_fds(&b->ancil_data);
+    } else if (ancil_data) {
+        ancil_data->creds_valid = false;
+        ancil_data->nfd = 0;
+    }
+#endif
+
+    n = PA_MIN(l, b->length - b->index);
+    memcpy(data, b->data + b->index, n);
+    b->index += n;
+
+    if (b->index >= b->length) {
+        /* If the caller wants more, the rest of its request is queued
+         * right away. Otherwise we stay readable, so that the caller
+         * comes back and tells us the size of its next read. */
+        if (n < l) {
+            io->readable = false;
+            uring_submit_read(io, l - n);
+        } else
+            io->mainloop->defer_enable(io->defer_event, 1);
+    } else
+        io->mainloop->defer_enable(io->defer_event, 1);
+
+    return (ssize_t) n;
+}
+
+static ssize_t uring_write(pa_iochannel *io, const void *data, size_t l) {
+    struct uring_buffer *b = io->write_buffer;
+    size_t n;
+
+    if (io->write_error > 0) {
+        errno = io->write_error;
+        return -1;
+    }
+
+    /* Once the kernel has seen the buffer we may not touch it anymore */
+    if (io->write_op && pa_iouring_op_is_submitted(io->write_op))
+        n = 0;
+    else
+        n = PA_MIN(l, sizeof(b->data) - b->length);
+
+    if (n > 0) {
+        memcpy(b->data + b->length, data, n);
+        b->length += n;
+
+        if (io->write_op)
+            b->iov.iov_len = b->length;
+        else
+            uring_submit_write(io);
+    }
+
+    if (n < l)
+        io->writable = false;
+
+    return (ssize_t) n;
+}
+
+#ifdef HAVE_CREDS
+
+/* Ancillary data has to go out with the first byte of a sendmsg(), so
+ * we can only attach it while nothing else is pending */
+static struct cmsghdr *uring_write_cmsg(pa_iochannel *io, size_t len) {
+    struct uring_buffer *b = io->write_buffer;
+
+    if (io->write_error > 0 || io->write_op || b->length > 0)
+        return NULL;
+
+    pa_zero(b->cmsg);
+    b->msg.msg_control = &b->cmsg;
+    b->msg.msg_controllen = len;
+
+    return &b->cmsg.hdr;
+}
+
+#endif
+
+struct uring_leftovers {
+    unsigned n_ref;
+    int fd;
+    struct uring_buffer *read_buffer, *write_buffer;
+};
+
+static void uring_leftovers_unref(void *userdata) {
+    struct uring_leftovers *l = userdata;
+
+    if (--l->n_ref > 0)
+        return;
+
+    if (l->fd >= 0)
+        pa_close(l->fd);
+
+#ifdef HAVE_CREDS
+    close_ancil_fds(&l->read_buffer->ancil_data);
+#endif
+
+    pa_xfree(l->read_buffer);
+    pa_xfree(l->write_buffer);
+    pa_xfree(l);
+}
+
+static void uring_free(pa_iochannel *io) {
+    struct uring_leftovers *l;
+
+    io->mainloop->defer_free(io->defer_event);
+
+    /* The kernel might still access the buffers and the fd of the
+     * requests in flight, so we keep them around until it is done
+     * with them. A peer that doesn't read could keep a pending write
+     * and with it the fd around forever, so the requests are canceled
+     * and shutting down the socket makes sure that those which can't
+     * be canceled anymore finish right away. */
+    if (!io->no_close && (io->read_op || io->write_op))
+        shutdown(io->ifd, SHUT_RDWR);
+
+    l = pa_xnew(struct uring_leftovers, 1);
+    l->n_ref = 1;
+    l->fd = io->no_close ? -1 : io->ifd;
+    l->read_buffer = io->read_buffer;
+    l->write_buffer = io->write_buffer;
+
+    if (io->read_op) {
+        l->n_ref++;
+        pa_iouring_op_release(io->read_op, true, uring_leftovers_unref, l);
+    }
+
+    if (io->write_op) {
+        l->n_ref++;
+        pa_iouring_op_release(io->write_op, true, uring_leftovers_unref, l);
+    }
+
+    uring_leftovers_unref(l);
+}
+
+#endif /* HAVE_IO_URING */
+
+int pa_iochannel_enable_iouring(pa_iochannel*io, pa_iouring *r) {
+#ifdef HAVE_IO_URING
+    int type;
+    socklen_t len = sizeof(type);
+
+    pa_assert(io);
+    pa_assert(r);
+    pa_assert(!io->iouring);
+    pa_assert(pa_iouring_get_mainloop_api(r) == io->mainloop);
+
+    if (io->ifd < 0 || io->ifd != io->ofd)
+        return -1;
+
+    if (getsockopt(io->ifd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_STREAM)
+        return -1;
+
+    delete_events(io);
+
+    io->iouring = r;
+    io->read_buffer = pa_xnew0(struct uring_buffer, 1);
+    io->write_buffer = pa_xnew0(struct uring_buffer, 1);
+    io->write_buffer->msg.msg_iov = &io->write_buffer->iov;
+    io->write_buffer->msg.msg_iovlen = 1;
+
+    io->defer_event = io->mainloop->defer_new(io->mainloop, uring_defer_cb, io);
+    io->mainloop->defer_enable(io->defer_event, 0);
+
+    /* The first read is queued once the owner asks for data, see
+     * uring_read() */
+    io->readable = true;
+    io->writable = true;
+    io->mainloop->defer_enable(io->defer_event, 1);
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 void pa_iochannel_free(pa_iochannel*io) {
     pa_assert(io);
 
+#ifdef HAVE_IO_URING
+    if (io->iouring) {
+        uring_free(io);
+        pa_xfree(io);
+        return;
+    }
+#endif
+
     delete_events(io);
 
     if (!io->no_close) {
@@ -215,6 +680,16 @@ bool pa_iochannel_is_hungup(pa_iochannel*io) {
     return io->hungup;
 }
 
+bool pa_iochannel_is_iouring(pa_iochannel*io) {
+    pa_assert(io);
+
+#ifdef HAVE_IO_URING
+    return !!io->iouring;
+#else
+    return false;
+#endif
+}
+
 ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
     ssize_t r;
 
@@ -223,6 +698,11 @@ ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
     pa_assert(l);
     pa_assert(io->ofd >= 0);
 
+#ifdef HAVE_IO_URING
+    if (io->iouring)
+        return uring_write(io, data, l);
+#endif
+
     r = pa_write(io->ofd, data, l, &io->ofd_type);
 
     if ((size_t) r == l)
@@ -249,6 +729,11 @@ ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l) {
     pa_assert(data);
     pa_assert(io->ifd >= 0);
 
+#ifdef HAVE_IO_URING
+    if (io->iouring)
+        return uring_read(io, data, l, NULL);
+#endif
+
     if ((r = pa_read(io->ifd, data, l, &io->ifd_type)) >= 0) {
 
         /* We also reset the hangup flag here to ensure that another
@@ -307,32 +792,37 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
         struct cmsghdr hdr;
         uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
     } cmsg;
-    struct ucred *u;
 
     pa_assert(io);
     pa_assert(data);
     pa_assert(l);
     pa_assert(io->ofd >= 0);
 
+#ifdef HAVE_IO_URING
+    if (io->iouring) {
+        struct cmsghdr *hdr;
+
+        if (!(hdr = uring_write_cmsg(io, sizeof(cmsg)))) {
+            if (io->write_error > 0) {
+                errno = io->write_error;
+                return -1;
+            }
+
+            io->writable = false;
+            return 0;
+        }
+
+        init_creds_cmsg(hdr, ucred);
+        return uring_write(io, data, l);
+    }
+#endif
+
     pa_zero(iov);
     iov.iov_base = (void*) data;
     iov.iov_len = l;
 
     pa_zero(cmsg);
-    cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(struct ucred));
-    cmsg.hdr.cmsg_level = SOL_SOCKET;
-    cmsg.hdr.cmsg_type = SCM_CREDENTIALS;
-
-    u = (struct ucred*) CMSG_DATA(&cmsg.hdr);
-
-    u->pid = getpid();
-    if (ucred) {
-        u->uid = ucred->uid;
-        u->gid = ucred->gid;
-    } else {
-        u->uid = getuid();
-        u->gid = getgid();
-    }
+    init_creds_cmsg(&cmsg.hdr, ucred);
 
     pa_zero(mh);
     mh.msg_iov = &iov;
@@ -350,7 +840,6 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
 
 ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l, int nfd, const int *fds) {
     ssize_t r;
-    int *msgdata;
     struct msghdr mh;
     struct iovec iov;
     union {
@@ -366,17 +855,31 @@ ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l,
     pa_assert(nfd > 0);
     pa_assert(nfd <= MAX_ANCIL_DATA_FDS);
 
+#ifdef HAVE_IO_URING
+    if (io->iouring) {
+        struct cmsghdr *hdr;
+
+        if (!(hdr = uring_write_cmsg(io, CMSG_SPACE(sizeof(int) * nfd)))) {
+            if (io->write_error > 0) {
+                errno = io->write_error;
+                return -1;
+            }
+
+            io->writable = false;
+            return 0;
+        }
+
+        init_fds_cmsg(hdr, nfd, fds);
+        return uring_write(io, data, l);
+    }
+#endif
+
     pa_zero(iov);
     iov.iov_base = (void*) data;
     iov.iov_len = l;
 
     pa_zero(cmsg);
-    cmsg.hdr.cmsg_level = SOL_SOCKET;
-    cmsg.hdr.cmsg_type = SCM_RIGHTS;
-
-    msgdata = (int*) CMSG_DATA(&cmsg.hdr);
-    memcpy(msgdata, fds, nfd * sizeof(int));
-    cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(int) * nfd);
+    init_fds_cmsg(&cmsg.hdr, nfd, fds);
 
     pa_zero(mh);
     mh.msg_iov = &iov;
@@ -406,6 +909,14 @@ ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l,
     pa_assert(io->ifd >= 0);
     pa_assert(ancil_data);
 
+#ifdef HAVE_IO_URING
+    if (io->iouring) {
+        ancil_data->creds_valid = false;
+        ancil_data->nfd = 0;
+        return uring_read(io, data, l, ancil_data);
+    }
+#endif
+
     if (io->ifd_type > 0) {
         ancil_data->creds_valid = false;
         ancil_data->nfd = 0;
@@ -424,38 +935,7 @@ ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l,
     mh.msg_controllen = sizeof(cmsg);
 
     if ((r = recvmsg(io->ifd, &mh, 0)) >= 0) {
-        struct cmsghdr *cmh;
-
-        ancil_data->creds_valid = false;
-        ancil_data->nfd = 0;
-
-        for (cmh = CMSG_FIRSTHDR(&mh); cmh; cmh = CMSG_NXTHDR(&mh, cmh)) {
-
-            if (cmh->cmsg_level != SOL_SOCKET)
-                continue;
-
-            if (cmh->cmsg_type == SCM_CREDENTIALS) {
-                struct ucred u;
-                pa_assert(cmh->cmsg_len == CMSG_LEN(sizeof(struct ucred)));
-                memcpy(&u, CMSG_DATA(cmh), sizeof(struct ucred));
-
-                ancil_data->creds.gid = u.gid;
-                ancil_data->creds.uid = u.uid;
-                ancil_data->creds_valid = true;
-            }
-            else if (cmh->cmsg_type == SCM_RIGHTS) {
-                int nfd = (cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int);
-                if (nfd > MAX_ANCIL_DATA_FDS) {
-                    int i;
-                    pa_log("Trying to receive too many file descriptors!");
-                    for (i = 0; i < nfd; i++)
-                        pa_close(((int*) CMSG_DATA(cmh))[i]);
-                    continue;
-                }
-                memcpy(ancil_data->fds, CMSG_DATA(cmh), nfd * sizeof(int));
-                ancil_data->nfd = nfd;
-            }
-        }
+        parse_ancil_data(&mh, ancil_data);
 
         io->readable = io->hungup = false;
         enable_events(io);
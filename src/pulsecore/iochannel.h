@@ -31,6 +31,7 @@
 
 #include <pulse/mainloop-api.h>
 #include <pulsecore/creds.h>
+#include <pulsecore/iouring.h>
 #include <pulsecore/macro.h>
 
 /* A wrapper around UNIX file descriptors for attaching them to the a
@@ -48,6 +49,20 @@ channel specify -1 for the other direction. */
 pa_iochannel* pa_iochannel_new(pa_mainloop_api*m, int ifd, int ofd);
 void pa_iochannel_free(pa_iochannel*io);
 
+/* Drive a full-duplex stream socket channel through an io_uring
+ * instead of polling its file descriptor. A read that finds no data
+ * queues a receive of the requested size and fails with EAGAIN, and
+ * writes are collected in an internal buffer that is handed to the
+ * kernel once per main loop iteration. Call this right after creating
+ * the channel. Returns 0 on success, negative if the channel can't be
+ * used with io_uring, in which case it keeps working as before. */
+int pa_iochannel_enable_iouring(pa_iochannel*io, pa_iouring *r);
+
+/* Returns true if the channel is driven by an io_uring. Only then does
+ * a read fail with EAGAIN in the normal course of things, and the
+ * channel stays readable until that happens. */
+bool pa_iochannel_is_iouring(pa_iochannel*io);
+
 /* Returns: length written on success, 0 if a retry is needed, negative value
  * on error. */
 ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l);
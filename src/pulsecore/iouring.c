@@ -0,0 +1,548 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "iouring.h"
+
+#ifdef HAVE_IO_URING
+
+/* We don't use liburing, the few bits of the ring protocol we need are
+ * simple enough to do them by hand. The submission and completion
+ * queues are shared with the kernel, so their indexes need to be
+ * accessed with the proper memory ordering. */
+
+struct pa_iouring_op {
+    pa_iouring *ring;
+
+    uint8_t opcode;
+    int fd;
+    struct msghdr *msg;
+    int flags;
+
+    pa_iouring_cb_t callback;
+    void *userdata;
+
+    bool submitted:1;
+    bool released:1;
+    bool cancel:1;
+    bool cancel_submitted:1;
+
+    pa_free_cb_t free_cb;
+    void *free_data;
+
+    PA_LLIST_FIELDS(pa_iouring_op);
+};
+
+struct pa_iouring {
+    pa_mainloop_api *mainloop;
+    int fd;
+
+    pa_io_event *io_event;
+    pa_defer_event *defer_event;
+
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size;
+
+    unsigned *sq_head, *sq_tail, *sq_flags, *sq_array;
+    unsigned sq_mask, sq_entries;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *cq_head, *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Requests not yet placed in the submission queue, in FIFO order */
+    PA_LLIST_HEAD(pa_iouring_op, queued);
+    pa_iouring_op *queued_tail;
+
+    /* Requests placed in the submission queue, waiting for their
+     * completion */
+    PA_LLIST_HEAD(pa_iouring_op, in_flight);
+
+    /* Cancellations of requests in in_flight which still need to be
+     * placed in the submission queue resp. wait for their completion */
+    unsigned n_cancel_queued;
+    unsigned n_cancel_in_flight;
+
+    /* The kernel didn't take everything in the submission queue on the
+     * last attempt */
+    bool sq_pending;
+};
+
+static inline unsigned load_acquire(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned *p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static int ring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void op_free(pa_iouring_op *op) {
+    pa_iouring *r = op->ring;
+
+    if (op->cancel && !op->cancel_submitted) {
+        pa_assert(r->n_cancel_queued > 0);
+        r->n_cancel_queued--;
+    }
+
+    if (op->released && op->free_cb)
+        op->free_cb(op->free_data);
+
+    pa_xfree(op);
+}
+
+static void dequeue(pa_iouring *r, pa_iouring_op *op) {
+    if (r->queued_tail == op)
+        r->queued_tail = op->prev;
+
+    PA_LLIST_REMOVE(pa_iouring_op, r->queued, op);
+}
+
+static void update_defer(pa_iouring *r) {
+    r->mainloop->defer_enable(r->defer_event, r->queued || r->n_cancel_queued > 0 || r->sq_pending);
+}
+
+/* Move as many queued requests and cancellations to the submission
+ * queue as fit and tell the kernel about everything in there that it
+ * hasn't consumed yet, all with a single system call. */
+static void submit(pa_iouring *r) {
+    unsigned head, tail;
+    pa_iouring_op *op;
+
+    head = load_acquire(r->sq_head);
+    tail = *r->sq_tail;
+
+    if (r->n_cancel_queued > 0)
+        PA_LLIST_FOREACH(op, r->in_flight) {
+            struct io_uring_sqe *sqe;
+
+            if (!op->cancel || op->cancel_submitted)
+                continue;
+
+            if (tail - head >= r->sq_entries)
+                break;
+
+            sqe = &r->sqes[tail & r->sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (uintptr_t) op;
+            sqe->user_data = 0;
+            r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+            tail++;
+
+            op->cancel_submitted = true;
+            r->n_cancel_queued--;
+            r->n_cancel_in_flight++;
+        }
+
+    while ((op = r->queued) && tail - head < r->sq_entries) {
+        struct io_uring_sqe *sqe;
+
+        sqe = &r->sqes[tail & r->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = op->opcode;
+        sqe->fd = op->fd;
+        sqe->addr = (uintptr_t) op->msg;
+        sqe->len = 1;
+        sqe->msg_flags = (uint32_t) op->flags;
+        sqe->user_data = (uintptr_t) op;
+        r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+        tail++;
+
+        dequeue(r, op);
+        PA_LLIST_PREPEND(pa_iouring_op, r->in_flight, op);
+        op->submitted = true;
+    }
+
+    store_release(r->sq_tail, tail);
+
+    if (tail != head) {
+        /* If the kernel is busy flushing completions it failed to post
+         * earlier, the entries stay in the submission queue. We try
+         * again in the next iteration, after reaping made room. */
+        if (ring_enter(r->fd, tail - head, 0, 0) < 0 && errno != EBUSY && errno != EAGAIN && errno != EINTR)
+            pa_log_error("io_uring_enter(): %s", pa_cstrerror(errno));
+    }
+
+    r->sq_pending = load_acquire(r->sq_head) != tail;
+
+    update_defer(r);
+}
+
+/* Dispatch all completions the kernel posted so far */
+static void reap(pa_iouring *r) {
+    unsigned head;
+
+    head = *r->cq_head;
+
+    for (;;) {
+        struct io_uring_cqe *cqe;
+        pa_iouring_op *op;
+        int res;
+
+        if (head == load_acquire(r->cq_tail)) {
+
+#ifdef IORING_SQ_CQ_OVERFLOW
+            /* The completion queue overflowed, make the kernel flush
+             * the completions it had to hold back */
+            if (load_acquire(r->sq_flags) & IORING_SQ_CQ_OVERFLOW) {
+                ring_enter(r->fd, 0, 0, IORING_ENTER_GETEVENTS);
+
+                if (head != load_acquire(r->cq_tail))
+                    continue;
+            }
+#endif
+            break;
+        }
+
+        cqe = &r->cqes[head & r->cq_mask];
+        op = (pa_iouring_op*) (uintptr_t) cqe->user_data;
+        res = cqe->res;
+
+        store_release(r->cq_head, ++head);
+
+        if (!op) {
+            pa_assert(r->n_cancel_in_flight > 0);
+            r->n_cancel_in_flight--;
+            continue;
+        }
+
+        PA_LLIST_REMOVE(pa_iouring_op, r->in_flight, op);
+
+        if (!op->released)
+            op->callback(r, op, res, op->userdata);
+
+        op_free(op);
+    }
+}
+
+static void io_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    pa_iouring *r = userdata;
+
+    pa_assert(r);
+    pa_assert(r->io_event == e);
+
+    reap(r);
+}
+
+static void defer_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_iouring *r = userdata;
+
+    pa_assert(r);
+    pa_assert(r->defer_event == e);
+
+    submit(r);
+
+    /* Requests that could be completed right away don't need to wait
+     * for the next poll() */
+    reap(r);
+}
+
+static void unmap(pa_iouring *r) {
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+
+    if (r->cq_map && r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_size);
+
+    if (r->sq_map)
+        munmap(r->sq_map, r->sq_map_size);
+}
+
+pa_iouring* pa_iouring_new(pa_mainloop_api *m, unsigned entries) {
+    pa_iouring *r;
+    struct io_uring_params p;
+    uint8_t *sq, *cq;
+
+    pa_assert(m);
+    pa_assert(entries > 0);
+
+    /* There are lots of long-lived requests, so make room for plenty
+     * of completions */
+    pa_zero(p);
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 8;
+
+    r = pa_xnew0(pa_iouring, 1);
+    r->mainloop = m;
+
+    if ((r->fd = ring_setup(entries, &p)) < 0) {
+        pa_log_info("io_uring_setup() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    /* Without fast poll every pending recvmsg() would occupy a kernel
+     * worker thread, and without nodrop we'd have to care about
+     * completion queue overflows ourselves. */
+    if (!(p.features & IORING_FEAT_FAST_POLL) || !(p.features & IORING_FEAT_NODROP)) {
+        pa_log_info("io_uring of the running kernel lacks required features.");
+        goto fail;
+    }
+
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_map_size = r->cq_map_size = PA_MAX(r->sq_map_size, r->cq_map_size);
+
+    if ((r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+        r->sq_map = NULL;
+        pa_log_error("mmap() of io_uring submission queue failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_map = r->sq_map;
+    else if ((r->cq_map = mmap(NULL, r->cq_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        r->cq_map = NULL;
+        pa_log_error("mmap() of io_uring completion queue failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if ((r->sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES)) == MAP_FAILED) {
+        r->sqes = NULL;
+        pa_log_error("mmap() of io_uring submission entries failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    sq = r->sq_map;
+    r->sq_head = (unsigned*) (sq + p.sq_off.head);
+    r->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    r->sq_flags = (unsigned*) (sq + p.sq_off.flags);
+    r->sq_array = (unsigned*) (sq + p.sq_off.array);
+    r->sq_mask = *(unsigned*) (sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+
+    cq = r->cq_map;
+    r->cq_head = (unsigned*) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned*) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    r->io_event = m->io_new(m, r->fd, PA_IO_EVENT_INPUT, io_cb, r);
+    r->defer_event = m->defer_new(m, defer_cb, r);
+    m->defer_enable(r->defer_event, 0);
+
+    pa_log_debug("Using io_uring with %u submission and %u completion queue entries.", p.sq_entries, p.cq_entries);
+
+    return r;
+
+fail:
+    unmap(r);
+
+    if (r->fd >= 0)
+        pa_close(r->fd);
+
+    pa_xfree(r);
+    return NULL;
+}
+
+void pa_iouring_free(pa_iouring *r) {
+    pa_iouring_op *op;
+
+    pa_assert(r);
+
+    while ((op = r->queued)) {
+        dequeue(r, op);
+        op->released = true;
+        op_free(op);
+    }
+
+    PA_LLIST_FOREACH(op, r->in_flight) {
+        if (!op->cancel) {
+            op->cancel = true;
+            r->n_cancel_queued++;
+        }
+
+        op->released = true;
+    }
+
+    /* The kernel may still write into the buffers of the requests, so
+     * we need to wait until it has let go of all of them */
+    while (r->in_flight || r->n_cancel_in_flight > 0) {
+        submit(r);
+
+        if (ring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EBUSY) {
+            pa_log_error("io_uring_enter(): %s", pa_cstrerror(errno));
+            break;
+        }
+
+        reap(r);
+    }
+
+    r->mainloop->io_free(r->io_event);
+    r->mainloop->defer_free(r->defer_event);
+
+    unmap(r);
+    pa_close(r->fd);
+    pa_xfree(r);
+}
+
+pa_mainloop_api* pa_iouring_get_mainloop_api(pa_iouring *r) {
+    pa_assert(r);
+
+    return r->mainloop;
+}
+
+static pa_iouring_op* queue_op(pa_iouring *r, uint8_t opcode, int fd, struct msghdr *msg, int flags, pa_iouring_cb_t cb, void *userdata) {
+    pa_iouring_op *op;
+
+    pa_assert(r);
+    pa_assert(fd >= 0);
+    pa_assert(msg);
+    pa_assert(cb);
+
+    op = pa_xnew0(pa_iouring_op, 1);
+    op->ring = r;
+    op->opcode = opcode;
+    op->fd = fd;
+    op->msg = msg;
+    op->flags = flags;
+    op->callback = cb;
+    op->userdata = userdata;
+
+    /* Keep the queue in FIFO order, so that data written to the same
+     * fd is sent in order */
+    PA_LLIST_INSERT_AFTER(pa_iouring_op, r->queued, r->queued_tail, op);
+    r->queued_tail = op;
+
+    r->mainloop->defer_enable(r->defer_event, 1);
+
+    return op;
+}
+
+pa_iouring_op* pa_iouring_recvmsg(pa_iouring *r, int fd, struct msghdr *msg, int flags, pa_iouring_cb_t cb, void *userdata) {
+    return queue_op(r, IORING_OP_RECVMSG, fd, msg, flags, cb, userdata);
+}
+
+pa_iouring_op* pa_iouring_sendmsg(pa_iouring *r, int fd, struct msghdr *msg, int flags, pa_iouring_cb_t cb, void *userdata) {
+    return queue_op(r, IORING_OP_SENDMSG, fd, msg, flags, cb, userdata);
+}
+
+bool pa_iouring_op_is_submitted(pa_iouring_op *op) {
+    pa_assert(op);
+
+    return op->submitted;
+}
+
+void pa_iouring_op_release(pa_iouring_op *op, bool cancel, pa_free_cb_t free_cb, void *data) {
+    pa_iouring *r;
+
+    pa_assert(op);
+    pa_assert(!op->released);
+
+    r = op->ring;
+
+    op->released = true;
+    op->free_cb = free_cb;
+    op->free_data = data;
+
+    if (!op->submitted && !cancel)
+        submit(r);
+
+    if (!op->submitted) {
+        /* The kernel never saw it, so we can drop it right away */
+        dequeue(r, op);
+        op_free(op);
+        update_defer(r);
+        return;
+    }
+
+    if (cancel && !op->cancel) {
+        op->cancel = true;
+        r->n_cancel_queued++;
+        update_defer(r);
+    }
+}
+
+void pa_iouring_submit(pa_iouring *r) {
+    pa_assert(r);
+
+    submit(r);
+}
+
+#else /* HAVE_IO_URING */
+
+pa_iouring* pa_iouring_new(pa_mainloop_api *m, unsigned entries) {
+    pa_log_debug("Compiled without io_uring support.");
+    return NULL;
+}
+
+void pa_iouring_free(pa_iouring *r) {
+    pa_assert_not_reached();
+}
+
+pa_mainloop_api* pa_iouring_get_mainloop_api(pa_iouring *r) {
+    pa_assert_not_reached();
+}
+
+pa_iouring_op* pa_iouring_recvmsg(pa_iouring *r, int fd, struct msghdr *msg, int flags, pa_iouring_cb_t cb, void *userdata) {
+    pa_assert_not_reached();
+}
+
+pa_iouring_op* pa_iouring_sendmsg(pa_iouring *r, int fd, struct msghdr *msg, int flags, pa_iouring_cb_t cb, void *userdata) {
+    pa_assert_not_reached();
+}
+
+bool pa_iouring_op_is_submitted(pa_iouring_op *op) {
+    pa_assert_not_reached();
+}
+
+void pa_iouring_op_release(pa_iouring_op *op, bool cancel, pa_free_cb_t free_cb, void *data) {
+    pa_assert_not_reached();
+}
+
+void pa_iouring_submit(pa_iouring *r) {
+    pa_assert_not_reached();
+}
+
+#endif /* HAVE_IO_URING */
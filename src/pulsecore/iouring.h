@@ -0,0 +1,78 @@
+#ifndef foopulsecoreiouringhfoo
+#define foopulsecoreiouringhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/mainloop-api.h>
+#include <pulse/def.h>
+
+#include <pulsecore/socket.h>
+
+/* A Linux io_uring instance attached to a main loop. Requests are
+ * queued in userspace and handed to the kernel in a single system
+ * call once per main loop iteration, completions are reaped in one
+ * batch whenever the ring signals readiness.
+ *
+ * pa_iouring_new() returns NULL if io_uring is not available, either
+ * because PulseAudio was built without it or because the running
+ * kernel lacks the required features. Callers are expected to fall
+ * back to regular non-blocking I/O in that case. */
+
+typedef struct pa_iouring pa_iouring;
+typedef struct pa_iouring_op pa_iouring_op;
+
+struct msghdr;
+
+/* Called from the main loop when a request finished. res is what the
+ * equivalent system call would have returned, or a negative errno
+ * value. The request object is freed after the callback returns. */
+typedef void (*pa_iouring_cb_t)(pa_iouring *r, pa_iouring_op *op, int res, void *userdata);
+
+pa_iouring* pa_iouring_new(pa_mainloop_api *m, unsigned entries);
+
+/* Aborts all requests still in flight and waits for the kernel to let
+ * go of them. Callbacks of those requests are not called. */
+void pa_iouring_free(pa_iouring *r);
+
+pa_mainloop_api* pa_iouring_get_mainloop_api(pa_iouring *r);
+
+/* Queue a recvmsg() resp. sendmsg() on fd. msg and everything it
+ * points to needs to stay valid until the callback has been called.
+ * Until the request has been submitted (see
+ * pa_iouring_op_is_submitted()) the caller may still change msg, for
+ * example to append more data to the last buffer. */
+pa_iouring_op* pa_iouring_recvmsg(pa_iouring *r, int fd, struct msghdr *msg, int flags, pa_iouring_cb_t cb, void *userdata);
+pa_iouring_op* pa_iouring_sendmsg(pa_iouring *r, int fd, struct msghdr *msg, int flags, pa_iouring_cb_t cb, void *userdata);
+
+bool pa_iouring_op_is_submitted(pa_iouring_op *op);
+
+/* Detach the caller from a request: its callback will not be called
+ * anymore. If cancel is true the request is aborted, otherwise it is
+ * submitted right away and allowed to finish. Either way free_cb is
+ * called on data as soon as the kernel doesn't access the memory of
+ * the request anymore, which might be right away. This allows closing
+ * the file descriptor of the request after this call. */
+void pa_iouring_op_release(pa_iouring_op *op, bool cancel, pa_free_cb_t free_cb, void *data);
+
+/* Hand all queued requests to the kernel now, instead of waiting
+ * for the next main loop iteration */
+void pa_iouring_submit(pa_iouring *r);
+
+#endif
@@ -0,0 +1,639 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "limiter.h"
+
+/* The most frames that are processed in one go */
+#define MAX_BLOCK 1024
+
+/* How long the crossovers take to settle when the input is replayed
+ * after a rewind */
+#define CROSSOVER_SETTLE_MS 50
+
+static const double default_crossovers[PA_LIMITER_BANDS_MAX][PA_LIMITER_BANDS_MAX - 1] = {
+    { 0 },
+    { 250 },
+    { 250, 4000 },
+    { 150, 1000, 6000 },
+};
+
+enum {
+    FILTER_LOWPASS,
+    FILTER_HIGHPASS,
+    FILTER_ALLPASS,
+};
+
+/* A second order section, transposed direct form II */
+struct biquad {
+    float b0, b1, b2, a1, a2;
+    float z[2 * PA_CHANNELS_MAX];
+};
+
+/* One limiting stage. The gain is worked out from the incoming frames,
+ * and applied to the frames one look-ahead later:
+ *
+ *  1. the target is the gain that brings a frame down to the threshold
+ *  2. its minimum over the look-ahead window, so that the gain is low
+ *     enough for every peak in it
+ *  3. the average of that over the look-ahead window again, which ramps
+ *     the gain down linearly until the peak arrives
+ *  4. the release, which lets the gain recover slowly
+ *
+ * Every minimum that goes into the average covers the frame that leaves
+ * the delay line, so its gain is at most its own target. */
+struct stage {
+    unsigned size;          /* look-ahead + 1, the window */
+    float *work;            /* the delay line of look-ahead frames, followed by the block */
+
+    uint64_t pos;
+    unsigned slot;
+    float *targets;         /* ring of the last size targets */
+    float *minima;          /* ring of the last size minima */
+    double sum;             /* of the minima */
+
+    /* Candidates for the sliding minimum, ascending */
+    uint64_t *queue_pos;
+    float *queue_value;
+    unsigned queue_head, queue_length;
+
+    float gain;
+};
+
+struct pa_limiter {
+    uint32_t rate;
+    unsigned channels;
+    float threshold;
+    pa_usec_t lookahead_usec, release_usec;
+    unsigned bands;
+    double crossovers[PA_LIMITER_BANDS_MAX - 1];
+
+    unsigned lookahead;
+    float release;
+
+    /* Crossover j splits off band j with lowpass[j], the rest goes on
+     * through highpass[j]. Band i then goes through allpass[i][j] for all
+     * later crossovers j, so that the phases line up again. */
+    struct biquad lowpass[PA_LIMITER_BANDS_MAX - 1][2];
+    struct biquad highpass[PA_LIMITER_BANDS_MAX - 1][2];
+    struct biquad allpass[PA_LIMITER_BANDS_MAX][PA_LIMITER_BANDS_MAX - 1];
+    float *band[PA_LIMITER_BANDS_MAX];
+
+    /* One stage per band and a final one, or a single one */
+    struct stage stages[PA_LIMITER_BANDS_MAX + 1];
+    unsigned n_stages;
+
+    float *target, *gain;
+    float *scratch;
+
+    /* The input, and the gain of each stage, of the last history_length
+     * frames, for rewinding */
+    float *history, *gain_history;
+    unsigned history_length, history_write, history_fill;
+    unsigned max_rewind, replay;
+};
+
+static pa_limiter_target_func_t target_table[PA_CHANNELS_MAX + 1];
+static pa_limiter_apply_func_t apply_table[PA_CHANNELS_MAX + 1];
+
+static void target_generic(const float *src, unsigned channels, float threshold, float *target, unsigned n) {
+    unsigned c, i;
+
+    for (i = 0; i < n; i++, src += channels) {
+        float peak = fabsf(src[0]);
+
+        for (c = 1; c < channels; c++)
+            peak = PA_MAX(peak, fabsf(src[c]));
+
+        target[i] = PA_MIN(threshold / PA_MAX(peak, FLT_MIN), 1.0f);
+    }
+}
+
+static void apply_generic(const float *src, unsigned channels, const float *gain, float *dst, unsigned n) {
+    unsigned c, i;
+
+    for (i = 0; i < n; i++, src += channels, dst += channels)
+        for (c = 0; c < channels; c++)
+            dst[c] = src[c] * gain[i];
+}
+
+static void biquad_design(struct biquad *f, int type, double freq, uint32_t rate) {
+    double w, cw, alpha, a0;
+
+    /* Butterworth Q, so that two of them in a row make a Linkwitz-Riley
+     * filter, and the two halves of a crossover sum to an allpass */
+    freq = PA_MIN(freq, 0.45 * rate);
+    w = 2.0 * M_PI * freq / rate;
+    cw = cos(w);
+    alpha = sin(w) * M_SQRT1_2;
+    a0 = 1.0 + alpha;
+
+    switch (type) {
+        case FILTER_LOWPASS:
+            f->b0 = (float) ((1.0 - cw) / 2.0 / a0);
+            f->b1 = (float) ((1.0 - cw) / a0);
+            f->b2 = f->b0;
+            break;
+
+        case FILTER_HIGHPASS:
+            f->b0 = (float) ((1.0 + cw) / 2.0 / a0);
+            f->b1 = (float) (-(1.0 + cw) / a0);
+            f->b2 = f->b0;
+            break;
+
+        case FILTER_ALLPASS:
+            f->b0 = (float) ((1.0 - alpha) / a0);
+            f->b1 = (float) (-2.0 * cw / a0);
+            f->b2 = 1.0f;
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    f->a1 = (float) (-2.0 * cw / a0);
+    f->a2 = (float) ((1.0 - alpha) / a0);
+}
+
+static void biquad_run(struct biquad *f, unsigned channels, float *buf, unsigned n) {
+    unsigned c, i;
+
+    for (c = 0; c < channels; c++) {
+        float z1 = f->z[2 * c], z2 = f->z[2 * c + 1];
+        float *p = buf + c;
+
+        for (i = 0; i < n; i++, p += channels) {
+            float x = *p, y = f->b0 * x + z1;
+
+            z1 = f->b1 * x - f->a1 * y + z2;
+            z2 = f->b2 * x - f->a2 * y;
+            *p = y;
+        }
+
+        /* Don't let silence decay into denormals */
+        f->z[2 * c] = fabsf(z1) < 1e-20f ? 0.0f : z1;
+        f->z[2 * c + 1] = fabsf(z2) < 1e-20f ? 0.0f : z2;
+    }
+}
+
+static void stage_init(pa_limiter *l, struct stage *s) {
+    s->size = l->lookahead + 1;
+    s->work = pa_xnew(float, (l->lookahead + MAX_BLOCK) * l->channels);
+    s->targets = pa_xnew(float, s->size);
+    s->minima = pa_xnew(float, s->size);
+    s->queue_pos = pa_xnew(uint64_t, s->size);
+    s->queue_value = pa_xnew(float, s->size);
+}
+
+static void stage_done(struct stage *s) {
+    pa_xfree(s->work);
+    pa_xfree(s->targets);
+    pa_xfree(s->minima);
+    pa_xfree(s->queue_pos);
+    pa_xfree(s->queue_value);
+}
+
+static void stage_reset(pa_limiter *l, struct stage *s) {
+    unsigned i;
+
+    memset(s->work, 0, l->lookahead * l->channels * sizeof(float));
+
+    for (i = 0; i < s->size; i++) {
+        s->targets[i] = 1.0f;
+        s->minima[i] = 1.0f;
+    }
+
+    s->pos = 0;
+    s->slot = 0;
+    s->sum = s->size;
+    s->queue_head = 0;
+    s->queue_length = 0;
+    s->gain = 1.0f;
+}
+
+/* Limits n frames of buf in place, and leaves the gains in l->gain */
+static void stage_run(pa_limiter *l, struct stage *s, float *buf, unsigned n) {
+    pa_limiter_target_func_t target_func = target_table[l->channels];
+    pa_limiter_apply_func_t apply_func = apply_table[l->channels];
+    unsigned i, delay = l->lookahead * l->channels;
+
+    pa_assert(n <= MAX_BLOCK);
+
+    if (target_func)
+        target_func(buf, l->threshold, l->target, n);
+    else
+        target_generic(buf, l->channels, l->threshold, l->target, n);
+
+    memcpy(s->work + delay, buf, n * l->channels * sizeof(float));
+
+    for (i = 0; i < n; i++, s->pos++) {
+        float target = l->target[i], minimum, average, gain;
+        unsigned tail;
+
+        /* The sliding minimum: drop the candidate that fell out of the
+         * window, and those that can never be the minimum again */
+        if (s->queue_length > 0 && s->queue_pos[s->queue_head] + l->lookahead < s->pos) {
+            s->queue_head = (s->queue_head + 1) % s->size;
+            s->queue_length--;
+        }
+
+        while (s->queue_length > 0 && s->queue_value[(s->queue_head + s->queue_length - 1) % s->size] >= target)
+            s->queue_length--;
+
+        tail = (s->queue_head + s->queue_length) % s->size;
+        s->queue_pos[tail] = s->pos;
+        s->queue_value[tail] = target;
+        s->queue_length++;
+
+        minimum = s->queue_value[s->queue_head];
+
+        s->sum += minimum - s->minima[s->slot];
+        s->minima[s->slot] = minimum;
+        s->targets[s->slot] = target;
+
+        if (++s->slot == s->size) {
+            unsigned j;
+
+            /* Start the running sum afresh now and then, so that rounding
+             * errors don't pile up */
+            s->slot = 0;
+            s->sum = 0;
+            for (j = 0; j < s->size; j++)
+                s->sum += s->minima[j];
+        }
+
+        average = (float) (s->sum / s->size);
+
+        if (average < s->gain)
+            gain = average;
+        else
+            gain = s->gain + (average - s->gain) * l->release;
+
+        /* The slot is now the oldest target, the one of the frame that
+         * leaves the delay line */
+        gain = PA_MIN(gain, s->targets[s->slot]);
+
+        s->gain = gain;
+        l->gain[i] = gain;
+    }
+
+    if (apply_func)
+        apply_func(s->work, l->gain, buf, n);
+    else
+        apply_generic(s->work, l->channels, l->gain, buf, n);
+
+    memmove(s->work, s->work + n * l->channels, delay * sizeof(float));
+}
+
+static void record_gains(pa_limiter *l, unsigned stage, int64_t start, unsigned n) {
+    unsigned i;
+
+    if (start < 0)
+        return;
+
+    for (i = 0; i < n; i++)
+        l->gain_history[((start + i) % l->history_length) * l->n_stages + stage] = l->gain[i];
+}
+
+/* Runs n frames of buf through all of the limiter. If start isn't
+ * negative, the gains are recorded at that position of the history. */
+static void run(pa_limiter *l, float *buf, unsigned n, int64_t start) {
+    unsigned b, j, k, rest = l->bands - 1;
+
+    if (l->bands == 1) {
+        stage_run(l, &l->stages[0], buf, n);
+        record_gains(l, 0, start, n);
+        return;
+    }
+
+    memcpy(l->band[rest], buf, n * l->channels * sizeof(float));
+
+    for (j = 0; j < rest; j++) {
+        memcpy(l->band[j], l->band[rest], n * l->channels * sizeof(float));
+        biquad_run(&l->lowpass[j][0], l->channels, l->band[j], n);
+        biquad_run(&l->lowpass[j][1], l->channels, l->band[j], n);
+        biquad_run(&l->highpass[j][0], l->channels, l->band[rest], n);
+        biquad_run(&l->highpass[j][1], l->channels, l->band[rest], n);
+    }
+
+    for (b = 0; b < l->bands; b++) {
+        for (j = b + 1; j < rest; j++)
+            biquad_run(&l->allpass[b][j], l->channels, l->band[b], n);
+
+        stage_run(l, &l->stages[b], l->band[b], n);
+        record_gains(l, b, start, n);
+    }
+
+    for (k = 0; k < n * l->channels; k++) {
+        float sum = l->band[0][k];
+
+        for (b = 1; b < l->bands; b++)
+            sum += l->band[b][k];
+
+        buf[k] = sum;
+    }
+
+    stage_run(l, &l->stages[l->bands], buf, n);
+    record_gains(l, l->bands, start, n);
+}
+
+static void reset_state(pa_limiter *l) {
+    unsigned b, j;
+
+    for (j = 0; j < l->n_stages; j++)
+        stage_reset(l, &l->stages[j]);
+
+    for (j = 0; j + 1 < l->bands; j++) {
+        memset(l->lowpass[j][0].z, 0, sizeof(l->lowpass[j][0].z));
+        memset(l->lowpass[j][1].z, 0, sizeof(l->lowpass[j][1].z));
+        memset(l->highpass[j][0].z, 0, sizeof(l->highpass[j][0].z));
+        memset(l->highpass[j][1].z, 0, sizeof(l->highpass[j][1].z));
+
+        for (b = 0; b < l->bands; b++)
+            memset(l->allpass[b][j].z, 0, sizeof(l->allpass[b][j].z));
+    }
+}
+
+static void alloc_history(pa_limiter *l) {
+    l->history_length = l->max_rewind + l->replay;
+    l->history = pa_xnew(float, l->history_length * l->channels);
+    l->gain_history = pa_xnew(float, l->history_length * l->n_stages);
+    l->history_write = 0;
+    l->history_fill = 0;
+}
+
+/* Sets up everything that depends on the rate */
+static void setup(pa_limiter *l) {
+    unsigned b, j;
+    double release;
+
+    l->lookahead = (unsigned) (l->lookahead_usec * l->rate / PA_USEC_PER_SEC);
+
+    release = (double) l->release_usec * l->rate / PA_USEC_PER_SEC;
+    l->release = release > 1.0 ? (float) (1.0 - exp(-1.0 / release)) : 1.0f;
+
+    for (j = 0; j + 1 < l->bands; j++) {
+        biquad_design(&l->lowpass[j][0], FILTER_LOWPASS, l->crossovers[j], l->rate);
+        biquad_design(&l->lowpass[j][1], FILTER_LOWPASS, l->crossovers[j], l->rate);
+        biquad_design(&l->highpass[j][0], FILTER_HIGHPASS, l->crossovers[j], l->rate);
+        biquad_design(&l->highpass[j][1], FILTER_HIGHPASS, l->crossovers[j], l->rate);
+
+        for (b = 0; b < j; b++)
+            biquad_design(&l->allpass[b][j], FILTER_ALLPASS, l->crossovers[j], l->rate);
+    }
+
+    for (j = 0; j < l->n_stages; j++)
+        stage_init(l, &l->stages[j]);
+
+    /* Every stage is back in its exact state after twice its window. The
+     * gains are restored from the history, the crossovers need a bit
+     * more. */
+    l->replay = l->n_stages * (2 * l->lookahead + 1);
+    if (l->bands > 1)
+        l->replay += l->rate * CROSSOVER_SETTLE_MS / 1000;
+
+    alloc_history(l);
+    reset_state(l);
+}
+
+static void teardown(pa_limiter *l) {
+    unsigned j;
+
+    for (j = 0; j < l->n_stages; j++)
+        stage_done(&l->stages[j]);
+
+    pa_xfree(l->history);
+    pa_xfree(l->gain_history);
+}
+
+pa_limiter *pa_limiter_new(uint32_t rate, unsigned channels, double threshold, pa_usec_t lookahead, pa_usec_t release,
+                           unsigned bands, const double *crossovers) {
+    pa_limiter *l;
+    unsigned b;
+
+    pa_assert(rate > 0);
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+    pa_assert(threshold <= 0);
+    pa_assert(bands >= 1);
+    pa_assert(bands <= PA_LIMITER_BANDS_MAX);
+
+    l = pa_xnew0(pa_limiter, 1);
+    l->rate = rate;
+    l->channels = channels;
+    l->threshold = (float) pow(10.0, threshold / 20.0);
+    l->lookahead_usec = lookahead;
+    l->release_usec = release;
+    l->bands = bands;
+    l->n_stages = bands > 1 ? bands + 1 : 1;
+
+    for (b = 0; b + 1 < bands; b++) {
+        l->crossovers[b] = crossovers ? crossovers[b] : default_crossovers[bands - 1][b];
+        pa_assert(l->crossovers[b] > 0);
+        pa_assert(b == 0 || l->crossovers[b] > l->crossovers[b - 1]);
+    }
+
+    if (bands > 1)
+        for (b = 0; b < bands; b++)
+            l->band[b] = pa_xnew(float, MAX_BLOCK * channels);
+
+    l->target = pa_xnew(float, MAX_BLOCK);
+    l->gain = pa_xnew(float, MAX_BLOCK);
+    l->scratch = pa_xnew(float, MAX_BLOCK * channels);
+
+    setup(l);
+
+    pa_log_debug("Limiter at %0.1f dB with %u band(s), %u frames of look-ahead", threshold, bands, l->lookahead);
+
+    return l;
+}
+
+void pa_limiter_free(pa_limiter *l) {
+    unsigned b;
+
+    pa_assert(l);
+
+    teardown(l);
+
+    for (b = 0; b < l->bands; b++)
+        pa_xfree(l->band[b]);
+
+    pa_xfree(l->target);
+    pa_xfree(l->gain);
+    pa_xfree(l->scratch);
+    pa_xfree(l);
+}
+
+void pa_limiter_process(pa_limiter *l, const float *src, float *dst, unsigned n) {
+    pa_assert(l);
+    pa_assert(src);
+    pa_assert(dst);
+
+    while (n > 0) {
+        unsigned k = PA_MIN(n, MAX_BLOCK), done = 0;
+        unsigned start = l->history_write;
+
+        /* Keep the input before it is overwritten */
+        while (done < k) {
+            unsigned m = PA_MIN(k - done, l->history_length - l->history_write);
+
+            memcpy(l->history + l->history_write * l->channels, src + done * l->channels, m * l->channels * sizeof(float));
+            l->history_write = (l->history_write + m) % l->history_length;
+            done += m;
+        }
+
+        l->history_fill = PA_MIN(l->history_fill + k, l->history_length);
+
+        if (dst != src)
+            memcpy(dst, src, k * l->channels * sizeof(float));
+
+        run(l, dst, k, start);
+
+        src += k * l->channels;
+        dst += k * l->channels;
+        n -= k;
+    }
+}
+
+void pa_limiter_reset(pa_limiter *l) {
+    pa_assert(l);
+
+    reset_state(l);
+    l->history_fill = 0;
+}
+
+void pa_limiter_rewind(pa_limiter *l, unsigned n) {
+    unsigned replay, pos, j;
+
+    pa_assert(l);
+
+    if (n == 0)
+        return;
+
+    if (n > l->history_fill) {
+        pa_log_debug("Rewinding %u frames, but only %u are known. Resetting the limiter.", n, l->history_fill);
+        pa_limiter_reset(l);
+        return;
+    }
+
+    l->history_write = (l->history_write + l->history_length - n) % l->history_length;
+    l->history_fill -= n;
+
+    /* Start from silence, and feed the frames before the new position
+     * through again to get back to where the limiter was */
+    reset_state(l);
+
+    replay = PA_MIN(l->replay, l->history_fill);
+    pos = (l->history_write + l->history_length - replay) % l->history_length;
+
+    while (replay > 0) {
+        unsigned k = PA_MIN(PA_MIN(replay, MAX_BLOCK), l->history_length - pos);
+
+        memcpy(l->scratch, l->history + pos * l->channels, k * l->channels * sizeof(float));
+        run(l, l->scratch, k, -1);
+
+        pos = (pos + k) % l->history_length;
+        replay -= k;
+    }
+
+    if (l->history_fill > 0) {
+        pos = (l->history_write + l->history_length - 1) % l->history_length;
+
+        for (j = 0; j < l->n_stages; j++)
+            l->stages[j].gain = l->gain_history[pos * l->n_stages + j];
+    }
+}
+
+void pa_limiter_set_max_rewind(pa_limiter *l, unsigned n) {
+    pa_assert(l);
+
+    if (n == l->max_rewind)
+        return;
+
+    pa_xfree(l->history);
+    pa_xfree(l->gain_history);
+
+    l->max_rewind = n;
+    alloc_history(l);
+}
+
+void pa_limiter_set_rate(pa_limiter *l, uint32_t rate) {
+    pa_assert(l);
+    pa_assert(rate > 0);
+
+    if (rate == l->rate)
+        return;
+
+    teardown(l);
+    l->rate = rate;
+    setup(l);
+}
+
+unsigned pa_limiter_get_latency(pa_limiter *l) {
+    pa_assert(l);
+
+    return l->bands > 1 ? 2 * l->lookahead : l->lookahead;
+}
+
+unsigned pa_limiter_get_channels(pa_limiter *l) {
+    pa_assert(l);
+
+    return l->channels;
+}
+
+pa_limiter_target_func_t pa_limiter_get_target_func(unsigned channels) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    return target_table[channels];
+}
+
+void pa_limiter_set_target_func(unsigned channels, pa_limiter_target_func_t func) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    target_table[channels] = func;
+}
+
+pa_limiter_apply_func_t pa_limiter_get_apply_func(unsigned channels) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    return apply_table[channels];
+}
+
+void pa_limiter_set_apply_func(unsigned channels, pa_limiter_apply_func_t func) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    apply_table[channels] = func;
+}
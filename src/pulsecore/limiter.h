@@ -0,0 +1,84 @@
+#ifndef foopulsecorelimiterhfoo
+#define foopulsecorelimiterhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+
+/* A look-ahead peak limiter for interleaved float samples. The output is
+ * delayed by the look-ahead time, which gives the gain that much time to
+ * ramp down before a peak arrives, so no sample ever leaves above the
+ * threshold and there is no need for clipping. All channels share one
+ * gain, so the stereo image doesn't move. After a peak the gain recovers
+ * exponentially with the release time.
+ *
+ * With more than one band, the signal is split with Linkwitz-Riley
+ * crossovers, every band is limited on its own and the sum goes through a
+ * final broadband stage. That keeps a loud bass line from pumping the
+ * rest of the mix, at the price of twice the latency. */
+
+#define PA_LIMITER_BANDS_MAX 4
+
+typedef struct pa_limiter pa_limiter;
+
+/* threshold is in dB below full scale. crossovers holds bands - 1
+ * ascending frequencies in Hz, or is NULL for the defaults. */
+pa_limiter *pa_limiter_new(uint32_t rate, unsigned channels, double threshold, pa_usec_t lookahead, pa_usec_t release,
+                           unsigned bands, const double *crossovers);
+void pa_limiter_free(pa_limiter *l);
+
+/* Processes n frames. dst may be the same as src. */
+void pa_limiter_process(pa_limiter *l, const float *src, float *dst, unsigned n);
+
+/* Drops all history, as if only silence had been processed so far */
+void pa_limiter_reset(pa_limiter *l);
+
+/* Takes back the last n frames that were processed, so that the ones
+ * which replace them are limited as if the old ones never happened. The
+ * limiter keeps enough of its input for that, up to the amount set with
+ * pa_limiter_set_max_rewind(). Anything further back is forgotten, and
+ * the limiter starts from silence. */
+void pa_limiter_rewind(pa_limiter *l, unsigned n);
+void pa_limiter_set_max_rewind(pa_limiter *l, unsigned n);
+
+/* Restarts the limiter at a different sample rate */
+void pa_limiter_set_rate(pa_limiter *l, uint32_t rate);
+
+/* The delay of the output, in frames */
+unsigned pa_limiter_get_latency(pa_limiter *l);
+
+unsigned pa_limiter_get_channels(pa_limiter *l);
+
+/* Computes the gain that brings each of n frames of src down to the
+ * threshold, i.e. the threshold over the largest magnitude in the frame,
+ * but at most 1 */
+typedef void (*pa_limiter_target_func_t) (const float *src, float threshold, float *target, unsigned n);
+/* Multiplies each of n frames of src with its gain */
+typedef void (*pa_limiter_apply_func_t) (const float *src, const float *gain, float *dst, unsigned n);
+
+/* Optimized versions for some channel counts, NULL where there are
+ * none */
+pa_limiter_target_func_t pa_limiter_get_target_func(unsigned channels);
+void pa_limiter_set_target_func(unsigned channels, pa_limiter_target_func_t func);
+
+pa_limiter_apply_func_t pa_limiter_get_apply_func(unsigned channels);
+void pa_limiter_set_apply_func(unsigned channels, pa_limiter_apply_func_t func);
+
+#endif
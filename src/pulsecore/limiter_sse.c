@@ -0,0 +1,187 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <float.h>
+#include <math.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "cpu-x86.h"
+#include "limiter.h"
+
+/* The intrinsics are only available if the compiler may use SSE, which
+ * is always the case on amd64 */
+#if defined (__SSE__)
+
+#include <xmmintrin.h>
+
+#define ABS(v) _mm_andnot_ps(_mm_set1_ps(-0.0f), (v))
+
+/* The kernels work on four frames at a time, the rest is done one frame
+ * at a time, exactly like the generic code */
+
+static inline __m128 target_from_peak(__m128 peak, __m128 threshold) {
+    return _mm_min_ps(_mm_div_ps(threshold, _mm_max_ps(peak, _mm_set1_ps(FLT_MIN))), _mm_set1_ps(1.0f));
+}
+
+static void target_rest(const float *src, unsigned channels, float threshold, float *target, unsigned n) {
+    unsigned c, i;
+
+    for (i = 0; i < n; i++, src += channels) {
+        float peak = fabsf(src[0]);
+
+        for (c = 1; c < channels; c++)
+            peak = PA_MAX(peak, fabsf(src[c]));
+
+        target[i] = PA_MIN(threshold / PA_MAX(peak, FLT_MIN), 1.0f);
+    }
+}
+
+static void target_1ch_sse(const float *src, float threshold, float *target, unsigned n) {
+    __m128 t = _mm_set1_ps(threshold);
+    unsigned i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_ps(target + i, target_from_peak(ABS(_mm_loadu_ps(src + i)), t));
+
+    target_rest(src + i, 1, threshold, target + i, n - i);
+}
+
+static void target_2ch_sse(const float *src, float threshold, float *target, unsigned n) {
+    __m128 t = _mm_set1_ps(threshold);
+    unsigned i;
+
+    for (i = 0; i + 4 <= n; i += 4, src += 8) {
+        __m128 a = ABS(_mm_loadu_ps(src)), b = ABS(_mm_loadu_ps(src + 4));
+        __m128 peak = _mm_max_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        _mm_storeu_ps(target + i, target_from_peak(peak, t));
+    }
+
+    target_rest(src, 2, threshold, target + i, n - i);
+}
+
+static void target_4ch_sse(const float *src, float threshold, float *target, unsigned n) {
+    __m128 t = _mm_set1_ps(threshold);
+    unsigned i;
+
+    for (i = 0; i + 4 <= n; i += 4, src += 16) {
+        __m128 r0 = ABS(_mm_loadu_ps(src)), r1 = ABS(_mm_loadu_ps(src + 4));
+        __m128 r2 = ABS(_mm_loadu_ps(src + 8)), r3 = ABS(_mm_loadu_ps(src + 12));
+
+        /* One channel of all four frames per register */
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        _mm_storeu_ps(target + i, target_from_peak(_mm_max_ps(_mm_max_ps(r0, r1), _mm_max_ps(r2, r3)), t));
+    }
+
+    target_rest(src, 4, threshold, target + i, n - i);
+}
+
+static void target_8ch_sse(const float *src, float threshold, float *target, unsigned n) {
+    __m128 t = _mm_set1_ps(threshold);
+    unsigned i;
+
+    for (i = 0; i + 4 <= n; i += 4, src += 32) {
+        __m128 r0 = ABS(_mm_loadu_ps(src)), r1 = ABS(_mm_loadu_ps(src + 8));
+        __m128 r2 = ABS(_mm_loadu_ps(src + 16)), r3 = ABS(_mm_loadu_ps(src + 24));
+        __m128 r4 = ABS(_mm_loadu_ps(src + 4)), r5 = ABS(_mm_loadu_ps(src + 12));
+        __m128 r6 = ABS(_mm_loadu_ps(src + 20)), r7 = ABS(_mm_loadu_ps(src + 28));
+
+        /* The maximum is taken over both halves of every frame first */
+        r0 = _mm_max_ps(r0, r4);
+        r1 = _mm_max_ps(r1, r5);
+        r2 = _mm_max_ps(r2, r6);
+        r3 = _mm_max_ps(r3, r7);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        _mm_storeu_ps(target + i, target_from_peak(_mm_max_ps(_mm_max_ps(r0, r1), _mm_max_ps(r2, r3)), t));
+    }
+
+    target_rest(src, 8, threshold, target + i, n - i);
+}
+
+static void apply_1ch_sse(const float *src, const float *gain, float *dst, unsigned n) {
+    unsigned i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), _mm_loadu_ps(gain + i)));
+
+    for (; i < n; i++)
+        dst[i] = src[i] * gain[i];
+}
+
+static void apply_2ch_sse(const float *src, const float *gain, float *dst, unsigned n) {
+    unsigned i;
+
+    for (i = 0; i + 4 <= n; i += 4, src += 8, dst += 8) {
+        __m128 g = _mm_loadu_ps(gain + i);
+
+        _mm_storeu_ps(dst, _mm_mul_ps(_mm_loadu_ps(src), _mm_unpacklo_ps(g, g)));
+        _mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_loadu_ps(src + 4), _mm_unpackhi_ps(g, g)));
+    }
+
+    for (; i < n; i++, src += 2, dst += 2) {
+        dst[0] = src[0] * gain[i];
+        dst[1] = src[1] * gain[i];
+    }
+}
+
+static void apply_4ch_sse(const float *src, const float *gain, float *dst, unsigned n) {
+    unsigned i;
+
+    for (i = 0; i < n; i++, src += 4, dst += 4)
+        _mm_storeu_ps(dst, _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(gain[i])));
+}
+
+static void apply_8ch_sse(const float *src, const float *gain, float *dst, unsigned n) {
+    unsigned i;
+
+    for (i = 0; i < n; i++, src += 8, dst += 8) {
+        __m128 g = _mm_set1_ps(gain[i]);
+
+        _mm_storeu_ps(dst, _mm_mul_ps(_mm_loadu_ps(src), g));
+        _mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_loadu_ps(src + 4), g));
+    }
+}
+
+#endif /* defined (__SSE__) */
+
+void pa_limiter_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__SSE__)
+    if (flags & PA_CPU_X86_SSE) {
+        pa_log_info("Initialising SSE optimized limiter functions.");
+
+        pa_limiter_set_target_func(1, target_1ch_sse);
+        pa_limiter_set_target_func(2, target_2ch_sse);
+        pa_limiter_set_target_func(4, target_4ch_sse);
+        pa_limiter_set_target_func(8, target_8ch_sse);
+
+        pa_limiter_set_apply_func(1, apply_1ch_sse);
+        pa_limiter_set_apply_func(2, apply_2ch_sse);
+        pa_limiter_set_apply_func(4, apply_4ch_sse);
+        pa_limiter_set_apply_func(8, apply_8ch_sse);
+    }
+#endif /* defined (__SSE__) */
+}
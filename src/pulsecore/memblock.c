@@ -864,6 +864,13 @@ const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p) {
     return &p->stat;
 }
 
+/* No lock necessary */
+void pa_mempool_account_rewind_history(pa_mempool *p, int delta) {
+    pa_assert(p);
+
+    pa_atomic_add(&p->stat.rewind_history_size, delta);
+}
+
 /* No lock necessary */
 size_t pa_mempool_block_size_max(pa_mempool *p) {
     pa_assert(p);
@@ -76,6 +76,10 @@ struct pa_mempool_stat {
 
     pa_atomic_t n_allocated_by_type[PA_MEMBLOCK_TYPE_MAX];
     pa_atomic_t n_accumulated_by_type[PA_MEMBLOCK_TYPE_MAX];
+
+    /* How much rendered data the sink inputs may keep around for
+     * rewinding, in total. Maintained by the sink inputs. */
+    pa_atomic_t rewind_history_size;
 };
 
 /* Allocate a new memory block of type PA_MEMBLOCK_MEMPOOL or PA_MEMBLOCK_APPENDED, depending on the size */
@@ -123,6 +127,10 @@ pa_memblock *pa_memblock_will_need(pa_memblock *b);
 pa_mempool* pa_mempool_new(bool shared, size_t size);
 void pa_mempool_free(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
+
+/* Account for delta bytes more (or less) of rewind history being kept
+ * around by users of the pool */
+void pa_mempool_account_rewind_history(pa_mempool *p, int delta);
 void pa_mempool_vacuum(pa_mempool *p);
 int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id);
 bool pa_mempool_is_shared(pa_mempool *p);
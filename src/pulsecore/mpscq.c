@@ -0,0 +1,189 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/fdsem.h>
+#include <pulsecore/thread.h>
+
+#include "mpscq.h"
+
+/* This is Dmitry Vyukov's intrusive MPSC node-based queue. Producers
+ * swap themselves in as the new tail and then link the previous tail
+ * to themselves. Between those two steps the queue is briefly
+ * inconsistent: the consumer can see a tail that is not reachable
+ * from the head yet. pa_mpscq_is_empty() reports such a queue as
+ * non-empty, so the reader spins rather than sleeps in that case. */
+
+struct pa_mpscq {
+    /* Written by the producers */
+    pa_atomic_ptr_t tail;
+
+    /* Only touched by the consumer */
+    pa_mpscq_item *head;
+    pa_mpscq_item stub;
+
+    pa_fdsem *fdsem;
+};
+
+pa_mpscq* pa_mpscq_new(void) {
+    pa_mpscq *q;
+
+    q = pa_xnew0(pa_mpscq, 1);
+
+    if (!(q->fdsem = pa_fdsem_new())) {
+        pa_xfree(q);
+        return NULL;
+    }
+
+    pa_atomic_ptr_store(&q->stub.next, NULL);
+    q->head = &q->stub;
+    pa_atomic_ptr_store(&q->tail, &q->stub);
+
+    return q;
+}
+
+void pa_mpscq_free(pa_mpscq *q) {
+    pa_assert(q);
+    pa_assert(pa_mpscq_is_empty(q));
+
+    pa_fdsem_free(q->fdsem);
+    pa_xfree(q);
+}
+
+static void enqueue(pa_mpscq *q, pa_mpscq_item *i) {
+    pa_mpscq_item *prev;
+
+    pa_atomic_ptr_store(&i->next, NULL);
+
+    /* Not all atomic backends have an exchange operation, so emulate
+     * it. This is still lock-free. */
+    do {
+        prev = pa_atomic_ptr_load(&q->tail);
+    } while (!pa_atomic_ptr_cmpxchg(&q->tail, prev, i));
+
+    pa_atomic_ptr_store(&prev->next, i);
+}
+
+void pa_mpscq_push(pa_mpscq *q, pa_mpscq_item *i, bool wakeup) {
+    pa_assert(q);
+    pa_assert(i);
+
+    enqueue(q, i);
+
+    if (wakeup)
+        pa_fdsem_post(q->fdsem);
+}
+
+void pa_mpscq_wakeup(pa_mpscq *q) {
+    pa_assert(q);
+
+    pa_fdsem_post(q->fdsem);
+}
+
+static pa_mpscq_item* dequeue(pa_mpscq *q) {
+    pa_mpscq_item *head, *next;
+
+    head = q->head;
+    next = pa_atomic_ptr_load(&head->next);
+
+    if (head == &q->stub) {
+        if (!next)
+            return NULL;
+
+        q->head = head = next;
+        next = pa_atomic_ptr_load(&next->next);
+    }
+
+    if (next) {
+        q->head = next;
+        return head;
+    }
+
+    /* head is the last item we can see. If it is not the tail, a
+     * producer is in the middle of pushing, try again later. */
+    if (pa_atomic_ptr_load(&q->tail) != head)
+        return NULL;
+
+    /* Put the stub back in, so that head can be taken out */
+    enqueue(q, &q->stub);
+
+    if ((next = pa_atomic_ptr_load(&head->next))) {
+        q->head = next;
+        return head;
+    }
+
+    return NULL;
+}
+
+bool pa_mpscq_is_empty(pa_mpscq *q) {
+    pa_assert(q);
+
+    return
+        q->head == &q->stub &&
+        !pa_atomic_ptr_load(&q->stub.next) &&
+        pa_atomic_ptr_load(&q->tail) == &q->stub;
+}
+
+pa_mpscq_item* pa_mpscq_pop(pa_mpscq *q, bool wait_op) {
+    pa_mpscq_item *i;
+
+    pa_assert(q);
+
+    while (!(i = dequeue(q))) {
+
+        if (!wait_op)
+            return NULL;
+
+        if (pa_mpscq_is_empty(q))
+            pa_fdsem_wait(q->fdsem);
+        else
+            pa_thread_yield();
+    }
+
+    return i;
+}
+
+int pa_mpscq_read_fd(pa_mpscq *q) {
+    pa_assert(q);
+
+    return pa_fdsem_get(q->fdsem);
+}
+
+int pa_mpscq_read_before_poll(pa_mpscq *q) {
+    pa_assert(q);
+
+    for (;;) {
+        if (!pa_mpscq_is_empty(q))
+            return -1;
+
+        if (pa_fdsem_before_poll(q->fdsem) >= 0)
+            return 0;
+    }
+}
+
+void pa_mpscq_read_after_poll(pa_mpscq *q) {
+    pa_assert(q);
+
+    pa_fdsem_after_poll(q->fdsem);
+}
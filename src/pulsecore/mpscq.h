@@ -0,0 +1,60 @@
+#ifndef foopulsempscqhfoo
+#define foopulsempscqhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* An unbounded, intrusive, lock-free multiple-producer
+ * single-consumer queue. Any number of threads may push items
+ * concurrently without taking a lock, a single thread may pop
+ * them. Items are queued in FIFO order per producer.
+ *
+ * Since the queue is unbounded pushing never blocks. The reading side
+ * may block on a pa_fdsem when the queue is empty, similar to
+ * pa_asyncq. Waking up the reader can be deferred, so that a batch of
+ * items costs only a single wakeup: push them with wakeup set to false
+ * and call pa_mpscq_wakeup() after the last one. */
+
+typedef struct pa_mpscq_item {
+    pa_atomic_ptr_t next;
+} pa_mpscq_item;
+
+typedef struct pa_mpscq pa_mpscq;
+
+pa_mpscq* pa_mpscq_new(void);
+
+/* The queue needs to be empty when freeing it */
+void pa_mpscq_free(pa_mpscq *q);
+
+/* For the writing side, may be called from any thread */
+void pa_mpscq_push(pa_mpscq *q, pa_mpscq_item *i, bool wakeup);
+void pa_mpscq_wakeup(pa_mpscq *q);
+
+/* For the reading side */
+pa_mpscq_item* pa_mpscq_pop(pa_mpscq *q, bool wait);
+bool pa_mpscq_is_empty(pa_mpscq *q);
+
+int pa_mpscq_read_fd(pa_mpscq *q);
+int pa_mpscq_read_before_poll(pa_mpscq *q);
+void pa_mpscq_read_after_poll(pa_mpscq *q);
+
+#endif
@@ -181,6 +181,9 @@ enum {
     PA_COMMAND_ENABLE_SRBCHANNEL,
     PA_COMMAND_DISABLE_SRBCHANNEL,
 
+    /* Supported since protocol v31 (6.0) */
+    PA_COMMAND_GET_IO_STATS_INFO_LIST,
+
     PA_COMMAND_MAX
 };
 
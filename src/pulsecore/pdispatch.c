@@ -197,6 +197,9 @@ static const char *command_names[PA_COMMAND_MAX] = {
     /* BOTH DIRECTIONS */
     [PA_COMMAND_ENABLE_SRBCHANNEL] = "ENABLE_SRBCHANNEL",
     [PA_COMMAND_DISABLE_SRBCHANNEL] = "DISABLE_SRBCHANNEL",
+
+    /* Supported since protocol v31 (6.0) */
+    [PA_COMMAND_GET_IO_STATS_INFO_LIST] = "GET_IO_STATS_INFO_LIST",
 };
 
 #endif
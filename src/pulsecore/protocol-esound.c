@@ -246,7 +246,7 @@ static void connection_unlink(connection *c) {
     }
 
     if (c->auth_timeout_event) {
-        c->protocol->core->mainloop->time_free(c->auth_timeout_event);
+        pa_core_rttime_free(c->protocol->core, c->auth_timeout_event);
         c->auth_timeout_event = NULL;
     }
 
@@ -356,7 +356,7 @@ static int esd_proto_connect(connection *c, esd_proto_t request, const void *dat
     }
 
     if (c->auth_timeout_event) {
-        c->protocol->core->mainloop->time_free(c->auth_timeout_event);
+        pa_core_rttime_free(c->protocol->core, c->auth_timeout_event);
         c->auth_timeout_event = NULL;
     }
 
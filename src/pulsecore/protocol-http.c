@@ -27,6 +27,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
 
 #include <pulse/util.h>
 #include <pulse/xmalloc.h>
@@ -42,6 +44,8 @@
 #include <pulsecore/shared.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/mime-type.h>
+#include <pulsecore/core-scache.h>
+#include <pulsecore/strbuf.h>
 
 #include "protocol-http.h"
 
@@ -53,10 +57,12 @@
 #define URL_STATUS "/status"
 #define URL_LISTEN "/listen"
 #define URL_LISTEN_SOURCE "/listen/source/"
+#define URL_METRICS "/metrics"
 
 #define MIME_HTML "text/html; charset=utf-8"
 #define MIME_TEXT "text/plain; charset=utf-8"
 #define MIME_CSS "text/css"
+#define MIME_METRICS "text/plain; version=0.0.4; charset=utf-8"
 
 #define HTML_HEADER(t)                                                  \
     "<?xml version=\"1.0\"?>\n"                                         \
@@ -409,6 +415,7 @@ static void handle_root(struct connection *c) {
                    "</table>\n"
                    "<p><a href=\"" URL_STATUS "\">Show an extensive server status report</a></p>\n"
                    "<p><a href=\"" URL_LISTEN "\">Monitor sinks and sources</a></p>\n"
+                   "<p><a href=\"" URL_METRICS "\">Show metrics for monitoring systems</a></p>\n"
                    HTML_FOOTER);
 
     pa_ioline_defer_close(c->line);
@@ -455,6 +462,268 @@ static void handle_status(struct connection *c) {
     pa_ioline_defer_close(c->line);
 }
 
+/* Label values of the Prometheus text format need \, " and newlines
+ * escaped */
+static void metrics_put_label(pa_strbuf *buf, const char *name, const char *value, bool first) {
+    pa_strbuf_printf(buf, "%s%s=\"", first ? "" : ",", name);
+
+    for (; value && *value; value++) {
+        if (*value == '\\' || *value == '"')
+            pa_strbuf_printf(buf, "\\%c", *value);
+        else if (*value == '\n')
+            pa_strbuf_puts(buf, "\\n");
+        else
+            pa_strbuf_putc(buf, *value);
+    }
+
+    pa_strbuf_putc(buf, '"');
+}
+
+static void metrics_put_header(pa_strbuf *buf, const char *name, const char *type, const char *help) {
+    pa_strbuf_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* The io-stats metric families. Each family is printed in one go, as
+ * the text format wants it. */
+enum {
+    IO_STATS_XRUNS,
+    IO_STATS_REWINDS,
+    IO_STATS_REWOUND_BYTES,
+    IO_STATS_RENDER_DURATION,
+    IO_STATS_RESAMPLE_TIME,
+    IO_STATS_BUFFER,
+    IO_STATS_BUFFER_MAX,
+    IO_STATS_MAX
+};
+
+static const struct {
+    const char *name, *type, *help;
+} io_stats_families[IO_STATS_MAX] = {
+    [IO_STATS_XRUNS] = { "pulseaudio_xruns_total", "counter", "Underruns of sinks and playback streams, overruns of sources and record streams." },
+    [IO_STATS_REWINDS] = { "pulseaudio_rewinds_total", "counter", "Number of rewinds." },
+    [IO_STATS_REWOUND_BYTES] = { "pulseaudio_rewound_bytes_total", "counter", "Number of bytes rewound." },
+    [IO_STATS_RENDER_DURATION] = { "pulseaudio_render_duration_seconds", "summary", "Time it took to render or post one block." },
+    [IO_STATS_RESAMPLE_TIME] = { "pulseaudio_resample_seconds_total", "counter", "Time spent in the resampler." },
+    [IO_STATS_BUFFER] = { "pulseaudio_buffer_bytes", "gauge", "Current fill level of the buffer of a stream." },
+    [IO_STATS_BUFFER_MAX] = { "pulseaudio_buffer_max_bytes", "gauge", "Highest fill level of the buffer of a stream." },
+};
+
+struct io_stats_entry {
+    char *labels;
+    pa_io_stats_snapshot stats;
+};
+
+static void io_stats_entry_init(struct io_stats_entry *e, const char *type, uint32_t idx, const char *name, const char *device, const pa_io_stats *s) {
+    pa_strbuf *labels;
+
+    pa_io_stats_get_snapshot(s, &e->stats);
+
+    labels = pa_strbuf_new();
+    metrics_put_label(labels, "type", type, true);
+    pa_strbuf_printf(labels, ",index=\"%u\"", idx);
+    metrics_put_label(labels, "name", name, false);
+    if (device)
+        metrics_put_label(labels, "device", device, false);
+    e->labels = pa_strbuf_tostring_free(labels);
+}
+
+static void metrics_put_io_stats(pa_strbuf *buf, unsigned family, const struct io_stats_entry *e) {
+    const char *n = io_stats_families[family].name, *l = e->labels;
+    const pa_io_stats_snapshot *i = &e->stats;
+
+    switch (family) {
+        case IO_STATS_XRUNS:
+            pa_strbuf_printf(buf, "%s{%s} %u\n", n, l, i->xruns);
+            break;
+
+        case IO_STATS_REWINDS:
+            pa_strbuf_printf(buf, "%s{%s} %u\n", n, l, i->rewinds);
+            break;
+
+        case IO_STATS_REWOUND_BYTES:
+            pa_strbuf_printf(buf, "%s{%s} %llu\n", n, l, (unsigned long long) i->rewind_bytes);
+            break;
+
+        case IO_STATS_RENDER_DURATION:
+            pa_strbuf_printf(buf, "%s{%s,quantile=\"0.5\"} %0.6f\n", n, l, (double) i->render_time_p50 / PA_USEC_PER_SEC);
+            pa_strbuf_printf(buf, "%s{%s,quantile=\"0.99\"} %0.6f\n", n, l, (double) i->render_time_p99 / PA_USEC_PER_SEC);
+            pa_strbuf_printf(buf, "%s{%s,quantile=\"1\"} %0.6f\n", n, l, (double) i->render_time_max / PA_USEC_PER_SEC);
+            pa_strbuf_printf(buf, "%s_sum{%s} %0.6f\n", n, l, (double) i->render_time_total / PA_USEC_PER_SEC);
+            pa_strbuf_printf(buf, "%s_count{%s} %u\n", n, l, i->render_count);
+            break;
+
+        case IO_STATS_RESAMPLE_TIME:
+            pa_strbuf_printf(buf, "%s{%s} %0.6f\n", n, l, (double) i->resample_time / PA_USEC_PER_SEC);
+            break;
+
+        case IO_STATS_BUFFER:
+            pa_strbuf_printf(buf, "%s{%s} %u\n", n, l, i->queue_length);
+            break;
+
+        case IO_STATS_BUFFER_MAX:
+            pa_strbuf_printf(buf, "%s{%s} %u\n", n, l, i->queue_length_max);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+#ifdef __linux__
+/* Reads the CPU time of all our threads from /proc, which costs the IO
+ * threads nothing */
+static void metrics_put_thread_cpu(pa_strbuf *buf) {
+    DIR *d;
+    struct dirent *de;
+    long ticks;
+
+    if ((ticks = sysconf(_SC_CLK_TCK)) <= 0)
+        return;
+
+    if (!(d = opendir("/proc/self/task")))
+        return;
+
+    metrics_put_header(buf, "pulseaudio_thread_cpu_seconds_total", "counter", "CPU time spent by each thread of the daemon.");
+
+    while ((de = readdir(d))) {
+        char *fn, *contents, *comm, *e;
+        unsigned long utime, stime;
+
+        if (de->d_name[0] == '.')
+            continue;
+
+        fn = pa_sprintf_malloc("/proc/self/task/%s/stat", de->d_name);
+        contents = pa_read_line_from_file(fn);
+        pa_xfree(fn);
+
+        if (!contents)
+            continue;
+
+        /* The thread name may contain spaces and parentheses, so look
+         * for the last closing one. utime and stime are the 12th and
+         * 13th field after it. */
+        if ((comm = strchr(contents, '(')) && (e = strrchr(comm, ')')) &&
+            sscanf(e + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+
+            *e = 0;
+            pa_strbuf_puts(buf, "pulseaudio_thread_cpu_seconds_total{");
+            metrics_put_label(buf, "thread", comm + 1, true);
+            metrics_put_label(buf, "tid", de->d_name, false);
+            pa_strbuf_printf(buf, "} %0.2f\n", (double) (utime + stime) / (double) ticks);
+        }
+
+        pa_xfree(contents);
+    }
+
+    closedir(d);
+}
+#endif
+
+static void handle_metrics(struct connection *c) {
+    pa_core *core;
+    const pa_mempool_stat *stat;
+    pa_strbuf *buf;
+    pa_sink *sink;
+    pa_source *source;
+    pa_sink_input *si;
+    pa_source_output *so;
+    struct io_stats_entry *entries;
+    unsigned n_entries = 0, family, j;
+    uint32_t idx;
+    char *r;
+
+    pa_assert(c);
+
+    http_response(c, 200, "OK", MIME_METRICS);
+
+    if (c->method == METHOD_HEAD) {
+        pa_ioline_defer_close(c->line);
+        return;
+    }
+
+    core = c->protocol->core;
+    stat = pa_mempool_get_stat(core->mempool);
+    buf = pa_strbuf_new();
+
+    metrics_put_header(buf, "pulseaudio_memblocks", "gauge", "Currently allocated memory blocks.");
+    pa_strbuf_printf(buf, "pulseaudio_memblocks %u\n", (unsigned) pa_atomic_load(&stat->n_allocated));
+    metrics_put_header(buf, "pulseaudio_memblocks_bytes", "gauge", "Total size of the currently allocated memory blocks.");
+    pa_strbuf_printf(buf, "pulseaudio_memblocks_bytes %u\n", (unsigned) pa_atomic_load(&stat->allocated_size));
+    metrics_put_header(buf, "pulseaudio_memblocks_allocated_total", "counter", "Memory blocks allocated during the whole lifetime of the daemon.");
+    pa_strbuf_printf(buf, "pulseaudio_memblocks_allocated_total %u\n", (unsigned) pa_atomic_load(&stat->n_accumulated));
+    metrics_put_header(buf, "pulseaudio_memblocks_allocated_bytes_total", "counter", "Total size of the memory blocks allocated during the whole lifetime of the daemon.");
+    pa_strbuf_printf(buf, "pulseaudio_memblocks_allocated_bytes_total %u\n", (unsigned) pa_atomic_load(&stat->accumulated_size));
+    metrics_put_header(buf, "pulseaudio_sample_cache_bytes", "gauge", "Total size of all sample cache entries.");
+    pa_strbuf_printf(buf, "pulseaudio_sample_cache_bytes %u\n", (unsigned) pa_scache_total_size(core));
+
+    metrics_put_header(buf, "pulseaudio_clients", "gauge", "Number of connected clients.");
+    pa_strbuf_printf(buf, "pulseaudio_clients %u\n", pa_idxset_size(core->clients));
+    metrics_put_header(buf, "pulseaudio_sink_inputs", "gauge", "Number of playback streams.");
+    pa_strbuf_printf(buf, "pulseaudio_sink_inputs %u\n", pa_idxset_size(core->sink_inputs));
+    metrics_put_header(buf, "pulseaudio_source_outputs", "gauge", "Number of record streams.");
+    pa_strbuf_printf(buf, "pulseaudio_source_outputs %u\n", pa_idxset_size(core->source_outputs));
+
+    metrics_put_header(buf, "pulseaudio_sink_latency_seconds", "gauge", "Current latency of each sink.");
+    PA_IDXSET_FOREACH(sink, core->sinks, idx) {
+        if (!PA_SINK_IS_LINKED(sink->state))
+            continue;
+
+        pa_strbuf_puts(buf, "pulseaudio_sink_latency_seconds{");
+        metrics_put_label(buf, "name", sink->name, true);
+        pa_strbuf_printf(buf, "} %0.6f\n", (double) pa_sink_get_latency(sink) / PA_USEC_PER_SEC);
+    }
+
+    metrics_put_header(buf, "pulseaudio_source_latency_seconds", "gauge", "Current latency of each source.");
+    PA_IDXSET_FOREACH(source, core->sources, idx) {
+        if (!PA_SOURCE_IS_LINKED(source->state))
+            continue;
+
+        pa_strbuf_puts(buf, "pulseaudio_source_latency_seconds{");
+        metrics_put_label(buf, "name", source->name, true);
+        pa_strbuf_printf(buf, "} %0.6f\n", (double) pa_source_get_latency(source) / PA_USEC_PER_SEC);
+    }
+
+    /* Take the snapshots once, so that all families show the same state */
+    entries = pa_xnew(struct io_stats_entry,
+                      pa_idxset_size(core->sinks) + pa_idxset_size(core->sources) +
+                      pa_idxset_size(core->sink_inputs) + pa_idxset_size(core->source_outputs));
+
+    PA_IDXSET_FOREACH(sink, core->sinks, idx)
+        io_stats_entry_init(&entries[n_entries++], "sink", idx, sink->name, NULL, &sink->io_stats);
+
+    PA_IDXSET_FOREACH(source, core->sources, idx)
+        io_stats_entry_init(&entries[n_entries++], "source", idx, source->name, NULL, &source->io_stats);
+
+    PA_IDXSET_FOREACH(si, core->sink_inputs, idx)
+        io_stats_entry_init(&entries[n_entries++], "sink-input", idx, pa_strnull(pa_proplist_gets(si->proplist, PA_PROP_APPLICATION_NAME)),
+                            si->sink ? si->sink->name : NULL, &si->io_stats);
+
+    PA_IDXSET_FOREACH(so, core->source_outputs, idx)
+        io_stats_entry_init(&entries[n_entries++], "source-output", idx, pa_strnull(pa_proplist_gets(so->proplist, PA_PROP_APPLICATION_NAME)),
+                            so->source ? so->source->name : NULL, &so->io_stats);
+
+    for (family = 0; family < IO_STATS_MAX; family++) {
+        metrics_put_header(buf, io_stats_families[family].name, io_stats_families[family].type, io_stats_families[family].help);
+
+        for (j = 0; j < n_entries; j++)
+            metrics_put_io_stats(buf, family, &entries[j]);
+    }
+
+    for (j = 0; j < n_entries; j++)
+        pa_xfree(entries[j].labels);
+    pa_xfree(entries);
+
+#ifdef __linux__
+    metrics_put_thread_cpu(buf);
+#endif
+
+    r = pa_strbuf_tostring_free(buf);
+    pa_ioline_puts(c->line, r);
+    pa_xfree(r);
+
+    pa_ioline_defer_close(c->line);
+}
+
 static void handle_listen(struct connection *c) {
     pa_source *source;
     pa_sink *sink;
@@ -625,6 +894,8 @@ static void handle_url(struct connection *c) {
         handle_status(c);
     else if (pa_streq(c->url, URL_LISTEN))
         handle_listen(c);
+    else if (pa_streq(c->url, URL_METRICS))
+        handle_metrics(c);
     else if (pa_startswith(c->url, URL_LISTEN_SOURCE))
         handle_listen_prefix(c, c->url + sizeof(URL_LISTEN_SOURCE)-1);
     else
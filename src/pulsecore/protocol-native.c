@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <pulse/mainloop.h>
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/version.h>
@@ -56,6 +57,8 @@
 #include <pulsecore/creds.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/ipacl.h>
+#include <pulsecore/queue.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 
 #include "protocol-native.h"
@@ -68,6 +71,13 @@
 /* Don't accept more connection than this */
 #define MAX_CONNECTIONS 64
 
+/* Submission queue size of the io_uring shared by all connections,
+ * enough for a read, a write and a cancellation of every connection */
+#define IOURING_ENTRIES 256
+
+/* Upper limit for io-threads= */
+#define MAX_IO_THREADS 16
+
 #define MAX_MEMBLOCKQ_LENGTH (4*1024*1024) /* 4MB */
 #define DEFAULT_TLENGTH_MSEC 2000 /* 2s */
 #define DEFAULT_PROCESS_MSEC 20   /* 20ms */
@@ -167,6 +177,49 @@ typedef struct upload_stream {
 #define UPLOAD_STREAM(o) (upload_stream_cast(o))
 PA_DEFINE_PRIVATE_CLASS(upload_stream, output_stream);
 
+/* A thread doing the pstream I/O of a number of connections, and
+ * passing the audio data of their playback streams directly to the
+ * sinks. Everything else is forwarded to the main thread. */
+typedef struct io_thread {
+    pa_msgobject parent;
+
+    pa_thread *thread;
+    pa_mainloop *mainloop;
+    pa_thread_mq thread_mq;
+
+    /* Only accessed from the I/O thread */
+    pa_iouring *iouring;
+    bool iouring_failed;
+
+    /* Only accessed from main context */
+    unsigned n_connections;
+} io_thread;
+
+#define IO_THREAD(o) (io_thread_cast(o))
+PA_DEFINE_PRIVATE_CLASS(io_thread, pa_msgobject);
+
+/* The I/O thread's view of a playback stream */
+typedef struct io_playback_stream {
+    playback_stream *stream;
+    size_t frame_size;
+
+    /* NULL while the sink input is being moved, blocks received in
+     * the meantime are kept in pending */
+    pa_asyncmsgq *asyncmsgq;
+    pa_queue *pending;
+
+    /* Stream commands received but not yet applied by the main
+     * thread. Blocks that come after them are kept in pending too, so
+     * that they don't overtake, e.g., a flush. */
+    unsigned n_held;
+} io_playback_stream;
+
+struct pending_block {
+    int64_t offset;
+    pa_seek_mode_t seek;
+    pa_memchunk chunk;
+};
+
 struct pa_native_connection {
     pa_msgobject parent;
     pa_native_protocol *protocol;
@@ -182,6 +235,12 @@ struct pa_native_connection {
     pa_subscription *subscription;
     pa_time_event *auth_timeout_event;
     pa_srbchannel *srbpending;
+
+    /* Set if the pstream I/O is done by an I/O thread */
+    io_thread *io_thread;
+    int io_fd;
+    /* channel -> io_playback_stream, only accessed from the I/O thread */
+    pa_hashmap *io_playback_streams;
 };
 
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
@@ -197,6 +256,15 @@ struct pa_native_protocol {
     pa_hook hooks[PA_NATIVE_HOOK_MAX];
 
     pa_hashmap *extensions;
+
+    /* Shared by all connections that use io_uring, created on demand */
+    pa_iouring *iouring;
+    bool iouring_failed;
+
+    /* Started on demand, see the io-threads= option */
+    io_thread *io_threads[MAX_IO_THREADS];
+    unsigned n_io_threads;
+    pa_hook_slot *sink_input_move_start_slot, *sink_input_move_finish_slot;
 };
 
 enum {
@@ -232,6 +300,15 @@ enum {
     CONNECTION_MESSAGE_REVOKE
 };
 
+enum {
+    IO_THREAD_MESSAGE_ADD_CONNECTION,
+    IO_THREAD_MESSAGE_ADD_PLAYBACK_STREAM,
+    IO_THREAD_MESSAGE_REMOVE_PLAYBACK_STREAM,
+    IO_THREAD_MESSAGE_DETACH_PLAYBACK_STREAM,  /* the sink input starts moving */
+    IO_THREAD_MESSAGE_ATTACH_PLAYBACK_STREAM,  /* the sink input finished moving */
+    IO_THREAD_MESSAGE_RELEASE_PLAYBACK_STREAM  /* a stream command has been applied */
+};
+
 static bool sink_input_process_underrun_cb(pa_sink_input *i);
 static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk);
 static void sink_input_kill_cb(pa_sink_input *i);
@@ -296,6 +373,7 @@ static void command_set_card_profile(pa_pdispatch *pd, uint32_t command, uint32_
 static void command_set_sink_or_source_port(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_io_stats_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_ERROR] = NULL,
@@ -401,6 +479,8 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_ENABLE_SRBCHANNEL] = command_enable_srbchannel,
 
+    [PA_COMMAND_GET_IO_STATS_INFO_LIST] = command_get_io_stats_info_list,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -773,6 +853,9 @@ static void playback_stream_unlink(playback_stream *s) {
     if (!s->connection)
         return;
 
+    if (s->connection->io_thread)
+        pa_asyncmsgq_send(s->connection->io_thread->thread_mq.inq, PA_MSGOBJECT(s->connection->io_thread), IO_THREAD_MESSAGE_REMOVE_PLAYBACK_STREAM, s, 0, NULL);
+
     if (s->sink_input) {
         pa_sink_input_unlink(s->sink_input);
         pa_sink_input_unref(s->sink_input);
@@ -1244,6 +1327,9 @@ static playback_stream* playback_stream_new(
 
     pa_sink_input_put(s->sink_input);
 
+    if (c->io_thread)
+        pa_asyncmsgq_send(c->io_thread->thread_mq.inq, PA_MSGOBJECT(c->io_thread), IO_THREAD_MESSAGE_ADD_PLAYBACK_STREAM, s, 0, NULL);
+
 out:
     if (formats)
         pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
@@ -1349,8 +1435,15 @@ static void native_connection_unlink(pa_native_connection *c) {
     if (c->pstream)
         pa_pstream_unlink(c->pstream);
 
+    if (c->io_thread) {
+        /* The I/O thread doesn't look at the connection anymore now */
+        pa_hashmap_free(c->io_playback_streams);
+        c->io_playback_streams = NULL;
+        c->io_thread->n_connections--;
+    }
+
     if (c->auth_timeout_event) {
-        c->protocol->core->mainloop->time_free(c->auth_timeout_event);
+        pa_core_rttime_free(c->protocol->core, c->auth_timeout_event);
         c->auth_timeout_event = NULL;
     }
 
@@ -1657,6 +1750,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     if (!handle_input_underrun(s, false))
         s->is_underrun = false;
 
+    pa_io_stats_set_queue_length(&i->io_stats, pa_memblockq_get_length(s->memblockq));
+
     /* This call will not fail with prebuf=0, hence we check for
        underrun explicitly in handle_input_underrun */
     if (pa_memblockq_peek(s->memblockq, chunk) < 0)
@@ -2602,6 +2697,11 @@ static void setup_srbchannel(pa_native_connection *c) {
         return;
     }
 
+    if (c->io_thread) {
+        pa_log_debug("Disabling srbchannel, reason: Connection is served by an I/O thread");
+        return;
+    }
+
     if (!pa_pstream_get_shm(c->pstream)) {
         pa_log_debug("Disabling srbchannel, reason: No SHM support");
         return;
@@ -2731,7 +2831,7 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
 
         c->authorized = true;
         if (c->auth_timeout_event) {
-            c->protocol->core->mainloop->time_free(c->auth_timeout_event);
+            pa_core_rttime_free(c->protocol->core, c->auth_timeout_event);
             c->auth_timeout_event = NULL;
         }
     }
@@ -2907,6 +3007,63 @@ static void command_stat(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+static void io_stats_fill_tagstruct(pa_tagstruct *t, pa_subscription_event_type_t facility, uint32_t idx, const pa_io_stats *s) {
+    pa_io_stats_snapshot i;
+
+    pa_io_stats_get_snapshot(s, &i);
+
+    pa_tagstruct_putu32(t, facility);
+    pa_tagstruct_putu32(t, idx);
+    pa_tagstruct_putu32(t, i.xruns);
+    pa_tagstruct_putu32(t, i.rewinds);
+    pa_tagstruct_putu64(t, i.rewind_bytes);
+    pa_tagstruct_putu32(t, i.render_count);
+    pa_tagstruct_put_usec(t, i.render_time_p50);
+    pa_tagstruct_put_usec(t, i.render_time_p99);
+    pa_tagstruct_put_usec(t, i.render_time_max);
+    pa_tagstruct_put_usec(t, i.resample_time);
+    pa_tagstruct_putu32(t, i.queue_length);
+    pa_tagstruct_putu32(t, i.queue_length_max);
+}
+
+static void command_get_io_stats_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_core *core;
+    pa_tagstruct *reply;
+    pa_sink *sink;
+    pa_source *source;
+    pa_sink_input *si;
+    pa_source_output *so;
+    uint32_t idx;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (!pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    core = c->protocol->core;
+    reply = reply_new(tag);
+
+    PA_IDXSET_FOREACH(sink, core->sinks, idx)
+        io_stats_fill_tagstruct(reply, PA_SUBSCRIPTION_EVENT_SINK, idx, &sink->io_stats);
+
+    PA_IDXSET_FOREACH(source, core->sources, idx)
+        io_stats_fill_tagstruct(reply, PA_SUBSCRIPTION_EVENT_SOURCE, idx, &source->io_stats);
+
+    PA_IDXSET_FOREACH(si, core->sink_inputs, idx)
+        io_stats_fill_tagstruct(reply, PA_SUBSCRIPTION_EVENT_SINK_INPUT, idx, &si->io_stats);
+
+    PA_IDXSET_FOREACH(so, core->source_outputs, idx)
+        io_stats_fill_tagstruct(reply, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT, idx, &so->io_stats);
+
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
 static void command_get_playback_latency(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_tagstruct *reply;
@@ -4888,17 +5045,90 @@ static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command,
 
 /*** pstream callbacks ***/
 
+/* Called from main context or from the I/O thread. Returns the channel
+ * of a playback stream command that needs to be applied in order with
+ * the data of the stream, PA_INVALID_INDEX for anything else. */
+static uint32_t packet_get_playback_stream_command_channel(pa_packet *packet) {
+    pa_tagstruct *t;
+    uint32_t command, tag, channel = PA_INVALID_INDEX;
+
+    if (packet->length == 0)
+        return PA_INVALID_INDEX;
+
+    t = pa_tagstruct_new(packet->data, packet->length);
+
+    if (pa_tagstruct_getu32(t, &command) >= 0 &&
+        pa_tagstruct_getu32(t, &tag) >= 0) {
+
+        switch (command) {
+            case PA_COMMAND_DRAIN_PLAYBACK_STREAM:
+            case PA_COMMAND_CORK_PLAYBACK_STREAM:
+            case PA_COMMAND_FLUSH_PLAYBACK_STREAM:
+            case PA_COMMAND_TRIGGER_PLAYBACK_STREAM:
+            case PA_COMMAND_PREBUF_PLAYBACK_STREAM:
+            case PA_COMMAND_SET_PLAYBACK_STREAM_BUFFER_ATTR:
+            case PA_COMMAND_UPDATE_PLAYBACK_STREAM_SAMPLE_RATE:
+                if (pa_tagstruct_getu32(t, &channel) < 0)
+                    channel = PA_INVALID_INDEX;
+                break;
+        }
+    }
+
+    pa_tagstruct_free(t);
+
+    return channel;
+}
+
 static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t channel = PA_INVALID_INDEX;
 
     pa_assert(p);
     pa_assert(packet);
     pa_native_connection_assert_ref(c);
 
+    if (c->io_thread)
+        channel = packet_get_playback_stream_command_channel(packet);
+
+    /* The command might unlink the connection */
+    pa_native_connection_ref(c);
+
     if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0) {
         pa_log("invalid packet.");
         native_connection_unlink(c);
     }
+
+    /* The I/O thread held back the data that came after the command,
+     * which may now follow it */
+    if (channel != PA_INVALID_INDEX && c->io_playback_streams)
+        pa_asyncmsgq_send(c->io_thread->thread_mq.inq, PA_MSGOBJECT(c->io_thread), IO_THREAD_MESSAGE_RELEASE_PLAYBACK_STREAM, c, (int64_t) channel, NULL);
+
+    pa_native_connection_unref(c);
+}
+
+/* Called from main context or from the I/O thread */
+static bool playback_stream_check_block(playback_stream *ps, size_t frame_size, const pa_memchunk *chunk) {
+
+    if (chunk->index % frame_size != 0 || chunk->length % frame_size != 0) {
+        pa_log_warn("Client sent non-aligned memblock: index %d, length %d, frame size: %d",
+                    (int) chunk->index, (int) chunk->length, (int) frame_size);
+        return false;
+    }
+
+    return true;
+}
+
+/* Called from main context or from the I/O thread */
+static void playback_stream_post_block(playback_stream *ps, pa_asyncmsgq *q, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk) {
+
+    pa_atomic_inc(&ps->seek_or_post_in_queue);
+    if (chunk->memblock) {
+        if (seek != PA_SEEK_RELATIVE || offset != 0)
+            pa_asyncmsgq_post(q, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset, chunk, NULL);
+        else
+            pa_asyncmsgq_post(q, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
+    } else
+        pa_asyncmsgq_post(q, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset+chunk->length, NULL, NULL);
 }
 
 static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
@@ -4922,21 +5152,10 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
     if (playback_stream_isinstance(stream)) {
         playback_stream *ps = PLAYBACK_STREAM(stream);
 
-        size_t frame_size = pa_frame_size(&ps->sink_input->sample_spec);
-        if (chunk->index % frame_size != 0 || chunk->length % frame_size != 0) {
-            pa_log_warn("Client sent non-aligned memblock: index %d, length %d, frame size: %d",
-                        (int) chunk->index, (int) chunk->length, (int) frame_size);
+        if (!playback_stream_check_block(ps, pa_frame_size(&ps->sink_input->sample_spec), chunk))
             return;
-        }
 
-        pa_atomic_inc(&ps->seek_or_post_in_queue);
-        if (chunk->memblock) {
-            if (seek != PA_SEEK_RELATIVE || offset != 0)
-                pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset, chunk, NULL);
-            else
-                pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
-        } else
-            pa_asyncmsgq_post(ps->sink_input->sink->asyncmsgq, PA_MSGOBJECT(ps->sink_input), SINK_INPUT_MESSAGE_SEEK, PA_UINT_TO_PTR(seek), offset+chunk->length, NULL, NULL);
+        playback_stream_post_block(ps, ps->sink_input->sink->asyncmsgq, offset, seek, chunk);
 
     } else {
         upload_stream *u = UPLOAD_STREAM(stream);
@@ -5002,23 +5221,326 @@ static void pstream_drain_callback(pa_pstream *p, void *userdata) {
 }
 
 static void pstream_revoke_callback(pa_pstream *p, uint32_t block_id, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_thread_mq *q;
 
-    if (!(q = pa_thread_mq_get()))
+    /* A pstream with an I/O thread can be fed from any thread */
+    if (!(q = pa_thread_mq_get()) || c->io_thread)
         pa_pstream_send_revoke(p, block_id);
     else
         pa_asyncmsgq_post(q->outq, PA_MSGOBJECT(userdata), CONNECTION_MESSAGE_REVOKE, PA_UINT_TO_PTR(block_id), 0, NULL, NULL);
 }
 
 static void pstream_release_callback(pa_pstream *p, uint32_t block_id, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_thread_mq *q;
 
-    if (!(q = pa_thread_mq_get()))
+    if (!(q = pa_thread_mq_get()) || c->io_thread)
         pa_pstream_send_release(p, block_id);
     else
         pa_asyncmsgq_post(q->outq, PA_MSGOBJECT(userdata), CONNECTION_MESSAGE_RELEASE, PA_UINT_TO_PTR(block_id), 0, NULL, NULL);
 }
 
+/*** I/O threads ***/
+
+static void pending_block_free(struct pending_block *b) {
+    if (b->chunk.memblock)
+        pa_memblock_unref(b->chunk.memblock);
+
+    pa_xfree(b);
+}
+
+static void io_playback_stream_free(io_playback_stream *s) {
+    pa_queue_free(s->pending, (pa_free_cb_t) pending_block_free);
+    pa_xfree(s);
+}
+
+/* Called from the I/O thread */
+static void io_playback_stream_post_pending(io_playback_stream *s) {
+    struct pending_block *b;
+
+    if (!s->asyncmsgq || s->n_held > 0)
+        return;
+
+    while ((b = pa_queue_pop(s->pending))) {
+        playback_stream_post_block(s->stream, s->asyncmsgq, b->offset, b->seek, &b->chunk);
+        pending_block_free(b);
+    }
+}
+
+/* Called from the I/O thread */
+static void pstream_packet_io_callback(pa_pstream *p, pa_packet *packet, void *userdata) {
+    pa_native_connection *c = userdata;
+    io_playback_stream *s;
+    uint32_t channel;
+
+    pa_assert(p);
+    pa_assert(packet);
+    pa_assert(c);
+
+    if ((channel = packet_get_playback_stream_command_channel(packet)) == PA_INVALID_INDEX)
+        return;
+
+    if ((s = pa_hashmap_get(c->io_playback_streams, PA_UINT32_TO_PTR(channel))))
+        s->n_held++;
+}
+
+/* Called from the I/O thread */
+static bool pstream_memblock_io_callback(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    pa_native_connection *c = userdata;
+    io_playback_stream *s;
+
+    pa_assert(p);
+    pa_assert(chunk);
+    pa_assert(c);
+
+    /* Upload streams and invalid channels are taken care of by the
+     * main thread */
+    if (!(s = pa_hashmap_get(c->io_playback_streams, PA_UINT32_TO_PTR(channel))))
+        return false;
+
+    if (!playback_stream_check_block(s->stream, s->frame_size, chunk))
+        return true;
+
+    if (s->asyncmsgq && s->n_held == 0)
+        playback_stream_post_block(s->stream, s->asyncmsgq, offset, seek, chunk);
+    else {
+        struct pending_block *b;
+
+        b = pa_xnew(struct pending_block, 1);
+        b->offset = offset;
+        b->seek = seek;
+        b->chunk = *chunk;
+        if (b->chunk.memblock)
+            pa_memblock_ref(b->chunk.memblock);
+
+        pa_queue_push(s->pending, b);
+    }
+
+    return true;
+}
+
+/* Called from the I/O thread */
+static void io_thread_add_connection(io_thread *t, pa_native_connection *c) {
+    pa_mainloop_api *m = pa_mainloop_get_api(t->mainloop);
+    pa_iochannel *io;
+
+    io = pa_iochannel_new(m, c->io_fd, c->io_fd);
+
+    if (c->options->io_uring && !t->iouring && !t->iouring_failed) {
+        if (!(t->iouring = pa_iouring_new(m, IOURING_ENTRIES))) {
+            pa_log_info("io_uring not available, using regular I/O for client connections.");
+            t->iouring_failed = true;
+        }
+    }
+
+    if (c->options->io_uring && t->iouring && pa_iochannel_enable_iouring(io, t->iouring) >= 0)
+        pa_log_debug("Using io_uring for client connection.");
+
+#ifdef HAVE_CREDS
+    if (pa_iochannel_creds_supported(io))
+        pa_iochannel_creds_enable(io);
+#endif
+
+    pa_pstream_attach_io(c->pstream, m, io);
+    pa_pstream_set_receive_memblock_io_callback(c->pstream, pstream_memblock_io_callback, c);
+    pa_pstream_set_receive_packet_io_callback(c->pstream, pstream_packet_io_callback, c);
+}
+
+/* Called from the I/O thread */
+static int io_thread_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
+    io_thread *t = IO_THREAD(o);
+    playback_stream *ps = userdata;
+    pa_native_connection *c = userdata;
+    io_playback_stream *s;
+
+    io_thread_assert_ref(t);
+
+    switch (code) {
+
+        case IO_THREAD_MESSAGE_ADD_CONNECTION:
+            io_thread_add_connection(t, userdata);
+            break;
+
+        case IO_THREAD_MESSAGE_ADD_PLAYBACK_STREAM:
+            /* The main thread waits for us, so we may look at the
+             * sink input here */
+            s = pa_xnew(io_playback_stream, 1);
+            s->stream = ps;
+            s->frame_size = pa_frame_size(&ps->sink_input->sample_spec);
+            s->asyncmsgq = ps->sink_input->sink ? ps->sink_input->sink->asyncmsgq : NULL;
+            s->pending = pa_queue_new();
+            s->n_held = 0;
+
+            pa_assert_se(pa_hashmap_put(ps->connection->io_playback_streams, PA_UINT32_TO_PTR(ps->index), s) == 0);
+            break;
+
+        case IO_THREAD_MESSAGE_REMOVE_PLAYBACK_STREAM:
+            if ((s = pa_hashmap_remove(ps->connection->io_playback_streams, PA_UINT32_TO_PTR(ps->index))))
+                io_playback_stream_free(s);
+            break;
+
+        case IO_THREAD_MESSAGE_DETACH_PLAYBACK_STREAM:
+            if ((s = pa_hashmap_get(ps->connection->io_playback_streams, PA_UINT32_TO_PTR(ps->index))))
+                s->asyncmsgq = NULL;
+            break;
+
+        case IO_THREAD_MESSAGE_ATTACH_PLAYBACK_STREAM:
+            if (!(s = pa_hashmap_get(ps->connection->io_playback_streams, PA_UINT32_TO_PTR(ps->index))))
+                break;
+
+            s->asyncmsgq = ps->sink_input->sink->asyncmsgq;
+            io_playback_stream_post_pending(s);
+            break;
+
+        case IO_THREAD_MESSAGE_RELEASE_PLAYBACK_STREAM:
+            if (!(s = pa_hashmap_get(c->io_playback_streams, PA_UINT32_TO_PTR((uint32_t) offset))) || s->n_held == 0)
+                break;
+
+            s->n_held--;
+            io_playback_stream_post_pending(s);
+            break;
+    }
+
+    return 0;
+}
+
+static void io_thread_func(void *userdata) {
+    io_thread *t = userdata;
+
+    pa_assert(t);
+
+    pa_log_debug("I/O thread starting up");
+
+    pa_thread_mq_install(&t->thread_mq);
+
+    /* Runs until we get PA_MESSAGE_SHUTDOWN */
+    pa_mainloop_run(t->mainloop, NULL);
+
+    if (t->iouring)
+        pa_iouring_free(t->iouring);
+
+    pa_log_debug("I/O thread shutting down");
+}
+
+/* Called from main context */
+static void io_thread_free(pa_object *o) {
+    io_thread *t = IO_THREAD(o);
+
+    pa_assert(t);
+
+    pa_xfree(t);
+}
+
+/* Called from main context */
+static io_thread* io_thread_new(pa_native_protocol *p) {
+    io_thread *t;
+    char name[16];
+
+    t = pa_msgobject_new(io_thread);
+    t->parent.parent.free = io_thread_free;
+    t->parent.process_msg = io_thread_process_msg;
+    t->iouring = NULL;
+    t->iouring_failed = false;
+    t->n_connections = 0;
+
+    t->mainloop = pa_mainloop_new();
+    pa_thread_mq_init_thread_mainloop(&t->thread_mq, p->core->mainloop, pa_mainloop_get_api(t->mainloop));
+
+    pa_snprintf(name, sizeof(name), "native-io%u", p->n_io_threads);
+    if (!(t->thread = pa_thread_new(name, io_thread_func, t))) {
+        pa_log("Failed to create I/O thread.");
+        pa_thread_mq_done(&t->thread_mq);
+        pa_mainloop_free(t->mainloop);
+        io_thread_unref(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+/* Called from main context */
+static void io_thread_shutdown(io_thread *t) {
+    pa_assert(t);
+    pa_assert(t->n_connections == 0);
+
+    pa_asyncmsgq_send(t->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(t->thread);
+
+    pa_thread_mq_done(&t->thread_mq);
+    pa_mainloop_free(t->mainloop);
+
+    io_thread_unref(t);
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_move_start_cb(pa_core *core, pa_sink_input *i, pa_native_protocol *p) {
+    playback_stream *s;
+
+    /* Not one of ours? */
+    if (i->moving != sink_input_moving_cb)
+        return PA_HOOK_OK;
+
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+
+    /* The sink thread is about to let go of the sink input, so stop
+     * passing it data until it arrived at the new sink */
+    if (s->connection && s->connection->io_thread)
+        pa_asyncmsgq_send(s->connection->io_thread->thread_mq.inq, PA_MSGOBJECT(s->connection->io_thread), IO_THREAD_MESSAGE_DETACH_PLAYBACK_STREAM, s, 0, NULL);
+
+    return PA_HOOK_OK;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_move_finish_cb(pa_core *core, pa_sink_input *i, pa_native_protocol *p) {
+    playback_stream *s;
+
+    if (i->moving != sink_input_moving_cb)
+        return PA_HOOK_OK;
+
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+
+    if (s->connection && s->connection->io_thread)
+        pa_asyncmsgq_send(s->connection->io_thread->thread_mq.inq, PA_MSGOBJECT(s->connection->io_thread), IO_THREAD_MESSAGE_ATTACH_PLAYBACK_STREAM, s, 0, NULL);
+
+    return PA_HOOK_OK;
+}
+
+/* Called from main context. Returns the least busy of the first n I/O
+ * threads, starting them as needed. */
+static io_thread* get_io_thread(pa_native_protocol *p, unsigned n) {
+    io_thread *t = NULL;
+    unsigned i;
+
+    pa_assert(n <= MAX_IO_THREADS);
+
+    while (p->n_io_threads < n) {
+        io_thread *nt;
+
+        if (!(nt = io_thread_new(p)))
+            break;
+
+        p->io_threads[p->n_io_threads++] = nt;
+    }
+
+    if (p->n_io_threads > 0 && !p->sink_input_move_start_slot) {
+        /* Run last, so that nobody cancels the move after we detached
+         * the stream, and attach again as early as possible */
+        p->sink_input_move_start_slot = pa_hook_connect(&p->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_START], PA_HOOK_LATE+30,
+                                                        (pa_hook_cb_t) sink_input_move_start_cb, p);
+        p->sink_input_move_finish_slot = pa_hook_connect(&p->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_FINISH], PA_HOOK_EARLY,
+                                                         (pa_hook_cb_t) sink_input_move_finish_cb, p);
+    }
+
+    for (i = 0; i < PA_MIN(n, p->n_io_threads); i++)
+        if (!t || p->io_threads[i]->n_connections < t->n_connections)
+            t = p->io_threads[i];
+
+    return t;
+}
+
 /*** client callbacks ***/
 
 static void client_kill_cb(pa_client *c) {
@@ -5119,12 +5641,41 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     c->is_local = pa_iochannel_socket_is_local(io);
     c->version = 8;
 
+    c->io_thread = NULL;
+    c->io_fd = -1;
+    c->io_playback_streams = NULL;
+
+    if (o->io_threads > 0 && (c->io_thread = get_io_thread(p, o->io_threads))) {
+        /* The I/O thread sets up its own iochannel for the socket */
+        pa_iochannel_set_noclose(io, true);
+        c->io_fd = pa_iochannel_get_recv_fd(io);
+        pa_iochannel_free(io);
+        io = NULL;
+
+        c->io_thread->n_connections++;
+        c->io_playback_streams = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func,
+                                                     NULL, (pa_free_cb_t) io_playback_stream_free);
+    } else {
+        if (o->io_uring && !p->iouring && !p->iouring_failed) {
+            if (!(p->iouring = pa_iouring_new(p->core->mainloop, IOURING_ENTRIES))) {
+                pa_log_info("io_uring not available, using regular I/O for client connections.");
+                p->iouring_failed = true;
+            }
+        }
+
+        if (o->io_uring && p->iouring && pa_iochannel_enable_iouring(io, p->iouring) >= 0)
+            pa_log_debug("Using io_uring for client connection.");
+    }
+
     c->client = client;
     c->client->kill = client_kill_cb;
     c->client->send_event = client_send_event_cb;
     c->client->userdata = c;
 
-    c->pstream = pa_pstream_new(p->core->mainloop, io, p->core->mempool);
+    if (c->io_thread)
+        c->pstream = pa_pstream_new_threaded(p->core->mainloop, p->core->mempool);
+    else
+        c->pstream = pa_pstream_new(p->core->mainloop, io, p->core->mempool);
     pa_pstream_set_receive_packet_callback(c->pstream, pstream_packet_callback, c);
     pa_pstream_set_receive_memblock_callback(c->pstream, pstream_memblock_callback, c);
     pa_pstream_set_die_callback(c->pstream, pstream_die_callback, c);
@@ -5142,8 +5693,11 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
 
     pa_idxset_put(p->connections, c, NULL);
 
+    if (c->io_thread)
+        pa_asyncmsgq_send(c->io_thread->thread_mq.inq, PA_MSGOBJECT(c->io_thread), IO_THREAD_MESSAGE_ADD_CONNECTION, c, 0, NULL);
+
 #ifdef HAVE_CREDS
-    if (pa_iochannel_creds_supported(io))
+    if (io && pa_iochannel_creds_supported(io))
         pa_iochannel_creds_enable(io);
 #endif
 
@@ -5175,6 +5729,12 @@ static pa_native_protocol* native_protocol_new(pa_core *c) {
 
     p->servers = NULL;
 
+    p->iouring = NULL;
+    p->iouring_failed = false;
+
+    p->n_io_threads = 0;
+    p->sink_input_move_start_slot = p->sink_input_move_finish_slot = NULL;
+
     p->extensions = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
     for (h = 0; h < PA_NATIVE_HOOK_MAX; h++)
@@ -5218,6 +5778,17 @@ void pa_native_protocol_unref(pa_native_protocol *p) {
 
     pa_idxset_free(p->connections, NULL);
 
+    if (p->iouring)
+        pa_iouring_free(p->iouring);
+
+    while (p->n_io_threads > 0)
+        io_thread_shutdown(p->io_threads[--p->n_io_threads]);
+
+    if (p->sink_input_move_start_slot)
+        pa_hook_slot_free(p->sink_input_move_start_slot);
+    if (p->sink_input_move_finish_slot)
+        pa_hook_slot_free(p->sink_input_move_finish_slot);
+
     pa_strlist_free(p->servers);
 
     for (h = 0; h < PA_NATIVE_HOOK_MAX; h++)
@@ -5333,6 +5904,18 @@ int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
         return -1;
     }
 
+    o->io_uring = false;
+    if (pa_modargs_get_value_boolean(ma, "io-uring", &o->io_uring) < 0) {
+        pa_log("io-uring= expects a boolean argument.");
+        return -1;
+    }
+
+    o->io_threads = 0;
+    if (pa_modargs_get_value_u32(ma, "io-threads", &o->io_threads) < 0 || o->io_threads > MAX_IO_THREADS) {
+        pa_log("io-threads= expects a number between 0 and %u.", MAX_IO_THREADS);
+        return -1;
+    }
+
     if (pa_modargs_get_value_boolean(ma, "auth-anonymous", &o->auth_anonymous) < 0) {
         pa_log("auth-anonymous= expects a boolean argument.");
         return -1;
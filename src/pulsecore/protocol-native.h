@@ -45,6 +45,8 @@ typedef struct pa_native_options {
 
     bool auth_anonymous;
     bool srbchannel;
+    bool io_uring;
+    uint32_t io_threads;
     char *auth_group;
     pa_ip_acl *auth_ip_acl;
     pa_auth_cookie *auth_cookie;
@@ -25,6 +25,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -40,6 +41,8 @@
 #include <pulsecore/creds.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/mpscq.h>
+#include <pulsecore/semaphore.h>
 #include <pulsecore/macro.h>
 
 #include "pstream.h"
@@ -85,11 +88,24 @@ typedef uint32_t pa_pstream_descriptor[PA_PSTREAM_DESCRIPTOR_MAX];
 PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
 
 struct item_info {
+    /* Needs to be the first member, for threaded pstreams items are
+     * passed between threads through a pa_mpscq */
+    pa_mpscq_item mpscq_item;
+
     enum {
         PA_PSTREAM_ITEM_PACKET,
         PA_PSTREAM_ITEM_MEMBLOCK,
         PA_PSTREAM_ITEM_SHMRELEASE,
-        PA_PSTREAM_ITEM_SHMREVOKE
+        PA_PSTREAM_ITEM_SHMREVOKE,
+
+        /* Requests from the owner to the I/O thread */
+        PA_PSTREAM_ITEM_ENABLE_SHM,
+        PA_PSTREAM_ITEM_DISABLE_SHM,
+        PA_PSTREAM_ITEM_UNLINK,
+
+        /* Notifications from the I/O thread to the owner */
+        PA_PSTREAM_ITEM_DRAIN,
+        PA_PSTREAM_ITEM_DIE
     } type;
 
     /* packet info */
@@ -173,10 +189,52 @@ struct pa_pstream {
     pa_cmsg_ancil_data read_ancil_data, write_ancil_data;
     bool send_ancil_data_now;
 #endif
+
+    /* Only used by pstreams created with pa_pstream_new_threaded(). The
+     * fields above belong to the I/O thread, except for the callbacks
+     * which belong to the owner. */
+    bool threaded;
+    pa_mainloop_api *owner_mainloop;
+    pa_mpscq *send_mpscq, *receive_mpscq;
+    pa_io_event *send_event, *receive_event;
+    pa_semaphore *semaphore;
+    pa_atomic_t n_pending;
+    bool owner_unlinked;
+    bool receive_wakeup;
+
+    pa_pstream_memblock_io_cb_t receive_memblock_io_callback;
+    void *receive_memblock_io_callback_userdata;
+
+    pa_pstream_packet_io_cb_t receive_packet_io_callback;
+    void *receive_packet_io_callback_userdata;
 };
 
 static int do_write(pa_pstream *p);
 static int do_read(pa_pstream *p, struct pstream_read *re);
+static void unlink_io(pa_pstream *p);
+
+static struct item_info* item_new(int type) {
+    struct item_info *i;
+
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        i = pa_xnew(struct item_info, 1);
+
+    i->type = type;
+#ifdef HAVE_CREDS
+    i->with_ancil_data = false;
+#endif
+
+    return i;
+}
+
+/* Called from the I/O thread, the owner is woken up at the end of
+ * do_pstream_read_write() */
+static void notify_owner(pa_pstream *p, struct item_info *i) {
+    pa_assert(p->threaded);
+
+    pa_mpscq_push(p->receive_mpscq, &i->mpscq_item, false);
+    p->receive_wakeup = true;
+}
 
 static void do_pstream_read_write(pa_pstream *p) {
     pa_assert(p);
@@ -194,6 +252,14 @@ static void do_pstream_read_write(pa_pstream *p) {
     if (!p->dead && pa_iochannel_is_readable(p->io)) {
         if (do_read(p, &p->readio) < 0)
             goto fail;
+
+        /* A polled channel gets one read per readiness event. One
+         * driven by io_uring stays readable until a read has to wait
+         * for the kernel, so consume everything that is there now. */
+        if (pa_iochannel_is_iouring(p->io))
+            while (!p->dead && pa_iochannel_is_readable(p->io))
+                if (do_read(p, &p->readio) < 0)
+                    goto fail;
     } else if (!p->dead && pa_iochannel_is_hungup(p->io))
         goto fail;
 
@@ -205,15 +271,29 @@ static void do_pstream_read_write(pa_pstream *p) {
             break;
     }
 
-    pa_pstream_unref(p);
-    return;
+    goto finish;
 
 fail:
 
-    if (p->die_callback)
-        p->die_callback(p, p->die_callback_userdata);
+    if (p->threaded) {
+        /* The owner unlinks us when it gets the notification, until
+         * then we only stop doing I/O */
+        notify_owner(p, item_new(PA_PSTREAM_ITEM_DIE));
+        unlink_io(p);
+    } else {
+        if (p->die_callback)
+            p->die_callback(p, p->die_callback_userdata);
+
+        pa_pstream_unlink(p);
+    }
+
+finish:
+
+    if (p->receive_wakeup) {
+        p->receive_wakeup = false;
+        pa_mpscq_wakeup(p->receive_mpscq);
+    }
 
-    pa_pstream_unlink(p);
     pa_pstream_unref(p);
 }
 
@@ -251,15 +331,7 @@ static void defer_callback(pa_mainloop_api *m, pa_defer_event *e, void*userdata)
 
 static void memimport_release_cb(pa_memimport *i, uint32_t block_id, void *userdata);
 
-pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *pool) {
-    pa_pstream *p;
-
-    pa_assert(m);
-    pa_assert(io);
-    pa_assert(pool);
-
-    p = pa_xnew0(pa_pstream, 1);
-    PA_REFCNT_INIT(p);
+static void attach_io(pa_pstream *p, pa_mainloop_api *m, pa_iochannel *io) {
     p->io = io;
     pa_iochannel_set_callback(io, io_callback, p);
 
@@ -267,15 +339,26 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     p->defer_event = m->defer_new(m, defer_callback, p);
     m->defer_enable(p->defer_event, 0);
 
-    p->send_queue = pa_queue_new();
-
-    p->mempool = pool;
-
     /* We do importing unconditionally */
     p->import = pa_memimport_new(p->mempool, memimport_release_cb, p);
 
     pa_iochannel_socket_set_rcvbuf(io, pa_mempool_block_size_max(p->mempool));
     pa_iochannel_socket_set_sndbuf(io, pa_mempool_block_size_max(p->mempool));
+}
+
+pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *pool) {
+    pa_pstream *p;
+
+    pa_assert(m);
+    pa_assert(io);
+    pa_assert(pool);
+
+    p = pa_xnew0(pa_pstream, 1);
+    PA_REFCNT_INIT(p);
+    p->send_queue = pa_queue_new();
+    p->mempool = pool;
+
+    attach_io(p, m, io);
 
     return p;
 }
@@ -285,8 +368,12 @@ static void item_free(void *item) {
     pa_assert(i);
 
     if (i->type == PA_PSTREAM_ITEM_MEMBLOCK) {
-        pa_assert(i->chunk.memblock);
-        pa_memblock_unref(i->chunk.memblock);
+        /* Blocks received from the I/O thread may lack the memblock if
+         * importing it failed */
+        pa_assert(i->chunk.memblock || i->chunk.length > 0);
+
+        if (i->chunk.memblock)
+            pa_memblock_unref(i->chunk.memblock);
     } else if (i->type == PA_PSTREAM_ITEM_PACKET) {
         pa_assert(i->packet);
         pa_packet_unref(i->packet);
@@ -296,11 +383,222 @@ static void item_free(void *item) {
         pa_xfree(i);
 }
 
+static void set_shm(pa_pstream *p, bool enable);
+
+/* Called from the I/O thread. Moves everything the owner queued to
+ * the send queue and carries out its requests. Returns false if the
+ * owner unlinked the pstream, it must not be touched anymore then. */
+static bool fetch_send_items(pa_pstream *p) {
+    pa_mpscq_item *item;
+
+    while ((item = pa_mpscq_pop(p->send_mpscq, false))) {
+        struct item_info *i = (struct item_info*) item;
+
+        switch (i->type) {
+            case PA_PSTREAM_ITEM_ENABLE_SHM:
+            case PA_PSTREAM_ITEM_DISABLE_SHM:
+                set_shm(p, i->type == PA_PSTREAM_ITEM_ENABLE_SHM);
+                item_free(i);
+                pa_semaphore_post(p->semaphore);
+                break;
+
+            case PA_PSTREAM_ITEM_UNLINK:
+                item_free(i);
+                unlink_io(p);
+
+                p->mainloop->io_free(p->send_event);
+                p->send_event = NULL;
+
+                /* The owner may free the pstream right away */
+                pa_semaphore_post(p->semaphore);
+                return false;
+
+            default:
+                if (p->dead) {
+                    pa_atomic_dec(&p->n_pending);
+                    item_free(i);
+                } else
+                    pa_queue_push(p->send_queue, i);
+                break;
+        }
+    }
+
+    return true;
+}
+
+/* Called from the I/O thread */
+static void send_event_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->send_event == e);
+
+    pa_mpscq_read_after_poll(p->send_mpscq);
+
+    do
+        if (!fetch_send_items(p))
+            return;
+    while (pa_mpscq_read_before_poll(p->send_mpscq) < 0);
+
+    if (!p->dead)
+        do_pstream_read_write(p);
+}
+
+/* Called from the owner's thread */
+static void dispatch_received_item(pa_pstream *p, struct item_info *i) {
+
+    switch (i->type) {
+        case PA_PSTREAM_ITEM_PACKET:
+            if (p->receive_packet_callback)
+#ifdef HAVE_CREDS
+                p->receive_packet_callback(p, i->packet, &i->ancil_data, p->receive_packet_callback_userdata);
+#else
+                p->receive_packet_callback(p, i->packet, NULL, p->receive_packet_callback_userdata);
+#endif
+            break;
+
+        case PA_PSTREAM_ITEM_MEMBLOCK:
+            if (p->receive_memblock_callback)
+                p->receive_memblock_callback(p, i->channel, i->offset, i->seek_mode, &i->chunk, p->receive_memblock_callback_userdata);
+            break;
+
+        case PA_PSTREAM_ITEM_DRAIN:
+            if (p->drain_callback && !pa_pstream_is_pending(p))
+                p->drain_callback(p, p->drain_callback_userdata);
+            break;
+
+        case PA_PSTREAM_ITEM_DIE:
+            if (p->die_callback)
+                p->die_callback(p, p->die_callback_userdata);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    item_free(i);
+}
+
+/* Called from the owner's thread */
+static void receive_event_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_pstream *p = userdata;
+    pa_mpscq_item *i;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->receive_event == e);
+
+    pa_pstream_ref(p);
+
+    pa_mpscq_read_after_poll(p->receive_mpscq);
+
+    for (;;) {
+        while (!p->owner_unlinked && (i = pa_mpscq_pop(p->receive_mpscq, false)))
+            dispatch_received_item(p, (struct item_info*) i);
+
+        if (p->owner_unlinked || pa_mpscq_read_before_poll(p->receive_mpscq) == 0)
+            break;
+    }
+
+    pa_pstream_unref(p);
+}
+
+/* Called from the owner's thread, returns when the I/O thread is done
+ * with the request */
+static void call_io_thread(pa_pstream *p, int type) {
+    pa_assert(p->send_event);
+
+    pa_mpscq_push(p->send_mpscq, &item_new(type)->mpscq_item, true);
+    pa_semaphore_wait(p->semaphore);
+}
+
+pa_pstream *pa_pstream_new_threaded(pa_mainloop_api *m, pa_mempool *pool) {
+    pa_pstream *p;
+
+    pa_assert(m);
+    pa_assert(pool);
+
+    p = pa_xnew0(pa_pstream, 1);
+    PA_REFCNT_INIT(p);
+    p->send_queue = pa_queue_new();
+    p->mempool = pool;
+
+    p->threaded = true;
+    p->owner_mainloop = m;
+    pa_assert_se(p->send_mpscq = pa_mpscq_new());
+    pa_assert_se(p->receive_mpscq = pa_mpscq_new());
+    p->semaphore = pa_semaphore_new(0);
+    pa_atomic_store(&p->n_pending, 0);
+
+    pa_assert_se(pa_mpscq_read_before_poll(p->receive_mpscq) == 0);
+    p->receive_event = m->io_new(m, pa_mpscq_read_fd(p->receive_mpscq), PA_IO_EVENT_INPUT, receive_event_cb, p);
+
+    return p;
+}
+
+void pa_pstream_attach_io(pa_pstream *p, pa_mainloop_api *m, pa_iochannel *io) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->threaded);
+    pa_assert(!p->io);
+    pa_assert(!p->dead);
+    pa_assert(m);
+    pa_assert(io);
+
+    attach_io(p, m, io);
+
+    /* Pick up whatever has been queued so far */
+    do
+        pa_assert_se(fetch_send_items(p));
+    while (pa_mpscq_read_before_poll(p->send_mpscq) < 0);
+
+    p->send_event = m->io_new(m, pa_mpscq_read_fd(p->send_mpscq), PA_IO_EVENT_INPUT, send_event_cb, p);
+
+    if (!pa_queue_isempty(p->send_queue))
+        m->defer_enable(p->defer_event, 1);
+}
+
+/* Called from the owner's thread */
+static void queue_item(pa_pstream *p, struct item_info *i) {
+    if (p->threaded) {
+        pa_atomic_inc(&p->n_pending);
+        pa_mpscq_push(p->send_mpscq, &i->mpscq_item, false);
+    } else
+        pa_queue_push(p->send_queue, i);
+}
+
+/* Called from the owner's thread */
+static void kick_write(pa_pstream *p) {
+    if (p->threaded)
+        pa_mpscq_wakeup(p->send_mpscq);
+    else
+        p->mainloop->defer_enable(p->defer_event, 1);
+}
+
+/* Called from the owner's thread */
+static bool is_dead(pa_pstream *p) {
+    return p->threaded ? p->owner_unlinked : p->dead;
+}
+
 static void pstream_free(pa_pstream *p) {
     pa_assert(p);
 
     pa_pstream_unlink(p);
 
+    if (p->threaded) {
+        pa_mpscq_item *i;
+
+        while ((i = pa_mpscq_pop(p->send_mpscq, false)))
+            item_free(i);
+        while ((i = pa_mpscq_pop(p->receive_mpscq, false)))
+            item_free(i);
+
+        pa_mpscq_free(p->send_mpscq);
+        pa_mpscq_free(p->receive_mpscq);
+        pa_semaphore_free(p->semaphore);
+    }
+
     pa_queue_free(p->send_queue, item_free);
 
     if (p->write.current)
@@ -331,13 +629,10 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_cmsg_ancil
     pa_assert(PA_REFCNT_VALUE(p) > 0);
     pa_assert(packet);
 
-    if (p->dead)
+    if (is_dead(p))
         return;
 
-    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
-        i = pa_xnew(struct item_info, 1);
-
-    i->type = PA_PSTREAM_ITEM_PACKET;
+    i = item_new(PA_PSTREAM_ITEM_PACKET);
     i->packet = pa_packet_ref(packet);
 
 #ifdef HAVE_CREDS
@@ -350,9 +645,8 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_cmsg_ancil
     }
 #endif
 
-    pa_queue_push(p->send_queue, i);
-
-    p->mainloop->defer_enable(p->defer_event, 1);
+    queue_item(p, i);
+    kick_write(p);
 }
 
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek_mode, const pa_memchunk *chunk) {
@@ -364,7 +658,7 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
     pa_assert(channel != (uint32_t) -1);
     pa_assert(chunk);
 
-    if (p->dead)
+    if (is_dead(p))
         return;
 
     idx = 0;
@@ -376,9 +670,7 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
         struct item_info *i;
         size_t n;
 
-        if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
-            i = pa_xnew(struct item_info, 1);
-        i->type = PA_PSTREAM_ITEM_MEMBLOCK;
+        i = item_new(PA_PSTREAM_ITEM_MEMBLOCK);
 
         n = PA_MIN(length, bsm);
         i->chunk.index = chunk->index + idx;
@@ -388,17 +680,14 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
         i->channel = channel;
         i->offset = offset;
         i->seek_mode = seek_mode;
-#ifdef HAVE_CREDS
-        i->with_ancil_data = false;
-#endif
 
-        pa_queue_push(p->send_queue, i);
+        queue_item(p, i);
 
         idx += n;
         length -= n;
     }
 
-    p->mainloop->defer_enable(p->defer_event, 1);
+    kick_write(p);
 }
 
 void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
@@ -406,21 +695,16 @@ void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (p->dead)
+    if (is_dead(p))
         return;
 
 /*     pa_log("Releasing block %u", block_id); */
 
-    if (!(item = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
-        item = pa_xnew(struct item_info, 1);
-    item->type = PA_PSTREAM_ITEM_SHMRELEASE;
+    item = item_new(PA_PSTREAM_ITEM_SHMRELEASE);
     item->block_id = block_id;
-#ifdef HAVE_CREDS
-    item->with_ancil_data = false;
-#endif
 
-    pa_queue_push(p->send_queue, item);
-    p->mainloop->defer_enable(p->defer_event, 1);
+    queue_item(p, item);
+    kick_write(p);
 }
 
 /* might be called from thread context */
@@ -444,20 +728,15 @@ void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (p->dead)
+    if (is_dead(p))
         return;
 /*     pa_log("Revoking block %u", block_id); */
 
-    if (!(item = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
-        item = pa_xnew(struct item_info, 1);
-    item->type = PA_PSTREAM_ITEM_SHMREVOKE;
+    item = item_new(PA_PSTREAM_ITEM_SHMREVOKE);
     item->block_id = block_id;
-#ifdef HAVE_CREDS
-    item->with_ancil_data = false;
-#endif
 
-    pa_queue_push(p->send_queue, item);
-    p->mainloop->defer_enable(p->defer_event, 1);
+    queue_item(p, item);
+    kick_write(p);
 }
 
 /* might be called from thread context */
@@ -645,7 +924,11 @@ static int do_write(pa_pstream *p) {
         else
             if ((r = pa_iochannel_write_with_fds(p->io, d, l, p->write_ancil_data.nfd, p->write_ancil_data.fds)) < 0)
                 goto fail;
-        p->send_ancil_data_now = false;
+
+        /* Nothing was written, so try again with the ancillary data
+         * the next time */
+        if (r > 0)
+            p->send_ancil_data_now = false;
     } else
 #endif
     if (p->srb)
@@ -668,7 +951,10 @@ static int do_write(pa_pstream *p) {
 
         pa_memchunk_reset(&p->write.memchunk);
 
-        if (p->drain_callback && !pa_pstream_is_pending(p))
+        if (p->threaded) {
+            if (pa_atomic_dec(&p->n_pending) <= 1)
+                notify_owner(p, item_new(PA_PSTREAM_ITEM_DRAIN));
+        } else if (p->drain_callback && !pa_pstream_is_pending(p))
             p->drain_callback(p, p->drain_callback_userdata);
     }
 
@@ -682,6 +968,69 @@ fail:
     return -1;
 }
 
+/* Called from the I/O thread */
+static bool wants_memblocks(pa_pstream *p) {
+    return p->threaded || p->receive_memblock_callback;
+}
+
+/* Called from the I/O thread */
+static void deliver_memblock(pa_pstream *p, struct pstream_read *re, const pa_memchunk *chunk) {
+    uint32_t channel;
+    int64_t offset;
+    pa_seek_mode_t seek;
+
+    channel = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+    offset = (int64_t) (
+            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
+            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+    seek = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK;
+
+    if (p->threaded) {
+        struct item_info *i;
+
+        if (p->receive_memblock_io_callback &&
+            p->receive_memblock_io_callback(p, channel, offset, seek, chunk, p->receive_memblock_io_callback_userdata))
+            return;
+
+        i = item_new(PA_PSTREAM_ITEM_MEMBLOCK);
+        i->chunk = *chunk;
+        if (i->chunk.memblock)
+            pa_memblock_ref(i->chunk.memblock);
+        i->channel = channel;
+        i->offset = offset;
+        i->seek_mode = seek;
+
+        notify_owner(p, i);
+
+    } else if (p->receive_memblock_callback)
+        p->receive_memblock_callback(p, channel, offset, seek, chunk, p->receive_memblock_callback_userdata);
+}
+
+/* Called from the I/O thread */
+static void deliver_packet(pa_pstream *p, pa_packet *packet) {
+
+    if (p->threaded) {
+        struct item_info *i;
+
+        if (p->receive_packet_io_callback)
+            p->receive_packet_io_callback(p, packet, p->receive_packet_io_callback_userdata);
+
+        i = item_new(PA_PSTREAM_ITEM_PACKET);
+        i->packet = pa_packet_ref(packet);
+#ifdef HAVE_CREDS
+        i->ancil_data = p->read_ancil_data;
+#endif
+
+        notify_owner(p, i);
+
+    } else if (p->receive_packet_callback)
+#ifdef HAVE_CREDS
+        p->receive_packet_callback(p, packet, &p->read_ancil_data, p->receive_packet_callback_userdata);
+#else
+        p->receive_packet_callback(p, packet, NULL, p->receive_packet_callback_userdata);
+#endif
+}
+
 static int do_read(pa_pstream *p, struct pstream_read *re) {
     void *d;
     size_t l;
@@ -832,7 +1181,7 @@ static int do_read(pa_pstream *p, struct pstream_read *re) {
     } else if (re->index > PA_PSTREAM_DESCRIPTOR_SIZE) {
         /* Frame payload available */
 
-        if (re->memblock && p->receive_memblock_callback) {
+        if (re->memblock && wants_memblocks(p)) {
 
             /* Is this memblock data? Than pass it to the user */
             l = (re->index - (size_t) r) < PA_PSTREAM_DESCRIPTOR_SIZE ? (size_t) (re->index - PA_PSTREAM_DESCRIPTOR_SIZE) : (size_t) r;
@@ -844,21 +1193,7 @@ static int do_read(pa_pstream *p, struct pstream_read *re) {
                 chunk.index = re->index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
                 chunk.length = l;
 
-                if (p->receive_memblock_callback) {
-                    int64_t offset;
-
-                    offset = (int64_t) (
-                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
-
-                    p->receive_memblock_callback(
-                        p,
-                        ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
-                        offset,
-                        ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
-                        &chunk,
-                        p->receive_memblock_callback_userdata);
-                }
+                deliver_memblock(p, re, &chunk);
 
                 /* Drop seek info for following callbacks */
                 re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
@@ -877,13 +1212,7 @@ static int do_read(pa_pstream *p, struct pstream_read *re) {
 
             } else if (re->packet) {
 
-                if (p->receive_packet_callback)
-#ifdef HAVE_CREDS
-                    p->receive_packet_callback(p, re->packet, &p->read_ancil_data, p->receive_packet_callback_userdata);
-#else
-                    p->receive_packet_callback(p, re->packet, NULL, p->receive_packet_callback_userdata);
-#endif
-
+                deliver_packet(p, re->packet);
                 pa_packet_unref(re->packet);
             } else {
                 pa_memblock *b;
@@ -903,25 +1232,14 @@ static int do_read(pa_pstream *p, struct pstream_read *re) {
                         pa_log_debug("Failed to import memory block.");
                 }
 
-                if (p->receive_memblock_callback) {
-                    int64_t offset;
+                if (wants_memblocks(p)) {
                     pa_memchunk chunk;
 
                     chunk.memblock = b;
                     chunk.index = 0;
                     chunk.length = b ? pa_memblock_get_length(b) : ntohl(re->shm_info[PA_PSTREAM_SHM_LENGTH]);
 
-                    offset = (int64_t) (
-                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
-
-                    p->receive_memblock_callback(
-                            p,
-                            ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
-                            offset,
-                            ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
-                            &chunk,
-                            p->receive_memblock_callback_userdata);
+                    deliver_memblock(p, re, &chunk);
                 }
 
                 if (b)
@@ -948,6 +1266,16 @@ frame_done:
     return 0;
 
 fail:
+    /* A channel driven by io_uring has just queued the receive. For a
+     * polled channel this is an error like any other, it would stay
+     * readable and we would never stop trying. */
+    if (r < 0 && errno == EAGAIN && pa_iochannel_is_iouring(p->io)) {
+        if (release_memblock)
+            pa_memblock_release(release_memblock);
+
+        return 1;
+    }
+
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
@@ -1002,13 +1330,33 @@ void pa_pstream_set_revoke_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb,
     p->release_callback_userdata = userdata;
 }
 
+void pa_pstream_set_receive_memblock_io_callback(pa_pstream *p, pa_pstream_memblock_io_cb_t cb, void *userdata) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->threaded);
+
+    p->receive_memblock_io_callback = cb;
+    p->receive_memblock_io_callback_userdata = userdata;
+}
+
+void pa_pstream_set_receive_packet_io_callback(pa_pstream *p, pa_pstream_packet_io_cb_t cb, void *userdata) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->threaded);
+
+    p->receive_packet_io_callback = cb;
+    p->receive_packet_io_callback_userdata = userdata;
+}
+
 bool pa_pstream_is_pending(pa_pstream *p) {
     bool b;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (p->dead)
+    if (p->threaded)
+        b = !p->owner_unlinked && pa_atomic_load(&p->n_pending) > 0;
+    else if (p->dead)
         b = false;
     else
         b = p->write.current || !pa_queue_isempty(p->send_queue);
@@ -1032,8 +1380,8 @@ pa_pstream* pa_pstream_ref(pa_pstream*p) {
     return p;
 }
 
-void pa_pstream_unlink(pa_pstream *p) {
-    pa_assert(p);
+/* Called from the thread doing the I/O */
+static void unlink_io(pa_pstream *p) {
 
     if (p->dead)
         return;
@@ -1063,16 +1411,41 @@ void pa_pstream_unlink(pa_pstream *p) {
         p->defer_event = NULL;
     }
 
+    p->receive_memblock_io_callback = NULL;
+    p->receive_packet_io_callback = NULL;
+}
+
+void pa_pstream_unlink(pa_pstream *p) {
+    pa_assert(p);
+
+    if (p->threaded) {
+        if (p->owner_unlinked)
+            return;
+
+        p->owner_unlinked = true;
+
+        if (p->send_event)
+            call_io_thread(p, PA_PSTREAM_ITEM_UNLINK);
+        else
+            unlink_io(p);
+
+        p->owner_mainloop->io_free(p->receive_event);
+        p->receive_event = NULL;
+
+    } else {
+        if (p->dead)
+            return;
+
+        unlink_io(p);
+    }
+
     p->die_callback = NULL;
     p->drain_callback = NULL;
     p->receive_packet_callback = NULL;
     p->receive_memblock_callback = NULL;
 }
 
-void pa_pstream_enable_shm(pa_pstream *p, bool enable) {
-    pa_assert(p);
-    pa_assert(PA_REFCNT_VALUE(p) > 0);
-
+static void set_shm(pa_pstream *p, bool enable) {
     p->use_shm = enable;
 
     if (enable) {
@@ -1089,6 +1462,16 @@ void pa_pstream_enable_shm(pa_pstream *p, bool enable) {
     }
 }
 
+void pa_pstream_enable_shm(pa_pstream *p, bool enable) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    if (p->threaded && p->send_event)
+        call_io_thread(p, enable ? PA_PSTREAM_ITEM_ENABLE_SHM : PA_PSTREAM_ITEM_DISABLE_SHM);
+    else
+        set_shm(p, enable);
+}
+
 bool pa_pstream_get_shm(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
@@ -1099,6 +1482,7 @@ bool pa_pstream_get_shm(pa_pstream *p) {
 void pa_pstream_set_srbchannel(pa_pstream *p, pa_srbchannel *srb) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0 || srb == NULL);
+    pa_assert(!p->threaded || srb == NULL);
 
     if (srb == p->srb)
         return;
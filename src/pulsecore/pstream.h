@@ -42,9 +42,27 @@ typedef void (*pa_pstream_packet_cb_t)(pa_pstream *p, pa_packet *packet, const p
 typedef void (*pa_pstream_memblock_cb_t)(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata);
 typedef void (*pa_pstream_notify_cb_t)(pa_pstream *p, void *userdata);
 typedef void (*pa_pstream_block_id_cb_t)(pa_pstream *p, uint32_t block_id, void *userdata);
+typedef bool (*pa_pstream_memblock_io_cb_t)(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata);
+typedef void (*pa_pstream_packet_io_cb_t)(pa_pstream *p, pa_packet *packet, void *userdata);
 
 pa_pstream* pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *p);
 
+/* Creates a pstream whose I/O is done by a main loop running in
+ * another thread. The pstream is owned by the thread running m: all
+ * functions are to be called from there, and all callbacks except the
+ * memblock I/O, release and revoke callbacks are called from there.
+ * Outgoing data is handed to the I/O thread through a lock-free
+ * queue, received packets and memory blocks are passed back the same
+ * way. Once the pstream is set up, the I/O thread needs to call
+ * pa_pstream_attach_io() with an iochannel belonging to its own main
+ * loop. The owner needs to call pa_pstream_unlink() before dropping
+ * the last reference. SHM ring buffer channels are not supported. */
+pa_pstream* pa_pstream_new_threaded(pa_mainloop_api *m, pa_mempool *p);
+
+/* Called from the I/O thread of a pstream created with
+ * pa_pstream_new_threaded() while the owner waits for it */
+void pa_pstream_attach_io(pa_pstream *p, pa_mainloop_api *m, pa_iochannel *io);
+
 pa_pstream* pa_pstream_ref(pa_pstream*p);
 void pa_pstream_unref(pa_pstream*p);
 
@@ -62,6 +80,19 @@ void pa_pstream_set_die_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void
 void pa_pstream_set_release_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb, void *userdata);
 void pa_pstream_set_revoke_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb, void *userdata);
 
+/* Only for pstreams created with pa_pstream_new_threaded(). The
+ * callback is called from the I/O thread for every memory block
+ * received. If it returns true the block has been consumed, otherwise
+ * it is passed on to the memblock callback in the owner's thread. Set
+ * it from the I/O thread, right after pa_pstream_attach_io(). */
+void pa_pstream_set_receive_memblock_io_callback(pa_pstream *p, pa_pstream_memblock_io_cb_t cb, void *userdata);
+
+/* Only for pstreams created with pa_pstream_new_threaded(). The
+ * callback is called from the I/O thread for every packet received,
+ * before it is passed on to the packet callback in the owner's thread.
+ * Set it from the I/O thread, right after pa_pstream_attach_io(). */
+void pa_pstream_set_receive_packet_io_callback(pa_pstream *p, pa_pstream_packet_io_cb_t cb, void *userdata);
+
 bool pa_pstream_is_pending(pa_pstream *p);
 
 void pa_pstream_enable_shm(pa_pstream *p, bool enable);
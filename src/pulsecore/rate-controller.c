@@ -0,0 +1,138 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "rate-controller.h"
+
+/* The measured latency is smoothed with a time constant this much
+ * shorter than the one of the controller */
+#define FILTER_DIVIDER 2
+
+/* The rate is only changed once it is off by this much, in Hz, so that
+ * it doesn't flip between two neighbours all the time */
+#define RATE_HYSTERESIS 0.75
+
+struct pa_rate_controller {
+    uint32_t base_rate;
+    double time_constant;
+    double max_deviation;
+
+    bool started;
+    pa_usec_t last;
+
+    double error;         /* Low pass filtered error, in usec */
+    double integral;      /* Learned drift, relative */
+
+    uint32_t rate;
+};
+
+pa_rate_controller *pa_rate_controller_new(uint32_t base_rate, pa_usec_t time_constant, double max_deviation) {
+    pa_rate_controller *c;
+
+    pa_assert(base_rate > 0);
+    pa_assert(time_constant > 0);
+    pa_assert(max_deviation > 0 && max_deviation < 1);
+
+    c = pa_xnew0(pa_rate_controller, 1);
+    c->base_rate = base_rate;
+    c->time_constant = (double) time_constant;
+    c->max_deviation = max_deviation;
+
+    pa_rate_controller_reset(c);
+
+    return c;
+}
+
+void pa_rate_controller_free(pa_rate_controller *c) {
+    pa_assert(c);
+
+    pa_xfree(c);
+}
+
+void pa_rate_controller_reset(pa_rate_controller *c) {
+    pa_assert(c);
+
+    c->started = false;
+    c->last = 0;
+    c->error = 0;
+    c->integral = 0;
+    c->rate = c->base_rate;
+}
+
+uint32_t pa_rate_controller_update(pa_rate_controller *c, pa_usec_t now, int64_t error) {
+    double dt, correction, rate;
+
+    pa_assert(c);
+
+    dt = c->started && now > c->last ? (double) (now - c->last) : 0;
+
+    if (!c->started || dt > c->time_constant) {
+        /* First measurement, or we haven't heard anything for a long
+         * time, e.g. because the stream was corked. The drift we
+         * learned is probably still right, the rest is not. */
+        c->error = (double) error;
+        dt = 0;
+        c->started = true;
+    } else
+        c->error += ((double) error - c->error) * PA_MIN(dt * FILTER_DIVIDER / c->time_constant, 1.0);
+
+    c->last = now;
+
+    /* This is a critically damped PI controller for the latency, which
+     * changes with the integral of the rate */
+    correction = 2 * c->error / c->time_constant + c->integral;
+
+    /* Don't learn anything while we are correcting as fast as we may
+     * anyway, or we'd overshoot afterwards */
+    if (fabs(correction) < c->max_deviation || (correction > 0) != (c->error > 0)) {
+        c->integral += c->error * dt / (c->time_constant * c->time_constant);
+        c->integral = PA_CLAMP(c->integral, -c->max_deviation, c->max_deviation);
+        correction = 2 * c->error / c->time_constant + c->integral;
+    }
+
+    correction = PA_CLAMP(correction, -c->max_deviation, c->max_deviation);
+
+    rate = (double) c->base_rate * (1 + correction);
+
+    if (fabs(rate - (double) c->rate) >= RATE_HYSTERESIS)
+        c->rate = (uint32_t) lrint(rate);
+
+    return c->rate;
+}
+
+double pa_rate_controller_get_drift(pa_rate_controller *c) {
+    pa_assert(c);
+
+    return c->integral;
+}
+
+int64_t pa_rate_controller_get_error(pa_rate_controller *c) {
+    pa_assert(c);
+
+    return (int64_t) llrint(c->error);
+}
@@ -0,0 +1,57 @@
+#ifndef foopulsecoreratecontrollerhfoo
+#define foopulsecoreratecontrollerhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+
+/* A PI controller that keeps the latency between two devices that run
+ * off different clocks at a target, by continuously adjusting the rate
+ * of the resampler in between. Feed it the deviation from the target
+ * latency whenever it was measured, e.g. once per period from the IO
+ * thread, and it returns the rate to resample from.
+ *
+ * 'time_constant' determines how quickly deviations are corrected.
+ * The proportional part corrects a latency deviation with this time
+ * constant, the integral part learns the drift between the two
+ * clocks. The returned rate never deviates more than 'max_deviation'
+ * (relative) from 'base_rate'. */
+
+typedef struct pa_rate_controller pa_rate_controller;
+
+pa_rate_controller *pa_rate_controller_new(uint32_t base_rate, pa_usec_t time_constant, double max_deviation);
+void pa_rate_controller_free(pa_rate_controller *c);
+
+/* Forgets everything learned so far, including the drift */
+void pa_rate_controller_reset(pa_rate_controller *c);
+
+/* 'now' is the time of the measurement, 'error' how much the latency
+ * exceeds the target, in usec. Returns the new rate. */
+uint32_t pa_rate_controller_update(pa_rate_controller *c, pa_usec_t now, int64_t error);
+
+/* The relative drift between the two clocks, as learned so far */
+double pa_rate_controller_get_drift(pa_rate_controller *c);
+
+/* The last error passed in, after low pass filtering */
+int64_t pa_rate_controller_get_error(pa_rate_controller *c);
+
+#endif
@@ -30,6 +30,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/trace.h>
 
 #include "resampler.h"
 
@@ -1296,6 +1297,7 @@ static pa_memchunk *convert_from_work_format(pa_resampler *r, pa_memchunk *input
 
 void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
     pa_memchunk *buf;
+    pa_usec_t t;
 
     pa_assert(r);
     pa_assert(in);
@@ -1304,6 +1306,8 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out)
     pa_assert(in->memblock);
     pa_assert(in->length % r->i_fz == 0);
 
+    t = pa_trace_begin();
+
     buf = (pa_memchunk*) in;
     buf = convert_to_work_format(r, buf);
 
@@ -1327,6 +1331,8 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out)
             pa_memchunk_reset(buf);
     } else
         pa_memchunk_reset(out);
+
+    pa_trace_end("resample", t);
 }
 
 /*** copy (noop) implementation ***/
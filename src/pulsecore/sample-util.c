@@ -306,6 +306,87 @@ void pa_sample_clamp(pa_sample_format_t format, void *dst, size_t dstr, const vo
     }
 }
 
+static pa_deinterleave_float_func_t deinterleave_float_table[PA_CHANNELS_MAX + 1];
+static pa_interleave_float_func_t interleave_float_table[PA_CHANNELS_MAX + 1];
+
+void pa_deinterleave_float_clamp(const float *src, unsigned stride, float *dst[], unsigned channels, unsigned n) {
+    unsigned c, j;
+
+    pa_assert(src);
+    pa_assert(dst);
+    pa_assert(channels > 0);
+    pa_assert(channels <= stride);
+
+    if (stride == channels && channels <= PA_CHANNELS_MAX && deinterleave_float_table[channels]) {
+        deinterleave_float_table[channels](src, dst, n);
+        return;
+    }
+
+    for (c = 0; c < channels; c++) {
+        const float *s = src + c;
+        float *d = dst[c];
+
+        for (j = 0; j < n; j++, s += stride) {
+            float f = *s;
+
+            d[j] = PA_CLAMP_UNLIKELY(f, -1.0f, 1.0f);
+        }
+    }
+}
+
+void pa_interleave_float_clamp(float * const src[], unsigned channels, float *dst, unsigned stride, unsigned n) {
+    unsigned c, j;
+
+    pa_assert(src);
+    pa_assert(dst);
+    pa_assert(channels > 0);
+    pa_assert(channels <= stride);
+
+    if (stride == channels && channels <= PA_CHANNELS_MAX && interleave_float_table[channels]) {
+        interleave_float_table[channels](src, dst, n);
+        return;
+    }
+
+    for (c = 0; c < channels; c++) {
+        const float *s = src[c];
+        float *d = dst + c;
+
+        for (j = 0; j < n; j++, d += stride) {
+            float f = s[j];
+
+            *d = PA_CLAMP_UNLIKELY(f, -1.0f, 1.0f);
+        }
+    }
+}
+
+pa_deinterleave_float_func_t pa_get_deinterleave_float_func(unsigned channels) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    return deinterleave_float_table[channels];
+}
+
+void pa_set_deinterleave_float_func(unsigned channels, pa_deinterleave_float_func_t func) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    deinterleave_float_table[channels] = func;
+}
+
+pa_interleave_float_func_t pa_get_interleave_float_func(unsigned channels) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    return interleave_float_table[channels];
+}
+
+void pa_set_interleave_float_func(unsigned channels, pa_interleave_float_func_t func) {
+    pa_assert(channels > 0);
+    pa_assert(channels <= PA_CHANNELS_MAX);
+
+    interleave_float_table[channels] = func;
+}
+
 /* Similar to pa_bytes_to_usec() but rounds up, not down */
 
 pa_usec_t pa_bytes_to_usec_round_up(uint64_t length, const pa_sample_spec *spec) {
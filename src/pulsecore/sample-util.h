@@ -56,6 +56,24 @@ void pa_deinterleave(const void *src, void *dst[], unsigned channels, size_t ss,
 
 void pa_sample_clamp(pa_sample_format_t format, void *dst, size_t dstr, const void *src, size_t sstr, unsigned n);
 
+/* Like pa_deinterleave() and pa_interleave() for PA_SAMPLE_FLOAT32NE,
+ * but clamping the samples to [-1, 1] on the way, which is what filters
+ * with one buffer per channel need. The interleaved side has frames of
+ * stride samples, of which the first channels are used. */
+void pa_deinterleave_float_clamp(const float *src, unsigned stride, float *dst[], unsigned channels, unsigned n);
+void pa_interleave_float_clamp(float * const src[], unsigned channels, float *dst, unsigned stride, unsigned n);
+
+/* Optimized versions for stride == channels. A NULL function means the
+ * generic code is used for that number of channels. */
+typedef void (*pa_deinterleave_float_func_t) (const float *src, float *dst[], unsigned n);
+typedef void (*pa_interleave_float_func_t) (float * const src[], float *dst, unsigned n);
+
+pa_deinterleave_float_func_t pa_get_deinterleave_float_func(unsigned channels);
+void pa_set_deinterleave_float_func(unsigned channels, pa_deinterleave_float_func_t func);
+
+pa_interleave_float_func_t pa_get_interleave_float_func(unsigned channels);
+void pa_set_interleave_float_func(unsigned channels, pa_interleave_float_func_t func);
+
 static inline int32_t pa_mult_s16_volume(int16_t v, int32_t cv) {
 #if __WORDSIZE == 64 || ((ULONG_MAX) > (UINT_MAX))
     /* Multiply with 64 bit integers on 64 bit platforms */
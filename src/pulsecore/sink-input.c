@@ -31,6 +31,8 @@
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/internal.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/core-format.h>
 #include <pulsecore/mix.h>
@@ -40,6 +42,7 @@
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/trace.h>
 
 #include "sink-input.h"
 
@@ -48,6 +51,10 @@
 #define MEMBLOCKQ_MAXLENGTH (32*1024*1024)
 #define CONVERT_BUFFER_LENGTH (PA_PAGE_SIZE)
 
+/* How often pa_sink_input_set_rate_within_thread() may notify the main
+ * thread */
+#define RATE_REPORT_INTERVAL_USEC (PA_USEC_PER_SEC)
+
 PA_DEFINE_PUBLIC_CLASS(pa_sink_input, pa_msgobject);
 
 struct volume_factor_entry {
@@ -531,6 +538,8 @@ int pa_sink_input_new(
     i->thread_info.attached = false;
     pa_atomic_store(&i->thread_info.drained, 1);
     i->thread_info.sample_spec = i->sample_spec;
+    i->thread_info.reported_rate = i->sample_spec.rate;
+    i->thread_info.reported_rate_time = 0;
     i->thread_info.resampler = resampler;
     i->thread_info.soft_volume = i->soft_volume;
     i->thread_info.muted = i->muted;
@@ -539,6 +548,10 @@ int pa_sink_input_new(
     i->thread_info.rewrite_flush = false;
     i->thread_info.dont_rewind_render = false;
     i->thread_info.underrun_for = (uint64_t) -1;
+    i->thread_info.rewind_dirty = false;
+    i->thread_info.mixed_bytes = 0;
+    i->thread_info.mixed_volume_bytes = 0;
+    pa_cvolume_init(&i->thread_info.mixed_volume);
     i->thread_info.underrun_for_sink = 0;
     i->thread_info.playing_for = 0;
     i->thread_info.direct_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
@@ -578,6 +591,20 @@ int pa_sink_input_new(
     return 0;
 }
 
+/* Called from thread context, or from main context while unlinked */
+static void set_render_maxrewind(pa_sink_input *i, size_t nbytes) {
+    size_t old;
+
+    pa_assert(i);
+
+    old = pa_memblockq_get_maxrewind(i->thread_info.render_memblockq);
+    pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
+
+    /* Keep track of the history all streams may keep, in the pool
+     * statistics */
+    pa_mempool_account_rewind_history(i->core->mempool, (int) nbytes - (int) old);
+}
+
 /* Called from main context */
 static void update_n_corked(pa_sink_input *i, pa_sink_input_state_t state) {
     pa_assert(i);
@@ -734,8 +761,10 @@ static void sink_input_free(pa_object *o) {
      * "half-moved" or are connected to sinks that have no asyncmsgq
      * and are hence half-destructed themselves! */
 
-    if (i->thread_info.render_memblockq)
+    if (i->thread_info.render_memblockq) {
+        set_render_maxrewind(i, 0);
         pa_memblockq_free(i->thread_info.render_memblockq);
+    }
 
     if (i->thread_info.resampler)
         pa_resampler_free(i->thread_info.resampler);
@@ -835,6 +864,21 @@ pa_usec_t pa_sink_input_get_latency(pa_sink_input *i, pa_usec_t *sink_latency) {
     return r[0];
 }
 
+/* Called from thread context */
+static int sink_input_pop(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    pa_usec_t begin, end;
+    int r;
+
+    begin = pa_rtclock_now();
+    r = i->pop(i, nbytes, chunk);
+    end = pa_rtclock_now();
+
+    pa_io_stats_add_render(&i->io_stats, end - begin);
+    pa_trace_span("sink-input-pop", begin, end);
+
+    return r;
+}
+
 /* Called from thread context */
 void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume) {
     bool do_volume_adj_here, need_volume_factor_sink;
@@ -897,12 +941,16 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
          * with data from the implementor. */
 
         if (i->thread_info.state == PA_SINK_INPUT_CORKED ||
-            i->pop(i, ilength, &tchunk) < 0) {
+            sink_input_pop(i, ilength, &tchunk) < 0) {
 
             /* OK, we're corked or the implementor didn't give us any
              * data, so let's just hand out silence */
             pa_atomic_store(&i->thread_info.drained, 1);
 
+            /* We were playing until now, so this is an underrun */
+            if (i->thread_info.state != PA_SINK_INPUT_CORKED && i->thread_info.underrun_for == 0)
+                pa_io_stats_add_xrun(&i->io_stats);
+
             pa_memblockq_seek(i->thread_info.render_memblockq, (int64_t) slength, PA_SEEK_RELATIVE, true);
             i->thread_info.playing_for = 0;
             if (i->thread_info.underrun_for != (uint64_t) -1) {
@@ -963,7 +1011,11 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
                 pa_memblockq_push_align(i->thread_info.render_memblockq, &wchunk);
             } else {
                 pa_memchunk rchunk;
+                pa_usec_t t;
+
+                t = pa_rtclock_now();
                 pa_resampler_run(i->thread_info.resampler, &wchunk, &rchunk);
+                pa_io_stats_add_resample(&i->io_stats, pa_rtclock_now() - t);
 
 #ifdef SINK_INPUT_DEBUG
                 pa_log_debug("pushing %lu", (unsigned long) rchunk.length);
@@ -1091,6 +1143,8 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
         if (amount > 0) {
             pa_log_debug("Have to rewind %lu bytes on implementor.", (unsigned long) amount);
 
+            pa_io_stats_add_rewind(&i->io_stats, amount);
+
             /* Tell the implementor */
             if (i->process_rewind)
                 i->process_rewind(i, amount);
@@ -1148,7 +1202,7 @@ void pa_sink_input_update_max_rewind(pa_sink_input *i, size_t nbytes  /* in the
     pa_assert(PA_SINK_INPUT_IS_LINKED(i->thread_info.state));
     pa_assert(pa_frame_aligned(nbytes, &i->sink->sample_spec));
 
-    pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
+    set_render_maxrewind(i, nbytes);
 
     if (i->update_max_rewind)
         i->update_max_rewind(i, i->thread_info.resampler ? pa_resampler_request(i->thread_info.resampler, nbytes) : nbytes);
@@ -1867,6 +1921,34 @@ int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, bool save) {
     return 0;
 }
 
+/* Called from IO thread context */
+void pa_sink_input_set_rate_within_thread(pa_sink_input *i, uint32_t rate) {
+    pa_usec_t now;
+
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(i->thread_info.resampler);
+
+    if (i->thread_info.sample_spec.rate != rate) {
+        i->thread_info.sample_spec.rate = rate;
+        pa_resampler_set_input_rate(i->thread_info.resampler, rate);
+    }
+
+    /* Callers may change the rate every period. A rate that is held
+     * back here is reported on a later call. */
+    if (i->thread_info.reported_rate == rate)
+        return;
+
+    now = pa_rtclock_now();
+    if (now < i->thread_info.reported_rate_time + RATE_REPORT_INTERVAL_USEC)
+        return;
+
+    i->thread_info.reported_rate = rate;
+    i->thread_info.reported_rate_time = now;
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_UPDATE_RATE, PA_UINT_TO_PTR(rate), 0, NULL, NULL);
+}
+
 /* Called from IO thread context */
 void pa_sink_input_set_state_within_thread(pa_sink_input *i, pa_sink_input_state_t state) {
     bool corking, uncorking;
@@ -1950,6 +2032,7 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
         case PA_SINK_INPUT_MESSAGE_SET_RATE:
 
             i->thread_info.sample_spec.rate = PA_PTR_TO_UINT(userdata);
+            i->thread_info.reported_rate = PA_PTR_TO_UINT(userdata);
             pa_resampler_set_input_rate(i->thread_info.resampler, PA_PTR_TO_UINT(userdata));
 
             return 0;
@@ -1981,6 +2064,17 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
             *r = i->thread_info.requested_sink_latency;
             return 0;
         }
+
+        case PA_SINK_INPUT_MESSAGE_UPDATE_RATE:
+            /* This message is sent from IO-thread and handled in main thread. */
+            pa_assert_ctl_context();
+
+            if (!PA_SINK_INPUT_IS_LINKED(i->state) || i->sample_spec.rate == PA_PTR_TO_UINT(userdata))
+                return 0;
+
+            i->sample_spec.rate = PA_PTR_TO_UINT(userdata);
+            pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+            return 0;
     }
 
     return -PA_ERR_NOTIMPLEMENTED;
@@ -2092,10 +2186,10 @@ void pa_sink_input_request_rewind(
             nbytes = pa_resampler_result(i->thread_info.resampler, nbytes);
 
         if (nbytes > lbq)
-            pa_sink_request_rewind(i->sink, nbytes - lbq);
+            pa_sink_request_rewind_input(i->sink, i, nbytes - lbq);
         else
             /* This call will make sure process_rewind() is called later */
-            pa_sink_request_rewind(i->sink, 0);
+            pa_sink_request_rewind_input(i->sink, i, 0);
     }
 }
 
@@ -2191,6 +2285,7 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
 
     i->thread_info.resampler = new_resampler;
 
+    set_render_maxrewind(i, 0);
     pa_memblockq_free(i->thread_info.render_memblockq);
 
     memblockq_name = pa_sprintf_malloc("sink input render_memblockq [%u]", i->index);
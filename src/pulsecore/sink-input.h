@@ -29,6 +29,7 @@ typedef struct pa_sink_input pa_sink_input;
 
 #include <pulse/sample.h>
 #include <pulse/format.h>
+#include <pulsecore/io-stats.h>
 #include <pulsecore/memblockq.h>
 #include <pulsecore/resampler.h>
 #include <pulsecore/module.h>
@@ -224,6 +225,9 @@ struct pa_sink_input {
      * mute status changes. Called from main context */
     void (*mute_changed)(pa_sink_input *i); /* may be NULL */
 
+    /* Updated from the IO thread, see io-stats.h */
+    pa_io_stats io_stats;
+
     struct {
         pa_sink_input_state_t state;
         pa_atomic_t drained;
@@ -241,6 +245,11 @@ struct pa_sink_input {
 
         pa_sample_spec sample_spec;
 
+        /* The rate the main thread was last told about by
+         * pa_sink_input_set_rate_within_thread(), and when */
+        uint32_t reported_rate;
+        pa_usec_t reported_rate_time;
+
         pa_resampler *resampler;                     /* may be NULL */
 
         /* We maintain a history of resampled audio data here. */
@@ -252,6 +261,18 @@ struct pa_sink_input {
         pa_usec_t requested_sink_latency;
 
         pa_hashmap *direct_outputs;
+
+        /* Set if this input requested the pending rewind of the sink,
+         * and, after a partial rewind, while its data is rendered
+         * again */
+        bool rewind_dirty:1;
+
+        /* How much of our data has been mixed into the sink since we
+         * were attached, and how much of it at the current volume,
+         * in sink bytes. Needed to take our data out of the sink's
+         * mix again on partial rewinds. */
+        size_t mixed_bytes, mixed_volume_bytes;
+        pa_cvolume mixed_volume;
     } thread_info;
 
     void *userdata;
@@ -268,6 +289,7 @@ enum {
     PA_SINK_INPUT_MESSAGE_SET_STATE,
     PA_SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY,
     PA_SINK_INPUT_MESSAGE_GET_REQUESTED_LATENCY,
+    PA_SINK_INPUT_MESSAGE_UPDATE_RATE,
     PA_SINK_INPUT_MESSAGE_MAX
 };
 
@@ -407,6 +429,11 @@ void pa_sink_input_update_max_request(pa_sink_input *i, size_t nbytes  /* in the
 
 void pa_sink_input_set_state_within_thread(pa_sink_input *i, pa_sink_input_state_t state);
 
+/* Changes the input rate of the resampler right away. The main thread
+ * learns about the new rate asynchronously, and at most once per
+ * second, since that causes a change event for the clients. */
+void pa_sink_input_set_rate_within_thread(pa_sink_input *i, uint32_t rate);
+
 int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk);
 
 pa_usec_t pa_sink_input_set_requested_latency_within_thread(pa_sink_input *i, pa_usec_t usec);
@@ -47,7 +47,9 @@
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/play-memblockq.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/trace.h>
 
 #include "sink.h"
 
@@ -164,6 +166,7 @@ static void reset_callbacks(pa_sink *s) {
     s->get_formats = NULL;
     s->set_formats = NULL;
     s->update_rate = NULL;
+    s->print_info = NULL;
 }
 
 /* Called from main context */
@@ -316,6 +319,9 @@ pa_sink* pa_sink_new(
     else
         s->latency_offset = 0;
 
+    s->rewind_limit = (pa_usec_t) core->default_rewind_limit_msec * PA_USEC_PER_MSEC;
+    s->limiter = NULL;
+
     s->save_volume = data->save_volume;
     s->save_muted = data->save_muted;
 
@@ -327,14 +333,21 @@ pa_sink* pa_sink_new(
             0);
 
     s->thread_info.rtpoll = NULL;
-    s->thread_info.inputs = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL,
-                                                (pa_free_cb_t) pa_sink_input_unref);
+    s->thread_info.inputs = pa_dense_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL,
+                                                      (pa_free_cb_t) pa_sink_input_unref);
     s->thread_info.soft_volume =  s->soft_volume;
     s->thread_info.soft_muted = s->muted;
     s->thread_info.state = s->state;
     s->thread_info.rewind_nbytes = 0;
     s->thread_info.rewind_requested = false;
+    s->thread_info.rewind_full = false;
+    s->thread_info.mix_history = NULL;
+    s->thread_info.mix_history_length = 0;
+    s->thread_info.premix = NULL;
+    s->thread_info.limiter = NULL;
     s->thread_info.max_rewind = 0;
+    s->thread_info.requested_max_rewind = 0;
+    s->thread_info.rewind_limit = s->rewind_limit;
     s->thread_info.max_request = 0;
     s->thread_info.requested_latency_valid = false;
     s->thread_info.requested_latency = 0;
@@ -735,7 +748,13 @@ static void sink_free(pa_object *o) {
     }
 
     pa_idxset_free(s->inputs, NULL);
-    pa_hashmap_free(s->thread_info.inputs);
+    pa_dense_hashmap_free(s->thread_info.inputs);
+
+    if (s->thread_info.premix)
+        pa_memblockq_free(s->thread_info.premix);
+
+    if (s->thread_info.mix_history)
+        pa_memblockq_free(s->thread_info.mix_history);
 
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
@@ -948,7 +967,7 @@ size_t pa_sink_process_input_underruns(pa_sink *s, size_t left_to_play) {
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
         size_t uf = i->thread_info.underrun_for_sink;
         if (uf == 0)
             continue;
@@ -965,10 +984,290 @@ size_t pa_sink_process_input_underruns(pa_sink *s, size_t left_to_play) {
     return left_to_play - result;
 }
 
+/* Called from IO thread context */
+static void mix_history_reset(pa_sink *s) {
+    pa_sink_assert_ref(s);
+
+    if (!s->thread_info.mix_history)
+        return;
+
+    pa_memblockq_flush_read(s->thread_info.mix_history);
+    s->thread_info.mix_history_length = 0;
+}
+
+/* Called from IO thread context */
+static void mix_history_push(pa_sink *s, const pa_memchunk *chunk) {
+    pa_sink_assert_ref(s);
+    pa_assert(chunk);
+
+    if (!s->thread_info.mix_history)
+        return;
+
+    /* What we rendered before the soft volume changed is of no use
+     * for taking the data of individual inputs out again */
+    if (s->thread_info.mix_history_muted != s->thread_info.soft_muted ||
+        !pa_cvolume_equal(&s->thread_info.mix_history_volume, &s->thread_info.soft_volume)) {
+
+        mix_history_reset(s);
+        s->thread_info.mix_history_volume = s->thread_info.soft_volume;
+        s->thread_info.mix_history_muted = s->thread_info.soft_muted;
+    }
+
+    pa_assert_se(pa_memblockq_push(s->thread_info.mix_history, chunk) >= 0);
+    pa_memblockq_drop(s->thread_info.mix_history, chunk->length);
+
+    s->thread_info.mix_history_length = PA_MIN(s->thread_info.mix_history_length + chunk->length, s->thread_info.max_rewind);
+}
+
+/* Called from IO thread context */
+static void mix_history_rewind(pa_sink *s, size_t nbytes) {
+    pa_sink_assert_ref(s);
+
+    if (!s->thread_info.mix_history)
+        return;
+
+    /* Forget what we are going to render again */
+    nbytes = PA_MIN(nbytes, s->thread_info.mix_history_length);
+    pa_memblockq_rewind(s->thread_info.mix_history, nbytes);
+    pa_memblockq_seek(s->thread_info.mix_history, - (int64_t) nbytes, PA_SEEK_RELATIVE, true);
+    s->thread_info.mix_history_length -= nbytes;
+}
+
+/* Called from IO thread context */
+static void update_mix_history(pa_sink *s) {
+    size_t block_size_max;
+
+    pa_sink_assert_ref(s);
+
+    if (s->thread_info.mix_history) {
+        pa_memblockq_free(s->thread_info.mix_history);
+        s->thread_info.mix_history = NULL;
+        s->thread_info.mix_history_length = 0;
+    }
+
+    /* Taking the data of a single input out of the mix again only
+     * works if mixing doesn't clip */
+    if (!s->core->partial_rewind ||
+        s->sample_spec.format != PA_SAMPLE_FLOAT32NE ||
+        s->thread_info.max_rewind <= 0)
+        return;
+
+    block_size_max = pa_mempool_block_size_max(s->core->mempool);
+
+    s->thread_info.mix_history = pa_memblockq_new(
+            "sink mix history",
+            0,
+            s->thread_info.max_rewind + block_size_max,
+            0,
+            &s->sample_spec,
+            0,
+            1,
+            s->thread_info.max_rewind,
+            &s->silence);
+}
+
+/* Called from IO thread context */
+static void subtract_input(pa_sink *s, pa_memchunk *target, size_t offset, const pa_memchunk *chunk, const pa_cvolume *volume) {
+    float linear[PA_CHANNELS_MAX];
+    float *d;
+    const float *src;
+    unsigned channel;
+    size_t n;
+
+    pa_assert(s->sample_spec.format == PA_SAMPLE_FLOAT32NE);
+    pa_assert(offset + chunk->length <= target->length);
+
+    if (s->thread_info.soft_muted || pa_cvolume_is_muted(volume) || pa_memblock_is_silence(chunk->memblock))
+        return;
+
+    /* Calculate the factors exactly like pa_mix() does */
+    for (channel = 0; channel < s->sample_spec.channels; channel++) {
+        float g = (float) pa_sw_volume_to_linear(s->thread_info.soft_volume.values[channel]);
+        linear[channel] = (float) (pa_sw_volume_to_linear(volume->values[channel]) * g);
+    }
+
+    d = (float*) ((uint8_t*) pa_memblock_acquire_chunk(target) + offset);
+    src = pa_memblock_acquire_chunk(chunk);
+
+    for (n = chunk->length / sizeof(float), channel = 0; n > 0; n--) {
+        *(d++) -= *(src++) * linear[channel];
+
+        if (PA_UNLIKELY(++channel >= s->sample_spec.channels))
+            channel = 0;
+    }
+
+    pa_memblock_release(chunk->memblock);
+    pa_memblock_release(target->memblock);
+}
+
+/* Called from IO thread context */
+static bool partial_rewind_possible(pa_sink *s, size_t nbytes) {
+    pa_sink_input *i;
+    void *state = NULL;
+    unsigned n_dirty = 0, n_clean = 0;
+
+    pa_sink_assert_ref(s);
+
+    /* What comes out of the limiter depends on everything that went
+     * into it, so there is no taking a single input out again */
+    if (nbytes <= 0 ||
+        s->thread_info.rewind_full ||
+        s->thread_info.limiter ||
+        !s->thread_info.mix_history ||
+        s->thread_info.mix_history_length < nbytes)
+        return false;
+
+    /* Inputs that didn't fit into the mix are not accounted for */
+    if (pa_dense_hashmap_size(s->thread_info.inputs) > MAX_MIX_CHANNELS)
+        return false;
+
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+
+        /* Direct outputs would need the data of all inputs again */
+        if (pa_hashmap_size(i->thread_info.direct_outputs) > 0)
+            return false;
+
+        if (!i->thread_info.rewind_dirty) {
+            n_clean++;
+            continue;
+        }
+
+        /* We need to know the volume the data was mixed with */
+        if (i->thread_info.mixed_volume_bytes < PA_MIN(nbytes, i->thread_info.mixed_bytes))
+            return false;
+
+        n_dirty++;
+    }
+
+    /* Taking the data out of the mix costs about as much as mixing
+     * it, so this only pays off if most inputs stay unchanged */
+    return n_clean > 0 && n_clean >= n_dirty;
+}
+
+/* Called from IO thread context */
+static void partial_rewind(pa_sink *s, size_t nbytes) {
+    pa_sink_input *i;
+    void *state = NULL;
+    size_t block_size_max, done;
+
+    pa_sink_assert_ref(s);
+    pa_assert(!s->thread_info.premix);
+
+    block_size_max = pa_frame_align(pa_mempool_block_size_max(s->core->mempool), &s->sample_spec);
+
+    s->thread_info.premix = pa_memblockq_new(
+            "sink premix",
+            0,
+            nbytes,
+            0,
+            &s->sample_spec,
+            0,
+            1,
+            0,
+            &s->silence);
+
+    /* Go back to where the data we are going to replace starts, in
+     * the mix as well as in the inputs that requested the rewind */
+    pa_memblockq_rewind(s->thread_info.mix_history, nbytes);
+
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        if (i->thread_info.rewind_dirty)
+            pa_memblockq_rewind(i->thread_info.render_memblockq, PA_MIN(nbytes, i->thread_info.mixed_bytes));
+
+    for (done = 0; done < nbytes; done += block_size_max) {
+        pa_memchunk chunk;
+        size_t length;
+
+        length = PA_MIN(nbytes - done, block_size_max);
+
+        pa_assert_se(pa_memblockq_peek_fixed_size(s->thread_info.mix_history, length, &chunk) >= 0);
+        pa_memchunk_make_writable(&chunk, 0);
+
+        PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+            pa_memchunk ichunk;
+            size_t skip, offset;
+
+            if (!i->thread_info.rewind_dirty)
+                continue;
+
+            /* Whatever came before the input was attached to us is
+             * not part of the mix */
+            skip = nbytes - PA_MIN(nbytes, i->thread_info.mixed_bytes);
+
+            if (done + length <= skip)
+                continue;
+
+            offset = done < skip ? skip - done : 0;
+
+            pa_assert_se(pa_memblockq_peek_fixed_size(i->thread_info.render_memblockq, length - offset, &ichunk) >= 0);
+            subtract_input(s, &chunk, offset, &ichunk, &i->thread_info.mixed_volume);
+            pa_memblock_unref(ichunk.memblock);
+
+            pa_memblockq_drop(i->thread_info.render_memblockq, length - offset);
+        }
+
+        pa_assert_se(pa_memblockq_push(s->thread_info.premix, &chunk) >= 0);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_memblockq_drop(s->thread_info.mix_history, length);
+    }
+}
+
+/* Called from IO thread context */
+static void partial_rewind_finish(pa_sink *s) {
+    pa_sink_input *i;
+    void *state = NULL;
+
+    pa_sink_assert_ref(s);
+    pa_assert(s->thread_info.premix);
+
+    pa_memblockq_free(s->thread_info.premix);
+    s->thread_info.premix = NULL;
+
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        i->thread_info.rewind_dirty = false;
+}
+
+/* Called from IO thread context */
+static void partial_rewind_cancel(pa_sink *s) {
+    pa_sink_input *i;
+    void *state = NULL;
+    size_t left;
+
+    pa_sink_assert_ref(s);
+
+    if (!s->thread_info.premix)
+        return;
+
+    /* The inputs that didn't need to be rendered again are ahead of
+     * us by what is left of the premix. Move them back to where we
+     * are, as if they had been rewound in the first place. */
+    left = pa_memblockq_get_length(s->thread_info.premix);
+
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        if (!i->thread_info.rewind_dirty)
+            pa_memblockq_rewind(i->thread_info.render_memblockq, left);
+
+    pa_memblockq_free(s->thread_info.premix);
+    s->thread_info.premix = NULL;
+}
+
+/* Called from IO thread context */
+static void partial_rewind_reset_input(pa_sink_input *i) {
+    pa_sink_input_assert_ref(i);
+
+    /* Nothing of this input is in the mix of this sink yet */
+    i->thread_info.rewind_dirty = false;
+    i->thread_info.mixed_bytes = 0;
+    i->thread_info.mixed_volume_bytes = 0;
+    pa_cvolume_init(&i->thread_info.mixed_volume);
+}
+
 /* Called from IO thread context */
 void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     pa_sink_input *i;
     void *state = NULL;
+    bool partial;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -984,15 +1283,50 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     s->thread_info.rewind_nbytes = 0;
     s->thread_info.rewind_requested = false;
 
+    partial_rewind_cancel(s);
+
+    /* If only a few inputs changed we take their data out of what
+     * we mixed before and leave the others alone */
+    partial = partial_rewind_possible(s, nbytes);
+    s->thread_info.rewind_full = false;
+
     if (nbytes > 0) {
-        pa_log_debug("Processing rewind...");
+        pa_log_debug("Processing %srewind...", partial ? "partial " : "");
+        pa_io_stats_add_rewind(&s->io_stats, nbytes);
         if (s->flags & PA_SINK_DEFERRED_VOLUME)
             pa_sink_volume_change_rewind(s, nbytes);
     }
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+    if (partial)
+        partial_rewind(s, nbytes);
+
+    mix_history_rewind(s, nbytes);
+
+    if (s->thread_info.limiter && nbytes > 0)
+        pa_limiter_rewind(s->thread_info.limiter, nbytes / pa_frame_size(&s->sample_spec));
+
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
         pa_sink_input_assert_ref(i);
-        pa_sink_input_process_rewind(i, nbytes);
+
+        /* If the render memblockq isn't rewound, what is in front of
+         * its read index doesn't match what we mixed anymore */
+        if (i->thread_info.dont_rewind_render)
+            i->thread_info.mixed_bytes = 0;
+        else
+            i->thread_info.mixed_bytes -= PA_MIN(nbytes, i->thread_info.mixed_bytes);
+
+        i->thread_info.mixed_volume_bytes -= PA_MIN(nbytes, i->thread_info.mixed_volume_bytes);
+        i->thread_info.mixed_volume_bytes = PA_MIN(i->thread_info.mixed_volume_bytes, i->thread_info.mixed_bytes);
+
+        if (partial && !i->thread_info.rewind_dirty)
+            pa_sink_input_process_rewind(i, 0);
+        else
+            pa_sink_input_process_rewind(i, nbytes);
+
+        /* After a partial rewind the flag marks the inputs we render
+         * again until the premix is used up */
+        if (!partial)
+            i->thread_info.rewind_dirty = false;
     }
 
     if (nbytes > 0) {
@@ -1012,9 +1346,13 @@ static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, uns
     pa_sink_assert_io_context(s);
     pa_assert(info);
 
-    while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)) && maxinfo > 0) {
+    while ((i = pa_dense_hashmap_iterate(s->thread_info.inputs, &state, NULL)) && maxinfo > 0) {
         pa_sink_input_assert_ref(i);
 
+        /* The data of the unchanged inputs is already in the premix */
+        if (s->thread_info.premix && !i->thread_info.rewind_dirty)
+            continue;
+
         pa_sink_input_peek(i, *length, &info->chunk, &info->volume);
 
         if (mixlength == 0 || info->chunk.length < mixlength)
@@ -1056,12 +1394,20 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
 
     /* We optimize for the case where the order of the inputs has not changed */
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
         unsigned j;
         pa_mix_info* m = NULL;
 
         pa_sink_input_assert_ref(i);
 
+        if (s->thread_info.premix && !i->thread_info.rewind_dirty) {
+            /* This input is already ahead of us, but its data ends up
+             * in the mix through the premix */
+            i->thread_info.mixed_bytes = PA_MIN(i->thread_info.mixed_bytes + result->length, s->thread_info.max_rewind);
+            i->thread_info.mixed_volume_bytes = PA_MIN(i->thread_info.mixed_volume_bytes + result->length, s->thread_info.max_rewind);
+            continue;
+        }
+
         /* Let's try to find the matching entry info the pa_mix_info array */
         for (j = 0; j < n; j ++) {
 
@@ -1075,6 +1421,16 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
                 p = 0;
         }
 
+        /* Remember how long the input has been mixed with the same
+         * volume, so that we can take its data out of the mix again */
+        if (m && !pa_cvolume_equal(&i->thread_info.mixed_volume, &m->volume)) {
+            i->thread_info.mixed_volume = m->volume;
+            i->thread_info.mixed_volume_bytes = 0;
+        }
+
+        i->thread_info.mixed_bytes = PA_MIN(i->thread_info.mixed_bytes + result->length, s->thread_info.max_rewind);
+        i->thread_info.mixed_volume_bytes = PA_MIN(i->thread_info.mixed_volume_bytes + result->length, s->thread_info.max_rewind);
+
         /* Drop read data */
         pa_sink_input_drop(i, result->length);
 
@@ -1135,15 +1491,174 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         }
     }
 
+    mix_history_push(s, result);
+
     if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state))
         pa_source_post(s->monitor_source, result);
 }
 
+/* Called from IO thread context */
+static void render_done(pa_sink *s, pa_usec_t begin) {
+    pa_usec_t end;
+
+    end = pa_rtclock_now();
+
+    pa_io_stats_add_render(&s->io_stats, end - begin);
+    pa_trace_span("sink-render", begin, end);
+}
+
+/* Called from IO thread context */
+static void render_premix(pa_sink *s, size_t length, pa_memchunk *result) {
+    pa_mix_info info[MAX_MIX_CHANNELS];
+    pa_memchunk chunk;
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_assert(s->thread_info.premix);
+    pa_assert(result);
+
+    pa_assert_se(pa_memblockq_peek(s->thread_info.premix, &chunk) >= 0);
+
+    if (length > chunk.length)
+        length = chunk.length;
+
+    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+
+    if (n == 0) {
+        *result = chunk;
+        result->length = length;
+    } else {
+        float *d;
+        const float *src;
+        size_t k;
+
+        result->memblock = pa_memblock_new(s->core->mempool, length);
+        result->index = 0;
+
+        d = pa_memblock_acquire(result->memblock);
+        result->length = pa_mix(info, n,
+                                d, length,
+                                &s->sample_spec,
+                                &s->thread_info.soft_volume,
+                                s->thread_info.soft_muted);
+
+        src = pa_memblock_acquire_chunk(&chunk);
+        for (k = result->length / sizeof(float); k > 0; k--)
+            *(d++) += *(src++);
+
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_release(result->memblock);
+
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    inputs_drop(s, info, n, result);
+
+    pa_memblockq_drop(s->thread_info.premix, result->length);
+
+    if (pa_memblockq_get_length(s->thread_info.premix) <= 0)
+        partial_rewind_finish(s);
+}
+
+/* Called from IO thread context */
+static void render_limited(pa_sink *s, size_t length, pa_memchunk *result) {
+    pa_mix_info info[MAX_MIX_CHANNELS];
+    pa_memblock *mix_block, *convert_block = NULL;
+    float *mix, *convert = NULL;
+    size_t frame_size, mix_length;
+    unsigned channels, frames, n, k;
+
+    pa_sink_assert_ref(s);
+    pa_assert(s->thread_info.limiter);
+    pa_assert(result);
+
+    channels = s->sample_spec.channels;
+    frame_size = pa_frame_size(&s->sample_spec);
+
+    /* The mix is in float, which may need more room than the sample
+     * format of the sink */
+    length = PA_MIN(length, pa_mempool_block_size_max(s->core->mempool) / (channels * sizeof(float)) * frame_size);
+
+    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+
+    frames = (unsigned) (length / frame_size);
+    mix_length = frames * channels * sizeof(float);
+
+    mix_block = pa_memblock_new(s->core->mempool, mix_length);
+    mix = pa_memblock_acquire(mix_block);
+    memset(mix, 0, mix_length);
+
+    for (k = 0; k < n && !s->thread_info.soft_muted; k++) {
+        float linear[PA_CHANNELS_MAX];
+        const float *src;
+        unsigned channel, j;
+
+        if (pa_cvolume_is_muted(&info[k].volume))
+            continue;
+
+        /* Calculate the factors exactly like pa_mix() does */
+        for (channel = 0; channel < channels; channel++) {
+            float g = (float) pa_sw_volume_to_linear(s->thread_info.soft_volume.values[channel]);
+            linear[channel] = (float) (pa_sw_volume_to_linear(info[k].volume.values[channel]) * g);
+        }
+
+        src = pa_memblock_acquire_chunk(&info[k].chunk);
+
+        if (s->sample_spec.format != PA_SAMPLE_FLOAT32NE) {
+            if (!convert_block) {
+                convert_block = pa_memblock_new(s->core->mempool, mix_length);
+                convert = pa_memblock_acquire(convert_block);
+            }
+
+            pa_get_convert_to_float32ne_function(s->sample_spec.format)(frames * channels, src, convert);
+            pa_memblock_release(info[k].chunk.memblock);
+            src = convert;
+        }
+
+        for (j = 0, channel = 0; j < frames * channels; j++) {
+            mix[j] += src[j] * linear[channel];
+
+            if (PA_UNLIKELY(++channel >= channels))
+                channel = 0;
+        }
+
+        if (s->sample_spec.format == PA_SAMPLE_FLOAT32NE)
+            pa_memblock_release(info[k].chunk.memblock);
+    }
+
+    if (convert_block) {
+        pa_memblock_release(convert_block);
+        pa_memblock_unref(convert_block);
+    }
+
+    /* Even silence has to go through, to push out what is still in the
+     * look-ahead */
+    pa_limiter_process(s->thread_info.limiter, mix, mix, frames);
+
+    if (s->sample_spec.format == PA_SAMPLE_FLOAT32NE) {
+        pa_memblock_release(mix_block);
+        result->memblock = mix_block;
+    } else {
+        result->memblock = pa_memblock_new(s->core->mempool, length);
+        pa_get_convert_from_float32ne_function(s->sample_spec.format)(frames * channels, mix, pa_memblock_acquire(result->memblock));
+        pa_memblock_release(result->memblock);
+
+        pa_memblock_release(mix_block);
+        pa_memblock_unref(mix_block);
+    }
+
+    result->index = 0;
+    result->length = length;
+
+    inputs_drop(s, info, n, result);
+}
+
 /* Called from IO thread context */
 void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t block_size_max;
+    pa_usec_t t;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1172,6 +1687,22 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_assert(length > 0);
 
+    t = pa_rtclock_now();
+
+    if (s->thread_info.premix) {
+        render_premix(s, length, result);
+        render_done(s, t);
+        pa_sink_unref(s);
+        return;
+    }
+
+    if (s->thread_info.limiter) {
+        render_limited(s, length, result);
+        render_done(s, t);
+        pa_sink_unref(s);
+        return;
+    }
+
     n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
 
     if (n == 0) {
@@ -1221,6 +1752,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     inputs_drop(s, info, n, result);
 
+    render_done(s, t);
+
     pa_sink_unref(s);
 }
 
@@ -1229,6 +1762,7 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t length, block_size_max;
+    pa_usec_t t;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1255,6 +1789,36 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_assert(length > 0);
 
+    t = pa_rtclock_now();
+
+    if (s->thread_info.premix) {
+        pa_memchunk chunk;
+
+        render_premix(s, length, &chunk);
+
+        target->length = chunk.length;
+        pa_memchunk_memcpy(target, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        render_done(s, t);
+        pa_sink_unref(s);
+        return;
+    }
+
+    if (s->thread_info.limiter) {
+        pa_memchunk chunk;
+
+        render_limited(s, length, &chunk);
+
+        target->length = chunk.length;
+        pa_memchunk_memcpy(target, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        render_done(s, t);
+        pa_sink_unref(s);
+        return;
+    }
+
     n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
 
     if (n == 0) {
@@ -1306,6 +1870,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     inputs_drop(s, info, n, target);
 
+    render_done(s, t);
+
     pa_sink_unref(s);
 }
 
@@ -1448,6 +2014,11 @@ int pa_sink_update_rate(pa_sink *s, uint32_t rate, bool passthrough) {
         /* update monitor source as well */
         if (s->monitor_source && !passthrough)
             pa_source_update_rate(s->monitor_source, desired_rate, false);
+
+        /* The IO thread doesn't render while we are suspended */
+        if (s->limiter)
+            pa_limiter_set_rate(s->limiter, s->sample_spec.rate);
+
         pa_log_info("Changed sampling rate successfully");
 
         PA_IDXSET_FOREACH(i, s->inputs, idx) {
@@ -1481,6 +2052,9 @@ pa_usec_t pa_sink_get_latency(pa_sink *s) {
 
     pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
 
+    if (s->limiter && !pa_sink_is_passthrough(s))
+        usec += pa_bytes_to_usec(pa_limiter_get_latency(s->limiter) * pa_frame_size(&s->sample_spec), &s->sample_spec);
+
     /* usec is unsigned, so check that the offset can be added to usec without
      * underflowing. */
     if (-s->latency_offset <= (int64_t) usec)
@@ -1515,6 +2089,9 @@ pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s) {
     if (o->process_msg(o, PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) < 0)
         return -1;
 
+    if (s->thread_info.limiter)
+        usec += pa_bytes_to_usec(pa_limiter_get_latency(s->thread_info.limiter) * pa_frame_size(&s->sample_spec), &s->sample_spec);
+
     /* usec is unsigned, so check that the offset can be added to usec without
      * underflowing. */
     if (-s->thread_info.latency_offset <= (int64_t) usec)
@@ -1557,6 +2134,35 @@ pa_sink *pa_sink_get_master(pa_sink *s) {
     return s;
 }
 
+/* Called from IO thread context, or from main context before the IO
+ * thread started up */
+static void set_limiter_within_thread(pa_sink *s, pa_limiter *limiter) {
+    pa_sink_assert_ref(s);
+
+    /* A pending premix and the mix we kept were rendered with or
+     * without the limiter, and neither matches what comes next */
+    partial_rewind_cancel(s);
+    mix_history_reset(s);
+
+    s->thread_info.limiter = limiter;
+
+    /* Whatever the limiter saw before doesn't belong to this sink */
+    if (limiter) {
+        pa_limiter_reset(limiter);
+        pa_limiter_set_max_rewind(limiter, s->thread_info.max_rewind / pa_frame_size(&s->sample_spec));
+    }
+}
+
+/* Called from main context */
+static void send_limiter(pa_sink *s, pa_limiter *limiter) {
+    pa_sink_assert_ref(s);
+
+    if (PA_SINK_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_SET_LIMITER, limiter, 0, NULL) == 0);
+    else
+        set_limiter_within_thread(s, limiter);
+}
+
 /* Called from main context */
 bool pa_sink_is_passthrough(pa_sink *s) {
     pa_sink_input *alt_i;
@@ -1591,6 +2197,10 @@ void pa_sink_enter_passthrough(pa_sink *s) {
 
     pa_cvolume_set(&volume, s->sample_spec.channels, PA_MIN(s->base_volume, PA_VOLUME_NORM));
     pa_sink_set_volume(s, &volume, true, false);
+
+    /* The data isn't PCM */
+    if (s->limiter)
+        send_limiter(s, NULL);
 }
 
 /* Called from main context */
@@ -1606,6 +2216,9 @@ void pa_sink_leave_passthrough(pa_sink *s) {
 
     pa_cvolume_init(&s->saved_volume);
     s->saved_save_volume = false;
+
+    if (s->limiter)
+        send_limiter(s, s->limiter);
 }
 
 /* Called from main context. */
@@ -2400,7 +3013,7 @@ static void sync_input_volumes_within_thread(pa_sink *s) {
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
         if (pa_cvolume_equal(&i->thread_info.soft_volume, &i->soft_volume))
             continue;
 
@@ -2419,7 +3032,7 @@ static void set_shared_volume_within_thread(pa_sink *s) {
 
     PA_MSGOBJECT(s)->process_msg(PA_MSGOBJECT(s), PA_SINK_MESSAGE_SET_VOLUME_SYNCED, NULL, 0, NULL);
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
         if (i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER))
             set_shared_volume_within_thread(i->origin_sink);
     }
@@ -2439,7 +3052,10 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
              * sink input handling a few lines down at
              * PA_SINK_MESSAGE_FINISH_MOVE, too. */
 
-            pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
+            partial_rewind_cancel(s);
+            partial_rewind_reset_input(i);
+
+            pa_dense_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
 
             /* Since the caller sleeps in pa_sink_input_put(), we can
              * safely access data outside of thread_info even though
@@ -2503,6 +3119,8 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
              * sink input handling a few lines down at
              * PA_SINK_MESSAGE_START_MOVE, too. */
 
+            partial_rewind_cancel(s);
+
             if (i->detach)
                 i->detach(i);
 
@@ -2528,7 +3146,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
                 i->thread_info.sync_next = NULL;
             }
 
-            pa_hashmap_remove_and_free(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index));
+            pa_dense_hashmap_remove_and_free(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index));
             pa_sink_invalidate_requested_latency(s, true);
             pa_sink_request_rewind(s, (size_t) -1);
 
@@ -2546,6 +3164,8 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(!i->thread_info.sync_next);
             pa_assert(!i->thread_info.sync_prev);
 
+            partial_rewind_cancel(s);
+
             if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
                 pa_usec_t usec = 0;
                 size_t sink_nbytes, total_nbytes;
@@ -2609,7 +3229,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             i->thread_info.attached = false;
 
             /* Let's remove the sink input ...*/
-            pa_hashmap_remove_and_free(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index));
+            pa_dense_hashmap_remove_and_free(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index));
 
             pa_sink_invalidate_requested_latency(s, true);
 
@@ -2630,7 +3250,10 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(!i->thread_info.sync_next);
             pa_assert(!i->thread_info.sync_prev);
 
-            pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
+            partial_rewind_cancel(s);
+            partial_rewind_reset_input(i);
+
+            pa_dense_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
 
             pa_assert(!i->thread_info.attached);
             i->thread_info.attached = true;
@@ -2761,13 +3384,20 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             if (s->thread_info.state == PA_SINK_SUSPENDED) {
                 s->thread_info.rewind_nbytes = 0;
                 s->thread_info.rewind_requested = false;
+                s->thread_info.rewind_full = false;
+
+                partial_rewind_cancel(s);
+                mix_history_reset(s);
+
+                if (s->thread_info.limiter)
+                    pa_limiter_reset(s->thread_info.limiter);
             }
 
             if (suspend_change) {
                 pa_sink_input *i;
                 void *state = NULL;
 
-                while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)))
+                while ((i = pa_dense_hashmap_iterate(s->thread_info.inputs, &state, NULL)))
                     if (i->suspend_within_thread)
                         i->suspend_within_thread(i, s->thread_info.state == PA_SINK_SUSPENDED);
             }
@@ -2861,6 +3491,15 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             s->thread_info.latency_offset = offset;
             return 0;
 
+        case PA_SINK_MESSAGE_SET_REWIND_LIMIT:
+            s->thread_info.rewind_limit = (pa_usec_t) offset;
+            pa_sink_set_max_rewind_within_thread(s, s->thread_info.requested_max_rewind);
+            return 0;
+
+        case PA_SINK_MESSAGE_SET_LIMITER:
+            set_limiter_within_thread(s, userdata);
+            return 0;
+
         case PA_SINK_MESSAGE_GET_LATENCY:
         case PA_SINK_MESSAGE_MAX:
             ;
@@ -2898,7 +3537,7 @@ void pa_sink_detach_within_thread(pa_sink *s) {
     pa_sink_assert_io_context(s);
     pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
         if (i->detach)
             i->detach(i);
 
@@ -2915,7 +3554,7 @@ void pa_sink_attach_within_thread(pa_sink *s) {
     pa_sink_assert_io_context(s);
     pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
         if (i->attach)
             i->attach(i);
 
@@ -2924,11 +3563,7 @@ void pa_sink_attach_within_thread(pa_sink *s) {
 }
 
 /* Called from IO thread */
-void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
-    pa_sink_assert_ref(s);
-    pa_sink_assert_io_context(s);
-    pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
-
+static void request_rewind(pa_sink *s, size_t nbytes) {
     if (nbytes == (size_t) -1)
         nbytes = s->thread_info.max_rewind;
 
@@ -2945,6 +3580,32 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
         s->request_rewind(s);
 }
 
+/* Called from IO thread */
+void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+    pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
+
+    /* We don't know what changed, so everything needs to be rendered
+     * again */
+    s->thread_info.rewind_full = true;
+
+    request_rewind(s, nbytes);
+}
+
+/* Called from IO thread */
+void pa_sink_request_rewind_input(pa_sink *s, pa_sink_input *i, size_t nbytes) {
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+    pa_assert(PA_SINK_IS_LINKED(s->thread_info.state));
+    pa_sink_input_assert_ref(i);
+    pa_assert(i->sink == s);
+
+    i->thread_info.rewind_dirty = true;
+
+    request_rewind(s, nbytes);
+}
+
 /* Called from IO thread */
 pa_usec_t pa_sink_get_requested_latency_within_thread(pa_sink *s) {
     pa_usec_t result = (pa_usec_t) -1;
@@ -2961,7 +3622,7 @@ pa_usec_t pa_sink_get_requested_latency_within_thread(pa_sink *s) {
     if (s->thread_info.requested_latency_valid)
         return s->thread_info.requested_latency;
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+    PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
         if (i->thread_info.requested_sink_latency != (pa_usec_t) -1 &&
             (result == (pa_usec_t) -1 || result > i->thread_info.requested_sink_latency))
             result = i->thread_info.requested_sink_latency;
@@ -3008,13 +3669,24 @@ void pa_sink_set_max_rewind_within_thread(pa_sink *s, size_t max_rewind) {
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
 
+    s->thread_info.requested_max_rewind = max_rewind;
+
+    if (s->thread_info.rewind_limit > 0)
+        max_rewind = PA_MIN(max_rewind, pa_usec_to_bytes(s->thread_info.rewind_limit, &s->sample_spec));
+
     if (max_rewind == s->thread_info.max_rewind)
         return;
 
     s->thread_info.max_rewind = max_rewind;
 
+    partial_rewind_cancel(s);
+    update_mix_history(s);
+
+    if (s->thread_info.limiter)
+        pa_limiter_set_max_rewind(s->thread_info.limiter, s->thread_info.max_rewind / pa_frame_size(&s->sample_spec));
+
     if (PA_SINK_IS_LINKED(s->thread_info.state))
-        PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
             pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
 
     if (s->monitor_source)
@@ -3047,7 +3719,7 @@ void pa_sink_set_max_request_within_thread(pa_sink *s, size_t max_request) {
     if (PA_SINK_IS_LINKED(s->thread_info.state)) {
         pa_sink_input *i;
 
-        PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
             pa_sink_input_update_max_request(i, s->thread_info.max_request);
     }
 }
@@ -3081,7 +3753,7 @@ void pa_sink_invalidate_requested_latency(pa_sink *s, bool dynamic) {
         if (s->update_requested_latency)
             s->update_requested_latency(s);
 
-        PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
             if (i->update_sink_requested_latency)
                 i->update_sink_requested_latency(i);
     }
@@ -3167,7 +3839,7 @@ void pa_sink_set_latency_range_within_thread(pa_sink *s, pa_usec_t min_latency,
         pa_sink_input *i;
         void *state = NULL;
 
-        PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
             if (i->update_sink_latency_range)
                 i->update_sink_latency_range(i);
     }
@@ -3246,7 +3918,7 @@ void pa_sink_set_fixed_latency_within_thread(pa_sink *s, pa_usec_t latency) {
         pa_sink_input *i;
         void *state = NULL;
 
-        PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+        PA_DENSE_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
             if (i->update_sink_fixed_latency)
                 i->update_sink_fixed_latency(i);
     }
@@ -3268,6 +3940,38 @@ void pa_sink_set_latency_offset(pa_sink *s, int64_t offset) {
         s->thread_info.latency_offset = offset;
 }
 
+/* Called from main context */
+void pa_sink_set_rewind_limit(pa_sink *s, pa_usec_t limit) {
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+
+    s->rewind_limit = limit;
+
+    if (PA_SINK_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_SET_REWIND_LIMIT, NULL, (int64_t) limit, NULL) == 0);
+    else {
+        s->thread_info.rewind_limit = limit;
+        pa_sink_set_max_rewind_within_thread(s, s->thread_info.requested_max_rewind);
+    }
+}
+
+/* Called from main context */
+void pa_sink_set_limiter(pa_sink *s, pa_limiter *limiter) {
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(!limiter || pa_limiter_get_channels(limiter) == s->sample_spec.channels);
+
+    if (limiter == s->limiter)
+        return;
+
+    s->limiter = limiter;
+
+    if (limiter)
+        pa_limiter_set_rate(limiter, s->sample_spec.rate);
+
+    send_limiter(s, pa_sink_is_passthrough(s) ? NULL : limiter);
+}
+
 /* Called from main context */
 size_t pa_sink_get_max_rewind(pa_sink *s) {
     size_t r;
@@ -36,13 +36,17 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 
 #include <pulsecore/core.h>
 #include <pulsecore/idxset.h>
+#include <pulsecore/dense-hashmap.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/source.h>
 #include <pulsecore/module.h>
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/msgobject.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/strbuf.h>
 #include <pulsecore/device-port.h>
+#include <pulsecore/io-stats.h>
+#include <pulsecore/limiter.h>
 #include <pulsecore/card.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
@@ -118,6 +122,16 @@ struct pa_sink {
     /* The latency offset is inherited from the currently active port */
     int64_t latency_offset;
 
+    /* How far back the sink may rewind at most, 0 for no limit */
+    pa_usec_t rewind_limit;
+
+    /* Limits the mix before it is converted to the sample format of the
+     * sink, may be NULL. Owned by whoever set it. */
+    pa_limiter *limiter;
+
+    /* Updated from the IO thread, see io-stats.h */
+    pa_io_stats io_stats;
+
     unsigned priority;
 
     bool set_mute_in_progress;
@@ -246,11 +260,16 @@ struct pa_sink {
      * main thread. */
     int (*update_rate)(pa_sink *s, uint32_t rate);
 
+    /* Called to append implementation specific state to the
+     * description of the sink in "pacmd list-sinks", one line per
+     * item, each starting with a tab. Called from main context. */
+    void (*print_info)(pa_sink *s, pa_strbuf *buf); /* may be NULL */
+
     /* Contains copies of the above data so that the real-time worker
      * thread can work without access locking */
     struct {
         pa_sink_state_t state;
-        pa_hashmap *inputs;
+        pa_dense_hashmap *inputs;
 
         pa_rtpoll *rtpoll;
 
@@ -267,6 +286,12 @@ struct pa_sink {
          * be able to satisfy every DMA buffer rewrite */
         size_t max_rewind;
 
+        /* What the implementor asked for as max_rewind, and the limit
+         * that is applied to it. Rewinding less means the streams need
+         * to keep less history around. */
+        size_t requested_max_rewind;
+        pa_usec_t rewind_limit;
+
         /* The number of bytes streams need to keep around to satisfy
          * every DMA write request */
         size_t max_request;
@@ -275,6 +300,28 @@ struct pa_sink {
         size_t rewind_nbytes;
         bool rewind_requested;
 
+        /* Set if the rewind was requested for other reasons than data
+         * of individual inputs changing, i.e. if everything needs to
+         * be rendered again */
+        bool rewind_full:1;
+
+        /* For partial rewinds: the last max_rewind bytes we rendered,
+         * NULL if partial rewinds are not available for this sink */
+        pa_memblockq *mix_history;
+        size_t mix_history_length;
+        pa_cvolume mix_history_volume;
+        bool mix_history_muted:1;
+
+        /* While rendering after a partial rewind: the mix of all
+         * inputs that didn't request the rewind. Only the other ones
+         * are rendered again and mixed into this. */
+        pa_memblockq *premix;
+
+        /* The limiter, unless we are in passthrough mode. With a
+         * limiter the inputs are mixed in float, and partial rewinds
+         * are not possible. */
+        pa_limiter *limiter;
+
         /* Both dynamic and fixed latencies will be clamped to this
          * range. */
         pa_usec_t min_latency; /* we won't go below this latency */
@@ -336,6 +383,8 @@ typedef enum pa_sink_message {
     PA_SINK_MESSAGE_SET_PORT,
     PA_SINK_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SINK_MESSAGE_SET_LATENCY_OFFSET,
+    PA_SINK_MESSAGE_SET_REWIND_LIMIT,
+    PA_SINK_MESSAGE_SET_LIMITER,
     PA_SINK_MESSAGE_MAX
 } pa_sink_message_t;
 
@@ -423,6 +472,19 @@ unsigned pa_device_init_priority(pa_proplist *p);
 int pa_sink_update_rate(pa_sink *s, uint32_t rate, bool passthrough);
 void pa_sink_set_latency_offset(pa_sink *s, int64_t offset);
 
+/* Limit how far the sink rewinds, and hence how much history each
+ * stream keeps around, to the given time. 0 means the sink rewinds as
+ * far as the implementor allows. */
+void pa_sink_set_rewind_limit(pa_sink *s, pa_usec_t limit);
+
+/* Runs the mix of all inputs through the limiter as the final stage of
+ * rendering, so that loud streams don't clip when the mix is converted
+ * to the sample format of the sink. The limiter must have as many
+ * channels as the sink, and it adds its look-ahead to the latency of the
+ * sink. It stays owned by the caller, who has to remove it again with
+ * NULL before freeing it. */
+void pa_sink_set_limiter(pa_sink *s, pa_limiter *limiter);
+
 /* The returned value is supposed to be in the time domain of the sound card! */
 pa_usec_t pa_sink_get_latency(pa_sink *s);
 pa_usec_t pa_sink_get_requested_latency(pa_sink *s);
@@ -513,6 +575,12 @@ size_t pa_sink_process_input_underruns(pa_sink *s, size_t left_to_play);
 
 void pa_sink_request_rewind(pa_sink*s, size_t nbytes);
 
+/* Like pa_sink_request_rewind(), but tells the sink that only the data
+ * of the sink input i changed. If the rest stays unchanged, the sink
+ * may keep the mix of the other inputs instead of rendering it
+ * again. */
+void pa_sink_request_rewind_input(pa_sink *s, pa_sink_input *i, size_t nbytes);
+
 void pa_sink_invalidate_requested_latency(pa_sink *s, bool dynamic);
 
 pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s);
@@ -39,6 +39,7 @@
 #include <pulsecore/log.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/trace.h>
 
 #include "source-output.h"
 
@@ -710,6 +711,18 @@ pa_usec_t pa_source_output_get_latency(pa_source_output *o, pa_usec_t *source_la
     return r[0];
 }
 
+/* Called from thread context */
+static void source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
+    pa_usec_t begin, end;
+
+    begin = pa_rtclock_now();
+    o->push(o, chunk);
+    end = pa_rtclock_now();
+
+    pa_io_stats_add_render(&o->io_stats, end - begin);
+    pa_trace_span("source-output-push", begin, end);
+}
+
 /* Called from thread context */
 void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     bool need_volume_factor_source;
@@ -730,6 +743,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
 
     if (pa_memblockq_push(o->thread_info.delay_memblockq, chunk) < 0) {
         pa_log_debug("Delay queue overflow!");
+        pa_io_stats_add_xrun(&o->io_stats);
         pa_memblockq_seek(o->thread_info.delay_memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, true);
     }
 
@@ -799,9 +813,10 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
                 pa_volume_memchunk(&qchunk, &o->thread_info.sample_spec, &o->volume_factor_source);
             }
 
-            o->push(o, &qchunk);
+            source_output_push(o, &qchunk);
         } else {
             pa_memchunk rchunk;
+            pa_usec_t t;
 
             if (mbs == 0)
                 mbs = pa_resampler_max_block_size(o->thread_info.resampler);
@@ -809,7 +824,9 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
             if (qchunk.length > mbs)
                 qchunk.length = mbs;
 
+            t = pa_rtclock_now();
             pa_resampler_run(o->thread_info.resampler, &qchunk, &rchunk);
+            pa_io_stats_add_resample(&o->io_stats, pa_rtclock_now() - t);
 
             if (rchunk.length > 0) {
                 if (nvfs) {
@@ -817,7 +834,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
                     pa_volume_memchunk(&rchunk, &o->thread_info.sample_spec, &o->volume_factor_source);
                 }
 
-                o->push(o, &rchunk);
+                source_output_push(o, &rchunk);
             }
 
             if (rchunk.memblock)
@@ -827,6 +844,8 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
         pa_memblock_unref(qchunk.memblock);
         pa_memblockq_drop(o->thread_info.delay_memblockq, qchunk.length);
     }
+
+    pa_io_stats_set_queue_length(&o->io_stats, pa_memblockq_get_length(o->thread_info.delay_memblockq));
 }
 
 /* Called from thread context */
@@ -840,6 +859,8 @@ void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes /* in so
     if (nbytes <= 0)
         return;
 
+    pa_io_stats_add_rewind(&o->io_stats, nbytes);
+
     if (o->process_rewind) {
         pa_assert(pa_memblockq_get_length(o->thread_info.delay_memblockq) == 0);
 
@@ -42,6 +42,7 @@
 #include <pulsecore/log.h>
 #include <pulsecore/mix.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/trace.h>
 
 #include "source.h"
 
@@ -315,8 +316,8 @@ pa_source* pa_source_new(
             0);
 
     s->thread_info.rtpoll = NULL;
-    s->thread_info.outputs = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL,
-                                                 (pa_free_cb_t) pa_source_output_unref);
+    s->thread_info.outputs = pa_dense_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func, NULL,
+                                                       (pa_free_cb_t) pa_source_output_unref);
     s->thread_info.soft_volume = s->soft_volume;
     s->thread_info.soft_muted = s->muted;
     s->thread_info.state = s->state;
@@ -665,7 +666,7 @@ static void source_free(pa_object *o) {
     pa_log_info("Freeing source %u \"%s\"", s->index, s->name);
 
     pa_idxset_free(s->outputs, NULL);
-    pa_hashmap_free(s->thread_info.outputs);
+    pa_dense_hashmap_free(s->thread_info.outputs);
 
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
@@ -892,7 +893,9 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
 
     pa_log_debug("Processing rewind...");
 
-    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
+    pa_io_stats_add_rewind(&s->io_stats, nbytes);
+
+    PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
         pa_source_output_assert_ref(o);
         pa_source_output_process_rewind(o, nbytes);
     }
@@ -902,6 +905,7 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
 void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     pa_source_output *o;
     void *state = NULL;
+    pa_usec_t begin, end;
 
     pa_source_assert_ref(s);
     pa_source_assert_io_context(s);
@@ -911,6 +915,8 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
+    begin = pa_rtclock_now();
+
     if (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
         pa_memchunk vchunk = *chunk;
 
@@ -922,7 +928,7 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
         else
             pa_volume_memchunk(&vchunk, &s->sample_spec, &s->thread_info.soft_volume);
 
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
+        while ((o = pa_dense_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
             pa_source_output_assert_ref(o);
 
             if (!o->thread_info.direct_on_input)
@@ -932,13 +938,18 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
         pa_memblock_unref(vchunk.memblock);
     } else {
 
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
+        while ((o = pa_dense_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
             pa_source_output_assert_ref(o);
 
             if (!o->thread_info.direct_on_input)
                 pa_source_output_push(o, chunk);
         }
     }
+
+    end = pa_rtclock_now();
+
+    pa_io_stats_add_render(&s->io_stats, end - begin);
+    pa_trace_span("source-post", begin, end);
 }
 
 /* Called from IO thread context */
@@ -1969,7 +1980,7 @@ static void sync_output_volumes_within_thread(pa_source *s) {
     pa_source_assert_ref(s);
     pa_source_assert_io_context(s);
 
-    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
+    PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
         if (pa_cvolume_equal(&o->thread_info.soft_volume, &o->soft_volume))
             continue;
 
@@ -1988,7 +1999,7 @@ static void set_shared_volume_within_thread(pa_source *s) {
 
     PA_MSGOBJECT(s)->process_msg(PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_SET_VOLUME_SYNCED, NULL, 0, NULL);
 
-    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
+    PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
         if (o->destination_source && (o->destination_source->flags & PA_SOURCE_SHARE_VOLUME_WITH_MASTER))
             set_shared_volume_within_thread(o->destination_source);
     }
@@ -2004,7 +2015,7 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
         case PA_SOURCE_MESSAGE_ADD_OUTPUT: {
             pa_source_output *o = PA_SOURCE_OUTPUT(userdata);
 
-            pa_hashmap_put(s->thread_info.outputs, PA_UINT32_TO_PTR(o->index), pa_source_output_ref(o));
+            pa_dense_hashmap_put(s->thread_info.outputs, PA_UINT32_TO_PTR(o->index), pa_source_output_ref(o));
 
             if (o->direct_on_input) {
                 o->thread_info.direct_on_input = o->direct_on_input;
@@ -2050,7 +2061,7 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
                 o->thread_info.direct_on_input = NULL;
             }
 
-            pa_hashmap_remove_and_free(s->thread_info.outputs, PA_UINT32_TO_PTR(o->index));
+            pa_dense_hashmap_remove_and_free(s->thread_info.outputs, PA_UINT32_TO_PTR(o->index));
             pa_source_invalidate_requested_latency(s, true);
 
             /* In flat volume mode we need to update the volume as
@@ -2132,7 +2143,7 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
                 pa_source_output *o;
                 void *state = NULL;
 
-                while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL)))
+                while ((o = pa_dense_hashmap_iterate(s->thread_info.outputs, &state, NULL)))
                     if (o->suspend_within_thread)
                         o->suspend_within_thread(o, s->thread_info.state == PA_SOURCE_SUSPENDED);
             }
@@ -2265,7 +2276,7 @@ void pa_source_detach_within_thread(pa_source *s) {
     pa_source_assert_io_context(s);
     pa_assert(PA_SOURCE_IS_LINKED(s->thread_info.state));
 
-    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+    PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
         if (o->detach)
             o->detach(o);
 }
@@ -2279,7 +2290,7 @@ void pa_source_attach_within_thread(pa_source *s) {
     pa_source_assert_io_context(s);
     pa_assert(PA_SOURCE_IS_LINKED(s->thread_info.state));
 
-    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+    PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
         if (o->attach)
             o->attach(o);
 }
@@ -2299,7 +2310,7 @@ pa_usec_t pa_source_get_requested_latency_within_thread(pa_source *s) {
     if (s->thread_info.requested_latency_valid)
         return s->thread_info.requested_latency;
 
-    PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+    PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
         if (o->thread_info.requested_source_latency != (pa_usec_t) -1 &&
             (result == (pa_usec_t) -1 || result > o->thread_info.requested_source_latency))
             result = o->thread_info.requested_source_latency;
@@ -2346,7 +2357,7 @@ void pa_source_set_max_rewind_within_thread(pa_source *s, size_t max_rewind) {
     s->thread_info.max_rewind = max_rewind;
 
     if (PA_SOURCE_IS_LINKED(s->thread_info.state))
-        PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+        PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
             pa_source_output_update_max_rewind(o, s->thread_info.max_rewind);
 }
 
@@ -2379,7 +2390,7 @@ void pa_source_invalidate_requested_latency(pa_source *s, bool dynamic) {
         if (s->update_requested_latency)
             s->update_requested_latency(s);
 
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL)))
+        while ((o = pa_dense_hashmap_iterate(s->thread_info.outputs, &state, NULL)))
             if (o->update_source_requested_latency)
                 o->update_source_requested_latency(o);
     }
@@ -2469,7 +2480,7 @@ void pa_source_set_latency_range_within_thread(pa_source *s, pa_usec_t min_laten
         pa_source_output *o;
         void *state = NULL;
 
-        PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+        PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
             if (o->update_source_latency_range)
                 o->update_source_latency_range(o);
     }
@@ -2541,7 +2552,7 @@ void pa_source_set_fixed_latency_within_thread(pa_source *s, pa_usec_t latency)
         pa_source_output *o;
         void *state = NULL;
 
-        PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+        PA_DENSE_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
             if (o->update_source_fixed_latency)
                 o->update_source_fixed_latency(o);
     }
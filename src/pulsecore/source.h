@@ -36,6 +36,7 @@ typedef struct pa_source_volume_change pa_source_volume_change;
 
 #include <pulsecore/core.h>
 #include <pulsecore/idxset.h>
+#include <pulsecore/dense-hashmap.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/module.h>
@@ -44,6 +45,7 @@ typedef struct pa_source_volume_change pa_source_volume_change;
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/card.h>
 #include <pulsecore/device-port.h>
+#include <pulsecore/io-stats.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/source-output.h>
@@ -118,6 +120,9 @@ struct pa_source {
     /* The latency offset is inherited from the currently active port */
     int64_t latency_offset;
 
+    /* Updated from the IO thread, see io-stats.h */
+    pa_io_stats io_stats;
+
     unsigned priority;
 
     bool set_mute_in_progress;
@@ -207,7 +212,7 @@ struct pa_source {
      * thread can work without access locking */
     struct {
         pa_source_state_t state;
-        pa_hashmap *outputs;
+        pa_dense_hashmap *outputs;
 
         pa_rtpoll *rtpoll;
 
@@ -41,13 +41,22 @@
  * allows cheap estimations of the remote time while clock updates may
  * be seldom and received in non-equidistant intervals.
  *
- * Basically, we estimate the gradient of received clock samples in a
- * certain history window (of size 'history_time') with linear
- * regression. With that info we estimate the remote time in
+ * Basically, we estimate the gradient of received clock samples with
+ * a two state (position, gradient) Kalman filter: each measurement is
+ * weighed against what we predicted from the previous ones. This needs
+ * only O(1) work per measurement, and unlike the measurements
+ * themselves the filtered position is mostly free of noise. The filter
+ * follows changes of the clock skew with a time constant on the order
+ * of 'history_time', and forgets faster when its predictions turn out
+ * to be off. With that info we estimate the remote time in
  * 'adjust_time' ahead and smoothen our current estimation function
  * towards that point with a 3rd order polynomial interpolation with
  * fitting derivatives. (more or less a b-spline)
  *
+ * Alternatively the gradient can be estimated with linear regression
+ * over all measurements of the last 'history_time', which is what
+ * older versions did. This is kept for comparison.
+ *
  * The larger 'history_time' is chosen the better we will suppress
  * noise -- but we'll adjust to clock skew slower..
  *
@@ -58,6 +67,13 @@
  * guaranteed to be monotonic.
  */
 
+/* The bandwidth of the Kalman filter, in multiples of 1/history_time */
+#define KALMAN_BANDWIDTH 1.0
+
+/* How much worse than expected our predictions may get on average
+ * before we assume the clock changed */
+#define KALMAN_FADE_THRESHOLD 2.0
+
 struct pa_smoother {
     pa_usec_t adjust_time, history_time;
 
@@ -70,10 +86,24 @@ struct pa_smoother {
     double de;            /* Gradient we estimated for point e */
     pa_usec_t ry;         /* The original y value for ex */
 
+    pa_smoother_estimator_t estimator;
+
                           /* History of last measurements */
     pa_usec_t history_x[HISTORY_MAX], history_y[HISTORY_MAX];
     unsigned history_idx, n_history;
 
+    /* State of the Kalman filter: remote time ky at local time kx,
+     * gradient kd, and their covariance matrix */
+    pa_usec_t kx;
+    double ky, kd;
+    double p00, p01, p11;
+    double interval;      /* Average time between two measurements */
+    double noise;         /* Estimated variance of the measurements */
+    double nis;           /* Average normalized innovation squared */
+    double my, md;        /* The previous measurement, and the gradient towards it */
+    pa_usec_t mdx;        /* The time between the last two measurements */
+    unsigned n_kalman;
+
     /* To even out for monotonicity */
     pa_usec_t last_y, last_x;
 
@@ -112,6 +142,7 @@ pa_smoother* pa_smoother_new(
     s->min_history = min_history;
     s->monotonic = monotonic;
     s->smoothing = smoothing;
+    s->estimator = PA_SMOOTHER_KALMAN;
 
     pa_smoother_reset(s, time_offset, paused);
 
@@ -243,6 +274,121 @@ static double avg_gradient(pa_smoother *s, pa_usec_t x) {
     return (s->monotonic && r < 0) ? 0 : r;
 }
 
+static void kalman_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
+    double dt, q, v, e, r, p00, p01, k0, k1;
+
+    /* The covariances are kept in units of the measurement noise
+     * variance. Since we choose the noise of the model relative to it,
+     * too, the gains don't depend on how noisy the measurements are. */
+
+    if (s->n_kalman <= 0) {
+        s->kx = x;
+        s->ky = s->my = (double) y;
+        s->kd = 1;
+        s->n_kalman = 1;
+        return;
+    }
+
+    if (x >= s->kx)
+        dt = (double) (x - s->kx);
+    else {
+        /* A measurement for a point we already passed. Move it to where
+         * we are now instead of moving the filter back in time. */
+        dt = 0;
+        y += (pa_usec_t) llrint(s->kd * (double) (s->kx - x));
+    }
+
+    if (s->n_kalman == 1) {
+        if (dt <= 0) {
+            /* We still know nothing about the gradient */
+            s->ky = s->my = (double) y;
+            return;
+        }
+
+        /* Second measurement, start with the straight line through
+         * the first two */
+        s->kd = s->md = ((double) y - s->ky) / dt;
+        s->kx = x;
+        s->ky = s->my = (double) y;
+        s->p00 = 1;
+        s->p01 = 1 / dt;
+        s->p11 = 2 / (dt * dt);
+        s->interval = dt;
+        s->mdx = (pa_usec_t) dt;
+        s->n_kalman = 2;
+        return;
+    }
+
+    if (dt > 0) {
+        double fade;
+
+        /* Learn how noisy the measurements are from how far each one
+         * is off the straight line through the previous two. This does
+         * not depend on what the filter thinks, so its own errors
+         * can't feed back into it. */
+        r = dt / (double) s->mdx;
+        e = (double) y - (s->my + s->md * dt);
+        e = e * e / (1 + (1 + r) * (1 + r) + r * r);
+        s->noise += (e - s->noise) / PA_MIN(s->n_kalman - 1, 16U);
+
+        s->md = ((double) y - s->my) / dt;
+        s->my = (double) y;
+        s->mdx = x - s->kx;
+
+        s->kx = x;
+        s->interval += (dt - s->interval) / 16;
+
+        /* The gradient is modelled as a random walk, which is what
+         * makes the filter forget old measurements. This is the
+         * variance that gives it the bandwidth we want. */
+        q = KALMAN_BANDWIDTH / (double) s->history_time;
+        q = s->interval * q * q * q * q;
+
+        /* If our predictions have been a lot worse than they should
+         * have been, the clock probably changed its pace. Forget faster
+         * then until we caught up. */
+        fade = s->nis > KALMAN_FADE_THRESHOLD ? s->nis - 1 : 1;
+
+        /* Predict */
+        s->ky += s->kd * dt;
+        s->p00 = fade * (s->p00 + dt * (2 * s->p01 + dt * s->p11)) + q * dt * dt * dt / 3;
+        s->p01 = fade * (s->p01 + dt * s->p11) + q * dt * dt / 2;
+        s->p11 = fade * s->p11 + q * dt;
+    }
+
+    v = (double) y - s->ky;
+    p00 = s->p00;
+    p01 = s->p01;
+
+    if (dt > 0 && s->noise > 0)
+        s->nis += (v * v / ((p00 + 1) * s->noise) - s->nis) / 16;
+
+    /* Update */
+    k0 = p00 / (p00 + 1);
+    k1 = p01 / (p00 + 1);
+
+    s->ky += k0 * v;
+    s->kd += k1 * v;
+    s->p00 -= k0 * p00;
+    s->p01 -= k0 * p01;
+    s->p11 -= k1 * p01;
+
+    s->n_kalman++;
+}
+
+static double kalman_gradient(pa_smoother *s) {
+
+    /* Too few measurements, assume gradient of 1 */
+    if (s->n_kalman < s->min_history)
+        return 1;
+
+    return (s->monotonic && s->kd < 0) ? 0 : s->kd;
+}
+
+static pa_usec_t kalman_position(pa_smoother *s) {
+    return s->ky > 0 ? (pa_usec_t) llrint(s->ky) : 0;
+}
+
 static void calc_abc(pa_smoother *s) {
     pa_usec_t ex, ey, px, py;
     int64_t kx, ky;
@@ -367,11 +513,19 @@ void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
         s->ry = y;
     }
 
-    /* Then, we add the new measurement to our history */
-    add_to_history(s, x, y);
+    if (s->estimator == PA_SMOOTHER_KALMAN) {
+        /* Then, we feed the new measurement to the filter, and take
+         * its idea of where we are instead of the measurement itself */
+        kalman_put(s, x, y);
+        s->ry = kalman_position(s);
+        s->dp = kalman_gradient(s);
+    } else {
+        /* Then, we add the new measurement to our history */
+        add_to_history(s, x, y);
 
-    /* And determine the average gradient of the history */
-    s->dp = avg_gradient(s, x);
+        /* And determine the average gradient of the history */
+        s->dp = avg_gradient(s, x);
+    }
 
     /* And calculate when we want to be on track again */
     if (s->smoothing) {
@@ -513,6 +667,17 @@ void pa_smoother_reset(pa_smoother *s, pa_usec_t time_offset, bool paused) {
     s->history_idx = 0;
     s->n_history = 0;
 
+    s->kx = 0;
+    s->ky = 0;
+    s->kd = 1;
+    s->p00 = s->p01 = s->p11 = 0;
+    s->interval = 0;
+    s->noise = 0;
+    s->nis = 1;
+    s->my = s->md = 0;
+    s->mdx = 0;
+    s->n_kalman = 0;
+
     s->last_y = s->last_x = 0;
 
     s->abc_valid = false;
@@ -524,3 +689,11 @@ void pa_smoother_reset(pa_smoother *s, pa_usec_t time_offset, bool paused) {
     pa_log_debug("reset()");
 #endif
 }
+
+void pa_smoother_set_estimator(pa_smoother *s, pa_smoother_estimator_t estimator) {
+    pa_assert(s);
+    pa_assert(estimator == PA_SMOOTHER_KALMAN || estimator == PA_SMOOTHER_REGRESSION);
+
+    s->estimator = estimator;
+    pa_smoother_reset(s, s->time_offset, s->paused);
+}
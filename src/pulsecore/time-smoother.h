@@ -27,6 +27,12 @@
 
 typedef struct pa_smoother pa_smoother;
 
+/* How the gradient of the remote clock is estimated */
+typedef enum pa_smoother_estimator {
+    PA_SMOOTHER_KALMAN,          /* Kalman filter, the default */
+    PA_SMOOTHER_REGRESSION       /* Linear regression over the history window */
+} pa_smoother_estimator_t;
+
 pa_smoother* pa_smoother_new(
         pa_usec_t x_adjust_time,
         pa_usec_t x_history_time,
@@ -56,4 +62,7 @@ void pa_smoother_reset(pa_smoother *s, pa_usec_t time_offset, bool paused);
 
 void pa_smoother_fix_now(pa_smoother *s);
 
+/* Switches to a different estimator, this resets the smoother */
+void pa_smoother_set_estimator(pa_smoother *s, pa_smoother_estimator_t estimator);
+
 #endif
@@ -0,0 +1,470 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/macro.h>
+
+#include "time-wheel.h"
+
+/* Every level of the wheel has 64 slots, so that the occupancy of a
+ * level fits into a single 64bit word. Level n covers 64^(n+1)
+ * ticks. With four levels and a 1ms tick this covers ~4.6h, events
+ * further in the future are parked in the last slot of the highest
+ * level and cascade down once it comes around. */
+#define SLOT_BITS 6
+#define N_SLOTS (1U << SLOT_BITS)
+#define SLOT_MASK ((uint64_t) N_SLOTS - 1)
+#define N_LEVELS 4
+#define MAX_DELTA (((uint64_t) 1 << (SLOT_BITS * N_LEVELS)) - 1)
+
+#define LEVEL_IDLE (-1)
+#define LEVEL_EXPIRED (-2)
+#define LEVEL_DISPATCH (-3)
+
+#define NO_TICK ((uint64_t) -1)
+
+struct pa_time_event {
+    pa_time_wheel *wheel;
+
+    pa_usec_t time;
+    uint64_t tick;
+
+    /* Where this event is currently queued */
+    int level;
+    unsigned slot;
+
+    pa_time_event_cb_t callback;
+    void *userdata;
+    pa_time_event_destroy_cb_t destroy_callback;
+
+    PA_LLIST_FIELDS(pa_time_event);
+};
+
+struct level {
+    uint64_t occupied;
+    PA_LLIST_HEAD(pa_time_event, slots[N_SLOTS]);
+};
+
+struct pa_time_wheel {
+    pa_mainloop_api *parent;
+    pa_mainloop_api api;
+
+    pa_usec_t tick_usec;
+
+    /* All ticks up to and including this one have been processed */
+    uint64_t tick;
+
+    struct level levels[N_LEVELS];
+    PA_LLIST_HEAD(pa_time_event, expired);
+    PA_LLIST_HEAD(pa_time_event, dispatch);
+    PA_LLIST_HEAD(pa_time_event, idle);
+
+    unsigned n_events;
+
+    pa_time_event *event;
+    uint64_t armed_tick;
+};
+
+static unsigned find_first_set(uint64_t v) {
+    unsigned r = 0;
+
+    pa_assert(v);
+
+#if __GNUC__ >= 4 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
+    r = (unsigned) __builtin_ctzll(v);
+#else
+    while (!(v & 1)) {
+        v >>= 1;
+        r++;
+    }
+#endif
+
+    return r;
+}
+
+static void unlink_event(pa_time_event *e) {
+    pa_time_wheel *w = e->wheel;
+
+    if (e->level == LEVEL_IDLE)
+        return;
+
+    if (e->level == LEVEL_EXPIRED)
+        PA_LLIST_REMOVE(pa_time_event, w->expired, e);
+    else if (e->level == LEVEL_DISPATCH)
+        PA_LLIST_REMOVE(pa_time_event, w->dispatch, e);
+    else {
+        struct level *l = &w->levels[e->level];
+
+        PA_LLIST_REMOVE(pa_time_event, l->slots[e->slot], e);
+
+        if (!l->slots[e->slot])
+            l->occupied &= ~((uint64_t) 1 << e->slot);
+    }
+
+    pa_assert(w->n_events > 0);
+    w->n_events--;
+
+    e->level = LEVEL_IDLE;
+    PA_LLIST_PREPEND(pa_time_event, w->idle, e);
+}
+
+static void link_event(pa_time_event *e) {
+    pa_time_wheel *w = e->wheel;
+    uint64_t delta, t;
+    unsigned n;
+
+    pa_assert(e->level == LEVEL_IDLE);
+
+    PA_LLIST_REMOVE(pa_time_event, w->idle, e);
+    w->n_events++;
+
+    if (e->tick <= w->tick) {
+        e->level = LEVEL_EXPIRED;
+        PA_LLIST_PREPEND(pa_time_event, w->expired, e);
+        return;
+    }
+
+    delta = e->tick - w->tick;
+    t = e->tick;
+
+    if (delta > MAX_DELTA) {
+        delta = MAX_DELTA;
+        t = w->tick + MAX_DELTA;
+    }
+
+    for (n = 0; n < N_LEVELS - 1; n++)
+        if (delta < ((uint64_t) 1 << (SLOT_BITS * (n + 1))))
+            break;
+
+    e->level = (int) n;
+    e->slot = (unsigned) ((t >> (SLOT_BITS * n)) & SLOT_MASK);
+
+    PA_LLIST_PREPEND(pa_time_event, w->levels[n].slots[e->slot], e);
+    w->levels[n].occupied |= (uint64_t) 1 << e->slot;
+}
+
+/* Returns the first tick at which anything in the wheel needs
+ * attention, either because it expires or because it needs to be
+ * cascaded down to a finer level. */
+static uint64_t next_tick(pa_time_wheel *w) {
+    uint64_t best = NO_TICK;
+    unsigned n;
+
+    if (w->expired)
+        return w->tick;
+
+    for (n = 0; n < N_LEVELS; n++) {
+        uint64_t occupied = w->levels[n].occupied, base, t;
+        unsigned cur, s;
+
+        if (!occupied)
+            continue;
+
+        base = w->tick >> (SLOT_BITS * n);
+        cur = (unsigned) (base & SLOT_MASK);
+
+        /* Rotate so that the slot right after the current one becomes
+         * bit 0; the current slot itself is always due in the next
+         * round. */
+        s = (cur + 1) & (N_SLOTS - 1);
+        if (s)
+            occupied = (occupied >> s) | (occupied << (N_SLOTS - s));
+
+        t = (base + find_first_set(occupied) + 1) << (SLOT_BITS * n);
+
+        if (t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+static void arm(pa_time_wheel *w, uint64_t t) {
+    struct timeval tv;
+
+    if (t == w->armed_tick)
+        return;
+
+    w->armed_tick = t;
+
+    if (t == NO_TICK)
+        w->parent->time_restart(w->event, NULL);
+    else
+        w->parent->time_restart(w->event, pa_timeval_rtstore(&tv, t * w->tick_usec, true));
+}
+
+static void cascade(pa_time_wheel *w, unsigned n, unsigned slot) {
+    pa_time_event *e;
+    struct level *l = &w->levels[n];
+
+    while ((e = l->slots[slot])) {
+        unlink_event(e);
+        link_event(e);
+    }
+}
+
+static void advance(pa_time_wheel *w, uint64_t target) {
+
+    while (w->tick < target) {
+        unsigned n;
+        uint64_t next;
+
+        /* All levels finer than the first occupied one are empty, so we
+         * can jump straight to the next boundary of that level. */
+        for (n = 0; n < N_LEVELS; n++)
+            if (w->levels[n].occupied)
+                break;
+
+        if (n >= N_LEVELS) {
+            w->tick = target;
+            break;
+        }
+
+        next = ((w->tick >> (SLOT_BITS * n)) + 1) << (SLOT_BITS * n);
+        if (next > target) {
+            w->tick = target;
+            break;
+        }
+
+        w->tick = next;
+
+        for (n = 1; n < N_LEVELS; n++) {
+            if (next & (((uint64_t) 1 << (SLOT_BITS * n)) - 1))
+                break;
+
+            cascade(w, n, (unsigned) ((next >> (SLOT_BITS * n)) & SLOT_MASK));
+        }
+
+        cascade(w, 0, (unsigned) (next & SLOT_MASK));
+    }
+}
+
+static void dispatch_cb(pa_mainloop_api *a, pa_time_event *ev, const struct timeval *tv, void *userdata) {
+    pa_time_wheel *w = userdata;
+    pa_time_event *e;
+
+    pa_assert(w);
+
+    w->armed_tick = NO_TICK;
+    advance(w, pa_rtclock_now() / w->tick_usec);
+
+    /* Everything that is due has been moved to the expired list by
+     * now. Take that batch as a whole, so that events which are
+     * restarted into the past from a callback are only dispatched on
+     * the next iteration. Events may be freed or restarted from the
+     * callbacks, so we dequeue them one at a time. */
+    while ((e = w->expired)) {
+        PA_LLIST_REMOVE(pa_time_event, w->expired, e);
+        e->level = LEVEL_DISPATCH;
+        PA_LLIST_PREPEND(pa_time_event, w->dispatch, e);
+    }
+
+    while ((e = w->dispatch)) {
+        struct timeval etv;
+
+        unlink_event(e);
+        e->callback(&w->api, e, pa_timeval_rtstore(&etv, e->time, true), e->userdata);
+    }
+
+    arm(w, next_tick(w));
+}
+
+static uint64_t usec_to_tick(pa_time_wheel *w, pa_usec_t t) {
+    return (t + w->tick_usec - 1) / w->tick_usec;
+}
+
+static pa_usec_t make_rt(const struct timeval *tv) {
+    struct timeval ttv;
+
+    if (!tv)
+        return PA_USEC_INVALID;
+
+    ttv = *tv;
+
+    if (ttv.tv_usec & PA_TIMEVAL_RTCLOCK)
+        ttv.tv_usec &= ~PA_TIMEVAL_RTCLOCK;
+    else
+        pa_rtclock_from_wallclock(&ttv);
+
+    return pa_timeval_load(&ttv);
+}
+
+static void event_set(pa_time_event *e, pa_usec_t t) {
+    pa_time_wheel *w = e->wheel;
+
+    unlink_event(e);
+
+    if (t == PA_USEC_INVALID)
+        return;
+
+    /* If the wheel has been idle it might lag behind, bring it up to
+     * date so that the new event is filed at the right level. */
+    if (w->n_events <= 0)
+        w->tick = PA_MAX(w->tick, pa_rtclock_now() / w->tick_usec);
+
+    e->time = t;
+    e->tick = usec_to_tick(w, t);
+    link_event(e);
+
+    if (e->level == LEVEL_EXPIRED)
+        arm(w, w->tick);
+    else if (w->armed_tick == NO_TICK || e->tick < w->armed_tick)
+        arm(w, next_tick(w));
+}
+
+static pa_time_event* wheel_time_new(pa_mainloop_api *a, const struct timeval *tv, pa_time_event_cb_t callback, void *userdata) {
+    pa_time_wheel *w;
+    pa_time_event *e;
+
+    pa_assert(a);
+    pa_assert(a->userdata);
+    pa_assert(callback);
+
+    w = a->userdata;
+    pa_assert(a == &w->api);
+
+    e = pa_xnew0(pa_time_event, 1);
+    e->wheel = w;
+    e->level = LEVEL_IDLE;
+    PA_LLIST_PREPEND(pa_time_event, w->idle, e);
+    e->callback = callback;
+    e->userdata = userdata;
+
+    event_set(e, make_rt(tv));
+
+    return e;
+}
+
+static void wheel_time_restart(pa_time_event *e, const struct timeval *tv) {
+    pa_assert(e);
+
+    event_set(e, make_rt(tv));
+}
+
+static void wheel_time_free(pa_time_event *e) {
+    pa_assert(e);
+
+    unlink_event(e);
+    PA_LLIST_REMOVE(pa_time_event, e->wheel->idle, e);
+
+    if (e->destroy_callback)
+        e->destroy_callback(&e->wheel->api, e, e->userdata);
+
+    pa_xfree(e);
+}
+
+static void wheel_time_set_destroy(pa_time_event *e, pa_time_event_destroy_cb_t callback) {
+    pa_assert(e);
+
+    e->destroy_callback = callback;
+}
+
+/* Everything that is not a time event is simply forwarded */
+
+static pa_io_event* wheel_io_new(pa_mainloop_api *a, int fd, pa_io_event_flags_t events, pa_io_event_cb_t callback, void *userdata) {
+    pa_time_wheel *w = a->userdata;
+
+    return w->parent->io_new(w->parent, fd, events, callback, userdata);
+}
+
+static pa_defer_event* wheel_defer_new(pa_mainloop_api *a, pa_defer_event_cb_t callback, void *userdata) {
+    pa_time_wheel *w = a->userdata;
+
+    return w->parent->defer_new(w->parent, callback, userdata);
+}
+
+static void wheel_quit(pa_mainloop_api *a, int retval) {
+    pa_time_wheel *w = a->userdata;
+
+    w->parent->quit(w->parent, retval);
+}
+
+pa_time_wheel* pa_time_wheel_new(pa_mainloop_api *m, pa_usec_t tick) {
+    pa_time_wheel *w;
+
+    pa_assert(m);
+    pa_assert(tick > 0);
+
+    w = pa_xnew0(pa_time_wheel, 1);
+    w->parent = m;
+    w->tick_usec = tick;
+    w->tick = pa_rtclock_now() / tick;
+    w->armed_tick = NO_TICK;
+
+    w->api = *m;
+    w->api.userdata = w;
+    w->api.io_new = wheel_io_new;
+    w->api.defer_new = wheel_defer_new;
+    w->api.time_new = wheel_time_new;
+    w->api.time_restart = wheel_time_restart;
+    w->api.time_free = wheel_time_free;
+    w->api.time_set_destroy = wheel_time_set_destroy;
+    w->api.quit = wheel_quit;
+
+    w->event = m->time_new(m, NULL, dispatch_cb, w);
+
+    return w;
+}
+
+static void free_list(pa_time_event **head) {
+    pa_time_event *e;
+
+    while ((e = *head))
+        wheel_time_free(e);
+}
+
+void pa_time_wheel_free(pa_time_wheel *w) {
+    unsigned n, s;
+
+    pa_assert(w);
+
+    free_list(&w->expired);
+    free_list(&w->dispatch);
+
+    for (n = 0; n < N_LEVELS; n++)
+        for (s = 0; s < N_SLOTS; s++)
+            free_list(&w->levels[n].slots[s]);
+
+    pa_assert(w->n_events == 0);
+    free_list(&w->idle);
+
+    w->parent->time_free(w->event);
+    pa_xfree(w);
+}
+
+pa_mainloop_api* pa_time_wheel_get_api(pa_time_wheel *w) {
+    pa_assert(w);
+
+    return &w->api;
+}
+
+unsigned pa_time_wheel_size(pa_time_wheel *w) {
+    pa_assert(w);
+
+    return w->n_events;
+}
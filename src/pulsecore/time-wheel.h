@@ -0,0 +1,48 @@
+#ifndef foopulsecoretimewheelhfoo
+#define foopulsecoretimewheelhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/mainloop-api.h>
+#include <pulse/sample.h>
+
+/* A hierarchical timer wheel that multiplexes any number of time
+ * events onto a single time event of an underlying main loop. Inserting,
+ * restarting and freeing an event is O(1), and all events that expire
+ * within the same tick are dispatched in one batch from a single wakeup
+ * of the underlying main loop.
+ *
+ * The wheel is accessed through a regular pa_mainloop_api vtable, as
+ * returned by pa_time_wheel_get_api(). Only the time_*() functions of
+ * that vtable are handled by the wheel itself, everything else is
+ * passed through to the underlying main loop. Time events are never
+ * dispatched early, but may be dispatched up to one tick late. */
+
+typedef struct pa_time_wheel pa_time_wheel;
+
+pa_time_wheel* pa_time_wheel_new(pa_mainloop_api *m, pa_usec_t tick);
+void pa_time_wheel_free(pa_time_wheel *w);
+
+pa_mainloop_api* pa_time_wheel_get_api(pa_time_wheel *w);
+
+/* Returns the number of enabled time events in the wheel */
+unsigned pa_time_wheel_size(pa_time_wheel *w);
+
+#endif
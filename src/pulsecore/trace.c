@@ -0,0 +1,230 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/llist.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/strbuf.h>
+#include <pulsecore/thread.h>
+
+#include "trace.h"
+
+/* Number of spans each thread keeps, must be a power of two */
+#define RING_SIZE 8192U
+
+typedef struct trace_event {
+    const char *name;
+    pa_usec_t begin, end;
+} trace_event;
+
+typedef struct trace_ring trace_ring;
+
+struct trace_ring {
+    PA_LLIST_FIELDS(trace_ring);
+
+    char *thread_name;
+    unsigned tid;
+
+    /* Only ever written by the thread owning the ring. The events are
+     * published by incrementing n_written. */
+    pa_atomic_t n_written;
+
+    /* Set when the owning thread exited */
+    pa_atomic_t dead;
+
+    trace_event events[RING_SIZE];
+};
+
+pa_atomic_t pa_trace_enabled_flag = PA_ATOMIC_INIT(0);
+
+/* Protects the list of rings and the fields below */
+static pa_static_mutex mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(trace_ring, rings) = NULL;
+static unsigned n_threads = 0;
+static pa_usec_t enabled_since = 0;
+
+static void ring_release(void *p) {
+    trace_ring *r = p;
+
+    /* The ring is freed with the next dump, once nobody writes to it
+     * anymore */
+    pa_atomic_store(&r->dead, 1);
+}
+
+PA_STATIC_TLS_DECLARE(trace_ring, ring_release);
+
+static trace_ring *get_ring(void) {
+    trace_ring *r;
+    const char *name;
+    pa_mutex *m;
+
+    if ((r = PA_STATIC_TLS_GET(trace_ring)))
+        return r;
+
+    r = pa_xnew0(trace_ring, 1);
+
+    m = pa_static_mutex_get(&mutex, false, false);
+    pa_mutex_lock(m);
+
+    r->tid = ++n_threads;
+
+    if ((name = pa_thread_get_name(pa_thread_self())))
+        r->thread_name = pa_xstrdup(name);
+    else
+        r->thread_name = pa_sprintf_malloc("thread-%u", r->tid);
+
+    PA_LLIST_PREPEND(trace_ring, rings, r);
+
+    pa_mutex_unlock(m);
+
+    PA_STATIC_TLS_SET(trace_ring, r);
+
+    return r;
+}
+
+void pa_trace_record(const char *name, pa_usec_t begin, pa_usec_t end) {
+    trace_ring *r;
+    unsigned n;
+    trace_event *e;
+
+    pa_assert(name);
+
+    r = get_ring();
+
+    n = (unsigned) pa_atomic_load(&r->n_written);
+
+    e = &r->events[n & (RING_SIZE - 1)];
+    e->name = name;
+    e->begin = begin;
+    e->end = end;
+
+    pa_atomic_store(&r->n_written, (int) (n + 1));
+}
+
+void pa_trace_set_enabled(bool enabled) {
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&mutex, false, false);
+    pa_mutex_lock(m);
+
+    if (enabled && !pa_atomic_load(&pa_trace_enabled_flag))
+        enabled_since = pa_rtclock_now();
+
+    pa_atomic_store(&pa_trace_enabled_flag, enabled);
+
+    pa_mutex_unlock(m);
+}
+
+static void append_json_string(pa_strbuf *buf, const char *s) {
+    pa_strbuf_putc(buf, '"');
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            pa_strbuf_printf(buf, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            pa_strbuf_printf(buf, "\\u%04x", (unsigned) *s);
+        else
+            pa_strbuf_putc(buf, *s);
+    }
+
+    pa_strbuf_putc(buf, '"');
+}
+
+static void dump_ring(trace_ring *r, trace_event *copy, pa_strbuf *buf, unsigned pid, bool *first) {
+    unsigned n, n_after, start, i;
+
+    /* Copy the events out first and then throw away whatever the
+     * thread might have overwritten while we were doing so. The event
+     * currently being written counts as overwritten, too. */
+    n = (unsigned) pa_atomic_load(&r->n_written);
+    start = n > RING_SIZE ? n - RING_SIZE : 0;
+
+    for (i = start; i != n; i++)
+        copy[i & (RING_SIZE - 1)] = r->events[i & (RING_SIZE - 1)];
+
+    n_after = (unsigned) pa_atomic_load(&r->n_written);
+    if (n_after - start >= RING_SIZE)
+        start = n_after - RING_SIZE + 1;
+
+    pa_strbuf_printf(buf, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":",
+                     *first ? "" : ",", pid, r->tid);
+    append_json_string(buf, r->thread_name);
+    pa_strbuf_puts(buf, "}}");
+    *first = false;
+
+    for (i = start; (int) (n - i) > 0; i++) {
+        const trace_event *e = &copy[i & (RING_SIZE - 1)];
+
+        if (e->begin < enabled_since)
+            continue;
+
+        pa_strbuf_puts(buf, ",\n{\"name\":");
+        append_json_string(buf, e->name);
+        pa_strbuf_printf(buf, ",\"cat\":\"pulseaudio\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%u,\"tid\":%u}",
+                         (unsigned long long) e->begin,
+                         (unsigned long long) (e->end - e->begin),
+                         pid, r->tid);
+    }
+}
+
+char *pa_trace_dump(void) {
+    pa_strbuf *buf;
+    trace_ring *r, *n;
+    trace_event *copy;
+    pa_mutex *m;
+    unsigned pid;
+    bool first = true;
+
+    buf = pa_strbuf_new();
+    copy = pa_xnew(trace_event, RING_SIZE);
+    pid = (unsigned) getpid();
+
+    pa_strbuf_puts(buf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    m = pa_static_mutex_get(&mutex, false, false);
+    pa_mutex_lock(m);
+
+    PA_LLIST_FOREACH_SAFE(r, n, rings) {
+        bool dead = pa_atomic_load(&r->dead);
+
+        dump_ring(r, copy, buf, pid, &first);
+
+        if (dead) {
+            PA_LLIST_REMOVE(trace_ring, rings, r);
+            pa_xfree(r->thread_name);
+            pa_xfree(r);
+        }
+    }
+
+    pa_mutex_unlock(m);
+
+    pa_strbuf_puts(buf, "\n]}\n");
+
+    pa_xfree(copy);
+
+    return pa_strbuf_tostring_free(buf);
+}
@@ -0,0 +1,85 @@
+#ifndef foopulsecoretracehfoo
+#define foopulsecoretracehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <stdbool.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* Lightweight tracing of how long the real-time threads spend in
+ * certain operations. Each thread records its spans into a ring buffer
+ * of its own, without taking any locks, so that tracing can be enabled
+ * at runtime on a live system. The rings can then be dumped in the
+ * JSON format of the Chrome trace viewer (also understood by
+ * Perfetto and other tools).
+ *
+ * Usage:
+ *
+ *     pa_usec_t t = pa_trace_begin();
+ *     ...
+ *     pa_trace_end("sink-render", t);
+ *
+ * The span name has to be a static string, only the pointer is
+ * stored. If tracing is disabled, all this costs is one atomic load. */
+
+extern pa_atomic_t pa_trace_enabled_flag;
+
+static inline bool pa_trace_enabled(void) {
+    return PA_UNLIKELY(pa_atomic_load(&pa_trace_enabled_flag));
+}
+
+/* Returns 0 if tracing is disabled, which makes pa_trace_end() a
+ * no-op for this span */
+static inline pa_usec_t pa_trace_begin(void) {
+    if (PA_LIKELY(!pa_trace_enabled()))
+        return 0;
+
+    return pa_rtclock_now();
+}
+
+void pa_trace_record(const char *name, pa_usec_t begin, pa_usec_t end);
+
+static inline void pa_trace_end(const char *name, pa_usec_t begin) {
+    if (PA_LIKELY(begin == 0))
+        return;
+
+    pa_trace_record(name, begin, pa_rtclock_now());
+}
+
+/* For callers that take the time of the span anyway */
+static inline void pa_trace_span(const char *name, pa_usec_t begin, pa_usec_t end) {
+    if (pa_trace_enabled())
+        pa_trace_record(name, begin, end);
+}
+
+/* Enabling tracing discards everything recorded before */
+void pa_trace_set_enabled(bool enabled);
+
+/* Returns the spans recorded since tracing was last enabled as a Chrome
+ * trace JSON document. Free with pa_xfree(). Only the most recent spans
+ * of each thread are kept, older ones are overwritten. */
+char *pa_trace_dump(void);
+
+#endif
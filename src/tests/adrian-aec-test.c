@@ -0,0 +1,253 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/cpu-arm.h>
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/echo-cancel/adrian.h>
+
+/* Feeds the canceller a synthetic echo of noise through a random room
+ * response, and measures the echo return loss enhancement (ERLE) after the
+ * filter has converged, and the CPU time it took. */
+
+#define SECONDS 6
+#define CONVERGE_SECONDS 3
+
+/* The echo path: a bulk delay and an exponentially decaying tail, which has
+ * to fit in the 100 ms of the filter. Its gain is fixed, independent of
+ * the rate, so the capture stays well away from clipping. */
+#define PATH_DELAY_MS 5
+#define PATH_LENGTH_MS 60
+#define PATH_GAIN 0.5f
+
+#define MIN_ERLE 20.0
+
+static const char * const vector_names[] = { "generic", "SSE", "AVX", "NEON" };
+
+struct signals {
+    int rate;
+    unsigned n;
+    int16_t *play, *rec;
+};
+
+static float noise(void) {
+    float x = 0;
+    int k;
+
+    /* Roughly gaussian with zero mean, a sum of uniforms; the standard
+     * deviation is 1 / sqrt(3) */
+    for (k = 0; k < 4; k++)
+        x += (float) rand() / RAND_MAX - 0.5f;
+
+    return x;
+}
+
+static void make_signals(struct signals *s, int rate) {
+    unsigned i, j, delay, length, clipped = 0;
+    float *h, energy = 0;
+
+    srand(rate);
+
+    s->rate = rate;
+    s->n = SECONDS * rate;
+    s->play = pa_xnew(int16_t, s->n);
+    s->rec = pa_xnew(int16_t, s->n);
+
+    delay = PATH_DELAY_MS * rate / 1000;
+    length = PATH_LENGTH_MS * rate / 1000;
+
+    h = pa_xnew0(float, length);
+    for (j = delay; j < length; j++) {
+        h[j] = noise() * expf(-6.0f * (j - delay) / (length - delay));
+        energy += h[j] * h[j];
+    }
+
+    for (j = delay; j < length; j++)
+        h[j] *= PATH_GAIN / sqrtf(energy);
+
+    for (i = 0; i < s->n; i++)
+        s->play[i] = (int16_t) (3000.0f * noise());
+
+    for (i = 0; i < s->n; i++) {
+        float echo = 0;
+
+        for (j = 0; j < length && j <= i; j++)
+            echo += h[j] * s->play[i - j];
+
+        /* plus some microphone noise, about 50 dB below the echo */
+        echo += 3.0f * noise();
+
+        if (echo < -0x8000 || echo > 0x7FFF)
+            clipped++;
+
+        s->rec[i] = (int16_t) PA_CLAMP_UNLIKELY(lrintf(echo), -0x8000, 0x7FFF);
+    }
+
+    pa_xfree(h);
+
+    /* A clipped echo is not linear in the playback, and can't be cancelled */
+    fail_unless(clipped == 0);
+}
+
+static void free_signals(struct signals *s) {
+    pa_xfree(s->play);
+    pa_xfree(s->rec);
+}
+
+static bool cpu_has_vector(AEC_vector vector) {
+    if (vector == AEC_VECTOR_NONE)
+        return true;
+
+    if (!AEC_have_vector(vector))
+        return false;
+
+#if defined (__i386__) || defined (__amd64__)
+    {
+        pa_cpu_x86_flag_t flags = 0;
+
+        pa_cpu_get_x86_flags(&flags);
+
+        if (vector == AEC_VECTOR_SSE)
+            return !!(flags & PA_CPU_X86_SSE);
+        if (vector == AEC_VECTOR_AVX)
+            return !!(flags & PA_CPU_X86_AVX);
+    }
+#elif defined (__arm__)
+    {
+        pa_cpu_arm_flag_t flags = 0;
+
+        pa_cpu_get_arm_flags(&flags);
+
+        if (vector == AEC_VECTOR_NEON)
+            return !!(flags & PA_CPU_ARM_NEON);
+    }
+#elif defined (__aarch64__)
+    if (vector == AEC_VECTOR_NEON)
+        return true;
+#endif
+
+    return false;
+}
+
+/* Returns the ERLE in dB */
+static double run_aec(const struct signals *s, AEC_vector vector) {
+    AEC *a;
+    double rec_energy = 0, out_energy = 0;
+    pa_usec_t start, stop;
+    unsigned i;
+
+    pa_assert_se(a = AEC_init(s->rate, vector));
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < s->n; i++) {
+        int out = AEC_doAEC(a, s->rec[i], s->play[i]);
+
+        if (i >= (unsigned) (CONVERGE_SECONDS * s->rate)) {
+            rec_energy += (double) s->rec[i] * s->rec[i];
+            out_energy += (double) out * out;
+        }
+    }
+
+    stop = pa_rtclock_now();
+
+    AEC_done(a);
+
+    pa_log_debug("%d Hz, %s: ERLE %0.1f dB, %0.1f%% CPU (%llu usec for %u s)", s->rate, vector_names[vector],
+                 10.0 * log10(rec_energy / (out_energy + 1.0)),
+                 100.0 * (stop - start) / (SECONDS * PA_USEC_PER_SEC),
+                 (unsigned long long) (stop - start), SECONDS);
+
+    return 10.0 * log10(rec_energy / (out_energy + 1.0));
+}
+
+static void run_rate_test(int rate) {
+    struct signals s;
+    double generic, erle;
+    int v;
+
+    make_signals(&s, rate);
+
+    generic = run_aec(&s, AEC_VECTOR_NONE);
+    fail_unless(generic > MIN_ERLE);
+
+    /* The vector versions sum in a different order, so the filters don't
+     * converge to exactly the same taps, but they should be as good */
+    for (v = AEC_VECTOR_SSE; v <= AEC_VECTOR_NEON; v++) {
+        if (!cpu_has_vector(v)) {
+            pa_log_info("%s not supported, skipping", vector_names[v]);
+            continue;
+        }
+
+        erle = run_aec(&s, v);
+        fail_unless(fabs(erle - generic) < 1.0);
+    }
+
+    free_signals(&s);
+}
+
+START_TEST (aec_16khz_test) {
+    run_rate_test(16000);
+}
+END_TEST
+
+START_TEST (aec_32khz_test) {
+    run_rate_test(32000);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Adrian AEC");
+
+    tc = tcase_create("aec");
+    tcase_add_test(tc, aec_16khz_test);
+    tcase_add_test(tc, aec_32khz_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
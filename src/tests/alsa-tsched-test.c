@@ -0,0 +1,232 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+#include <modules/alsa/alsa-tsched.h>
+
+/* The histograms have a resolution of 12.5% */
+#define IN_BUCKET(v, x) ((v) >= (x) && (v) < (x) + (x) / 8)
+
+START_TEST (percentile_test) {
+    pa_alsa_tsched_stats *s;
+    pa_alsa_tsched_info i;
+    unsigned j;
+
+    s = pa_alsa_tsched_stats_new();
+
+    /* 98% fast renders and 2% slow ones, not enough to decay yet */
+    for (j = 0; j < 980; j++)
+        pa_alsa_tsched_stats_add_render(s, 1000);
+    for (j = 0; j < 20; j++)
+        pa_alsa_tsched_stats_add_render(s, 8000);
+
+    /* Wakeups that didn't come from the timer say nothing about it */
+    for (j = 0; j < 100; j++)
+        pa_alsa_tsched_stats_add_wakeup(s, true, 200);
+    pa_alsa_tsched_stats_add_wakeup(s, false, 50000);
+
+    pa_alsa_tsched_stats_get_info(s, PA_USEC_PER_SEC, &i);
+
+    pa_log_debug("render p50 %llu, p99 %llu, max %llu; jitter p50 %llu, p99 %llu, max %llu",
+                 (unsigned long long) i.render_p50, (unsigned long long) i.render_p99, (unsigned long long) i.render_max,
+                 (unsigned long long) i.jitter_p50, (unsigned long long) i.jitter_p99, (unsigned long long) i.jitter_max);
+
+    fail_unless(IN_BUCKET(i.render_p50, 1000));
+    fail_unless(i.render_p99 == 8000);
+    fail_unless(i.render_max == 8000);
+
+    fail_unless(i.jitter_p99 == 200);
+    fail_unless(i.jitter_max == 200);
+
+    fail_unless(i.process_time == i.render_p99 + i.jitter_p99);
+    fail_unless(i.n_wakeups == 101);
+
+    pa_alsa_tsched_stats_free(s);
+}
+END_TEST
+
+START_TEST (min_samples_test) {
+    pa_alsa_tsched_stats *s;
+    pa_usec_t usec;
+    unsigned j;
+
+    s = pa_alsa_tsched_stats_new();
+
+    fail_if(pa_alsa_tsched_stats_get_process_time(s, &usec));
+
+    for (j = 0; j < 63; j++) {
+        pa_alsa_tsched_stats_add_render(s, 500);
+        pa_alsa_tsched_stats_add_wakeup(s, true, 100);
+    }
+
+    fail_if(pa_alsa_tsched_stats_get_process_time(s, &usec));
+
+    /* Both histograms need enough samples */
+    pa_alsa_tsched_stats_add_render(s, 500);
+    fail_if(pa_alsa_tsched_stats_get_process_time(s, &usec));
+
+    pa_alsa_tsched_stats_add_wakeup(s, true, 100);
+    fail_unless(pa_alsa_tsched_stats_get_process_time(s, &usec));
+    fail_unless(usec == 600);
+
+    pa_alsa_tsched_stats_free(s);
+}
+END_TEST
+
+START_TEST (decay_test) {
+    pa_alsa_tsched_stats *s;
+    pa_alsa_tsched_info i;
+    unsigned j;
+
+    s = pa_alsa_tsched_stats_new();
+
+    /* A slow phase, followed by a long fast one: the slow samples have
+     * to be forgotten eventually */
+    for (j = 0; j < 1000; j++)
+        pa_alsa_tsched_stats_add_render(s, 10000);
+
+    pa_alsa_tsched_stats_get_info(s, PA_USEC_PER_SEC, &i);
+    fail_unless(i.render_p99 == 10000);
+
+    for (j = 0; j < 500; j++)
+        pa_alsa_tsched_stats_add_render(s, 100);
+
+    /* Halved once, but still half of the samples, and the maximum
+     * decays with them */
+    pa_alsa_tsched_stats_get_info(s, PA_USEC_PER_SEC, &i);
+    fail_unless(i.render_p99 == 5000);
+    fail_unless(i.render_max == 5000);
+
+    for (j = 0; j < 5000; j++)
+        pa_alsa_tsched_stats_add_render(s, 100);
+
+    pa_alsa_tsched_stats_get_info(s, PA_USEC_PER_SEC, &i);
+    pa_log_debug("after decay: render p99 %llu, max %llu", (unsigned long long) i.render_p99, (unsigned long long) i.render_max);
+    fail_unless(IN_BUCKET(i.render_p99, 100));
+    fail_unless(i.render_max < 10000);
+
+    pa_alsa_tsched_stats_free(s);
+}
+END_TEST
+
+START_TEST (reset_test) {
+    pa_alsa_tsched_stats *s;
+    pa_alsa_tsched_info i;
+    pa_usec_t usec;
+    unsigned j;
+
+    s = pa_alsa_tsched_stats_new();
+
+    for (j = 0; j < 100; j++) {
+        pa_alsa_tsched_stats_add_render(s, 500);
+        pa_alsa_tsched_stats_add_wakeup(s, true, 100);
+    }
+    pa_alsa_tsched_stats_add_underrun(s);
+
+    fail_unless(pa_alsa_tsched_stats_get_process_time(s, &usec));
+
+    /* The histograms are gone, the counters stay */
+    pa_alsa_tsched_stats_reset(s);
+    fail_if(pa_alsa_tsched_stats_get_process_time(s, &usec));
+
+    pa_alsa_tsched_stats_get_info(s, PA_USEC_PER_SEC, &i);
+    fail_unless(i.render_p99 == 0);
+    fail_unless(i.render_max == 0);
+    fail_unless(i.jitter_max == 0);
+    fail_unless(i.process_time == 0);
+    fail_unless(i.n_wakeups == 100);
+    fail_unless(i.n_underruns == 1);
+
+    pa_alsa_tsched_stats_free(s);
+}
+END_TEST
+
+START_TEST (info_test) {
+    pa_alsa_tsched_stats *s;
+    pa_alsa_tsched_info i;
+    pa_strbuf *buf;
+    char *t;
+    unsigned j;
+
+    s = pa_alsa_tsched_stats_new();
+
+    /* The wakeup rate is measured between two calls */
+    pa_alsa_tsched_stats_get_info(s, PA_USEC_PER_SEC, &i);
+
+    for (j = 0; j < 50; j++)
+        pa_alsa_tsched_stats_add_wakeup(s, true, 100);
+
+    pa_alsa_tsched_stats_get_info(s, 3 * PA_USEC_PER_SEC / 2, &i);
+    fail_unless(i.wakeups_per_sec > 99.9 && i.wakeups_per_sec < 100.1);
+
+    i.watermark = 20 * PA_USEC_PER_MSEC;
+
+    buf = pa_strbuf_new();
+    pa_alsa_tsched_info_to_string(&i, buf);
+    t = pa_strbuf_tostring_free(buf);
+
+    pa_log_debug("\n%s", t);
+    fail_unless(strstr(t, "\ttsched watermark: 20.00 ms\n") != NULL);
+    fail_unless(strstr(t, "\ttsched wakeups: 50 (100.0 per second)\n") != NULL);
+
+    pa_xfree(t);
+    pa_alsa_tsched_stats_free(s);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("ALSA tsched");
+    tc = tcase_create("alsa-tsched");
+    tcase_add_test(tc, percentile_test);
+    tcase_add_test(tc, min_samples_test);
+    tcase_add_test(tc, decay_test);
+    tcase_add_test(tc, reset_test);
+    tcase_add_test(tc, info_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
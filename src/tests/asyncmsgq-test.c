@@ -27,11 +27,19 @@
 
 #include <check.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
+#define N_PRODUCERS 4
+#define N_MESSAGES 100000
+#define N_SENDS 10000
+#define BATCH_SIZE 64
+
 enum {
     OPERATION_A,
     OPERATION_B,
@@ -107,15 +115,167 @@ START_TEST (asyncmsgq_test) {
 }
 END_TEST
 
+enum {
+    BENCH_MESSAGE,
+    BENCH_QUIT
+};
+
+struct producer {
+    pa_asyncmsgq *q;
+    unsigned index;
+    bool batched;
+};
+
+static int64_t last_seen[N_PRODUCERS];
+static unsigned n_received;
+static bool out_of_order;
+
+static void consumer_thread(void *_q) {
+    pa_asyncmsgq *q = _q;
+    int code;
+
+    do {
+        void *data;
+        int64_t offset;
+
+        pa_assert_se(pa_asyncmsgq_get(q, NULL, &code, &data, &offset, NULL, true) == 0);
+
+        if (code == BENCH_MESSAGE) {
+            unsigned p = PA_PTR_TO_UINT(data);
+
+            /* Messages of a single producer need to arrive in order */
+            if (offset != last_seen[p] + 1)
+                out_of_order = true;
+
+            last_seen[p] = offset;
+            n_received++;
+        }
+
+        pa_asyncmsgq_done(q, 0);
+
+    } while (code != BENCH_QUIT);
+}
+
+static void producer_thread(void *userdata) {
+    struct producer *p = userdata;
+    int64_t i;
+
+    for (i = 0; i < N_MESSAGES; i++) {
+
+        if (!p->batched) {
+            pa_asyncmsgq_post(p->q, NULL, BENCH_MESSAGE, PA_UINT_TO_PTR(p->index), i, NULL, NULL);
+            continue;
+        }
+
+        pa_asyncmsgq_post_deferred(p->q, NULL, BENCH_MESSAGE, PA_UINT_TO_PTR(p->index), i, NULL, NULL);
+
+        if ((i + 1) % BATCH_SIZE == 0)
+            pa_asyncmsgq_wakeup(p->q);
+    }
+
+    pa_asyncmsgq_wakeup(p->q);
+}
+
+static void run_post_benchmark(bool batched) {
+    pa_asyncmsgq *q;
+    pa_thread *consumer, *producers[N_PRODUCERS];
+    struct producer p[N_PRODUCERS];
+    pa_usec_t start, stop;
+    unsigned i;
+
+    q = pa_asyncmsgq_new(0);
+
+    n_received = 0;
+    out_of_order = false;
+    for (i = 0; i < N_PRODUCERS; i++)
+        last_seen[i] = -1;
+
+    consumer = pa_thread_new("consumer", consumer_thread, q);
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < N_PRODUCERS; i++) {
+        p[i].q = q;
+        p[i].index = i;
+        p[i].batched = batched;
+        producers[i] = pa_thread_new("producer", producer_thread, &p[i]);
+    }
+
+    for (i = 0; i < N_PRODUCERS; i++)
+        pa_thread_free(producers[i]);
+
+    pa_asyncmsgq_post(q, NULL, BENCH_QUIT, NULL, 0, NULL, NULL);
+    pa_thread_free(consumer);
+
+    stop = pa_rtclock_now();
+
+    pa_log_info("%s: %u messages from %u producers in %llu usec (%.0f msgs/s)",
+                batched ? "post (batched wakeups)" : "post",
+                n_received, N_PRODUCERS, (unsigned long long) (stop - start),
+                (double) n_received * PA_USEC_PER_SEC / (double) PA_MAX(stop - start, 1U));
+
+    fail_unless(n_received == N_PRODUCERS * N_MESSAGES);
+    fail_unless(!out_of_order);
+
+    pa_asyncmsgq_unref(q);
+}
+
+START_TEST (asyncmsgq_post_benchmark) {
+    run_post_benchmark(false);
+    run_post_benchmark(true);
+}
+END_TEST
+
+START_TEST (asyncmsgq_send_benchmark) {
+    pa_asyncmsgq *q;
+    pa_thread *consumer;
+    pa_usec_t start, stop;
+    unsigned i;
+
+    q = pa_asyncmsgq_new(0);
+
+    n_received = 0;
+    out_of_order = false;
+    last_seen[0] = -1;
+
+    consumer = pa_thread_new("consumer", consumer_thread, q);
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < N_SENDS; i++)
+        fail_unless(pa_asyncmsgq_send(q, NULL, BENCH_MESSAGE, PA_UINT_TO_PTR(0), i, NULL) == 0);
+
+    stop = pa_rtclock_now();
+
+    pa_asyncmsgq_post(q, NULL, BENCH_QUIT, NULL, 0, NULL, NULL);
+    pa_thread_free(consumer);
+
+    pa_log_info("send: %u round trips in %llu usec (%.1f usec each)",
+                N_SENDS, (unsigned long long) (stop - start), (double) (stop - start) / N_SENDS);
+
+    fail_unless(n_received == N_SENDS);
+    fail_unless(!out_of_order);
+
+    pa_asyncmsgq_unref(q);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
     TCase *tc;
     SRunner *sr;
 
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
     s = suite_create("Async Message Queue");
     tc = tcase_create("asyncmsgq");
     tcase_add_test(tc, asyncmsgq_test);
+    tcase_add_test(tc, asyncmsgq_post_benchmark);
+    tcase_add_test(tc, asyncmsgq_send_benchmark);
+    /* the benchmarks can take a while on slow machines */
+    tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
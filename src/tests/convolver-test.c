@@ -0,0 +1,369 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/convolver.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "runtime-test-util.h"
+
+/* A 5.1 stream mixed down to two ears, like module-virtual-surround-sink
+ * does */
+#define N_INPUTS 6
+#define N_OUTPUTS 2
+#define BLOCK_SIZE 128
+
+/* Frames per call, deliberately not a multiple of the block size */
+#define CHUNK 100
+#define N_FRAMES 4000
+
+#define TIMES 1
+#define TIMES2 10
+
+static float *random_samples(unsigned n) {
+    float *f;
+    unsigned i;
+
+    f = pa_xnew(float, n);
+    for (i = 0; i < n; i++)
+        f[i] = (float) (rand() / (RAND_MAX + 1.0) - 0.5);
+
+    return f;
+}
+
+/* What the old time domain loop of module-virtual-surround-sink did, with
+ * the filters interleaved as [tap][input][output] */
+static void direct_convolve(const float *src, const float *filters, unsigned length, float *dst, unsigned frame) {
+    unsigned o, i, j;
+
+    for (o = 0; o < N_OUTPUTS; o++) {
+        float sum = 0.0f;
+
+        for (j = 0; j < length && j <= frame; j++)
+            for (i = 0; i < N_INPUTS; i++)
+                sum += src[(frame - j) * N_INPUTS + i] * filters[(j * N_INPUTS + i) * N_OUTPUTS + o];
+
+        dst[o] = sum;
+    }
+}
+
+static void check_convolver(unsigned length) {
+    pa_convolver *c;
+    float *src, *dst, *filters, *ref;
+    unsigned i, o, f;
+    double max_error = 0.0;
+
+    c = pa_convolver_new(BLOCK_SIZE, N_INPUTS, N_OUTPUTS, length);
+    fail_unless(pa_convolver_get_latency(c) == BLOCK_SIZE);
+
+    src = random_samples(N_FRAMES * N_INPUTS);
+    filters = random_samples(length * N_INPUTS * N_OUTPUTS);
+    dst = pa_xnew(float, N_FRAMES * N_OUTPUTS);
+    ref = pa_xnew(float, N_OUTPUTS);
+
+    /* Leave one filter silent, which is skipped */
+    for (i = 0; i < N_INPUTS; i++)
+        for (o = 0; o < N_OUTPUTS; o++)
+            if (i != 3 || o != 1)
+                pa_convolver_set_filter(c, i, o, filters + i * N_OUTPUTS + o, N_INPUTS * N_OUTPUTS, length);
+            else
+                for (f = 0; f < length; f++)
+                    filters[(f * N_INPUTS + i) * N_OUTPUTS + o] = 0.0f;
+
+    for (f = 0; f < N_FRAMES; f += CHUNK)
+        pa_convolver_process(c, src + f * N_INPUTS, dst + f * N_OUTPUTS, PA_MIN(CHUNK, N_FRAMES - f));
+
+    for (f = 0; f < N_FRAMES; f++) {
+        if (f < BLOCK_SIZE) {
+            for (o = 0; o < N_OUTPUTS; o++)
+                fail_unless(dst[f * N_OUTPUTS + o] == 0.0f);
+
+            continue;
+        }
+
+        direct_convolve(src, filters, length, ref, f - BLOCK_SIZE);
+
+        for (o = 0; o < N_OUTPUTS; o++)
+            max_error = PA_MAX(max_error, fabs(dst[f * N_OUTPUTS + o] - ref[o]));
+    }
+
+    pa_log_debug("%u taps: maximum error %g", length, max_error);
+    fail_unless(max_error < 1e-3 * sqrt(length));
+
+    /* After a reset, we start from silence again */
+    pa_convolver_reset(c);
+    pa_convolver_process(c, src, dst, N_FRAMES);
+
+    for (f = BLOCK_SIZE; f < N_FRAMES; f += 97) {
+        direct_convolve(src, filters, length, ref, f - BLOCK_SIZE);
+
+        for (o = 0; o < N_OUTPUTS; o++)
+            fail_unless(fabs(dst[f * N_OUTPUTS + o] - ref[o]) < 1e-3 * sqrt(length));
+    }
+
+    pa_convolver_free(c);
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(filters);
+    pa_xfree(ref);
+}
+
+START_TEST (convolver_test) {
+    srand(0);
+
+    check_convolver(1);
+    check_convolver(64);
+    check_convolver(BLOCK_SIZE + 1);
+    check_convolver(1000);
+}
+END_TEST
+
+/* Rewinding and processing something else must give the same as if the
+ * something else had been processed right away */
+static void check_rewind(unsigned length, unsigned rewind) {
+    pa_convolver *c, *ref;
+    float *src, *other, *filters, *dst, *dst_ref;
+    unsigned i, o, f, head = N_FRAMES - rewind;
+    double max_error = 0.0;
+
+    pa_log_debug("Checking a rewind of %u frames with %u taps", rewind, length);
+
+    c = pa_convolver_new(BLOCK_SIZE, N_INPUTS, N_OUTPUTS, length);
+    ref = pa_convolver_new(BLOCK_SIZE, N_INPUTS, N_OUTPUTS, length);
+    pa_convolver_set_max_rewind(c, N_FRAMES / 2);
+
+    src = random_samples(N_FRAMES * N_INPUTS);
+    other = random_samples(rewind * N_INPUTS);
+    filters = random_samples(length * N_INPUTS * N_OUTPUTS);
+    dst = pa_xnew(float, N_FRAMES * N_OUTPUTS);
+    dst_ref = pa_xnew(float, N_FRAMES * N_OUTPUTS);
+
+    for (i = 0; i < N_INPUTS; i++)
+        for (o = 0; o < N_OUTPUTS; o++) {
+            pa_convolver_set_filter(c, i, o, filters + i * N_OUTPUTS + o, N_INPUTS * N_OUTPUTS, length);
+            pa_convolver_set_filter(ref, i, o, filters + i * N_OUTPUTS + o, N_INPUTS * N_OUTPUTS, length);
+        }
+
+    for (f = 0; f < N_FRAMES; f += CHUNK)
+        pa_convolver_process(c, src + f * N_INPUTS, dst, PA_MIN(CHUNK, N_FRAMES - f));
+
+    pa_convolver_rewind(c, rewind);
+    pa_convolver_process(c, other, dst, rewind);
+
+    pa_convolver_process(ref, src, dst_ref, head);
+    pa_convolver_process(ref, other, dst_ref, rewind);
+
+    for (f = 0; f < rewind * N_OUTPUTS; f++)
+        max_error = PA_MAX(max_error, fabs(dst[f] - dst_ref[f]));
+
+    pa_log_debug("Largest difference %g", max_error);
+    fail_unless(max_error < 1e-4);
+
+    /* A second rewind right after the first one goes further back
+     * still, into blocks that were completed before the first */
+    pa_convolver_rewind(c, rewind);
+    pa_convolver_rewind(c, PA_MIN(rewind, N_FRAMES / 2 - rewind) / 2);
+    pa_convolver_process(c, other, dst, rewind);
+
+    pa_convolver_reset(ref);
+    pa_convolver_process(ref, src, dst_ref, head - PA_MIN(rewind, N_FRAMES / 2 - rewind) / 2);
+    pa_convolver_process(ref, other, dst_ref, rewind);
+
+    for (f = 0; f < rewind * N_OUTPUTS; f++)
+        max_error = PA_MAX(max_error, fabs(dst[f] - dst_ref[f]));
+
+    pa_log_debug("Largest difference after two rewinds %g", max_error);
+    fail_unless(max_error < 1e-4);
+
+    /* Further back than the history goes, it starts from silence */
+    pa_convolver_rewind(c, N_FRAMES);
+    pa_convolver_reset(ref);
+    pa_convolver_process(c, src, dst, N_FRAMES);
+    pa_convolver_process(ref, src, dst_ref, N_FRAMES);
+    fail_unless(memcmp(dst, dst_ref, N_FRAMES * N_OUTPUTS * sizeof(float)) == 0);
+
+    pa_convolver_free(c);
+    pa_convolver_free(ref);
+    pa_xfree(src);
+    pa_xfree(other);
+    pa_xfree(filters);
+    pa_xfree(dst);
+    pa_xfree(dst_ref);
+}
+
+START_TEST (convolver_rewind_test) {
+    srand(0);
+
+    check_rewind(64, 1);
+    check_rewind(64, BLOCK_SIZE);
+    check_rewind(1000, 777);
+    check_rewind(1000, N_FRAMES / 2);
+}
+END_TEST
+
+static void run_benchmark(unsigned length) {
+    pa_convolver *c;
+    float *src, *dst, *filters, *history;
+    unsigned i, o;
+    char label[64];
+
+    src = random_samples(N_FRAMES * N_INPUTS);
+    filters = random_samples(length * N_INPUTS * N_OUTPUTS);
+    dst = pa_xnew(float, N_FRAMES * N_OUTPUTS);
+    history = pa_xnew0(float, length * N_INPUTS);
+
+    pa_log_debug("Checking %u taps, %u frames", length, N_FRAMES);
+
+    /* The time domain loop, with a ring buffer of the input like the
+     * module had */
+    pa_snprintf(label, sizeof(label), "direct (%u taps)", length);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES, TIMES2) {
+        unsigned f, j, offset = 0;
+
+        for (f = 0; f < N_FRAMES; f++) {
+            float left = 0.0f, right = 0.0f;
+
+            for (i = 0; i < N_INPUTS; i++)
+                history[offset * N_INPUTS + i] = src[f * N_INPUTS + i];
+
+            for (j = 0; j < length; j++) {
+                const float *x = history + ((offset + j) % length) * N_INPUTS;
+                const float *h = filters + j * N_INPUTS * N_OUTPUTS;
+
+                for (i = 0; i < N_INPUTS; i++) {
+                    left += x[i] * h[i * N_OUTPUTS];
+                    right += x[i] * h[i * N_OUTPUTS + 1];
+                }
+            }
+
+            dst[f * N_OUTPUTS] = left;
+            dst[f * N_OUTPUTS + 1] = right;
+
+            offset = offset == 0 ? length - 1 : offset - 1;
+        }
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    c = pa_convolver_new(BLOCK_SIZE, N_INPUTS, N_OUTPUTS, length);
+
+    for (i = 0; i < N_INPUTS; i++)
+        for (o = 0; o < N_OUTPUTS; o++)
+            pa_convolver_set_filter(c, i, o, filters + i * N_OUTPUTS + o, N_INPUTS * N_OUTPUTS, length);
+
+    pa_snprintf(label, sizeof(label), "convolver (%u taps)", length);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES, TIMES2) {
+        pa_convolver_process(c, src, dst, N_FRAMES);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_convolver_free(c);
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(filters);
+    pa_xfree(history);
+}
+
+START_TEST (convolver_benchmark) {
+    run_benchmark(64);
+    run_benchmark(512);
+    run_benchmark(4096);
+}
+END_TEST
+
+/* A rewind mustn't cost more the longer the filters are, so it has to
+ * be much cheaper than processing what it takes back again */
+START_TEST (convolver_rewind_benchmark) {
+    pa_convolver *c;
+    float *src, *dst, *filters;
+    unsigned i, o, length = 16384, rewind = N_FRAMES / 2;
+    pa_usec_t start, rewinding = 0, processing = 0;
+
+    srand(0);
+
+    src = random_samples(N_FRAMES * N_INPUTS);
+    filters = random_samples(length * N_INPUTS * N_OUTPUTS);
+    dst = pa_xnew(float, N_FRAMES * N_OUTPUTS);
+
+    c = pa_convolver_new(BLOCK_SIZE, N_INPUTS, N_OUTPUTS, length);
+    pa_convolver_set_max_rewind(c, rewind);
+
+    for (i = 0; i < N_INPUTS; i++)
+        for (o = 0; o < N_OUTPUTS; o++)
+            pa_convolver_set_filter(c, i, o, filters + i * N_OUTPUTS + o, N_INPUTS * N_OUTPUTS, length);
+
+    pa_convolver_process(c, src, dst, N_FRAMES);
+
+    PA_RUNTIME_TEST_RUN_START("rewind and process again (16384 taps)", TIMES, TIMES2) {
+        start = pa_rtclock_now();
+        pa_convolver_rewind(c, rewind);
+        rewinding += pa_rtclock_now() - start;
+
+        start = pa_rtclock_now();
+        pa_convolver_process(c, src, dst, rewind);
+        processing += pa_rtclock_now() - start;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_log_debug("Rewinding %u frames: %llu usec, processing them again: %llu usec",
+                 rewind, (unsigned long long) rewinding, (unsigned long long) processing);
+    fail_unless(rewinding * 10 < processing);
+
+    pa_convolver_free(c);
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(filters);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Convolver");
+    tc = tcase_create("convolver");
+    tcase_add_test(tc, convolver_test);
+    tcase_add_test(tc, convolver_rewind_test);
+    tcase_add_test(tc, convolver_benchmark);
+    tcase_add_test(tc, convolver_rewind_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
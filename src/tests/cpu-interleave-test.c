@@ -0,0 +1,205 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <check.h>
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/random.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "runtime-test-util.h"
+
+#define SAMPLES 1028
+#define TIMES 1000
+#define TIMES2 100
+
+#define MAX_CHANNELS 8
+
+static void random_floats(float *f, unsigned n) {
+    unsigned i;
+
+    pa_random(f, n * sizeof(float));
+
+    /* Between -2 and 2, so that some of them need clamping */
+    for (i = 0; i < n; i++) {
+        uint32_t r;
+
+        memcpy(&r, &f[i], sizeof(r));
+        f[i] = (float) (r & 0xffff) / 0x4000 - 2.0f;
+    }
+}
+
+/* Checks the optimized (de)interleaving against a channel at a time with
+ * pa_sample_clamp(), which is what the filter modules used to do */
+static void run_interleave_test(unsigned channels, int align, bool correct, bool perf) {
+    PA_DECLARE_ALIGNED(16, float, in[SAMPLES * MAX_CHANNELS]) = { 0 };
+    PA_DECLARE_ALIGNED(16, float, out[SAMPLES * MAX_CHANNELS]) = { 0 };
+    PA_DECLARE_ALIGNED(16, float, out_ref[SAMPLES * MAX_CHANNELS]) = { 0 };
+    PA_DECLARE_ALIGNED(16, float, planar[MAX_CHANNELS][SAMPLES]) = { { 0 } };
+    PA_DECLARE_ALIGNED(16, float, planar_ref[MAX_CHANNELS][SAMPLES]) = { { 0 } };
+    float *src, *dst, *dst_ref, *p[MAX_CHANNELS], *p_ref[MAX_CHANNELS];
+    unsigned c, i, n;
+
+    pa_assert(channels <= MAX_CHANNELS);
+
+    /* Force sample alignment as requested */
+    src = in + channels * (4 - align);
+    dst = out + channels * (4 - align);
+    dst_ref = out_ref + channels * (4 - align);
+    n = SAMPLES - (4 - align);
+
+    for (c = 0; c < channels; c++) {
+        p[c] = planar[c] + (4 - align);
+        p_ref[c] = planar_ref[c] + (4 - align);
+    }
+
+    random_floats(src, n * channels);
+
+    if (correct) {
+        for (c = 0; c < channels; c++)
+            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, p_ref[c], sizeof(float), src + c, channels * sizeof(float), n);
+
+        pa_deinterleave_float_clamp(src, channels, p, channels, n);
+
+        for (c = 0; c < channels; c++)
+            for (i = 0; i < n; i++)
+                if (p[c][i] != p_ref[c][i]) {
+                    pa_log_debug("Deinterleaving failed: channels=%u, align=%d", channels, align);
+                    pa_log_debug("channel %u, frame %u: %f != %f (%f)", c, i, p[c][i], p_ref[c][i], src[i * channels + c]);
+                    fail();
+                }
+
+        /* Feed the unclamped input back, as if a filter produced it */
+        for (c = 0; c < channels; c++)
+            for (i = 0; i < n; i++)
+                p[c][i] = src[i * channels + c];
+
+        for (c = 0; c < channels; c++)
+            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst_ref + c, channels * sizeof(float), p[c], sizeof(float), n);
+
+        pa_interleave_float_clamp(p, channels, dst, channels, n);
+
+        for (i = 0; i < n * channels; i++)
+            if (dst[i] != dst_ref[i]) {
+                pa_log_debug("Interleaving failed: channels=%u, align=%d", channels, align);
+                pa_log_debug("%u: %f != %f", i, dst[i], dst_ref[i]);
+                fail();
+            }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %u-channel deinterleaving performance with %d sample alignment", channels, align);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            pa_deinterleave_float_clamp(src, channels, p, channels, n);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            for (c = 0; c < channels; c++)
+                pa_sample_clamp(PA_SAMPLE_FLOAT32NE, p_ref[c], sizeof(float), src + c, channels * sizeof(float), n);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        pa_log_debug("Testing %u-channel interleaving performance with %d sample alignment", channels, align);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            pa_interleave_float_clamp(p, channels, dst, channels, n);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            for (c = 0; c < channels; c++)
+                pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + c, channels * sizeof(float), p[c], sizeof(float), n);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+}
+
+START_TEST (interleave_generic_test) {
+    unsigned channels;
+
+    pa_log_debug("Checking generic (de)interleaving");
+
+    for (channels = 1; channels <= MAX_CHANNELS; channels++)
+        run_interleave_test(channels, 3, true, channels == 2);
+}
+END_TEST
+
+#if defined (__i386__) || defined (__amd64__)
+START_TEST (interleave_sse_test) {
+    pa_cpu_x86_flag_t flags = 0;
+    unsigned channels;
+    int align;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE)) {
+        pa_log_info("SSE not supported. Skipping");
+        return;
+    }
+
+    pa_interleave_func_init_sse(PA_CPU_X86_SSE);
+
+    pa_log_debug("Checking SSE (de)interleaving");
+
+    for (channels = 2; channels <= MAX_CHANNELS; channels += 2) {
+        if (!pa_get_deinterleave_float_func(channels) || !pa_get_interleave_float_func(channels)) {
+            pa_log_info("No SSE (de)interleaving for %u channels. Skipping", channels);
+            continue;
+        }
+
+        for (align = 0; align < 4; align++)
+            run_interleave_test(channels, align, true, false);
+
+        run_interleave_test(channels, 3, false, true);
+    }
+}
+END_TEST
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("CPU");
+
+    tc = tcase_create("interleave");
+    tcase_add_test(tc, interleave_generic_test);
+#if defined (__i386__) || defined (__amd64__)
+    tcase_add_test(tc, interleave_sse_test);
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,186 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/echo-cancel/delay-estimator.h>
+
+#include "random-test-util.h"
+
+#define RATE 16000
+#define MAX_DELAY_MS 100
+
+/* At 16 kHz with 100 ms of delay either way the window is 8192
+ * samples, feeding in a few more makes sure it is complete */
+#define WINDOW 8192
+#define BLOCK 160
+
+/* Feeds one window of playback noise and its echo, which comes delay
+ * samples later (or earlier, if negative) at the given level. Room
+ * noise keeps the capture signal from being just a copy. */
+static void feed_window(pa_ec_delay_estimator *e, int delay, float play_level, float echo_level) {
+    float *play, *rec;
+    unsigned i, n = WINDOW + 2 * BLOCK;
+
+    play = pa_xnew(float, n + 2 * RATE);
+    rec = pa_xnew(float, n);
+
+    /* The playback signal starts a second early, so that there is
+     * something to delay */
+    for (i = 0; i < n + 2 * RATE; i++)
+        play[i] = play_level * (float) pa_test_random_normal();
+
+    for (i = 0; i < n; i++)
+        rec[i] = echo_level * play[RATE + i - delay] + 0.03f * (float) pa_test_random_normal();
+
+    for (i = 0; i < n; i += BLOCK)
+        pa_ec_delay_estimator_feed(e, rec + i, play + RATE + i, BLOCK);
+
+    pa_xfree(play);
+    pa_xfree(rec);
+}
+
+START_TEST (lag_test) {
+    pa_ec_delay_estimator *e;
+    int delay = 0;
+
+    pa_test_random_seed(1);
+    e = pa_ec_delay_estimator_new(RATE, MAX_DELAY_MS);
+
+    /* Nothing to estimate yet */
+    fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+    /* A single window isn't trusted */
+    feed_window(e, 480, 0.1f, 0.5f);
+    fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+    feed_window(e, 480, 0.1f, 0.5f);
+    fail_unless(pa_ec_delay_estimator_estimate(e, &delay));
+    fail_unless(delay == 480);
+
+    /* An echo that arrives before the playback signal means that the
+     * playback stream is late, this comes out negative */
+    feed_window(e, -320, 0.1f, 0.5f);
+    fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+    feed_window(e, -320, 0.1f, 0.5f);
+    fail_unless(pa_ec_delay_estimator_estimate(e, &delay));
+    fail_unless(delay == -320);
+
+    pa_ec_delay_estimator_free(e);
+}
+END_TEST
+
+START_TEST (level_test) {
+    pa_ec_delay_estimator *e;
+    int delay = 0;
+    unsigned i;
+
+    pa_test_random_seed(2);
+    e = pa_ec_delay_estimator_new(RATE, MAX_DELAY_MS);
+
+    feed_window(e, 480, 0.1f, 0.5f);
+    fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+    /* Silent playback, playback too quiet to go by, and a capture
+     * signal that has no echo in it at all must not produce an
+     * estimate, however often they come */
+    for (i = 0; i < 3; i++) {
+        feed_window(e, 480, 0.0f, 0.5f);
+        fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+        feed_window(e, 480, 0.005f, 0.5f);
+        fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+        feed_window(e, 480, 0.1f, 0.0f);
+        fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+    }
+
+    /* The windows that were skipped don't count as previous
+     * estimates, so a good one still confirms the first */
+    feed_window(e, 480, 0.1f, 0.5f);
+    fail_unless(pa_ec_delay_estimator_estimate(e, &delay));
+    fail_unless(delay == 480);
+
+    pa_ec_delay_estimator_free(e);
+}
+END_TEST
+
+START_TEST (reset_test) {
+    pa_ec_delay_estimator *e;
+    int delay = 0;
+
+    pa_test_random_seed(3);
+    e = pa_ec_delay_estimator_new(RATE, MAX_DELAY_MS);
+
+    feed_window(e, 480, 0.1f, 0.5f);
+    fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+    /* A complete window from before the streams were realigned is
+     * thrown away, even though it would confirm the first one */
+    feed_window(e, 480, 0.1f, 0.5f);
+    pa_ec_delay_estimator_reset(e);
+    fail_if(pa_ec_delay_estimator_estimate(e, &delay));
+
+    /* And so is a window that was only partly filled */
+    pa_ec_delay_estimator_feed(e, (float[BLOCK]) { 1.0f }, (float[BLOCK]) { 0.0f, 1.0f }, BLOCK);
+    pa_ec_delay_estimator_reset(e);
+
+    feed_window(e, 480, 0.1f, 0.5f);
+    fail_unless(pa_ec_delay_estimator_estimate(e, &delay));
+    fail_unless(delay == 480);
+
+    pa_ec_delay_estimator_free(e);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Delay Estimator");
+    tc = tcase_create("delay-estimator");
+    tcase_add_test(tc, lag_test);
+    tcase_add_test(tc, level_test);
+    tcase_add_test(tc, reset_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,198 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/dense-hashmap.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "runtime-test-util.h"
+
+#define N_ENTRIES 1000
+
+#define TIMES 1000
+#define TIMES2 20
+
+static unsigned n_freed;
+
+static void free_cb(void *p) {
+    n_freed++;
+}
+
+START_TEST (dense_hashmap_test) {
+    pa_dense_hashmap *h;
+    void *state, *v;
+    const void *k;
+    unsigned i, n;
+
+    h = pa_dense_hashmap_new_full(NULL, NULL, NULL, free_cb);
+    fail_unless(pa_dense_hashmap_isempty(h));
+    fail_unless(pa_dense_hashmap_first(h) == NULL);
+
+    /* Key 0 is a perfectly valid key */
+    for (i = 0; i < N_ENTRIES; i++)
+        fail_unless(pa_dense_hashmap_put(h, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1)) == 0);
+
+    fail_unless(pa_dense_hashmap_put(h, PA_UINT_TO_PTR(0), PA_UINT_TO_PTR(1)) < 0);
+    fail_unless(pa_dense_hashmap_size(h) == N_ENTRIES);
+
+    for (i = 0; i < N_ENTRIES; i++)
+        fail_unless(pa_dense_hashmap_get(h, PA_UINT_TO_PTR(i)) == PA_UINT_TO_PTR(i + 1));
+
+    fail_unless(pa_dense_hashmap_get(h, PA_UINT_TO_PTR(N_ENTRIES)) == NULL);
+
+    /* Remove every other entry, including the current one while
+     * iterating */
+    i = 0;
+    PA_DENSE_HASHMAP_FOREACH(v, h, state) {
+        fail_unless(v == PA_UINT_TO_PTR(i + 1));
+
+        if (i % 2 == 0)
+            fail_unless(pa_dense_hashmap_remove(h, PA_UINT_TO_PTR(i)) == v);
+
+        i++;
+    }
+
+    fail_unless(i == N_ENTRIES);
+    fail_unless(pa_dense_hashmap_size(h) == N_ENTRIES / 2);
+    fail_unless(pa_dense_hashmap_remove(h, PA_UINT_TO_PTR(0)) == NULL);
+
+    /* Adding more entries compacts the array, the insertion order
+     * must survive that */
+    for (i = N_ENTRIES; i < 2 * N_ENTRIES; i++)
+        fail_unless(pa_dense_hashmap_put(h, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1)) == 0);
+
+    n = 0;
+    for (state = NULL, v = pa_dense_hashmap_iterate(h, &state, &k); v; v = pa_dense_hashmap_iterate(h, &state, &k)) {
+        i = PA_PTR_TO_UINT(k);
+
+        fail_unless(v == PA_UINT_TO_PTR(i + 1));
+        fail_unless(i < N_ENTRIES ? i == 2 * n + 1 : i == n + N_ENTRIES / 2);
+        n++;
+    }
+
+    fail_unless(n == pa_dense_hashmap_size(h));
+    fail_unless(pa_dense_hashmap_first(h) == PA_UINT_TO_PTR(2));
+
+    fail_unless(pa_dense_hashmap_remove_and_free(h, PA_UINT_TO_PTR(1)) == 0);
+    fail_unless(pa_dense_hashmap_remove_and_free(h, PA_UINT_TO_PTR(1)) < 0);
+    fail_unless(n_freed == 1);
+
+    pa_dense_hashmap_remove_all(h);
+    fail_unless(pa_dense_hashmap_isempty(h));
+    fail_unless(n_freed == n);
+
+    fail_unless(pa_dense_hashmap_put(h, PA_UINT_TO_PTR(1), PA_UINT_TO_PTR(2)) == 0);
+    fail_unless(pa_dense_hashmap_first(h) == PA_UINT_TO_PTR(2));
+
+    pa_dense_hashmap_free(h);
+    fail_unless(n_freed == n + 1);
+}
+END_TEST
+
+/* Compares the cost of walking and looking up the streams of a sink,
+ * which are keyed by their index */
+static void run_benchmark(unsigned n_entries) {
+    pa_hashmap *h;
+    pa_dense_hashmap *d;
+    void *state, *v;
+    unsigned i;
+    uintptr_t sum = 0;
+    char label[64];
+
+    h = pa_hashmap_new(NULL, NULL);
+    d = pa_dense_hashmap_new(NULL, NULL);
+
+    for (i = 0; i < n_entries; i++) {
+        pa_hashmap_put(h, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1));
+        pa_dense_hashmap_put(d, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1));
+    }
+
+    pa_log_debug("Checking %u entries", n_entries);
+
+    pa_snprintf(label, sizeof(label), "hashmap iterate (%u)", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES, TIMES2) {
+        PA_HASHMAP_FOREACH(v, h, state)
+            sum += (uintptr_t) v;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "dense iterate (%u)", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES, TIMES2) {
+        PA_DENSE_HASHMAP_FOREACH(v, d, state)
+            sum += (uintptr_t) v;
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "hashmap lookup (%u)", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES, TIMES2) {
+        sum += (uintptr_t) pa_hashmap_get(h, PA_UINT_TO_PTR(_j % n_entries));
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_snprintf(label, sizeof(label), "dense lookup (%u)", n_entries);
+    PA_RUNTIME_TEST_RUN_START(label, TIMES, TIMES2) {
+        sum += (uintptr_t) pa_dense_hashmap_get(d, PA_UINT_TO_PTR(_j % n_entries));
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    /* Make sure the loops aren't optimized away */
+    fail_unless(sum > 0);
+
+    pa_hashmap_free(h);
+    pa_dense_hashmap_free(d);
+}
+
+START_TEST (dense_hashmap_benchmark) {
+    run_benchmark(10);
+    run_benchmark(100);
+    run_benchmark(1000);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Dense hashmap");
+    tc = tcase_create("dense-hashmap");
+    tcase_add_test(tc, dense_hashmap_test);
+    tcase_add_test(tc, dense_hashmap_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,288 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "runtime-test-util.h"
+
+/* That many objects, e.g. clients or streams, a busy server might
+ * have */
+#define N_OBJECTS 10000
+
+#define TIMES 1
+#define TIMES2 20
+
+struct object {
+    uint32_t index;
+    char name[32];
+};
+
+static struct object *objects_new(void) {
+    struct object *o;
+    unsigned i;
+
+    o = pa_xnew0(struct object, N_OBJECTS);
+
+    for (i = 0; i < N_OBJECTS; i++)
+        pa_snprintf(o[i].name, sizeof(o[i].name), "alsa_output.pci-0000_00_1b.%u", i);
+
+    return o;
+}
+
+START_TEST (idxset_test) {
+    pa_idxset *s;
+    struct object *objects, *o;
+    uint32_t idx;
+    unsigned i, n;
+
+    objects = objects_new();
+    s = pa_idxset_new(NULL, NULL);
+
+    for (i = 0; i < N_OBJECTS; i++) {
+        fail_unless(pa_idxset_put(s, &objects[i], &objects[i].index) == 0);
+        fail_unless(objects[i].index == i);
+    }
+
+    fail_unless(pa_idxset_put(s, &objects[1], &idx) < 0);
+    fail_unless(idx == 1);
+    fail_unless(pa_idxset_size(s) == N_OBJECTS);
+
+    for (i = 0; i < N_OBJECTS; i++) {
+        fail_unless(pa_idxset_get_by_index(s, i) == &objects[i]);
+        fail_unless(pa_idxset_get_by_data(s, &objects[i], &idx) == &objects[i]);
+        fail_unless(idx == i);
+    }
+
+    /* Remove most objects while iterating, which shrinks the tables on
+     * the way */
+    n = 0;
+    PA_IDXSET_FOREACH(o, s, idx) {
+        fail_unless(o->index == idx);
+
+        if (idx % 16 != 0)
+            fail_unless(pa_idxset_remove_by_index(s, idx) == o);
+
+        n++;
+    }
+
+    fail_unless(n == N_OBJECTS);
+    fail_unless(pa_idxset_size(s) == N_OBJECTS / 16);
+
+    for (i = 0; i < N_OBJECTS; i++) {
+        fail_unless(pa_idxset_get_by_index(s, i) == (i % 16 == 0 ? &objects[i] : NULL));
+        fail_unless(pa_idxset_get_by_data(s, &objects[i], NULL) == (i % 16 == 0 ? &objects[i] : NULL));
+    }
+
+    /* pa_idxset_next() continues after an entry that is gone */
+    idx = 1;
+    fail_unless(pa_idxset_next(s, &idx) == &objects[16]);
+    fail_unless(idx == 16);
+
+    fail_unless(pa_idxset_remove_by_data(s, &objects[0], &idx) == &objects[0]);
+    fail_unless(idx == 0);
+    fail_unless(pa_idxset_first(s, &idx) == &objects[16]);
+
+    pa_idxset_free(s, NULL);
+    pa_xfree(objects);
+}
+END_TEST
+
+START_TEST (hashmap_test) {
+    pa_hashmap *h;
+    struct object *objects, *o;
+    void *state;
+    unsigned i;
+
+    objects = objects_new();
+    h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    for (i = 0; i < N_OBJECTS; i++)
+        fail_unless(pa_hashmap_put(h, objects[i].name, &objects[i]) == 0);
+
+    fail_unless(pa_hashmap_put(h, objects[0].name, &objects[0]) < 0);
+    fail_unless(pa_hashmap_size(h) == N_OBJECTS);
+
+    for (i = 0; i < N_OBJECTS; i++) {
+        char name[32];
+
+        /* Look up by a copy, not by the pointer that was put in */
+        pa_snprintf(name, sizeof(name), "%s", objects[i].name);
+        fail_unless(pa_hashmap_get(h, name) == &objects[i]);
+    }
+
+    fail_unless(pa_hashmap_get(h, "alsa_output.pci-0000_00_1b") == NULL);
+
+    /* The insertion order is kept across resizing */
+    i = 0;
+    PA_HASHMAP_FOREACH(o, h, state) {
+        fail_unless(o == &objects[i]);
+
+        if (i > 0)
+            fail_unless(pa_hashmap_remove(h, o->name) == o);
+
+        i++;
+    }
+
+    fail_unless(i == N_OBJECTS);
+    fail_unless(pa_hashmap_size(h) == 1);
+    fail_unless(pa_hashmap_first(h) == &objects[0]);
+
+    pa_hashmap_free(h);
+    pa_xfree(objects);
+}
+END_TEST
+
+START_TEST (string_hash_test) {
+    unsigned i, j, collisions = 0;
+    unsigned *hashes;
+    char name[32];
+
+    fail_unless(pa_idxset_string_hash_func("") == pa_idxset_string_hash_func(""));
+
+    /* Strings of all lengths around the block size of the hash */
+    for (i = 1; i < 24; i++) {
+        unsigned hash;
+
+        pa_snprintf(name, sizeof(name), "%.*s", (int) i, "abcdefghijklmnopqrstuvwxyz");
+        hash = pa_idxset_string_hash_func(name);
+        fail_unless(pa_idxset_string_hash_func(name) == hash);
+
+        /* Flipping one bit of any character changes the hash */
+        for (j = 0; j < i; j++) {
+            name[j] ^= 1;
+            fail_unless(pa_idxset_string_hash_func(name) != hash);
+            name[j] ^= 1;
+        }
+    }
+
+    /* Names that only differ a bit shouldn't collide */
+    hashes = pa_xnew(unsigned, N_OBJECTS);
+
+    for (i = 0; i < N_OBJECTS; i++) {
+        pa_snprintf(name, sizeof(name), "client-%u", i);
+        hashes[i] = pa_idxset_string_hash_func(name);
+    }
+
+    for (i = 0; i < N_OBJECTS; i++)
+        for (j = i + 1; j < N_OBJECTS; j++)
+            if (hashes[i] == hashes[j])
+                collisions++;
+
+    /* With 32 bits of hash, we'd expect about 0.01 collisions */
+    fail_unless(collisions <= 1);
+
+    pa_xfree(hashes);
+}
+END_TEST
+
+START_TEST (idxset_benchmark) {
+    struct object *objects;
+    uintptr_t sum = 0;
+
+    objects = objects_new();
+
+    pa_log_debug("Checking %u objects", N_OBJECTS);
+
+    PA_RUNTIME_TEST_RUN_START("idxset put/remove", TIMES, TIMES2) {
+        pa_idxset *s = pa_idxset_new(NULL, NULL);
+        unsigned i;
+
+        for (i = 0; i < N_OBJECTS; i++)
+            pa_idxset_put(s, &objects[i], NULL);
+
+        for (i = 0; i < N_OBJECTS; i++)
+            pa_idxset_remove_by_data(s, &objects[i], NULL);
+
+        pa_idxset_free(s, NULL);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    PA_RUNTIME_TEST_RUN_START("idxset lookup", TIMES, TIMES2) {
+        pa_idxset *s = pa_idxset_new(NULL, NULL);
+        unsigned i;
+
+        for (i = 0; i < N_OBJECTS; i++)
+            pa_idxset_put(s, &objects[i], NULL);
+
+        for (i = 0; i < N_OBJECTS; i++) {
+            sum += (uintptr_t) pa_idxset_get_by_index(s, i);
+            sum += (uintptr_t) pa_idxset_get_by_data(s, &objects[i], NULL);
+        }
+
+        pa_idxset_free(s, NULL);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    PA_RUNTIME_TEST_RUN_START("hashmap string lookup", TIMES, TIMES2) {
+        pa_hashmap *h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+        unsigned i;
+
+        for (i = 0; i < N_OBJECTS; i++)
+            pa_hashmap_put(h, objects[i].name, &objects[i]);
+
+        for (i = 0; i < N_OBJECTS; i++)
+            sum += (uintptr_t) pa_hashmap_get(h, objects[i].name);
+
+        pa_hashmap_free(h);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    /* Make sure the loops aren't optimized away */
+    fail_unless(sum > 0);
+
+    pa_xfree(objects);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Idxset");
+    tc = tcase_create("idxset");
+    tcase_add_test(tc, idxset_test);
+    tcase_add_test(tc, hashmap_test);
+    tcase_add_test(tc, string_hash_test);
+    tcase_add_test(tc, idxset_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,147 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/io-stats.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+START_TEST (counters_test) {
+    pa_io_stats s;
+    pa_io_stats_snapshot i;
+
+    memset(&s, 0, sizeof(s));
+
+    pa_io_stats_get_snapshot(&s, &i);
+    fail_unless(i.xruns == 0);
+    fail_unless(i.render_count == 0);
+    fail_unless(i.render_time_p99 == 0);
+
+    pa_io_stats_add_xrun(&s);
+    pa_io_stats_add_xrun(&s);
+    pa_io_stats_add_rewind(&s, 1024);
+    pa_io_stats_add_rewind(&s, 512);
+    pa_io_stats_add_resample(&s, 30);
+    pa_io_stats_add_resample(&s, 12);
+
+    pa_io_stats_set_queue_length(&s, 4096);
+    pa_io_stats_set_queue_length(&s, 100);
+
+    pa_io_stats_get_snapshot(&s, &i);
+    fail_unless(i.xruns == 2);
+    fail_unless(i.rewinds == 2);
+    fail_unless(i.rewind_bytes == 1536);
+    fail_unless(i.resample_time == 42);
+    fail_unless(i.queue_length == 100);
+    fail_unless(i.queue_length_max == 4096);
+}
+END_TEST
+
+START_TEST (render_time_test) {
+    pa_io_stats s;
+    pa_io_stats_snapshot i;
+    unsigned j;
+
+    memset(&s, 0, sizeof(s));
+
+    /* 98 fast renders and two slow ones */
+    for (j = 0; j < 98; j++)
+        pa_io_stats_add_render(&s, 100);
+
+    pa_io_stats_add_render(&s, 5000);
+    pa_io_stats_add_render(&s, 20000);
+
+    pa_io_stats_get_snapshot(&s, &i);
+
+    pa_log_debug("p50 %llu, p99 %llu, max %llu",
+                 (unsigned long long) i.render_time_p50,
+                 (unsigned long long) i.render_time_p99,
+                 (unsigned long long) i.render_time_max);
+
+    fail_unless(i.render_count == 100);
+    fail_unless(i.render_time_max == 20000);
+    fail_unless(i.render_time_total == 98 * 100 + 5000 + 20000);
+
+    /* The buckets have a resolution of 25% */
+    fail_unless(i.render_time_p50 >= 100 && i.render_time_p50 < 125);
+    fail_unless(i.render_time_p99 >= 5000 && i.render_time_p99 < 6250);
+
+    /* Very long renders end up in the last bucket */
+    pa_io_stats_add_render(&s, 100 * PA_USEC_PER_SEC);
+    pa_io_stats_get_snapshot(&s, &i);
+    fail_unless(i.render_count == 101);
+    fail_unless(i.render_time_max > 20000);
+}
+END_TEST
+
+/* The totals of bytes and time go beyond 32 bits */
+START_TEST (totals_test) {
+    pa_io_stats s;
+    pa_io_stats_snapshot i;
+    unsigned j;
+
+    memset(&s, 0, sizeof(s));
+
+    for (j = 0; j < 5; j++) {
+        pa_io_stats_add_rewind(&s, 1024 * 1024 * 1024);
+        pa_io_stats_add_resample(&s, 1000 * PA_USEC_PER_SEC);
+        pa_io_stats_add_render(&s, 1000 * PA_USEC_PER_SEC);
+    }
+
+    pa_io_stats_get_snapshot(&s, &i);
+    fail_unless(i.rewinds == 5);
+    fail_unless(i.rewind_bytes == 5ULL * 1024 * 1024 * 1024);
+    fail_unless(i.resample_time == 5000 * PA_USEC_PER_SEC);
+    fail_unless(i.render_time_total == 5000 * PA_USEC_PER_SEC);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("IO Stats");
+    tc = tcase_create("io-stats");
+    tcase_add_test(tc, counters_test);
+    tcase_add_test(tc, render_time_test);
+    tcase_add_test(tc, totals_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
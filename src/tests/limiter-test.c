@@ -0,0 +1,312 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/limiter.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "runtime-test-util.h"
+
+#define RATE 48000
+#define THRESHOLD -3.0
+#define LOOKAHEAD (5 * PA_USEC_PER_MSEC)
+#define RELEASE (50 * PA_USEC_PER_MSEC)
+
+#define N_FRAMES (2 * RATE)
+/* Frames per call, deliberately not a multiple of the internal block */
+#define CHUNK 700
+
+#define MAX_CHANNELS 8
+
+#define TIMES 10
+#define TIMES2 10
+
+/* Noise that is mostly quiet, with loud bursts in it */
+static float *make_signal(unsigned channels, unsigned n) {
+    float *f;
+    unsigned c, i;
+
+    srand(channels);
+
+    f = pa_xnew(float, n * channels);
+    for (i = 0; i < n; i++) {
+        float level = (i / (RATE / 10)) % 3 == 1 ? 3.0f : 0.3f;
+
+        for (c = 0; c < channels; c++)
+            f[i * channels + c] = level * (float) (rand() / (RAND_MAX + 1.0) - 0.5);
+    }
+
+    return f;
+}
+
+static void process(pa_limiter *l, const float *src, float *dst, unsigned n) {
+    unsigned i, k;
+
+    for (i = 0; i < n; i += k) {
+        k = PA_MIN(n - i, CHUNK);
+        pa_limiter_process(l, src + i * pa_limiter_get_channels(l), dst + i * pa_limiter_get_channels(l), k);
+    }
+}
+
+static float max_difference(const float *a, const float *b, unsigned n) {
+    float d = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        d = PA_MAX(d, fabsf(a[i] - b[i]));
+
+    return d;
+}
+
+static void check_threshold(unsigned channels, unsigned bands) {
+    pa_limiter *l;
+    float *src, *dst, threshold = (float) pow(10.0, THRESHOLD / 20.0), peak = 0;
+    unsigned i;
+
+    pa_log_debug("Checking the threshold with %u channels, %u bands", channels, bands);
+
+    src = make_signal(channels, N_FRAMES);
+    dst = pa_xnew(float, N_FRAMES * channels);
+
+    l = pa_limiter_new(RATE, channels, THRESHOLD, LOOKAHEAD, RELEASE, bands, NULL);
+    process(l, src, dst, N_FRAMES);
+
+    for (i = 0; i < N_FRAMES * channels; i++)
+        peak = PA_MAX(peak, fabsf(dst[i]));
+
+    pa_log_debug("Peak %f, threshold %f", peak, threshold);
+    fail_unless(peak <= threshold * 1.00001f);
+    /* It mustn't simply have turned everything down either */
+    fail_unless(peak > threshold * 0.9f);
+
+    pa_limiter_free(l);
+    pa_xfree(src);
+    pa_xfree(dst);
+}
+
+START_TEST (limiter_threshold_test) {
+    check_threshold(1, 1);
+    check_threshold(2, 1);
+    check_threshold(6, 1);
+    check_threshold(2, 2);
+    check_threshold(2, 3);
+    check_threshold(8, 4);
+}
+END_TEST
+
+/* Below the threshold, a single band is just a delay, and the bands add
+ * up to an allpass, which keeps the level of a sine */
+START_TEST (limiter_transparent_test) {
+    pa_limiter *l;
+    float *src, *dst;
+    double in_energy = 0, out_energy = 0;
+    unsigned i, latency;
+
+    src = pa_xnew(float, N_FRAMES * 2);
+    dst = pa_xnew(float, N_FRAMES * 2);
+
+    for (i = 0; i < N_FRAMES; i++)
+        src[2 * i] = src[2 * i + 1] = 0.5f * (float) sin(2 * M_PI * 1000 * i / RATE);
+
+    l = pa_limiter_new(RATE, 2, THRESHOLD, LOOKAHEAD, RELEASE, 1, NULL);
+    latency = pa_limiter_get_latency(l);
+    fail_unless(latency == LOOKAHEAD * RATE / PA_USEC_PER_SEC);
+
+    process(l, src, dst, N_FRAMES);
+
+    for (i = 0; i < latency * 2; i++)
+        fail_unless(dst[i] == 0.0f);
+    fail_unless(max_difference(src, dst + latency * 2, (N_FRAMES - latency) * 2) == 0.0f);
+
+    pa_limiter_free(l);
+
+    l = pa_limiter_new(RATE, 2, THRESHOLD, LOOKAHEAD, RELEASE, 3, NULL);
+    fail_unless(pa_limiter_get_latency(l) == 2 * latency);
+
+    process(l, src, dst, N_FRAMES);
+
+    for (i = N_FRAMES / 2; i < N_FRAMES; i++) {
+        in_energy += src[2 * i] * src[2 * i];
+        out_energy += dst[2 * i] * dst[2 * i];
+    }
+
+    pa_log_debug("Three bands change the level of a sine by %0.4f dB", 10.0 * log10(out_energy / in_energy));
+    fail_unless(fabs(10.0 * log10(out_energy / in_energy)) < 0.01);
+
+    pa_limiter_free(l);
+    pa_xfree(src);
+    pa_xfree(dst);
+}
+END_TEST
+
+/* Rewinding and processing something else must give the same as if the
+ * something else had been processed right away */
+static void check_rewind(unsigned bands, float tolerance) {
+    pa_limiter *l, *ref;
+    float *src, *other, *dst, *dst_ref;
+    unsigned rewind = RATE / 4, head = N_FRAMES - rewind;
+
+    pa_log_debug("Checking rewinding with %u bands", bands);
+
+    src = make_signal(2, N_FRAMES);
+    other = make_signal(3, N_FRAMES);
+    dst = pa_xnew(float, rewind * 2);
+    dst_ref = pa_xnew(float, N_FRAMES * 2);
+
+    l = pa_limiter_new(RATE, 2, THRESHOLD, LOOKAHEAD, RELEASE, bands, NULL);
+    pa_limiter_set_max_rewind(l, rewind);
+    ref = pa_limiter_new(RATE, 2, THRESHOLD, LOOKAHEAD, RELEASE, bands, NULL);
+
+    process(l, src, dst_ref, N_FRAMES);
+    pa_limiter_rewind(l, rewind);
+    process(l, other, dst, rewind);
+
+    process(ref, src, dst_ref, head);
+    process(ref, other, dst_ref, rewind);
+
+    pa_log_debug("Largest difference %g", max_difference(dst, dst_ref, rewind * 2));
+    fail_unless(max_difference(dst, dst_ref, rewind * 2) <= tolerance);
+
+    /* Further back than the history goes, it starts from silence */
+    pa_limiter_rewind(l, N_FRAMES);
+    pa_limiter_reset(ref);
+    process(l, src, dst, rewind);
+    process(ref, src, dst_ref, rewind);
+    fail_unless(max_difference(dst, dst_ref, rewind * 2) == 0.0f);
+
+    pa_limiter_free(l);
+    pa_limiter_free(ref);
+    pa_xfree(src);
+    pa_xfree(other);
+    pa_xfree(dst);
+    pa_xfree(dst_ref);
+}
+
+START_TEST (limiter_rewind_test) {
+    check_rewind(1, 1e-6f);
+    check_rewind(3, 1e-3f);
+}
+END_TEST
+
+#if defined (__i386__) || defined (__amd64__)
+static void run_sse_test(unsigned channels) {
+    pa_limiter_target_func_t target_func = pa_limiter_get_target_func(channels);
+    pa_limiter_apply_func_t apply_func = pa_limiter_get_apply_func(channels);
+    pa_limiter *l;
+    float *src, *dst, *dst_ref;
+
+    if (!target_func || !apply_func) {
+        pa_log_info("No SSE limiter functions for %u channels. Skipping", channels);
+        return;
+    }
+
+    pa_log_debug("Checking the SSE limiter with %u channels", channels);
+
+    src = make_signal(channels, N_FRAMES);
+    dst = pa_xnew(float, N_FRAMES * channels);
+    dst_ref = pa_xnew(float, N_FRAMES * channels);
+
+    l = pa_limiter_new(RATE, channels, THRESHOLD, LOOKAHEAD, RELEASE, 1, NULL);
+
+    pa_limiter_set_target_func(channels, NULL);
+    pa_limiter_set_apply_func(channels, NULL);
+    process(l, src, dst_ref, N_FRAMES);
+
+    PA_RUNTIME_TEST_RUN_START("generic", TIMES, TIMES2) {
+        pa_limiter_process(l, src, dst, N_FRAMES);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_limiter_set_target_func(channels, target_func);
+    pa_limiter_set_apply_func(channels, apply_func);
+
+    PA_RUNTIME_TEST_RUN_START("SSE", TIMES, TIMES2) {
+        pa_limiter_process(l, src, dst, N_FRAMES);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_limiter_reset(l);
+    process(l, src, dst, N_FRAMES);
+
+    fail_unless(max_difference(dst, dst_ref, N_FRAMES * channels) <= 1e-6f);
+
+    pa_limiter_free(l);
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(dst_ref);
+}
+
+START_TEST (limiter_sse_test) {
+    pa_cpu_x86_flag_t flags = 0;
+    unsigned channels;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE)) {
+        pa_log_info("SSE not supported. Skipping");
+        return;
+    }
+
+    pa_limiter_func_init_sse(PA_CPU_X86_SSE);
+
+    for (channels = 1; channels <= MAX_CHANNELS; channels++)
+        run_sse_test(channels);
+}
+END_TEST
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Limiter");
+
+    tc = tcase_create("limiter");
+    tcase_add_test(tc, limiter_threshold_test);
+    tcase_add_test(tc, limiter_transparent_test);
+    tcase_add_test(tc, limiter_rewind_test);
+#if defined (__i386__) || defined (__amd64__)
+    tcase_add_test(tc, limiter_sse_test);
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
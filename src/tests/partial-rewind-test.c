@@ -0,0 +1,495 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* A sink without a device behind it. The test tells the IO thread
+ * what to render and when to rewind, and collects everything that
+ * was rendered, so that it can be compared to what the inputs should
+ * sound like together. Whatever is rendered after a rewind has to
+ * sound like all inputs mixed with their current volumes. */
+
+#define CHANNELS 2
+#define FRAME_SIZE (CHANNELS * sizeof(float))
+#define BLOCK_FRAMES 256
+#define MAX_REWIND_FRAMES 4096
+#define TOTAL_FRAMES 16384
+#define N_INPUTS 3
+
+#define TOLERANCE 1e-5f
+
+enum {
+    TEST_MESSAGE_RENDER = PA_SINK_MESSAGE_MAX,
+    TEST_MESSAGE_STOP_INPUT,
+    TEST_MESSAGE_REWIND
+};
+
+struct test_input {
+    pa_sink_input *sink_input;
+    float amplitude, omega;
+    float volume;
+
+    size_t pos;
+    size_t stop_at;
+
+    /* What the input should contribute to each frame */
+    float gain[TOTAL_FRAMES];
+};
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+static pa_sink *sink;
+static pa_rtpoll *rtpoll;
+static pa_thread_mq thread_mq;
+static pa_thread *thread;
+
+static struct test_input inputs[N_INPUTS];
+static float sink_volume;
+static float sink_gain[TOTAL_FRAMES];
+
+/* Only touched by the IO thread, and by the test while the IO thread
+ * handles one of its messages */
+static float output[TOTAL_FRAMES * CHANNELS];
+static size_t written;
+static size_t rewindable;
+static size_t rewind_limit;
+static size_t last_rewind;
+static bool premix_pending;
+
+static float input_sample(const struct test_input *t, size_t frame, unsigned channel) {
+    return t->amplitude * sinf((float) frame * t->omega + (float) channel);
+}
+
+/* Called from IO thread context */
+static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
+    struct test_input *t = i->userdata;
+    float *d;
+    size_t n, k;
+    unsigned c;
+
+    n = length / FRAME_SIZE;
+
+    chunk->memblock = pa_memblock_new(core->mempool, n * FRAME_SIZE);
+    chunk->index = 0;
+    chunk->length = n * FRAME_SIZE;
+
+    d = pa_memblock_acquire(chunk->memblock);
+    for (k = 0; k < n; k++, t->pos++)
+        for (c = 0; c < CHANNELS; c++)
+            *(d++) = t->pos < t->stop_at ? input_sample(t, t->pos, c) : 0.0f;
+    pa_memblock_release(chunk->memblock);
+
+    return 0;
+}
+
+/* Called from IO thread context */
+static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    struct test_input *t = i->userdata;
+
+    pa_assert(nbytes / FRAME_SIZE <= t->pos);
+    t->pos -= nbytes / FRAME_SIZE;
+}
+
+/* Called from main context */
+static void sink_input_kill_cb(pa_sink_input *i) {
+    pa_sink_input_unlink(i);
+}
+
+/* Called from IO thread context */
+static void process_rewind(void) {
+    size_t nbytes;
+
+    if (!sink->thread_info.rewind_requested)
+        return;
+
+    /* The device has played everything that came before what we
+     * rendered since the last rewind */
+    nbytes = PA_MIN(sink->thread_info.rewind_nbytes, PA_MIN(rewindable, rewind_limit) * FRAME_SIZE);
+    pa_sink_process_rewind(sink, nbytes);
+
+    last_rewind = nbytes / FRAME_SIZE;
+    written -= last_rewind;
+    rewindable -= last_rewind;
+}
+
+/* Called from IO thread context */
+static void process_render(size_t frames) {
+    pa_assert(written + frames <= TOTAL_FRAMES);
+
+    while (frames > 0) {
+        pa_memchunk chunk;
+        size_t n;
+
+        pa_sink_render_full(sink, PA_MIN(frames, BLOCK_FRAMES) * FRAME_SIZE, &chunk);
+        n = chunk.length / FRAME_SIZE;
+
+        memcpy(output + written * CHANNELS, (uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index, chunk.length);
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        written += n;
+        rewindable = PA_MIN(rewindable + n, MAX_REWIND_FRAMES);
+        frames -= n;
+    }
+}
+
+/* Called from IO thread context */
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    int r = 0;
+
+    if (code >= TEST_MESSAGE_RENDER)
+        last_rewind = 0;
+
+    switch (code) {
+
+        case TEST_MESSAGE_RENDER:
+            process_rewind();
+            process_render((size_t) offset);
+            break;
+
+        case TEST_MESSAGE_STOP_INPUT: {
+            struct test_input *t = data;
+            size_t lbq;
+
+            /* The input goes silent where the rewind takes us, as if
+             * it had been removed from the sink at that point. What
+             * is still queued in the input has to go as well. */
+            lbq = pa_memblockq_get_length(t->sink_input->thread_info.render_memblockq);
+            pa_assert(t->pos == written + lbq / FRAME_SIZE);
+
+            t->stop_at = written - (size_t) offset;
+            pa_sink_input_request_rewind(t->sink_input, (size_t) offset * FRAME_SIZE + lbq, true, false, false);
+            process_rewind();
+            break;
+        }
+
+        case TEST_MESSAGE_REWIND:
+            pa_sink_request_rewind(sink, (size_t) offset * FRAME_SIZE);
+            process_rewind();
+            break;
+
+        default:
+            r = pa_sink_process_msg(o, code, data, offset, chunk);
+            break;
+    }
+
+    premix_pending = !!sink->thread_info.premix;
+
+    return r;
+}
+
+static void thread_func(void *userdata) {
+    pa_thread_mq_install(&thread_mq);
+
+    for (;;) {
+        int ret;
+
+        if ((ret = pa_rtpoll_run(rtpoll, true)) < 0)
+            pa_assert_not_reached();
+
+        if (ret == 0)
+            break;
+    }
+}
+
+static void send_message(int code, void *data, size_t frames) {
+    unsigned j;
+    size_t k;
+
+    pa_assert_se(pa_asyncmsgq_send(sink->asyncmsgq, PA_MSGOBJECT(sink), code, data, (int64_t) frames, NULL) == 0);
+
+    while (pa_mainloop_iterate(mainloop, false, NULL) > 0)
+        ;
+
+    /* Everything from here on is going to be rendered with the
+     * volumes we have now */
+    for (k = written; k < TOTAL_FRAMES; k++) {
+        for (j = 0; j < N_INPUTS; j++)
+            inputs[j].gain[k] = k < inputs[j].stop_at ? inputs[j].volume : 0.0f;
+
+        sink_gain[k] = sink_volume;
+    }
+}
+
+/* Lets the sink process a rewind that was requested by a volume
+ * change */
+static void process_pending_rewind(void) {
+    send_message(TEST_MESSAGE_RENDER, NULL, 0);
+}
+
+/* Renders up to the given frame */
+static void render_to(size_t frame) {
+    send_message(TEST_MESSAGE_RENDER, NULL, frame - written);
+    fail_unless(written == frame);
+}
+
+/* Stops the input the given number of frames back, returns whether
+ * the sink did that through a partial rewind */
+static bool stop_input(struct test_input *t, size_t frames) {
+    send_message(TEST_MESSAGE_STOP_INPUT, t, frames);
+    fail_unless(last_rewind == frames);
+
+    return premix_pending;
+}
+
+static void check_output(void) {
+    size_t k;
+    unsigned c, j;
+
+    for (k = 0; k < written; k++)
+        for (c = 0; c < CHANNELS; c++) {
+            float expected = 0.0f;
+
+            for (j = 0; j < N_INPUTS; j++)
+                expected += inputs[j].gain[k] * input_sample(&inputs[j], k, c);
+
+            expected *= sink_gain[k];
+
+            if (fabsf(output[k * CHANNELS + c] - expected) > TOLERANCE) {
+                pa_log("Frame %zu, channel %u: got %f, expected %f", k, c, output[k * CHANNELS + c], expected);
+                fail();
+                return;
+            }
+        }
+}
+
+static void setup(void) {
+    pa_sink_new_data data;
+    pa_sample_spec ss;
+    unsigned j;
+    size_t k;
+
+    mainloop = pa_mainloop_new();
+    fail_unless(mainloop != NULL);
+
+    core = pa_core_new(pa_mainloop_get_api(mainloop), false, 0);
+    fail_unless(core != NULL);
+    fail_unless(core->partial_rewind);
+
+    ss.format = PA_SAMPLE_FLOAT32NE;
+    ss.rate = 48000;
+    ss.channels = CHANNELS;
+
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, core->mainloop, rtpoll);
+
+    pa_sink_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_new_data_set_name(&data, "test_sink");
+    pa_sink_new_data_set_sample_spec(&data, &ss);
+    sink = pa_sink_new(core, &data, 0);
+    pa_sink_new_data_done(&data);
+    fail_unless(sink != NULL);
+
+    sink->parent.process_msg = sink_process_msg;
+    pa_sink_set_asyncmsgq(sink, thread_mq.inq);
+    pa_sink_set_rtpoll(sink, rtpoll);
+    pa_sink_set_max_rewind(sink, MAX_REWIND_FRAMES * FRAME_SIZE);
+    pa_sink_set_max_request(sink, MAX_REWIND_FRAMES * FRAME_SIZE);
+
+    fail_unless((thread = pa_thread_new("test-sink", thread_func, NULL)) != NULL);
+
+    pa_sink_put(sink);
+
+    written = 0;
+    rewindable = 0;
+    rewind_limit = (size_t) -1;
+    last_rewind = 0;
+    premix_pending = false;
+
+    sink_volume = 1.0f;
+    for (k = 0; k < TOTAL_FRAMES; k++)
+        sink_gain[k] = 1.0f;
+
+    for (j = 0; j < N_INPUTS; j++) {
+        struct test_input *t = inputs + j;
+        pa_sink_input_new_data idata;
+
+        t->amplitude = 0.3f;
+        t->omega = 0.01f + 0.037f * j;
+        t->volume = 1.0f;
+        t->pos = 0;
+        t->stop_at = (size_t) -1;
+
+        for (k = 0; k < TOTAL_FRAMES; k++)
+            t->gain[k] = 1.0f;
+
+        pa_sink_input_new_data_init(&idata);
+        idata.driver = __FILE__;
+        pa_sink_input_new_data_set_sink(&idata, sink, false);
+        pa_sink_input_new_data_set_sample_spec(&idata, &ss);
+        pa_sink_input_new(&t->sink_input, core, &idata);
+        pa_sink_input_new_data_done(&idata);
+        fail_unless(t->sink_input != NULL);
+
+        t->sink_input->pop = sink_input_pop_cb;
+        t->sink_input->process_rewind = sink_input_process_rewind_cb;
+        t->sink_input->kill = sink_input_kill_cb;
+        t->sink_input->userdata = t;
+    }
+
+    /* Only now, so that all inputs start playing at the same frame */
+    for (j = 0; j < N_INPUTS; j++)
+        pa_sink_input_put(inputs[j].sink_input);
+}
+
+static void teardown(void) {
+    unsigned j;
+
+    for (j = 0; j < N_INPUTS; j++) {
+        pa_sink_input_unlink(inputs[j].sink_input);
+        pa_sink_input_unref(inputs[j].sink_input);
+    }
+
+    pa_sink_unlink(sink);
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(thread);
+    pa_thread_mq_done(&thread_mq);
+
+    pa_sink_unref(sink);
+    pa_rtpoll_free(rtpoll);
+
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+
+START_TEST (partial_rewind_test) {
+    setup();
+
+    render_to(8192);
+
+    /* One of three inputs goes away, the other two are left alone */
+    fail_unless(stop_input(&inputs[2], 2048));
+
+    render_to(TOTAL_FRAMES);
+    fail_if(premix_pending);
+
+    check_output();
+
+    teardown();
+}
+END_TEST
+
+START_TEST (cancel_test) {
+    setup();
+
+    render_to(8192);
+    fail_unless(stop_input(&inputs[2], 2048));
+
+    /* A rewind of the whole sink in the middle of the premix */
+    render_to(7168);
+    fail_unless(premix_pending);
+
+    send_message(TEST_MESSAGE_REWIND, NULL, 1536);
+    fail_unless(last_rewind == 1536);
+    fail_if(premix_pending);
+
+    render_to(TOTAL_FRAMES);
+
+    check_output();
+
+    teardown();
+}
+END_TEST
+
+START_TEST (volume_test) {
+    pa_cvolume v;
+
+    setup();
+
+    pa_cvolume_set(&v, CHANNELS, pa_sw_volume_from_linear(0.5));
+
+    render_to(6144);
+
+    /* A volume change of a single input is rewound partially, with
+     * the data taken out of the mix at the volume it was mixed with */
+    inputs[1].volume = (float) pa_sw_volume_to_linear(v.values[0]);
+    pa_sink_input_set_volume(inputs[1].sink_input, &v, false, true);
+    process_pending_rewind();
+    fail_unless(last_rewind == MAX_REWIND_FRAMES);
+    fail_unless(premix_pending);
+
+    render_to(10240);
+    fail_if(premix_pending);
+
+    /* The device only lets us take back part of what it has got, so
+     * the mix from before the sink volume changed is still in
+     * there. It is of no use for taking an input out again. */
+    rewind_limit = 1024;
+    sink_volume = (float) pa_sw_volume_to_linear(v.values[0]);
+    pa_sink_set_soft_volume(sink, &v);
+    process_pending_rewind();
+    fail_unless(last_rewind == 1024);
+    rewind_limit = (size_t) -1;
+
+    render_to(10240);
+    fail_if(stop_input(&inputs[2], 2048));
+
+    render_to(TOTAL_FRAMES);
+
+    check_output();
+
+    teardown();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Partial rewind");
+    tc = tcase_create("partial-rewind");
+    tcase_add_test(tc, partial_rewind_test);
+    tcase_add_test(tc, cancel_test);
+    tcase_add_test(tc, volume_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
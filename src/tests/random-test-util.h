@@ -0,0 +1,47 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+***/
+
+#ifndef foorandomtestutilhfoo
+#define foorandomtestutilhfoo
+
+#include <inttypes.h>
+
+/* A small linear congruential generator for tests that simulate noisy
+ * measurements. Unlike rand() it gives the same sequence everywhere, so
+ * the thresholds the tests check hold on every platform. */
+
+static uint32_t pa_test_random_state = 4711;
+
+static inline void pa_test_random_seed(uint32_t seed) {
+    pa_test_random_state = seed;
+}
+
+/* Uniformly distributed in [0, 1) */
+static inline double pa_test_random_uniform(void) {
+    pa_test_random_state = pa_test_random_state * 1103515245 + 12345;
+    return (double) (pa_test_random_state >> 8) / (double) (1 << 24);
+}
+
+/* Roughly normally distributed, with zero mean and unit variance */
+static inline double pa_test_random_normal(void) {
+    double r = 0;
+    unsigned i;
+
+    for (i = 0; i < 12; i++)
+        r += pa_test_random_uniform();
+
+    return r - 6;
+}
+
+#endif
@@ -0,0 +1,188 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rate-controller.h>
+
+#include "random-test-util.h"
+
+#define BASE_RATE 48000
+#define PERIOD (10 * PA_USEC_PER_MSEC)
+#define TARGET_LATENCY (60 * PA_USEC_PER_MSEC)
+#define SINK_LATENCY (20 * PA_USEC_PER_MSEC)
+
+typedef struct result {
+    double drift;             /* As learned by the controller */
+    double max_error;         /* Largest latency deviation once settled, in usec */
+    double mean_error;        /* Average latency deviation once settled, in usec */
+    double min_queue;         /* Smallest fill level of the queue, in usec */
+    unsigned rate_changes;    /* Number of rate changes once settled */
+    uint32_t min_rate, max_rate;
+} result;
+
+/* Simulates a loopback between a source whose clock runs 'drift' too
+ * fast and a sink, like between a null source and a null sink that
+ * each post or request a period of audio whenever their own clock says
+ * so. All times are in usec of the sink's clock, all queue lengths in
+ * usec of audio at the nominal rate. */
+static void simulate(double drift, double initial_queue, pa_usec_t length, pa_usec_t settle_time, result *r) {
+    pa_rate_controller *c;
+    double source_next, sink_next, queue, capture_time = 0, error_sum = 0;
+    uint32_t rate = BASE_RATE;
+    unsigned n = 0;
+
+    pa_test_random_seed(4711);
+
+    c = pa_rate_controller_new(BASE_RATE, 10 * PA_USEC_PER_SEC, 0.005);
+
+    queue = initial_queue;
+    source_next = (double) PERIOD / (1 + drift);
+    sink_next = (double) PERIOD;
+
+    r->max_error = 0;
+    r->min_queue = queue;
+    r->rate_changes = 0;
+    r->min_rate = (uint32_t) -1;
+    r->max_rate = 0;
+
+    while (sink_next < (double) length) {
+
+        if (source_next <= sink_next) {
+            /* The source posts a period of audio. Up to half a period
+             * of what it captured may still sit in its buffer. */
+            queue += (double) PERIOD;
+            capture_time = source_next - (double) PERIOD / 2 * pa_test_random_uniform();
+            source_next += (double) PERIOD / (1 + drift);
+        } else {
+            double latency, error;
+            uint32_t new_rate;
+
+            /* The sink requests a period of audio, which takes this
+             * much out of the queue at the current resampler rate */
+            queue -= (double) PERIOD * rate / BASE_RATE;
+            r->min_queue = PA_MIN(r->min_queue, queue);
+
+            /* The sink's latency jitters a bit, too */
+            latency = sink_next + (double) SINK_LATENCY + 1000 * pa_test_random_uniform() + queue - capture_time;
+            error = latency - (double) TARGET_LATENCY;
+
+            new_rate = pa_rate_controller_update(c, (pa_usec_t) sink_next, (int64_t) error);
+
+            if (sink_next >= (double) settle_time) {
+                error = (double) pa_rate_controller_get_error(c);
+
+                r->max_error = PA_MAX(r->max_error, fabs(error));
+                error_sum += error;
+                n++;
+
+                if (new_rate != rate)
+                    r->rate_changes++;
+
+                r->min_rate = PA_MIN(r->min_rate, new_rate);
+                r->max_rate = PA_MAX(r->max_rate, new_rate);
+            }
+
+            rate = new_rate;
+            sink_next += (double) PERIOD;
+        }
+    }
+
+    r->drift = pa_rate_controller_get_drift(c);
+    r->mean_error = n > 0 ? error_sum / n : 0;
+
+    pa_rate_controller_free(c);
+
+    pa_log_debug("drift %+0.0f ppm: learned %+0.1f ppm, latency error mean %0.1f usec, max %0.1f usec, "
+                 "queue min %0.1f ms, rate %u..%u Hz, %u rate changes",
+                 drift * 1e6, r->drift * 1e6, r->mean_error, r->max_error,
+                 r->min_queue / PA_USEC_PER_MSEC, r->min_rate, r->max_rate, r->rate_changes);
+}
+
+START_TEST (drift_test) {
+    static const double drifts[] = { 0, 100e-6, -100e-6, 500e-6, -500e-6, 2000e-6 };
+    unsigned i;
+    result r;
+
+    for (i = 0; i < PA_ELEMENTSOF(drifts); i++) {
+        simulate(drifts[i], TARGET_LATENCY - SINK_LATENCY, 600 * PA_USEC_PER_SEC, 120 * PA_USEC_PER_SEC, &r);
+
+        /* The controller learned the drift between the clocks */
+        fail_unless(fabs(r.drift - drifts[i]) < 50e-6);
+
+        /* And keeps the latency at the target */
+        fail_unless(fabs(r.mean_error) < 100);
+        fail_unless(r.max_error < 1000);
+        fail_unless(r.min_queue > 0);
+
+        /* Without wobbling around by more than 100ppm */
+        fail_unless(r.max_rate - r.min_rate <= BASE_RATE / 10000);
+        fail_unless(r.rate_changes < 100);
+    }
+}
+END_TEST
+
+START_TEST (offset_test) {
+    result r;
+
+    /* Start with the latency 40ms off in either direction */
+    simulate(300e-6, TARGET_LATENCY - SINK_LATENCY + 40 * PA_USEC_PER_MSEC, 600 * PA_USEC_PER_SEC, 120 * PA_USEC_PER_SEC, &r);
+    fail_unless(fabs(r.mean_error) < 100);
+    fail_unless(r.max_error < 1000);
+
+    simulate(300e-6, TARGET_LATENCY - SINK_LATENCY - 30 * PA_USEC_PER_MSEC, 600 * PA_USEC_PER_SEC, 120 * PA_USEC_PER_SEC, &r);
+    fail_unless(fabs(r.mean_error) < 100);
+    fail_unless(r.max_error < 1000);
+    fail_unless(r.min_queue > 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Rate controller");
+    tc = tcase_create("rate-controller");
+    tcase_add_test(tc, drift_test);
+    tcase_add_test(tc, offset_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -23,14 +23,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <check.h>
 
 #include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/log.h>
 #include <pulsecore/time-smoother.h>
 
+#include "random-test-util.h"
+
 START_TEST (smoother_test) {
     pa_usec_t x;
     unsigned u = 0;
@@ -86,15 +90,273 @@ START_TEST (smoother_test) {
 }
 END_TEST
 
+/* A recorded or simulated clock trace: at local time x[i] the remote
+ * clock was measured as y[i]. Where known, the true remote time at x
+ * is ty0 + rate * (x - tx0). */
+typedef struct trace {
+    const char *name;
+    unsigned n;
+    pa_usec_t *x, *y;
+
+    /* The smoother is paused in between these two local times, the
+     * remote clock does not advance then */
+    pa_usec_t pause_begin, pause_end;
+
+    /* The true clock, if known */
+    bool have_truth;
+    double rate;
+    double rate_change;       /* Applied at the middle of the trace */
+
+    /* The estimate is considered locked once it stays this close */
+    double lock_threshold;
+} trace;
+
+typedef struct trace_result {
+    double rms_error;         /* RMS distance from the true clock, in usec */
+    double jitter;            /* RMS deviation of the step size, in usec */
+    pa_usec_t lock_time;      /* Until the error stays below the lock threshold */
+} trace_result;
+
+#define TRACE_STEP (PA_USEC_PER_MSEC)
+
+static double true_time(const trace *t, pa_usec_t x) {
+    pa_usec_t middle = t->x[t->n / 2];
+    double y;
+
+    if (x > t->pause_begin && x < t->pause_end)
+        x = t->pause_begin;
+    else if (x >= t->pause_end && t->pause_end > t->pause_begin)
+        x -= t->pause_end - t->pause_begin;
+
+    if (x <= middle)
+        return t->rate * (double) x;
+
+    y = t->rate * (double) middle;
+    return y + (t->rate + t->rate_change) * (double) (x - middle);
+}
+
+/* Simulates a device that reports its position every 'interval' with
+ * the given measurement noise, both in time and position */
+static void trace_simulate(trace *t, const char *name, pa_usec_t length, pa_usec_t interval,
+                           double x_noise, double y_noise, double rate, double rate_change, bool pause) {
+    unsigned i;
+
+    t->name = name;
+    t->n = (unsigned) (length / interval);
+    t->x = pa_xnew(pa_usec_t, t->n);
+    t->y = pa_xnew(pa_usec_t, t->n);
+    t->have_truth = true;
+    t->rate = rate;
+    t->rate_change = rate_change;
+    t->lock_threshold = 3 * y_noise;
+    t->pause_begin = t->pause_end = 0;
+
+    pa_test_random_seed(4711);
+
+    if (pause) {
+        t->pause_begin = length / 3;
+        t->pause_end = length / 3 + PA_USEC_PER_SEC;
+    }
+
+    for (i = 0; i < t->n; i++) {
+        double x;
+
+        x = (double) ((i + 1) * interval) + pa_test_random_normal() * x_noise;
+        t->x[i] = x > 0 ? (pa_usec_t) x : 0;
+
+        /* While paused the device is not asked for its position */
+        if (t->x[i] > t->pause_begin && t->x[i] < t->pause_end)
+            t->x[i] = t->pause_begin;
+
+        if (i > 0 && t->x[i] < t->x[i-1])
+            t->x[i] = t->x[i-1];
+    }
+
+    for (i = 0; i < t->n; i++) {
+        double y = true_time(t, t->x[i]) + pa_test_random_normal() * y_noise;
+        t->y[i] = y > 0 ? (pa_usec_t) y : 0;
+    }
+}
+
+/* Reads a recorded trace, one measurement per line: the local and
+ * the remote time in usec, separated by white space */
+static bool trace_load(trace *t, const char *fn) {
+    FILE *f;
+    unsigned long long x, y;
+    unsigned size = 0;
+
+    if (!(f = fopen(fn, "r")))
+        return false;
+
+    t->name = fn;
+    t->n = 0;
+    t->x = t->y = NULL;
+    t->have_truth = false;
+    t->pause_begin = t->pause_end = 0;
+
+    while (fscanf(f, "%llu %llu", &x, &y) == 2) {
+        if (t->n >= size) {
+            size = size > 0 ? size * 2 : 1024;
+            t->x = pa_xrenew(pa_usec_t, t->x, size);
+            t->y = pa_xrenew(pa_usec_t, t->y, size);
+        }
+
+        t->x[t->n] = (pa_usec_t) x;
+        t->y[t->n] = (pa_usec_t) y;
+        t->n++;
+    }
+
+    fclose(f);
+    return t->n > 0;
+}
+
+static void trace_free(trace *t) {
+    pa_xfree(t->x);
+    pa_xfree(t->y);
+}
+
+static void trace_replay(const trace *t, pa_smoother_estimator_t estimator, trace_result *r) {
+    pa_smoother *s;
+    pa_usec_t x, x_begin, x_end, last_y = 0, lock_time = 0;
+    double error_sum = 0, step_sum = 0;
+    unsigned u = 0, n = 0;
+    bool paused = false;
+
+    pa_assert(t->n > 0);
+
+    x_begin = t->x[0];
+    x_end = t->x[t->n - 1];
+
+    s = pa_smoother_new(PA_USEC_PER_SEC, 5 * PA_USEC_PER_SEC, true, true, 5, 0, false);
+    pa_smoother_set_estimator(s, estimator);
+
+    for (x = x_begin; x <= x_end; x += TRACE_STEP) {
+        pa_usec_t y;
+
+        if (t->pause_end > t->pause_begin) {
+            if (!paused && x > t->pause_begin && x < t->pause_end) {
+                pa_smoother_pause(s, t->pause_begin);
+                paused = true;
+            } else if (paused && x >= t->pause_end) {
+                pa_smoother_resume(s, t->pause_end, true);
+                paused = false;
+            }
+        }
+
+        while (u < t->n && t->x[u] <= x) {
+            pa_smoother_put(s, t->x[u], t->y[u]);
+            u++;
+        }
+
+        y = pa_smoother_get(s, x);
+
+        if (x > x_begin) {
+            double step = (double) y - (double) last_y;
+
+            /* The step size the clock is expected to move at in this step */
+            step -= t->have_truth ? true_time(t, x) - true_time(t, x - TRACE_STEP) : (double) TRACE_STEP;
+            step_sum += step * step;
+        }
+
+        if (t->have_truth) {
+            double error = (double) y - true_time(t, x);
+
+            error_sum += error * error;
+
+            if (fabs(error) > t->lock_threshold)
+                lock_time = x - x_begin;
+        }
+
+        last_y = y;
+        n++;
+    }
+
+    pa_smoother_free(s);
+
+    r->rms_error = t->have_truth ? sqrt(error_sum / n) : 0;
+    r->jitter = sqrt(step_sum / n);
+    r->lock_time = lock_time;
+}
+
+static void trace_compare(const trace *t, trace_result *kalman, trace_result *regression) {
+    trace_replay(t, PA_SMOOTHER_KALMAN, kalman);
+    trace_replay(t, PA_SMOOTHER_REGRESSION, regression);
+
+    pa_log_info("%s: kalman: error %0.1f usec, jitter %0.2f usec, locked after %0.2f s; "
+                "regression: error %0.1f usec, jitter %0.2f usec, locked after %0.2f s",
+                t->name,
+                kalman->rms_error, kalman->jitter, (double) kalman->lock_time / PA_USEC_PER_SEC,
+                regression->rms_error, regression->jitter, (double) regression->lock_time / PA_USEC_PER_SEC);
+}
+
+START_TEST (replay_test) {
+    trace t;
+    trace_result k, r;
+
+    /* A sound card polled every 10ms with scheduling noise, running
+     * slightly fast */
+    trace_simulate(&t, "soundcard", 30 * PA_USEC_PER_SEC, 10 * PA_USEC_PER_MSEC, 200, 50, 1.0002, 0, false);
+    trace_compare(&t, &k, &r);
+    fail_unless(k.rms_error <= r.rms_error);
+    fail_unless(k.lock_time <= r.lock_time);
+    trace_free(&t);
+
+    /* A network stream with timing updates every 100ms and lots of
+     * noise, paused for a while */
+    trace_simulate(&t, "network", 60 * PA_USEC_PER_SEC, 100 * PA_USEC_PER_MSEC, 1000, 2000, 0.9995, 0, true);
+    trace_compare(&t, &k, &r);
+    fail_unless(k.rms_error <= r.rms_error);
+    trace_free(&t);
+
+    /* A clock that is quite a bit off */
+    trace_simulate(&t, "skewed", 30 * PA_USEC_PER_SEC, 20 * PA_USEC_PER_MSEC, 200, 100, 1.005, 0, false);
+    trace_compare(&t, &k, &r);
+    fail_unless(k.rms_error <= r.rms_error);
+    fail_unless(k.lock_time <= r.lock_time);
+    trace_free(&t);
+
+    /* A clock that suddenly changes its rate in the middle. The
+     * regression forgets everything before its window at once, so it
+     * adapts faster to this, but we should still stay on track. */
+    trace_simulate(&t, "rate change", 30 * PA_USEC_PER_SEC, 20 * PA_USEC_PER_MSEC, 200, 100, 1.0, 0.0001, false);
+    trace_compare(&t, &k, &r);
+    fail_unless(k.rms_error <= t.lock_threshold);
+    trace_free(&t);
+}
+END_TEST
+
+static const char *replay_file = NULL;
+
+START_TEST (replay_file_test) {
+    trace t;
+    trace_result k, r;
+
+    fail_unless(trace_load(&t, replay_file));
+    trace_compare(&t, &k, &r);
+    trace_free(&t);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
     TCase *tc;
     SRunner *sr;
 
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
     s = suite_create("Smoother");
     tc = tcase_create("smoother");
     tcase_add_test(tc, smoother_test);
+    tcase_add_test(tc, replay_test);
+
+    /* Replay a recorded trace, if one is given */
+    if (argc > 1) {
+        replay_file = argv[1];
+        tcase_add_test(tc, replay_file_test);
+    }
+
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -0,0 +1,193 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/time-wheel.h>
+
+#define N_EVENTS 1000
+
+/* How late an event may be dispatched before we consider it a bug. This
+ * is generous, since the test might run on a loaded machine. */
+#define MAX_LATENESS (100 * PA_USEC_PER_MSEC)
+
+struct event {
+    pa_time_event *e;
+    pa_usec_t when;
+    unsigned fired;
+    bool restart;
+};
+
+static struct event events[N_EVENTS];
+static unsigned n_pending;
+static bool broken;
+
+static void time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct event *ev = userdata;
+    pa_usec_t now = pa_rtclock_now();
+
+    pa_assert(ev->e == e);
+
+    if (now < ev->when || now > ev->when + MAX_LATENESS) {
+        pa_log("Event %u dispatched at %llu, expected %llu",
+               (unsigned) (ev - events), (unsigned long long) now, (unsigned long long) ev->when);
+        broken = true;
+    }
+
+    ev->fired++;
+
+    if (ev->restart) {
+        struct timeval ntv;
+
+        /* Rearm once, relative to the original expiry */
+        ev->restart = false;
+        ev->when += 10 * PA_USEC_PER_MSEC;
+        a->time_restart(e, pa_timeval_rtstore(&ntv, ev->when, true));
+        return;
+    }
+
+    a->time_free(e);
+    ev->e = NULL;
+
+    if (--n_pending <= 0)
+        a->quit(a, 0);
+}
+
+static void run(pa_usec_t tick, pa_usec_t range) {
+    pa_mainloop *m;
+    pa_time_wheel *w;
+    pa_mainloop_api *a;
+    pa_usec_t now;
+    unsigned i;
+
+    m = pa_mainloop_new();
+    fail_unless(m != NULL);
+
+    w = pa_time_wheel_new(pa_mainloop_get_api(m), tick);
+    fail_unless(w != NULL);
+    a = pa_time_wheel_get_api(w);
+
+    broken = false;
+    n_pending = 0;
+    now = pa_rtclock_now();
+
+    for (i = 0; i < N_EVENTS; i++) {
+        struct timeval tv;
+
+        events[i].when = now + (pa_usec_t) rand() % range;
+        events[i].fired = 0;
+        events[i].restart = (i % 7) == 0;
+        events[i].e = a->time_new(a, pa_timeval_rtstore(&tv, events[i].when, true), time_cb, &events[i]);
+        n_pending++;
+    }
+
+    /* Disable some and free some others before they expire */
+    for (i = 3; i < N_EVENTS; i += 11) {
+        a->time_restart(events[i].e, NULL);
+        a->time_free(events[i].e);
+        events[i].e = NULL;
+        n_pending--;
+    }
+
+    fail_unless(pa_time_wheel_size(w) == n_pending);
+
+    pa_mainloop_run(m, NULL);
+
+    fail_unless(!broken);
+    fail_unless(pa_time_wheel_size(w) == 0);
+
+    for (i = 0; i < N_EVENTS; i++) {
+        if (i >= 3 && (i - 3) % 11 == 0)
+            fail_unless(events[i].fired == 0);
+        else
+            fail_unless(events[i].fired == ((i % 7) == 0 ? 2 : 1));
+    }
+
+    pa_time_wheel_free(w);
+    pa_mainloop_free(m);
+}
+
+START_TEST (time_wheel_test) {
+    /* Everything fits into the first level */
+    run(PA_USEC_PER_MSEC, 50 * PA_USEC_PER_MSEC);
+
+    /* Events need to cascade down through up to three levels */
+    run(10, 500 * PA_USEC_PER_MSEC);
+}
+END_TEST
+
+START_TEST (time_wheel_free_test) {
+    pa_mainloop *m;
+    pa_time_wheel *w;
+    pa_mainloop_api *a;
+    struct timeval tv;
+    unsigned i;
+
+    m = pa_mainloop_new();
+    w = pa_time_wheel_new(pa_mainloop_get_api(m), PA_USEC_PER_MSEC);
+    a = pa_time_wheel_get_api(w);
+
+    /* Events far beyond the horizon of the wheel, as well as disabled
+     * ones, are cleaned up when the wheel is freed */
+    for (i = 0; i < 16; i++)
+        a->time_new(a, pa_timeval_rtstore(&tv, pa_rtclock_now() + (pa_usec_t) i * 3600 * PA_USEC_PER_SEC, true), time_cb, NULL);
+    a->time_new(a, NULL, time_cb, NULL);
+
+    fail_unless(pa_time_wheel_size(w) == 16);
+
+    pa_time_wheel_free(w);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Time Wheel");
+    tc = tcase_create("timewheel");
+    tcase_add_test(tc, time_wheel_test);
+    tcase_add_test(tc, time_wheel_free_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
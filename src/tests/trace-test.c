@@ -0,0 +1,140 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/trace.h>
+
+#define N_THREADS 4
+#define N_SPANS 100
+
+static unsigned count(const char *haystack, const char *needle) {
+    unsigned n = 0;
+
+    while ((haystack = strstr(haystack, needle))) {
+        haystack += strlen(needle);
+        n++;
+    }
+
+    return n;
+}
+
+static void record_spans(unsigned n) {
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        pa_usec_t t = pa_trace_begin();
+        pa_trace_end("test-span", t);
+    }
+}
+
+static void thread_func(void *data) {
+    record_spans(PA_PTR_TO_UINT(data));
+}
+
+START_TEST (trace_test) {
+    pa_thread *threads[N_THREADS];
+    char *dump;
+    unsigned i;
+
+    /* Nothing is recorded while tracing is disabled */
+    fail_unless(!pa_trace_enabled());
+    fail_unless(pa_trace_begin() == 0);
+    record_spans(N_SPANS);
+
+    pa_trace_set_enabled(true);
+    fail_unless(pa_trace_enabled());
+
+    for (i = 0; i < N_THREADS; i++) {
+        char name[16];
+
+        pa_snprintf(name, sizeof(name), "trace-%u", i);
+        threads[i] = pa_thread_new(name, thread_func, PA_UINT_TO_PTR(N_SPANS));
+        fail_unless(threads[i] != NULL);
+    }
+
+    for (i = 0; i < N_THREADS; i++)
+        pa_thread_free(threads[i]);
+
+    pa_trace_set_enabled(false);
+    record_spans(N_SPANS);
+
+    dump = pa_trace_dump();
+    pa_log_debug("%s", dump);
+
+    fail_unless(strncmp(dump, "{", 1) == 0);
+    fail_unless(count(dump, "\"ph\":\"X\"") == N_THREADS * N_SPANS);
+    fail_unless(count(dump, "\"name\":\"test-span\"") == N_THREADS * N_SPANS);
+
+    for (i = 0; i < N_THREADS; i++) {
+        char name[32];
+
+        pa_snprintf(name, sizeof(name), "{\"name\":\"trace-%u\"}", i);
+        fail_unless(count(dump, name) == 1);
+    }
+
+    pa_xfree(dump);
+
+    /* The rings of the threads that exited are gone now, and enabling
+     * tracing again discards what the main thread recorded before */
+    pa_trace_set_enabled(true);
+    record_spans(1);
+
+    dump = pa_trace_dump();
+    fail_unless(count(dump, "\"ph\":\"X\"") == 1);
+    fail_unless(count(dump, "\"ph\":\"M\"") == 1);
+    pa_xfree(dump);
+
+    pa_trace_set_enabled(false);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Trace");
+    tc = tcase_create("trace");
+    tcase_add_test(tc, trace_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
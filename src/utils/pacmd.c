@@ -74,11 +74,13 @@ static void help(const char *argv0) {
     printf("%s %s %s\n", argv0, "set-card-profile", _("CARD PROFILE"));
     printf("%s %s %s\n", argv0, "set-(sink|source)-port", _("NAME|#N PORT"));
     printf("%s %s %s\n", argv0, "set-port-latency-offset", _("CARD-NAME|CARD-#N PORT OFFSET"));
+    printf("%s %s %s\n", argv0, "set-sink-rewind-limit", _("SINK-NAME|SINK-#N MSEC"));
     printf("%s %s %s\n", argv0, "set-log-target", _("TARGET"));
     printf("%s %s %s\n", argv0, "set-log-level", _("NUMERIC LEVEL"));
     printf("%s %s %s\n", argv0, "set-log-meta", _("1|0"));
     printf("%s %s %s\n", argv0, "set-log-time", _("1|0"));
     printf("%s %s %s\n", argv0, "set-log-backtrace", _("FRAMES"));
+    printf("%s %s %s\n", argv0, "set-trace", _("1|0"));
 
     printf(_("\n"
          "  -h, --help                            Show this help\n"
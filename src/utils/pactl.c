@@ -180,6 +180,78 @@ static void stat_callback(pa_context *c, const pa_stat_info *i, void *userdata)
     complete_action();
 }
 
+/* pa_bytes_snprint() only takes 32 bit values */
+static char *bytes_snprint64(char *s, size_t l, uint64_t v) {
+    if (v <= UINT32_MAX)
+        return pa_bytes_snprint(s, l, (unsigned) v);
+
+    pa_snprintf(s, l, _("%0.1f GiB"), ((double) v)/1024/1024/1024);
+    return s;
+}
+
+static void get_io_stats_info_callback(pa_context *c, const pa_io_stats_info *i, int is_last, void *userdata) {
+    char rb[PA_BYTES_SNPRINT_MAX], ql[PA_BYTES_SNPRINT_MAX], qm[PA_BYTES_SNPRINT_MAX];
+    const char *type;
+
+    if (is_last < 0) {
+        pa_log(_("Failed to get statistics: %s"), pa_strerror(pa_context_errno(c)));
+        quit(1);
+        return;
+    }
+
+    if (is_last) {
+        complete_action();
+        return;
+    }
+
+    pa_assert(i);
+
+    switch (i->facility) {
+        case PA_SUBSCRIPTION_EVENT_SINK:
+            type = "sink";
+            break;
+        case PA_SUBSCRIPTION_EVENT_SOURCE:
+            type = "source";
+            break;
+        case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+            type = "sink-input";
+            break;
+        case PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT:
+            type = "source-output";
+            break;
+        default:
+            return;
+    }
+
+    if (short_list_format) {
+        printf("%s\t%u\t%u\t%u\t%llu\t%u\t%llu\t%llu\t%llu\t%llu\t%u\t%u\n",
+               type, i->index, i->xruns, i->rewinds, (unsigned long long) i->rewind_bytes, i->render_count,
+               (unsigned long long) i->render_time_p50,
+               (unsigned long long) i->render_time_p99,
+               (unsigned long long) i->render_time_max,
+               (unsigned long long) i->resample_time,
+               i->queue_length, i->queue_length_max);
+        return;
+    }
+
+    printf(_("\n%s #%u\n"
+             "\tXruns: %u\n"
+             "\tRewinds: %u (%s)\n"
+             "\tRender Time: %u blocks, p50 %0.2f ms, p99 %0.2f ms, max %0.2f ms\n"
+             "\tResample Time: %0.2f ms\n"
+             "\tBuffer: %s, max %s\n"),
+           type, i->index,
+           i->xruns,
+           i->rewinds, bytes_snprint64(rb, sizeof(rb), i->rewind_bytes),
+           i->render_count,
+           (double) i->render_time_p50 / PA_USEC_PER_MSEC,
+           (double) i->render_time_p99 / PA_USEC_PER_MSEC,
+           (double) i->render_time_max / PA_USEC_PER_MSEC,
+           (double) i->resample_time / PA_USEC_PER_MSEC,
+           pa_bytes_snprint(ql, sizeof(ql), i->queue_length),
+           pa_bytes_snprint(qm, sizeof(qm), i->queue_length_max));
+}
+
 static void get_server_info_callback(pa_context *c, const pa_server_info *i, void *useerdata) {
     char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
 
@@ -1201,6 +1273,15 @@ static void context_state_callback(pa_context *c, void *userdata) {
             switch (action) {
                 case STAT:
                     o = pa_context_stat(c, stat_callback, NULL);
+
+                    if (pa_context_get_server_protocol_version(c) >= 31) {
+                        if (o) {
+                            pa_operation_unref(o);
+                            actions++;
+                        }
+
+                        o = pa_context_get_io_stats_info_list(c, get_io_stats_info_callback, NULL);
+                    }
                     break;
 
                 case INFO:
@@ -1556,7 +1637,7 @@ static enum mute_flags parse_mute(const char *mute_text) {
 
 static void help(const char *argv0) {
 
-    printf("%s %s %s\n",    argv0, _("[options]"), "stat");
+    printf("%s %s %s\n",    argv0, _("[options]"), "stat [short]");
     printf("%s %s %s\n",    argv0, _("[options]"), "info");
     printf("%s %s %s %s\n", argv0, _("[options]"), "list [short]", _("[TYPE]"));
     printf("%s %s %s\n",    argv0, _("[options]"), "exit");
@@ -1659,6 +1740,15 @@ int main(int argc, char *argv[]) {
         if (pa_streq(argv[optind], "stat")) {
             action = STAT;
 
+            if (optind+1 < argc) {
+                if (optind+2 < argc || !pa_streq(argv[optind+1], "short")) {
+                    pa_log(_("Specify nothing, or %s"), "short");
+                    goto quit;
+                }
+
+                short_list_format = true;
+            }
+
         } else if (pa_streq(argv[optind], "info"))
             action = INFO;
 